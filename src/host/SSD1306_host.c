@@ -0,0 +1,186 @@
+#include "SSD1306_host.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define SSD1306_PAGES (SSD1306_LCDHEIGHT / 8)
+
+// Emulated controller state, only the commands the driver uses are interpreted
+struct SSD1306_host
+{
+	uint8_t ram[SSD1306_LCDHEIGHT * SSD1306_LCDWIDTH / 8];
+
+	uint8_t col_start, col_end, col;
+	uint8_t page_start, page_end, page;
+
+	uint8_t pending_cmd;  // Command waiting for its arguments
+	uint8_t pending_args; // Number of arguments still missing
+	uint8_t args[2];
+
+	struct SSD1306_host_stats stats;
+};
+
+static struct SSD1306_host host_state;
+
+static uint8_t SSD1306_host_argCount(uint8_t c)
+{
+	switch (c)
+	{
+	case SSD1306_COLUMNADDR:
+	case SSD1306_PAGEADDR:
+		return 2;
+	case SSD1306_SETCONTRAST:
+	case SSD1306_SETMULTIPLEX:
+	case SSD1306_SETDISPLAYOFFSET:
+	case SSD1306_SETDISPLAYCLOCKDIV:
+	case SSD1306_SETPRECHARGE:
+	case SSD1306_SETCOMPINS:
+	case SSD1306_SETVCOMDETECT:
+	case SSD1306_CHARGEPUMP:
+	case SSD1306_MEMORYMODE:
+		return 1;
+	}
+
+	return 0;
+}
+
+static void SSD1306_host_execute(struct SSD1306_host* host)
+{
+	switch (host->pending_cmd)
+	{
+	case SSD1306_COLUMNADDR:
+		host->col_start = host->args[0];
+		host->col_end = host->args[1];
+		host->col = host->col_start;
+		break;
+	case SSD1306_PAGEADDR:
+		host->page_start = host->args[0];
+		host->page_end = host->args[1];
+		host->page = host->page_start;
+		break;
+	}
+}
+
+static void SSD1306_host_begin(void* ctx)
+{
+	((struct SSD1306_host*)ctx)->stats.transactions++;
+}
+
+static void SSD1306_host_commands(void* ctx, const uint8_t* cmds, int length)
+{
+	struct SSD1306_host* host = (struct SSD1306_host*)ctx;
+
+	host->stats.command_bytes += length;
+
+	for (int i = 0; i < length; i++)
+	{
+		if (host->pending_args > 0)
+		{
+			uint8_t count = SSD1306_host_argCount(host->pending_cmd);
+			host->args[count - host->pending_args] = cmds[i];
+			host->pending_args--;
+		}
+		else
+		{
+			host->pending_cmd = cmds[i];
+			host->pending_args = SSD1306_host_argCount(cmds[i]);
+		}
+
+		if (host->pending_args == 0)
+		{
+			SSD1306_host_execute(host);
+		}
+	}
+}
+
+static void SSD1306_host_data(void* ctx, const uint8_t* data, int length)
+{
+	struct SSD1306_host* host = (struct SSD1306_host*)ctx;
+
+	host->stats.data_bytes += length;
+
+	// Horizontal addressing mode, wraps inside the column and page window
+	for (int i = 0; i < length; i++)
+	{
+		if (host->col < SSD1306_LCDWIDTH && host->page < SSD1306_PAGES)
+		{
+			host->ram[host->page * SSD1306_LCDWIDTH + host->col] = data[i];
+		}
+
+		if (host->col >= host->col_end)
+		{
+			host->col = host->col_start;
+			host->page = (host->page >= host->page_end ? host->page_start : host->page + 1);
+		}
+		else
+		{
+			host->col++;
+		}
+	}
+}
+
+static bool SSD1306_host_end(void* ctx)
+{
+	return true;
+}
+
+static const struct SSD1306_transport host_transport = {
+	.begin = SSD1306_host_begin,
+	.commands = SSD1306_host_commands,
+	.data = SSD1306_host_data,
+	.end = SSD1306_host_end,
+	.ctx = &host_state};
+
+const struct SSD1306_transport* SSD1306_host_transport(void)
+{
+	memset(&host_state, 0, sizeof(host_state));
+
+	// Power on defaults
+	host_state.col_end = SSD1306_LCDWIDTH - 1;
+	host_state.page_end = SSD1306_PAGES - 1;
+
+	return &host_transport;
+}
+
+void SSD1306_host_getStats(struct SSD1306_host_stats* stats)
+{
+	*stats = host_state.stats;
+}
+
+void SSD1306_host_resetStats(void)
+{
+	memset(&host_state.stats, 0, sizeof(host_state.stats));
+}
+
+uint8_t SSD1306_host_getPixel(int16_t x, int16_t y)
+{
+	if ((x < 0) || (x >= SSD1306_LCDWIDTH) || (y < 0) || (y >= SSD1306_LCDHEIGHT))
+		return BLACK;
+
+	return (host_state.ram[x + (y / 8) * SSD1306_LCDWIDTH] >> (y & 7)) & 0x1;
+}
+
+bool SSD1306_host_dumpPBM(const char* path)
+{
+	FILE* file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+
+	// Binary PBM, 1 is black so lit pixels are written as 0
+	fprintf(file, "P4\n%d %d\n", SSD1306_LCDWIDTH, SSD1306_LCDHEIGHT);
+	for (int16_t y = 0; y < SSD1306_LCDHEIGHT; y++)
+	{
+		for (int16_t x = 0; x < SSD1306_LCDWIDTH; x += 8)
+		{
+			uint8_t packed = 0;
+			for (int16_t bit = 0; bit < 8; bit++)
+			{
+				if (!SSD1306_host_getPixel(x + bit, y))
+					packed |= (0x80 >> bit);
+			}
+			fputc(packed, file);
+		}
+	}
+
+	return (fclose(file) == 0);
+}
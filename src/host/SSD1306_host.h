@@ -0,0 +1,22 @@
+#ifndef _SSD1306_HOST_H_
+#define _SSD1306_HOST_H_
+
+#include "SSD1306.h"
+
+// Host transport, emulates the panel RAM and counts the traffic that would go over the bus
+struct SSD1306_host_stats
+{
+	uint32_t transactions;
+	uint32_t command_bytes;
+	uint32_t data_bytes;
+};
+
+const struct SSD1306_transport* SSD1306_host_transport(void);
+
+void SSD1306_host_getStats(struct SSD1306_host_stats* stats);
+void SSD1306_host_resetStats(void);
+
+uint8_t SSD1306_host_getPixel(int16_t x, int16_t y);
+bool SSD1306_host_dumpPBM(const char* path);
+
+#endif /* _SSD1306_HOST_H_ */
@@ -0,0 +1,140 @@
+// Host benchmark of the drawing core, renders the menu.c pages and reports the time per frame and the bus traffic.
+// The pages and their render functions are static, menu.c is built into the benchmark. Without the flush task
+// display_present sends every frame right away, a render is the whole frame from the drawing to the bus
+#include "menu.c"
+
+#include "SSD1306_host.h"
+
+#include <stdio.h>
+#include <time.h>
+
+#define ITERATIONS (20000)
+
+// No encoder on the host, the pages get their input from the benchmark
+void input_set_sleep(bool sleep)
+{
+}
+
+bool input_merge(struct input_event* into, const struct input_event* next)
+{
+	return false;
+}
+
+// menu_draw renders right away, the last frame is always a frame period old
+static void draw_now(void (*render)())
+{
+	frame_last = esp_timer_get_time() - FRAME_US;
+	menu_draw(render);
+}
+
+// Lists move one item per frame through menulist_input, scrolling included
+static void list_next(int frame)
+{
+	struct input_event input = {.button = INPUT_RIGHT, .detents = 1, .steps = 1};
+	frame_last = esp_timer_get_time() - FRAME_US;
+	menulist_input(&input);
+}
+
+static void setup_main(void)
+{
+	menulist_init(menu_page0_items, 3); // With a timelapse to resume
+}
+
+static void setup_scan(void)
+{
+	static const char* names[] = {"EOS R6", "EOS R5", "EOS RP"};
+
+	menu_page1_clear();
+	for (int i = 0; i < 3; i++)
+	{
+		strcpy(menu_page1_items[MENU1_NAME_START + i], names[i]);
+	}
+	menulist_init(menu_page1_items, 7);
+}
+
+static void setup_camera(void)
+{
+	menulist_init(menu_page5_items, 4);
+}
+
+static void setup_camera_page(void)
+{
+	setup_scan();
+	menu_page1_selected = 0;
+}
+
+static void draw_pair(int frame)
+{
+	menu_page2_state = (frame % 8 == 7 ? PAGE2_STATE_FAIL : PAGE2_STATE_WORKING);
+	mneu_page2_current = frame % 6;
+	draw_now(menu_page2_render);
+}
+
+static void draw_connecting(int frame)
+{
+	menu_page4_auth = (frame & 1);
+	draw_now(menu_page4_render);
+}
+
+static void draw_timer(int frame)
+{
+	menu_page6_timer_running = true;
+	menu_page6_timer_interval = 3600 * 1000;
+	menu_page6_timer_countdown = 3600 - (frame % 3600);
+	menu_page6_expo_count = frame;
+	menu_page6_selected = frame % (MENU_PAGE_6_MAX + 1);
+	menu_page6_selected_active = ((frame / 3) & 1);
+	draw_now(menu_page6_render);
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(const char* name, void (*setup)(void), void (*draw)(int))
+{
+	struct SSD1306_host_stats stats;
+
+	if (setup != NULL)
+	{
+		frame_last = esp_timer_get_time() - FRAME_US; // The setup draws the first frame
+		setup();
+	}
+	SSD1306_host_resetStats();
+
+	double start = now_ns();
+	for (int i = 0; i < ITERATIONS; i++)
+	{
+		draw(i);
+	}
+	double frame_ns = (now_ns() - start) / ITERATIONS;
+
+	SSD1306_host_getStats(&stats);
+
+	printf("%-12s render+display %8.0f ns  %6.1f data bytes/frame  %4.2f transactions/frame\n",
+		   name, frame_ns,
+		   (double)stats.data_bytes / ITERATIONS,
+		   (double)stats.transactions / ITERATIONS);
+}
+
+int main(int argc, char** argv)
+{
+	SSD1306_begin(SSD1306_SWITCHCAPVCC, SSD1306_host_transport());
+
+	bench("main", setup_main, list_next);
+	bench("scan", setup_scan, list_next);
+	bench("pair", setup_camera_page, draw_pair);
+	bench("connecting", setup_camera_page, draw_connecting);
+	bench("camera", setup_camera, list_next);
+	bench("timer", NULL, draw_timer);
+
+	if (argc > 1)
+	{
+		SSD1306_host_dumpPBM(argv[1]);
+	}
+
+	return 0;
+}
@@ -0,0 +1,1760 @@
+#include "camera_sim.h"
+#include "idf_host.h"
+#include "esp_timer.h"
+
+#include "canon_ble.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TAG "SIM"
+
+#define SIM_GATT_IF (3)
+#define SIM_CONN_ID (0)
+#define SIM_MTU (185)
+#define SIM_CONNECT_TIMEOUT_US (30 * 1000 * 1000)
+#define SIM_ATT_TIMEOUT_US (30 * 1000 * 1000) // An unanswered request makes the stack drop the link
+#define SIM_AUTH_FAIL_REASON (0x05)
+#define SIM_UPDATE_INSTANT (6) // Connection events between a parameter update request and its instant, plus the latency
+
+#define SIM_EVENTS_MAX (256)
+#define SIM_ADVERTISERS_MAX (64) // The camera, its twins and the crowd
+#define SIM_CANON_COMPANY_ID (0x01A9)
+#define SIM_VALUE_MAX (32)
+#define SIM_OTHER_BONDS_MAX (4)
+
+// Attribute table of the camera
+#define SIM_SVC_GAP (0)
+#define SIM_SVC_PAIR (1)
+#define SIM_SVC_TRIG (2)
+#define SIM_SVC_COUNT (3)
+
+#define SIM_CHR_DEVICE_NAME (0)
+#define SIM_CHR_PAIR_COMMAND (1)
+#define SIM_CHR_PAIR_DATA (2)
+#define SIM_CHR_TRIG (3)
+#define SIM_CHR_TRIG_NOTIF (4)
+#define SIM_CHR_TRIG_CONFIG (5)
+#define SIM_CHR_COUNT (6)
+
+struct sim_service
+{
+    esp_bt_uuid_t uuid;
+    uint16_t start_handle;
+    uint16_t end_handle;
+};
+
+struct sim_char
+{
+    esp_bt_uuid_t uuid;
+    uint16_t handle; // Value handle
+    uint16_t cccd;   // 0 if the characteristic has no CCCD
+    esp_gatt_char_prop_t properties;
+    bool encrypted; // Only accessible on an encrypted link
+};
+
+// Events
+#define SIM_EV_GATTC (0)         // GATTC callback
+#define SIM_EV_GAP (1)           // GAP callback
+#define SIM_EV_CONNECT (2)       // Connection established
+#define SIM_EV_REQUEST (3)       // Request arriving at the camera
+#define SIM_EV_PAIR_DECISION (4) // The user accepted or denied the pairing on the camera
+#define SIM_EV_ADV (5)           // Advertising packet while scanning
+#define SIM_EV_ATT_TIMEOUT (6)   // A request was never answered
+#define SIM_EV_TIMER (7)         // esp_timer deadline
+
+#define SIM_CONNECT_OK (0)      // SIM_EV_CONNECT ids
+#define SIM_CONNECT_TIMEOUT (1) // Nobody answered the direct connection
+
+#define SIM_REQ_MTU (0)
+#define SIM_REQ_SEARCH (1)
+#define SIM_REQ_SECURITY (2)
+#define SIM_REQ_WRITE (3)
+#define SIM_REQ_WRITE_DESCR (4)
+#define SIM_REQ_COMMAND (5) // Write without response
+
+#define SIM_PAIR_NONE (0)
+#define SIM_PAIR_REQUESTED (1)
+#define SIM_PAIR_WAITING (2)
+#define SIM_PAIR_ACCEPTED (3)
+
+struct sim_event
+{
+    int64_t time;
+    uint32_t seq;
+    uint8_t type;
+    uint32_t gen; // Link, scan or connect attempt the event belongs to, 0 if it is always delivered
+    int id;       // Callback event or request type
+
+    union
+    {
+        esp_ble_gattc_cb_param_t gattc;
+        esp_ble_gap_cb_param_t gap;
+    } param;
+
+    uint16_t handle;
+    uint16_t value_len;
+    uint8_t value[SIM_VALUE_MAX];
+
+    esp_timer_handle_t timer;
+};
+
+struct esp_timer
+{
+    esp_timer_cb_t callback;
+    void *arg;
+    uint64_t period; // 0 for a one shot timer
+    bool armed;
+    uint32_t gen; // Events of an earlier start are ignored
+};
+
+struct sim_state
+{
+    struct camera_sim_config config;
+    struct camera_sim_stats stats;
+    uint32_t rng;
+
+    struct sim_service services[SIM_SVC_COUNT];
+    struct sim_char chars[SIM_CHR_COUNT];
+
+    // Event queue, a binary heap ordered by time and scheduling order
+    struct sim_event events[SIM_EVENTS_MAX];
+    int event_count;
+    uint32_t seq;
+    int64_t now;
+
+    // Host side
+    esp_gap_ble_cb_t gap_cb;
+    esp_gattc_cb_t gattc_cb;
+    uint16_t local_mtu;
+    bool scanning;
+    int64_t scan_end;
+    uint32_t scan_gen;
+    bool scan_duplicate; // Controller duplicate filter, each address is reported once per scan
+    uint64_t scan_seen;
+    bool connecting;
+    uint32_t connect_gen;
+    esp_bd_addr_t connect_bda;
+    bool connected; // Until the disconnect is reported
+    bool discovered;
+    bool securing;
+
+    // Link
+    bool link_up;
+    uint32_t link_gen;
+    int64_t last_tx;
+    int64_t last_up;
+    int64_t last_down;
+    bool encrypted;
+    uint32_t interval_us; // Set by a connection parameter update, 0 while the link runs at the configured latency
+    uint16_t peer_latency; // Connection events the camera skips while it has nothing to send
+
+    // Bonds of cameras which are not simulated, listed ahead of the camera
+    esp_bd_addr_t other_bonds[SIM_OTHER_BONDS_MAX];
+    int other_bond_count;
+
+    // Camera
+    bool bonded;
+    bool paired;
+    int pair_state;
+    uint16_t cccd_value[SIM_CHR_COUNT];
+    bool remote;
+    bool pressed;
+};
+
+static struct sim_state sim;
+static camera_sim_dispatch_hook dispatch_hook = NULL; // Kept over camera_sim_init
+
+static uint32_t sim_random()
+{
+    // xorshift32
+    uint32_t x = sim.rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    sim.rng = x;
+
+    return x;
+}
+
+static bool sim_chance(uint32_t ppm)
+{
+    return ppm > 0 && (sim_random() % 1000000) < ppm;
+}
+
+static esp_bt_uuid_t sim_uuid16(uint16_t uuid16)
+{
+    esp_bt_uuid_t uuid = {.len = ESP_UUID_LEN_16};
+    uuid.uuid.uuid16 = uuid16;
+    return uuid;
+}
+
+static esp_bt_uuid_t sim_uuid128(const uint8_t *uuid128)
+{
+    esp_bt_uuid_t uuid = {.len = ESP_UUID_LEN_128};
+    memcpy(uuid.uuid.uuid128, uuid128, ESP_UUID_LEN_128);
+    return uuid;
+}
+
+static void sim_add_char(int index, esp_bt_uuid_t uuid, uint16_t handle, bool cccd, esp_gatt_char_prop_t properties, bool encrypted)
+{
+    struct sim_char *chr = &sim.chars[index];
+    chr->uuid = uuid;
+    chr->handle = handle;
+    chr->cccd = (cccd ? handle + 1 : 0);
+    chr->properties = properties;
+    chr->encrypted = encrypted;
+}
+
+// Same layout as the camera: declaration, value and the optional CCCD for every characteristic
+static void sim_build_table()
+{
+    static const uint8_t pair_service[] = {CANON_PAIR_SERVICE};
+    static const uint8_t pair_command[] = {CANON_PAIR_COMMAND_CHARACTERISTIC};
+    static const uint8_t pair_data[] = {CANON_PAIR_DATA_CHARACTERISTIC};
+    static const uint8_t trig_service[] = {CANON_TRIG_SERVICE};
+    static const uint8_t trig[] = {CANON_TRIG_CHARACTERISTIC};
+    static const uint8_t trig_notif[] = {CANON_TRIG_NOTIFICATION_CHARACTERISTIC};
+    static const uint8_t trig_config[] = {CANON_TRIG_CONFIG_CHARACTERISTIC};
+
+    uint16_t base = sim.config.handle_base;
+
+    sim.services[SIM_SVC_GAP] = (struct sim_service){sim_uuid16(ESP_GATT_UUID_GAP_SVC), base + 0x01, base + 0x03};
+    sim_add_char(SIM_CHR_DEVICE_NAME, sim_uuid16(ESP_GATT_UUID_GAP_DEVICE_NAME), base + 0x03, false, ESP_GATT_CHAR_PROP_BIT_READ, false);
+
+    sim.services[SIM_SVC_PAIR] = (struct sim_service){sim_uuid128(pair_service), base + 0x10, base + 0x15};
+    sim_add_char(SIM_CHR_PAIR_COMMAND, sim_uuid128(pair_command), base + 0x12, true, ESP_GATT_CHAR_PROP_BIT_WRITE | ESP_GATT_CHAR_PROP_BIT_INDICATE, true);
+    sim_add_char(SIM_CHR_PAIR_DATA, sim_uuid128(pair_data), base + 0x15, false, ESP_GATT_CHAR_PROP_BIT_WRITE, true);
+
+    esp_gatt_char_prop_t trig_props = ESP_GATT_CHAR_PROP_BIT_WRITE;
+    if (sim.config.trigger_write_no_rsp)
+    {
+        trig_props |= ESP_GATT_CHAR_PROP_BIT_WRITE_NR;
+    }
+
+    sim.services[SIM_SVC_TRIG] = (struct sim_service){sim_uuid128(trig_service), base + 0x20, base + 0x27};
+    sim_add_char(SIM_CHR_TRIG, sim_uuid128(trig), base + 0x22, false, trig_props, true);
+    sim_add_char(SIM_CHR_TRIG_NOTIF, sim_uuid128(trig_notif), base + 0x24, true, ESP_GATT_CHAR_PROP_BIT_NOTIFY, true);
+    sim_add_char(SIM_CHR_TRIG_CONFIG, sim_uuid128(trig_config), (sim.config.trigger_config_missing ? 0 : base + 0x27), false,
+                 ESP_GATT_CHAR_PROP_BIT_WRITE, true);
+}
+
+static struct sim_char *sim_find_char(uint16_t handle)
+{
+    for (int i = 0; i < SIM_CHR_COUNT; i++)
+    {
+        if (sim.chars[i].handle == handle)
+        {
+            return &sim.chars[i];
+        }
+    }
+
+    return NULL;
+}
+
+static struct sim_char *sim_find_cccd(uint16_t handle)
+{
+    for (int i = 0; i < SIM_CHR_COUNT; i++)
+    {
+        if (sim.chars[i].cccd != 0 && sim.chars[i].cccd == handle)
+        {
+            return &sim.chars[i];
+        }
+    }
+
+    return NULL;
+}
+
+// Event queue
+static bool sim_event_before(const struct sim_event *a, const struct sim_event *b)
+{
+    return (a->time < b->time) || (a->time == b->time && a->seq < b->seq);
+}
+
+static void sim_event_swap(int a, int b)
+{
+    struct sim_event tmp = sim.events[a];
+    sim.events[a] = sim.events[b];
+    sim.events[b] = tmp;
+}
+
+static struct sim_event *sim_schedule(int64_t time, uint8_t type, int id, uint32_t gen)
+{
+    if (sim.event_count == SIM_EVENTS_MAX)
+    {
+        ESP_LOGE(TAG, "Event queue full, event %d/%d lost", type, id);
+        return NULL;
+    }
+
+    int index = sim.event_count++;
+    struct sim_event *event = &sim.events[index];
+    memset(event, 0, sizeof(struct sim_event));
+    event->time = time;
+    event->seq = sim.seq++;
+    event->type = type;
+    event->id = id;
+    event->gen = gen;
+
+    // The parameters are filled in by the caller, the ordering only depends on the time and sequence
+    while (index > 0 && sim_event_before(&sim.events[index], &sim.events[(index - 1) / 2]))
+    {
+        sim_event_swap(index, (index - 1) / 2);
+        index = (index - 1) / 2;
+    }
+
+    return &sim.events[index];
+}
+
+static void sim_pop(struct sim_event *event)
+{
+    *event = sim.events[0];
+    sim.events[0] = sim.events[--sim.event_count];
+
+    int index = 0;
+    while (true)
+    {
+        int smallest = index;
+        int left = index * 2 + 1;
+        int right = left + 1;
+
+        if (left < sim.event_count && sim_event_before(&sim.events[left], &sim.events[smallest]))
+        {
+            smallest = left;
+        }
+        if (right < sim.event_count && sim_event_before(&sim.events[right], &sim.events[smallest]))
+        {
+            smallest = right;
+        }
+        if (smallest == index)
+        {
+            break;
+        }
+
+        sim_event_swap(index, smallest);
+        index = smallest;
+    }
+}
+
+// Link timing, without reordering a message never overtakes an earlier one in the same direction
+// A request waits for the next connection event the camera listens to, a sleeping camera wakes up for its answer
+static uint32_t sim_one_way(bool uplink)
+{
+    uint32_t delay = (sim.interval_us != 0 ? sim.interval_us : sim.config.latency_us / 2);
+    if (uplink)
+    {
+        delay *= 1 + sim.peer_latency;
+    }
+    if (sim.config.jitter_us > 0)
+    {
+        delay += sim_random() % (sim.config.jitter_us / 2 + 1);
+    }
+
+    return delay;
+}
+
+static int64_t sim_link_time(int64_t time, int64_t *last)
+{
+    if (!sim.config.reorder)
+    {
+        if (time < *last)
+        {
+            time = *last;
+        }
+        *last = time;
+    }
+
+    return time;
+}
+
+// Packets to the camera leave one slot apart, returns the time the packet is sent
+static int64_t sim_tx_time()
+{
+    int64_t time = sim.now;
+    if (time < sim.last_tx + sim.config.tx_slot_us)
+    {
+        time = sim.last_tx + sim.config.tx_slot_us;
+    }
+    sim.last_tx = time;
+
+    return time;
+}
+
+static struct sim_event *sim_uplink_at(int64_t tx_time, int request)
+{
+    // Requests sent into a dead link are lost, the host only notices after the supervision timeout
+    if (!sim.link_up)
+    {
+        return NULL;
+    }
+
+    return sim_schedule(sim_link_time(tx_time + sim_one_way(true), &sim.last_up), SIM_EV_REQUEST, request, sim.link_gen);
+}
+
+static struct sim_event *sim_uplink(int request)
+{
+    return sim_uplink_at(sim_tx_time(), request);
+}
+
+static struct sim_event *sim_downlink_at(int64_t time, int event)
+{
+    return sim_schedule(sim_link_time(time, &sim.last_down), SIM_EV_GATTC, event, sim.link_gen);
+}
+
+static struct sim_event *sim_downlink(int event)
+{
+    return sim_downlink_at(sim.now + sim_one_way(false), event);
+}
+
+static struct sim_event *sim_local_gattc(uint32_t delay, int event)
+{
+    return sim_schedule(sim.now + delay, SIM_EV_GATTC, event, 0);
+}
+
+static struct sim_event *sim_local_gap(uint32_t delay, int event)
+{
+    return sim_schedule(sim.now + delay, SIM_EV_GAP, event, 0);
+}
+
+static void sim_reset_session()
+{
+    sim.discovered = false;
+    sim.securing = false;
+    sim.encrypted = false;
+    sim.pair_state = SIM_PAIR_NONE;
+    sim.remote = false;
+    sim.pressed = false;
+    memset(sim.cccd_value, 0, sizeof(sim.cccd_value));
+}
+
+static void sim_link_drop(esp_gatt_conn_reason_t reason, uint32_t report_delay)
+{
+    if (!sim.link_up)
+    {
+        return;
+    }
+
+    ESP_LOGI(TAG, "Link down, reason 0x%x", reason);
+
+    sim.link_up = false;
+    sim.link_gen++;
+    sim.stats.disconnects++;
+    sim_reset_session();
+
+    struct sim_event *event = sim_local_gattc(report_delay, ESP_GATTC_DISCONNECT_EVT);
+    if (event != NULL)
+    {
+        event->param.gattc.disconnect.reason = reason;
+        event->param.gattc.disconnect.conn_id = SIM_CONN_ID;
+        memcpy(event->param.gattc.disconnect.remote_bda, sim.config.address, sizeof(esp_bd_addr_t));
+    }
+
+    event = sim_local_gattc(report_delay, ESP_GATTC_CLOSE_EVT);
+    if (event != NULL)
+    {
+        event->param.gattc.close.status = ESP_GATT_OK;
+        event->param.gattc.close.conn_id = SIM_CONN_ID;
+        event->param.gattc.close.reason = reason;
+        memcpy(event->param.gattc.close.remote_bda, sim.config.address, sizeof(esp_bd_addr_t));
+    }
+}
+
+// Camera
+static void sim_camera_trigger(const uint8_t *value, uint16_t len)
+{
+    if (!sim.remote)
+    {
+        sim.stats.rejected++;
+        return;
+    }
+
+    if (len != 2 || value[0] != 0x00)
+    {
+        return;
+    }
+
+    if (value[1] == 0x01) // Press
+    {
+        if (sim.pressed)
+        {
+            sim.stats.protocol_errors++;
+        }
+        sim.pressed = true;
+    }
+    else if (value[1] == 0x02) // Release
+    {
+        if (!sim.pressed)
+        {
+            sim.stats.protocol_errors++;
+        }
+        else
+        {
+            sim.stats.shots++;
+        }
+        sim.pressed = false;
+    }
+}
+
+static esp_gatt_status_t sim_camera_write(uint16_t handle, const uint8_t *value, uint16_t len, bool response)
+{
+    struct sim_char *chr = sim_find_char(handle);
+    if (chr == NULL)
+    {
+        return ESP_GATT_INVALID_HANDLE;
+    }
+    if (chr->encrypted && !sim.encrypted)
+    {
+        return ESP_GATT_INSUF_AUTHENTICATION;
+    }
+    if (!(chr->properties & (response ? ESP_GATT_CHAR_PROP_BIT_WRITE : ESP_GATT_CHAR_PROP_BIT_WRITE_NR)))
+    {
+        return ESP_GATT_WRITE_NOT_PERMIT;
+    }
+
+    if (response)
+    {
+        sim.stats.writes++;
+    }
+    else
+    {
+        sim.stats.writes_no_rsp++;
+    }
+
+    switch (chr - sim.chars)
+    {
+    case SIM_CHR_PAIR_COMMAND:
+        if (len >= 1 && value[0] == 0x01) // Name of the remote
+        {
+            sim.pair_state = SIM_PAIR_REQUESTED;
+        }
+        break;
+    case SIM_CHR_PAIR_DATA:
+        if (sim.pair_state == SIM_PAIR_ACCEPTED && len == 1 && value[0] == 0x01) // Confirmation
+        {
+            ESP_LOGI(TAG, "Camera paired");
+
+            sim.paired = true;
+            sim.pair_state = SIM_PAIR_NONE;
+        }
+        break;
+    case SIM_CHR_TRIG_CONFIG:
+        if (!sim.paired)
+        {
+            return ESP_GATT_WRITE_NOT_PERMIT;
+        }
+        sim.remote = (len >= 1 && value[0] == 0x03);
+        break;
+    case SIM_CHR_TRIG:
+        sim_camera_trigger(value, len);
+        break;
+    }
+
+    return ESP_GATT_OK;
+}
+
+static esp_gatt_status_t sim_camera_write_descr(uint16_t handle, const uint8_t *value, uint16_t len)
+{
+    struct sim_char *chr = sim_find_cccd(handle);
+    if (chr == NULL)
+    {
+        return ESP_GATT_INVALID_HANDLE;
+    }
+    if (chr->encrypted && !sim.encrypted)
+    {
+        return ESP_GATT_INSUF_AUTHENTICATION;
+    }
+
+    sim.stats.descr_writes++;
+
+    int index = chr - sim.chars;
+    sim.cccd_value[index] = (len >= 2 ? value[0] | (value[1] << 8) : 0);
+
+    // The camera shows the pairing request once the remote listens for the answer
+    if (index == SIM_CHR_PAIR_COMMAND && (sim.cccd_value[index] & BLE_INDICATION) && sim.pair_state == SIM_PAIR_REQUESTED)
+    {
+        sim.pair_state = SIM_PAIR_WAITING;
+        sim_schedule(sim.now + sim.config.confirm_us, SIM_EV_PAIR_DECISION, 0, sim.link_gen);
+    }
+
+    return ESP_GATT_OK;
+}
+
+static void sim_camera_pair_decision()
+{
+    uint8_t result = (sim.config.accept_pairing ? 0x02 : 0x03);
+    sim.pair_state = (sim.config.accept_pairing ? SIM_PAIR_ACCEPTED : SIM_PAIR_NONE);
+
+    if (!(sim.cccd_value[SIM_CHR_PAIR_COMMAND] & BLE_INDICATION))
+    {
+        return;
+    }
+
+    sim.stats.indications++;
+
+    struct sim_event *event = sim_downlink(ESP_GATTC_NOTIFY_EVT);
+    if (event != NULL)
+    {
+        event->param.gattc.notify.conn_id = SIM_CONN_ID;
+        memcpy(event->param.gattc.notify.remote_bda, sim.config.address, sizeof(esp_bd_addr_t));
+        event->param.gattc.notify.handle = sim.chars[SIM_CHR_PAIR_COMMAND].handle;
+        event->param.gattc.notify.is_notify = false;
+        event->value[0] = result;
+        event->value_len = 1;
+    }
+}
+
+static void sim_camera_search()
+{
+    // One round trip per service, then per characteristic and descriptor
+    int64_t time = sim.now;
+    for (int i = 0; i < SIM_SVC_COUNT; i++)
+    {
+        time += sim.config.latency_us;
+
+        struct sim_event *event = sim_downlink_at(time, ESP_GATTC_SEARCH_RES_EVT);
+        if (event != NULL)
+        {
+            event->param.gattc.search_res.conn_id = SIM_CONN_ID;
+            event->param.gattc.search_res.start_handle = sim.services[i].start_handle;
+            event->param.gattc.search_res.end_handle = sim.services[i].end_handle;
+            event->param.gattc.search_res.srvc_id.uuid = sim.services[i].uuid;
+            event->param.gattc.search_res.is_primary = true;
+        }
+    }
+
+    for (int i = 0; i < SIM_CHR_COUNT; i++)
+    {
+        time += sim.config.latency_us * (sim.chars[i].cccd != 0 ? 2 : 1);
+    }
+
+    struct sim_event *event = sim_downlink_at(time, ESP_GATTC_SEARCH_CMPL_EVT);
+    if (event != NULL)
+    {
+        event->param.gattc.search_cmpl.status = ESP_GATT_OK;
+        event->param.gattc.search_cmpl.conn_id = SIM_CONN_ID;
+        event->param.gattc.search_cmpl.searched_service_source = ESP_GATT_SERVICE_FROM_REMOTE_DEVICE;
+    }
+}
+
+static void sim_camera_security()
+{
+    bool success = true;
+    uint32_t duration = sim.config.latency_us; // Encryption with the stored keys
+
+    if (!sim.bonded)
+    {
+        // Pairing and key distribution take a few more round trips
+        duration = sim.config.latency_us * 4;
+
+        success = !sim_chance(sim.config.bond_fail_ppm);
+        if (success)
+        {
+            sim.bonded = true;
+            sim.stats.bonds++;
+        }
+    }
+
+    sim.encrypted = success;
+
+    struct sim_event *event = sim_schedule(sim_link_time(sim.now + duration, &sim.last_down), SIM_EV_GAP, ESP_GAP_BLE_AUTH_CMPL_EVT, sim.link_gen);
+    if (event != NULL)
+    {
+        esp_ble_auth_cmpl_t *auth = &event->param.gap.ble_security.auth_cmpl;
+        memcpy(auth->bd_addr, sim.config.address, sizeof(esp_bd_addr_t));
+        auth->key_present = success;
+        auth->success = success;
+        auth->fail_reason = (success ? 0 : SIM_AUTH_FAIL_REASON);
+        auth->addr_type = BLE_ADDR_TYPE_PUBLIC;
+        auth->auth_mode = ESP_LE_AUTH_REQ_SC_MITM_BOND;
+    }
+}
+
+static void sim_camera_request(struct sim_event *request)
+{
+    sim.stats.requests++;
+
+    if (request->id == SIM_REQ_WRITE || request->id == SIM_REQ_WRITE_DESCR || request->id == SIM_REQ_COMMAND)
+    {
+        if (sim_chance(sim.config.disconnect_ppm))
+        {
+            sim_link_drop(ESP_GATT_CONN_TIMEOUT, sim.config.supervision_us);
+            return;
+        }
+        if (sim_chance(sim.config.drop_ppm))
+        {
+            sim.stats.dropped++;
+            if (request->id != SIM_REQ_COMMAND)
+            {
+                sim_schedule(request->time + SIM_ATT_TIMEOUT_US, SIM_EV_ATT_TIMEOUT, 0, sim.link_gen);
+            }
+            return;
+        }
+    }
+
+    switch (request->id)
+    {
+    case SIM_REQ_MTU:
+    {
+        struct sim_event *event = sim_downlink(ESP_GATTC_CFG_MTU_EVT);
+        if (event != NULL)
+        {
+            event->param.gattc.cfg_mtu.status = ESP_GATT_OK;
+            event->param.gattc.cfg_mtu.conn_id = SIM_CONN_ID;
+            event->param.gattc.cfg_mtu.mtu = (sim.local_mtu < SIM_MTU ? sim.local_mtu : SIM_MTU);
+        }
+        break;
+    }
+    case SIM_REQ_SEARCH:
+        sim_camera_search();
+        break;
+    case SIM_REQ_SECURITY:
+        sim_camera_security();
+        break;
+    case SIM_REQ_WRITE:
+    case SIM_REQ_WRITE_DESCR:
+    {
+        esp_gatt_status_t status;
+        if (sim_chance(sim.config.fail_ppm))
+        {
+            sim.stats.failed++;
+            status = ESP_GATT_ERROR;
+        }
+        else if (request->id == SIM_REQ_WRITE)
+        {
+            status = sim_camera_write(request->handle, request->value, request->value_len, true);
+        }
+        else
+        {
+            status = sim_camera_write_descr(request->handle, request->value, request->value_len);
+        }
+
+        struct sim_event *event = sim_downlink(request->id == SIM_REQ_WRITE ? ESP_GATTC_WRITE_CHAR_EVT : ESP_GATTC_WRITE_DESCR_EVT);
+        if (event != NULL)
+        {
+            event->param.gattc.write.status = status;
+            event->param.gattc.write.conn_id = SIM_CONN_ID;
+            event->param.gattc.write.handle = request->handle;
+        }
+        break;
+    }
+    case SIM_REQ_COMMAND:
+        if (sim_camera_write(request->handle, request->value, request->value_len, false) != ESP_GATT_OK)
+        {
+            sim.stats.ignored++;
+        }
+        break;
+    }
+}
+
+// Delivery
+static void sim_deliver_gattc(struct sim_event *event)
+{
+    switch (event->id)
+    {
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        sim.discovered = true;
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        event->param.gattc.notify.value = event->value;
+        event->param.gattc.notify.value_len = event->value_len;
+        break;
+    case ESP_GATTC_DISCONNECT_EVT:
+        sim.connected = false;
+        break;
+    }
+
+    sim.stats.events++;
+    sim.gattc_cb(event->id, SIM_GATT_IF, &event->param.gattc);
+}
+
+static void sim_deliver_gap(struct sim_event *event)
+{
+    // The new parameters are in use from the instant on
+    if (event->id == ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT && event->param.gap.update_conn_params.status == ESP_BT_STATUS_SUCCESS)
+    {
+        sim.interval_us = event->param.gap.update_conn_params.conn_int * 1250;
+        sim.peer_latency = event->param.gap.update_conn_params.latency;
+        sim.stats.conn_updates++;
+    }
+
+    sim.stats.events++;
+    sim.gap_cb(event->id, &event->param.gap);
+}
+
+static void sim_deliver_connect()
+{
+    sim.connecting = false;
+    sim.connected = true;
+    sim.link_up = true;
+    sim.link_gen++;
+    sim.last_tx = sim.now;
+    sim.last_up = sim.now;
+    sim.last_down = sim.now;
+    sim.interval_us = 0;
+    sim.peer_latency = 0;
+    sim_reset_session();
+
+    esp_ble_gattc_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.connect.conn_id = SIM_CONN_ID;
+    memcpy(param.connect.remote_bda, sim.config.address, sizeof(esp_bd_addr_t));
+    sim.stats.events++;
+    sim.gattc_cb(ESP_GATTC_CONNECT_EVT, SIM_GATT_IF, &param);
+
+    memset(&param, 0, sizeof(param));
+    param.open.status = ESP_GATT_OK;
+    param.open.conn_id = SIM_CONN_ID;
+    param.open.mtu = 23;
+    memcpy(param.open.remote_bda, sim.config.address, sizeof(esp_bd_addr_t));
+    sim.stats.events++;
+    sim.gattc_cb(ESP_GATTC_OPEN_EVT, SIM_GATT_IF, &param);
+}
+
+static void sim_deliver_connect_timeout()
+{
+    sim.connecting = false;
+
+    esp_ble_gattc_cb_param_t param;
+
+    memset(&param, 0, sizeof(param));
+    param.open.status = ESP_GATT_ERROR;
+    memcpy(param.open.remote_bda, sim.connect_bda, sizeof(esp_bd_addr_t));
+    sim.stats.events++;
+    sim.gattc_cb(ESP_GATTC_OPEN_EVT, SIM_GATT_IF, &param);
+}
+
+static void sim_deliver_timer(struct sim_event *event)
+{
+    esp_timer_handle_t timer = event->timer;
+
+    if (timer->period > 0)
+    {
+        // Periodic deadlines don't drift with the callback
+        struct sim_event *next = sim_schedule(event->time + timer->period, SIM_EV_TIMER, 0, timer->gen);
+        if (next != NULL)
+        {
+            next->timer = timer;
+        }
+    }
+    else
+    {
+        timer->armed = false;
+    }
+
+    timer->callback(timer->arg);
+}
+
+// Advertiser 0 is the camera, the twins follow and then the crowd
+static void sim_advertise(int advertiser)
+{
+    uint32_t twins = sim.config.twin_cameras;
+    bool canon = (advertiser <= (int)twins);
+
+    if (advertiser == 0 && (!sim.config.available || sim.link_up))
+    {
+        return; // The camera stops advertising while it is connected
+    }
+    if (sim.scan_duplicate)
+    {
+        if (sim.scan_seen & (1ULL << advertiser))
+        {
+            return;
+        }
+        sim.scan_seen |= (1ULL << advertiser);
+    }
+
+    esp_ble_gap_cb_param_t param;
+    memset(&param, 0, sizeof(param));
+
+    param.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_RES_EVT;
+    memcpy(param.scan_rst.bda, sim.config.address, sizeof(esp_bd_addr_t));
+    param.scan_rst.bda[5] ^= advertiser;
+    param.scan_rst.bda[4] ^= (canon ? 0 : 0x80);
+    param.scan_rst.ble_addr_type = BLE_ADDR_TYPE_PUBLIC;
+    param.scan_rst.ble_evt_type = ESP_BLE_EVT_CONN_ADV;
+    param.scan_rst.rssi = (advertiser == 0 ? -60 : -40 - (advertiser * 37) % 56);
+
+    char crowd_name[16];
+    const char *name = sim.config.name;
+    if (!canon)
+    {
+        sprintf(crowd_name, "Phone %d", advertiser);
+        name = crowd_name;
+    }
+
+    uint8_t *adv = param.scan_rst.ble_adv;
+    int length = 0;
+
+    adv[length++] = 2;
+    adv[length++] = ESP_BLE_AD_TYPE_FLAG;
+    adv[length++] = 0x06;
+
+    if (canon)
+    {
+        adv[length++] = 5;
+        adv[length++] = ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE;
+        adv[length++] = SIM_CANON_COMPANY_ID & 0xFF;
+        adv[length++] = SIM_CANON_COMPANY_ID >> 8;
+        adv[length++] = 0x01;
+        adv[length++] = 0x00;
+    }
+    else
+    {
+        // Same size as the camera's, with another company
+        adv[length++] = 5;
+        adv[length++] = ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE;
+        adv[length++] = 0x4C;
+        adv[length++] = 0x00;
+        adv[length++] = 0x10;
+        adv[length++] = 0x05;
+    }
+
+    int name_len = strlen(name);
+    if (name_len > ESP_BLE_ADV_DATA_LEN_MAX - length - 2)
+    {
+        name_len = ESP_BLE_ADV_DATA_LEN_MAX - length - 2;
+    }
+
+    adv[length++] = name_len + 1;
+    adv[length++] = ESP_BLE_AD_TYPE_NAME_CMPL;
+    memcpy(&adv[length], name, name_len);
+    length += name_len;
+    param.scan_rst.adv_data_len = length;
+
+    sim.stats.events++;
+    sim.stats.reports++;
+    sim.gap_cb(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+}
+
+static void sim_deliver_adv()
+{
+    if (sim.now >= sim.scan_end)
+    {
+        sim.scanning = false;
+
+        esp_ble_gap_cb_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_CMPL_EVT;
+
+        sim.stats.events++;
+        sim.gap_cb(ESP_GAP_BLE_SCAN_RESULT_EVT, &param);
+        return;
+    }
+
+    sim_schedule(sim.now + sim.config.adv_interval_us, SIM_EV_ADV, 0, sim.scan_gen);
+
+    int advertisers = 1 + sim.config.twin_cameras + sim.config.crowd_devices;
+    if (advertisers > SIM_ADVERTISERS_MAX)
+    {
+        advertisers = SIM_ADVERTISERS_MAX;
+    }
+
+    for (int advertiser = 0; advertiser < advertisers; advertiser++)
+    {
+        sim_advertise(advertiser);
+    }
+}
+
+bool camera_sim_step(void)
+{
+    if (sim.event_count == 0)
+    {
+        if (dispatch_hook != NULL)
+        {
+            dispatch_hook();
+        }
+        return false;
+    }
+
+    struct sim_event event;
+    sim_pop(&event);
+
+    if (event.time > sim.now)
+    {
+        sim.now = event.time;
+        idf_host_set_time(sim.now);
+    }
+
+    switch (event.type)
+    {
+    case SIM_EV_GATTC:
+        if (event.gen == 0 || event.gen == sim.link_gen)
+        {
+            sim_deliver_gattc(&event);
+        }
+        break;
+    case SIM_EV_GAP:
+        if (event.gen == 0 || event.gen == sim.link_gen)
+        {
+            sim_deliver_gap(&event);
+        }
+        break;
+    case SIM_EV_CONNECT:
+        if (sim.connecting && event.gen == sim.connect_gen)
+        {
+            if (event.id == SIM_CONNECT_OK)
+            {
+                sim_deliver_connect();
+            }
+            else
+            {
+                sim_deliver_connect_timeout();
+            }
+        }
+        break;
+    case SIM_EV_REQUEST:
+        if (sim.link_up && event.gen == sim.link_gen)
+        {
+            sim_camera_request(&event);
+        }
+        break;
+    case SIM_EV_PAIR_DECISION:
+        if (sim.link_up && event.gen == sim.link_gen)
+        {
+            sim_camera_pair_decision();
+        }
+        break;
+    case SIM_EV_ADV:
+        if (sim.scanning && event.gen == sim.scan_gen)
+        {
+            sim_deliver_adv();
+        }
+        break;
+    case SIM_EV_ATT_TIMEOUT:
+        if (sim.link_up && event.gen == sim.link_gen)
+        {
+            sim_link_drop(ESP_GATT_CONN_TERMINATE_LOCAL_HOST, 0);
+        }
+        break;
+    case SIM_EV_TIMER:
+        if (event.timer->armed && event.gen == event.timer->gen)
+        {
+            sim_deliver_timer(&event);
+        }
+        break;
+    }
+
+    if (dispatch_hook != NULL)
+    {
+        dispatch_hook();
+    }
+
+    return true;
+}
+
+void camera_sim_run_until(int64_t time_us)
+{
+    while (sim.event_count > 0 && sim.events[0].time <= time_us)
+    {
+        camera_sim_step();
+    }
+
+    if (time_us > sim.now)
+    {
+        sim.now = time_us;
+        idf_host_set_time(sim.now);
+    }
+}
+
+int64_t camera_sim_time(void)
+{
+    return sim.now;
+}
+
+int camera_sim_pending(void)
+{
+    return sim.event_count;
+}
+
+void camera_sim_default_config(struct camera_sim_config *config)
+{
+    static const esp_bd_addr_t address = {0x00, 0x9d, 0x6b, 0x11, 0x22, 0x33};
+
+    memset(config, 0, sizeof(struct camera_sim_config));
+    memcpy(config->address, address, sizeof(esp_bd_addr_t));
+    config->name = "EOS SIM";
+    config->available = true;
+
+    config->handle_base = 0x0001;
+    config->trigger_config_missing = false;
+    config->trigger_write_no_rsp = false;
+    config->accept_pairing = true;
+    config->confirm_us = 2000 * 1000;
+
+    // Around a 30 ms connection interval
+    config->latency_us = 60 * 1000;
+    config->jitter_us = 0;
+    config->reorder = false;
+    config->local_us = 100;
+    config->tx_slot_us = 7500; // 4 packets per connection event
+    config->tx_buffers = 8;
+    config->connect_us = 100 * 1000;
+    config->supervision_us = 2000 * 1000;
+    config->adv_interval_us = 100 * 1000;
+
+    config->seed = 1;
+}
+
+void camera_sim_init(const struct camera_sim_config *config)
+{
+    int64_t now = sim.now;
+
+    memset(&sim, 0, sizeof(sim));
+    sim.now = now;
+    sim.local_mtu = 23;
+    sim.link_gen = 1;
+    sim.scan_gen = 1;
+    sim.connect_gen = 1;
+
+    camera_sim_set_config(config);
+}
+
+void camera_sim_set_dispatch(camera_sim_dispatch_hook hook)
+{
+    dispatch_hook = hook;
+}
+
+void camera_sim_set_config(const struct camera_sim_config *config)
+{
+    // A pending direct connection is taken once the camera is back in range
+    if (config->available && !sim.config.available && sim.connecting &&
+        memcmp(sim.connect_bda, config->address, sizeof(esp_bd_addr_t)) == 0)
+    {
+        sim_schedule(sim.now + config->connect_us, SIM_EV_CONNECT, SIM_CONNECT_OK, sim.connect_gen);
+    }
+
+    sim.config = *config;
+    sim.rng = (config->seed != 0 ? config->seed : 1);
+
+    sim_build_table();
+}
+
+uint32_t camera_sim_interval_us(void)
+{
+    return (sim.interval_us != 0 ? sim.interval_us : sim.config.latency_us / 2);
+}
+
+bool camera_sim_connected(void)
+{
+    return sim.connected;
+}
+
+bool camera_sim_paired(void)
+{
+    return sim.paired;
+}
+
+void camera_sim_link_loss(void)
+{
+    sim_link_drop(ESP_GATT_CONN_TIMEOUT, sim.config.supervision_us);
+}
+
+void camera_sim_camera_update(uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    if (!sim.link_up)
+    {
+        return;
+    }
+
+    struct sim_event *event = sim_schedule(sim.now + camera_sim_interval_us(), SIM_EV_GAP, ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT,
+                                           sim.link_gen);
+    if (event == NULL)
+    {
+        return;
+    }
+
+    event->param.gap.update_conn_params.status = ESP_BT_STATUS_SUCCESS;
+    memcpy(event->param.gap.update_conn_params.bda, sim.config.address, sizeof(esp_bd_addr_t));
+    event->param.gap.update_conn_params.min_int = interval;
+    event->param.gap.update_conn_params.max_int = interval;
+    event->param.gap.update_conn_params.latency = latency;
+    event->param.gap.update_conn_params.conn_int = interval;
+    event->param.gap.update_conn_params.timeout = timeout;
+}
+
+void camera_sim_forget_bond(void)
+{
+    sim.bonded = false;
+    sim.paired = false;
+}
+
+void camera_sim_set_other_bonds(const esp_bd_addr_t *addresses, int count)
+{
+    sim.other_bond_count = (count < SIM_OTHER_BONDS_MAX ? count : SIM_OTHER_BONDS_MAX);
+    memcpy(sim.other_bonds, addresses, sizeof(esp_bd_addr_t) * sim.other_bond_count);
+}
+
+void camera_sim_get_stats(struct camera_sim_stats *stats)
+{
+    *stats = sim.stats;
+}
+
+void camera_sim_reset_stats(void)
+{
+    memset(&sim.stats, 0, sizeof(sim.stats));
+}
+
+// Bluetooth controller and Bluedroid
+esp_err_t esp_bt_controller_mem_release(esp_bt_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu)
+{
+    sim.local_mtu = mtu;
+    return ESP_OK;
+}
+
+// GAP
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback)
+{
+    sim.gap_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params)
+{
+    sim.scan_duplicate = (scan_params->scan_duplicate == BLE_SCAN_DUPLICATE_ENABLE);
+
+    struct sim_event *event = sim_local_gap(0, ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    event->param.gap.scan_param_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration)
+{
+    sim.scanning = true;
+    sim.scan_gen++;
+    sim.scan_seen = 0;
+    sim.scan_end = sim.now + (int64_t)duration * 1000 * 1000;
+
+    struct sim_event *event = sim_local_gap(0, ESP_GAP_BLE_SCAN_START_COMPLETE_EVT);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    event->param.gap.scan_start_cmpl.status = ESP_BT_STATUS_SUCCESS;
+
+    sim_schedule(sim.now + sim.config.adv_interval_us, SIM_EV_ADV, 0, sim.scan_gen);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_stop_scanning(void)
+{
+    sim.scanning = false;
+    sim.scan_gen++;
+
+    struct sim_event *event = sim_local_gap(0, ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    event->param.gap.scan_stop_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_config_local_privacy(bool privacy_enable)
+{
+    struct sim_event *event = sim_local_gap(0, ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    event->param.gap.local_privacy_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_read_rssi(esp_bd_addr_t remote_addr)
+{
+    struct sim_event *event = sim_local_gap(0, ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // The connected camera is a bit further away than while it was advertising
+    event->param.gap.read_rssi_cmpl.status = (sim.connected ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_FAIL);
+    event->param.gap.read_rssi_cmpl.rssi = -62 - (int8_t)(sim.stats.shots % 4);
+    memcpy(event->param.gap.read_rssi_cmpl.remote_addr, remote_addr, sizeof(esp_bd_addr_t));
+    return ESP_OK;
+}
+
+// The camera takes the longest interval it is offered, the controller puts the instant far enough ahead
+// for a camera which skips events
+esp_err_t esp_ble_gap_update_conn_params(esp_ble_conn_update_params_t *params)
+{
+    bool valid = (sim.link_up && params->min_int >= 6 && params->min_int <= params->max_int && params->max_int <= 3200 &&
+                  params->timeout * 10000 > (1 + params->latency) * params->max_int * 1250 * 2);
+    if (valid && sim.config.update_rejects > 0)
+    {
+        sim.config.update_rejects--;
+        valid = false;
+    }
+
+    int64_t instant = sim.now;
+    if (valid)
+    {
+        instant += (int64_t)(sim.peer_latency + SIM_UPDATE_INSTANT) * camera_sim_interval_us();
+    }
+
+    struct sim_event *event = sim_schedule(instant, SIM_EV_GAP, ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT, sim.link_gen);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    event->param.gap.update_conn_params.status = (valid ? ESP_BT_STATUS_SUCCESS : ESP_BT_STATUS_FAIL);
+    memcpy(event->param.gap.update_conn_params.bda, params->bda, sizeof(esp_bd_addr_t));
+    event->param.gap.update_conn_params.min_int = params->min_int;
+    event->param.gap.update_conn_params.max_int = params->max_int;
+    event->param.gap.update_conn_params.latency = params->latency;
+    event->param.gap.update_conn_params.conn_int = params->max_int;
+    event->param.gap.update_conn_params.timeout = params->timeout;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_security_param(esp_ble_sm_param_t param_type, void *value, uint8_t len)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_security_rsp(esp_bd_addr_t bd_addr, bool accept)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_confirm_reply(esp_bd_addr_t bd_addr, bool accept)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_oob_req_reply(esp_bd_addr_t bd_addr, uint8_t *TK, uint8_t len)
+{
+    return ESP_OK;
+}
+
+int esp_ble_get_bond_device_num(void)
+{
+    return sim.other_bond_count + (sim.bonded ? 1 : 0);
+}
+
+esp_err_t esp_ble_get_bond_device_list(int *dev_num, esp_ble_bond_dev_t *dev_list)
+{
+    int num = 0;
+    for (int i = 0; i < sim.other_bond_count && num < *dev_num; i++)
+    {
+        memcpy(dev_list[num++].bd_addr, sim.other_bonds[i], sizeof(esp_bd_addr_t));
+    }
+    if (sim.bonded && num < *dev_num)
+    {
+        memcpy(dev_list[num++].bd_addr, sim.config.address, sizeof(esp_bd_addr_t));
+    }
+
+    *dev_num = num;
+    return ESP_OK;
+}
+
+uint8_t *esp_ble_resolve_adv_data(uint8_t *adv_data, uint8_t type, uint8_t *length)
+{
+    int offset = 0;
+    while (offset < ESP_BLE_ADV_DATA_LEN_MAX + ESP_BLE_SCAN_RSP_DATA_LEN_MAX && adv_data[offset] != 0)
+    {
+        uint8_t field_len = adv_data[offset];
+        if (adv_data[offset + 1] == type)
+        {
+            *length = field_len - 1;
+            return &adv_data[offset + 2];
+        }
+
+        offset += field_len + 1;
+    }
+
+    *length = 0;
+    return NULL;
+}
+
+// GATTC
+esp_err_t esp_ble_gattc_register_callback(esp_gattc_cb_t callback)
+{
+    sim.gattc_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_app_register(uint16_t app_id)
+{
+    struct sim_event *event = sim_local_gattc(0, ESP_GATTC_REG_EVT);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    event->param.gattc.reg.status = ESP_GATT_OK;
+    event->param.gattc.reg.app_id = app_id;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t gattc_if, esp_bd_addr_t remote_bda, esp_ble_addr_type_t remote_addr_type, bool is_direct)
+{
+    if (sim.connecting || sim.connected)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sim.connecting = true;
+    sim.connect_gen++;
+    memcpy(sim.connect_bda, remote_bda, sizeof(esp_bd_addr_t));
+
+    if (sim.config.available && memcmp(remote_bda, sim.config.address, sizeof(esp_bd_addr_t)) == 0)
+    {
+        sim_schedule(sim.now + sim.config.connect_us, SIM_EV_CONNECT, SIM_CONNECT_OK, sim.connect_gen);
+        return ESP_OK;
+    }
+
+    // Nothing answers, the direct connection times out unless the camera comes back in range before
+    if (sim_schedule(sim.now + SIM_CONNECT_TIMEOUT_US, SIM_EV_CONNECT, SIM_CONNECT_TIMEOUT, sim.connect_gen) == NULL)
+    {
+        sim.connecting = false;
+        return ESP_ERR_NO_MEM;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t gattc_if, uint16_t conn_id)
+{
+    if (sim.connecting)
+    {
+        sim.connecting = false;
+        return ESP_OK;
+    }
+    if (!sim.connected)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sim_link_drop(ESP_GATT_CONN_TERMINATE_LOCAL_HOST, sim.config.latency_us);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t gattc_if, uint16_t conn_id)
+{
+    if (!sim.connected)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sim_uplink(SIM_REQ_MTU);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_bt_uuid_t *filter_uuid)
+{
+    if (!sim.connected)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    sim.discovered = false;
+    sim_uplink(SIM_REQ_SEARCH);
+    return ESP_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_attr_count(esp_gatt_if_t gattc_if, uint16_t conn_id, esp_gatt_db_attr_type_t type,
+                                               uint16_t start_handle, uint16_t end_handle, uint16_t char_handle, uint16_t *count)
+{
+    *count = 0;
+
+    // The attribute database only exists after a service search in this connection
+    if (!sim.connected || !sim.discovered)
+    {
+        return ESP_GATT_NOT_FOUND;
+    }
+
+    for (int i = 0; i < SIM_CHR_COUNT; i++)
+    {
+        if (type == ESP_GATT_DB_CHARACTERISTIC && sim.chars[i].handle >= start_handle && sim.chars[i].handle <= end_handle)
+        {
+            (*count)++;
+        }
+        else if (type == ESP_GATT_DB_DESCRIPTOR && sim.chars[i].handle == char_handle && sim.chars[i].cccd != 0)
+        {
+            (*count)++;
+        }
+    }
+
+    return ESP_GATT_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_all_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t start_handle, uint16_t end_handle,
+                                             esp_gattc_char_elem_t *result, uint16_t *count, uint16_t offset)
+{
+    if (!sim.connected || !sim.discovered)
+    {
+        *count = 0;
+        return ESP_GATT_NOT_FOUND;
+    }
+
+    uint16_t found = 0;
+    uint16_t skipped = 0;
+    for (int i = 0; i < SIM_CHR_COUNT && found < *count; i++)
+    {
+        if (sim.chars[i].handle < start_handle || sim.chars[i].handle > end_handle)
+        {
+            continue;
+        }
+        if (skipped++ < offset)
+        {
+            continue;
+        }
+
+        result[found].char_handle = sim.chars[i].handle;
+        result[found].properties = sim.chars[i].properties;
+        result[found].uuid = sim.chars[i].uuid;
+        found++;
+    }
+
+    *count = found;
+    return ESP_GATT_OK;
+}
+
+esp_gatt_status_t esp_ble_gattc_get_all_descr(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t char_handle,
+                                              esp_gattc_descr_elem_t *result, uint16_t *count, uint16_t offset)
+{
+    if (!sim.connected || !sim.discovered)
+    {
+        *count = 0;
+        return ESP_GATT_NOT_FOUND;
+    }
+
+    struct sim_char *chr = sim_find_char(char_handle);
+    if (chr == NULL || chr->cccd == 0 || offset > 0 || *count == 0)
+    {
+        *count = 0;
+        return (chr == NULL ? ESP_GATT_INVALID_HANDLE : ESP_GATT_OK);
+    }
+
+    result[0].handle = chr->cccd;
+    result[0].uuid = sim_uuid16(ESP_GATT_UUID_CHAR_CLIENT_CONFIG);
+    *count = 1;
+    return ESP_GATT_OK;
+}
+
+static void sim_start_security()
+{
+    // A request needing a secure link only starts the encryption, it isn't sent itself
+    if (!sim.securing)
+    {
+        sim.securing = true;
+        sim_uplink(SIM_REQ_SECURITY);
+    }
+}
+
+static bool sim_check_write(uint16_t value_len, esp_err_t *err)
+{
+    *err = ESP_OK;
+    if (!sim.connected)
+    {
+        *err = ESP_ERR_INVALID_STATE;
+    }
+    else if (value_len > SIM_VALUE_MAX)
+    {
+        *err = ESP_ERR_INVALID_SIZE;
+    }
+
+    return (*err == ESP_OK);
+}
+
+static void sim_fill_request(struct sim_event *event, uint16_t handle, uint16_t value_len, uint8_t *value)
+{
+    if (event != NULL)
+    {
+        event->handle = handle;
+        event->value_len = value_len;
+        memcpy(event->value, value, value_len);
+    }
+}
+
+static esp_err_t sim_request_write(int request, uint16_t handle, uint16_t value_len, uint8_t *value, esp_gatt_auth_req_t auth_req)
+{
+    esp_err_t err;
+    if (!sim_check_write(value_len, &err))
+    {
+        return err;
+    }
+
+    if (auth_req != ESP_GATT_AUTH_REQ_NONE && !sim.encrypted)
+    {
+        sim_start_security();
+        return ESP_OK;
+    }
+
+    sim_fill_request(sim_uplink(request), handle, value_len, value);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_write_char(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, uint16_t value_len, uint8_t *value,
+                                   esp_gatt_write_type_t write_type, esp_gatt_auth_req_t auth_req)
+{
+    // Out of buffers or a busy link, the call fails and no event follows
+    if (sim.connected && sim_chance(sim.config.refuse_ppm))
+    {
+        sim.stats.refused++;
+        return ESP_FAIL;
+    }
+
+    if (write_type == ESP_GATT_WRITE_TYPE_RSP)
+    {
+        return sim_request_write(SIM_REQ_WRITE, handle, value_len, value, auth_req);
+    }
+
+    esp_err_t err;
+    if (!sim_check_write(value_len, &err))
+    {
+        return err;
+    }
+
+    esp_gatt_status_t status = ESP_GATT_OK;
+    int64_t complete = sim.now + sim.config.local_us;
+
+    bool release = (value_len == 2 && value[0] == 0x00 && value[1] == 0x02);
+    if (sim_chance(sim.config.fail_ppm) || (release && sim.config.release_no_rsp_fails > 0))
+    {
+        if (release && sim.config.release_no_rsp_fails > 0)
+        {
+            sim.config.release_no_rsp_fails--;
+        }
+        sim.stats.failed++;
+        status = ESP_GATT_CONGESTED;
+    }
+    else
+    {
+        // Without a response the write completes locally once it got a controller buffer,
+        // that is when the packet tx_buffers ahead of it was sent
+        int64_t tx_time = sim_tx_time();
+        int64_t buffered = tx_time - (int64_t)sim.config.tx_buffers * sim.config.tx_slot_us;
+        if (buffered > complete)
+        {
+            complete = buffered;
+        }
+
+        sim_fill_request(sim_uplink_at(tx_time, SIM_REQ_COMMAND), handle, value_len, value);
+    }
+
+    struct sim_event *event = sim_schedule(complete, SIM_EV_GATTC, ESP_GATTC_WRITE_CHAR_EVT, 0);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+    event->param.gattc.write.status = status;
+    event->param.gattc.write.conn_id = conn_id;
+    event->param.gattc.write.handle = handle;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_write_char_descr(esp_gatt_if_t gattc_if, uint16_t conn_id, uint16_t handle, uint16_t value_len, uint8_t *value,
+                                         esp_gatt_write_type_t write_type, esp_gatt_auth_req_t auth_req)
+{
+    return sim_request_write(SIM_REQ_WRITE_DESCR, handle, value_len, value, auth_req);
+}
+
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t gattc_if, esp_bd_addr_t server_bda, uint16_t handle)
+{
+    struct sim_event *event = sim_local_gattc(0, ESP_GATTC_REG_FOR_NOTIFY_EVT);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    event->param.gattc.reg_for_notify.status = ESP_GATT_OK;
+    event->param.gattc.reg_for_notify.handle = handle;
+    return ESP_OK;
+}
+
+// esp_timer
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+    esp_timer_handle_t timer = calloc(1, sizeof(struct esp_timer));
+    if (timer == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    timer->callback = create_args->callback;
+    timer->arg = create_args->arg;
+
+    *out_handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t sim_timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period)
+{
+    if (timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    timer->gen++;
+    struct sim_event *event = sim_schedule(sim.now + timeout_us, SIM_EV_TIMER, 0, timer->gen);
+    if (event == NULL)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    event->timer = timer;
+    timer->period = period;
+    timer->armed = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return sim_timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    return sim_timer_start(timer, period, period);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if (!timer->armed)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // The queued deadline stays in the heap and is skipped by its generation
+    timer->armed = false;
+    timer->gen++;
+    return ESP_OK;
+}
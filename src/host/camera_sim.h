@@ -0,0 +1,106 @@
+#ifndef _CAMERA_SIM_H_
+#define _CAMERA_SIM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_bt_defs.h"
+
+// Simulated Canon camera behind a host implementation of the Bluedroid GAP/GATTC API used by app_ble.c.
+// Everything runs on the calling thread: the API calls schedule events and camera_sim_step delivers them
+// to the registered callbacks in time order, moving the esp_timer clock forward.
+struct camera_sim_config
+{
+    esp_bd_addr_t address;
+    const char *name;
+    bool available; // Advertising and accepting connections
+
+    uint16_t handle_base;      // First attribute handle, change it to make cached handles stale
+    bool trigger_config_missing; // The trigger service lacks the config characteristic
+    bool trigger_write_no_rsp; // The trigger characteristic declares write without response
+    bool accept_pairing;       // The user accepts the pairing request on the camera
+    uint32_t confirm_us;       // Time the user needs to accept the pairing request
+
+    uint32_t latency_us;     // Round trip of a request and its response
+    uint32_t jitter_us;      // Random extra round trip time
+    bool reorder;            // Let the jitter reorder messages on the link, they keep their order otherwise
+    uint32_t local_us;       // Local completion of a write without response
+    uint32_t tx_slot_us;     // Minimum spacing of packets sent to the camera, limits the throughput
+    uint32_t tx_buffers;     // Controller buffers, a write without response completes once it got one
+    uint32_t connect_us;     // Connection setup
+    uint32_t supervision_us; // A lost link is only reported after the supervision timeout
+    uint32_t adv_interval_us;
+
+    // Other advertisers in range, they can't be connected
+    uint32_t twin_cameras;  // Cameras of the same model, same name and Canon manufacturer data
+    uint32_t crowd_devices; // Phones and beacons
+
+    // Failure injection, in parts per million of the requests the camera receives
+    uint32_t fail_ppm;       // Answered with an error status
+    uint32_t drop_ppm;       // Lost, never answered
+    uint32_t disconnect_ppm; // The link drops
+    uint32_t bond_fail_ppm;  // Bonding fails
+    uint32_t refuse_ppm;     // Characteristic writes the local stack refuses, in parts per million of the calls
+    uint32_t release_no_rsp_fails; // The next trigger releases written without response which complete with an error
+    uint32_t update_rejects;       // The next connection parameter updates the camera rejects
+
+    uint32_t seed;
+};
+
+struct camera_sim_stats
+{
+    uint32_t events;   // Callbacks delivered to app_ble.c
+    uint32_t reports;  // Advertising reports passed to the GAP callback
+    uint32_t requests; // Requests received by the camera
+    uint32_t writes;
+    uint32_t writes_no_rsp;
+    uint32_t descr_writes;
+    uint32_t indications;
+    uint32_t bonds;
+
+    uint32_t shots;           // Press followed by a release
+    uint32_t protocol_errors; // Press while pressed or release without a press
+    uint32_t rejected;        // Trigger writes before the remote mode was enabled
+    uint32_t ignored;         // Writes without response the camera didn't take
+
+    uint32_t failed;  // Injected error statuses
+    uint32_t dropped; // Injected lost requests
+    uint32_t refused; // Injected local write failures
+    uint32_t disconnects;
+    uint32_t conn_updates; // Connection parameter updates which reached their instant
+};
+
+typedef void (*camera_sim_dispatch_hook)(void);
+
+void camera_sim_default_config(struct camera_sim_config *config);
+
+// Resets the stack and the camera including the bond, the NVS contents are kept
+void camera_sim_init(const struct camera_sim_config *config);
+
+// Changes the camera between connections, the pairing and the bond are kept
+void camera_sim_set_config(const struct camera_sim_config *config);
+
+// Called after every step, the callbacks only post application events and the driver dispatches them here
+void camera_sim_set_dispatch(camera_sim_dispatch_hook hook);
+
+bool camera_sim_step(void);
+void camera_sim_run_until(int64_t time_us);
+int64_t camera_sim_time(void);
+int camera_sim_pending(void);
+
+bool camera_sim_connected(void);
+uint32_t camera_sim_interval_us(void); // Connection interval of the link
+bool camera_sim_paired(void);
+void camera_sim_link_loss(void);
+
+// The camera asks for parameters of its own, in use after the next connection event, intervals in 1.25 ms units
+void camera_sim_camera_update(uint16_t interval, uint16_t latency, uint16_t timeout);
+void camera_sim_forget_bond(void);
+
+// Bonds of other cameras, the stack lists them ahead of the simulated one
+void camera_sim_set_other_bonds(const esp_bd_addr_t *addresses, int count);
+
+void camera_sim_get_stats(struct camera_sim_stats *stats);
+void camera_sim_reset_stats(void);
+
+#endif /* _CAMERA_SIM_H_ */
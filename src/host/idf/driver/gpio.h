@@ -0,0 +1,9 @@
+// Host stand-in for the ESP-IDF header, app_ble.h includes it but nothing is used
+#ifndef _DRIVER_GPIO_H_
+#define _DRIVER_GPIO_H_
+
+#include "esp_err.h"
+
+typedef int gpio_num_t;
+
+#endif
@@ -0,0 +1,10 @@
+// Host stand-in for the ESP-IDF header, the RTC time runs with the simulated time
+#ifndef __ESP32_CLK_H__
+#define __ESP32_CLK_H__
+
+#include <stdint.h>
+
+// Time since the RTC timer started, kept over resets except a power-on
+uint64_t esp_clk_rtc_time(void);
+
+#endif
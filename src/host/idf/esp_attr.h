@@ -0,0 +1,7 @@
+// Host stand-in for the ESP-IDF header, RTC memory is ordinary memory which keeps its content over the simulated boots
+#ifndef __ESP_ATTR_H__
+#define __ESP_ATTR_H__
+
+#define RTC_DATA_ATTR
+
+#endif
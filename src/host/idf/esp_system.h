@@ -0,0 +1,23 @@
+// Host stand-in for the ESP-IDF header, only what the simulator build needs
+#ifndef __ESP_SYSTEM_H__
+#define __ESP_SYSTEM_H__
+
+typedef enum
+{
+    ESP_RST_UNKNOWN,
+    ESP_RST_POWERON,
+    ESP_RST_EXT,
+    ESP_RST_SW,
+    ESP_RST_PANIC,
+    ESP_RST_INT_WDT,
+    ESP_RST_TASK_WDT,
+    ESP_RST_WDT,
+    ESP_RST_DEEPSLEEP,
+    ESP_RST_BROWNOUT,
+    ESP_RST_SDIO,
+} esp_reset_reason_t;
+
+// Set by idf_host_reset and idf_host_boot
+esp_reset_reason_t esp_reset_reason(void);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef INC_TASK_H
+#define INC_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// Tasks are not started, the simulator driver runs their work from its own loop
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack, void *param, UBaseType_t priority, TaskHandle_t *handle);
+
+// Nobody waits for a notification
+static inline BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdTRUE;
+}
+
+static inline uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t wait)
+{
+    return 0;
+}
+
+// One core, nothing else runs while the caller waits
+#define portNUM_PROCESSORS (1)
+#define xPortGetCoreID() (0)
+#define vTaskDelay(ticks) ((void)(ticks))
+
+#endif
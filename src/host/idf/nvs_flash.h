@@ -0,0 +1,10 @@
+// Host stand-in for the ESP-IDF header, only what the simulator build needs
+#ifndef __NVS_FLASH_H__
+#define __NVS_FLASH_H__
+
+#include "nvs.h"
+
+esp_err_t nvs_flash_init(void);
+esp_err_t nvs_flash_erase(void);
+
+#endif
@@ -0,0 +1,633 @@
+#include "idf_host.h"
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp32/clk.h"
+#include "nvs_flash.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "esp_partition.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "freertos/task.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Clock, the simulator moves it forward as it delivers events
+static int64_t host_time_us = 0;
+
+void idf_host_set_time(int64_t time_us)
+{
+    host_time_us = time_us;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_time_us;
+}
+
+// The RTC timer started before the esp_timer, so the conversions between them are exercised
+#define HOST_RTC_OFFSET_US (3600LL * 1000 * 1000)
+
+uint64_t esp_clk_rtc_time(void)
+{
+    return (uint64_t)(host_time_us + HOST_RTC_OFFSET_US);
+}
+
+// FreeRTOS queues and tasks
+struct host_queue
+{
+    uint8_t *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue *queue = calloc(1, sizeof(struct host_queue));
+    queue->items = malloc(length * item_size);
+    queue->length = length;
+    queue->item_size = item_size;
+
+    return queue;
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t wait)
+{
+    struct host_queue *queue = handle;
+    if (queue->count == queue->length)
+    {
+        return pdFALSE;
+    }
+
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(&queue->items[tail * queue->item_size], item, queue->item_size);
+    queue->count++;
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t handle, const void *item, BaseType_t *woken)
+{
+    return xQueueSend(handle, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t wait)
+{
+    struct host_queue *queue = handle;
+    if (queue->count == 0)
+    {
+        return pdFALSE;
+    }
+
+    memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+
+    return pdTRUE;
+}
+
+BaseType_t xQueuePeek(QueueHandle_t handle, void *item, TickType_t wait)
+{
+    struct host_queue *queue = handle;
+    if (queue->count == 0)
+    {
+        return pdFALSE;
+    }
+
+    memcpy(item, &queue->items[queue->head * queue->item_size], queue->item_size);
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle)
+{
+    return ((struct host_queue *)handle)->count;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return calloc(1, sizeof(bool));
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t wait)
+{
+    bool *taken = semaphore;
+    if (*taken)
+    {
+        printf("xSemaphoreTake: mutex already taken\n");
+        abort();
+    }
+
+    *taken = true;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    *(bool *)semaphore = false;
+    return pdTRUE;
+}
+
+// Power management, the locks are only counted
+#define PM_HOST_LOCKS (8)
+
+struct esp_pm_lock
+{
+    esp_pm_lock_type_t type;
+    const char *name;
+    int count;
+};
+
+static struct esp_pm_lock pm_host_locks[PM_HOST_LOCKS];
+static int pm_host_lock_count = 0;
+
+esp_err_t esp_pm_configure(const void *config)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_create(esp_pm_lock_type_t lock_type, int arg, const char *name, esp_pm_lock_handle_t *out_handle)
+{
+    // Created again by the simulated boots
+    for (int i = 0; i < pm_host_lock_count; i++)
+    {
+        if (strcmp(pm_host_locks[i].name, name) == 0)
+        {
+            *out_handle = &pm_host_locks[i];
+            return ESP_OK;
+        }
+    }
+
+    if (pm_host_lock_count == PM_HOST_LOCKS)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    struct esp_pm_lock *lock = &pm_host_locks[pm_host_lock_count++];
+    lock->type = lock_type;
+    lock->name = name;
+    lock->count = 0;
+
+    *out_handle = lock;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_acquire(esp_pm_lock_handle_t handle)
+{
+    handle->count++;
+    return ESP_OK;
+}
+
+esp_err_t esp_pm_lock_release(esp_pm_lock_handle_t handle)
+{
+    if (handle->count == 0)
+    {
+        printf("esp_pm_lock_release: %s not held\n", handle->name);
+        abort();
+    }
+
+    handle->count--;
+    return ESP_OK;
+}
+
+bool idf_host_light_sleep_allowed(void)
+{
+    for (int i = 0; i < pm_host_lock_count; i++)
+    {
+        if (pm_host_locks[i].type == ESP_PM_NO_LIGHT_SLEEP && pm_host_locks[i].count > 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Deep sleep
+static esp_sleep_wakeup_cause_t sleep_host_cause = ESP_SLEEP_WAKEUP_UNDEFINED;
+static uint64_t sleep_host_timer_us;
+static int64_t sleep_host_wake_us;
+static bool sleep_host_requested = false;
+
+esp_err_t esp_sleep_enable_timer_wakeup(uint64_t time_in_us)
+{
+    sleep_host_timer_us = time_in_us;
+    return ESP_OK;
+}
+
+esp_err_t esp_sleep_enable_ext0_wakeup(gpio_num_t gpio_num, int level)
+{
+    return ESP_OK;
+}
+
+void esp_deep_sleep_start(void)
+{
+    sleep_host_requested = true;
+    sleep_host_wake_us = host_time_us + (int64_t)sleep_host_timer_us;
+}
+
+esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause(void)
+{
+    return sleep_host_cause;
+}
+
+bool idf_host_deep_sleep(int64_t *wake_us)
+{
+    if (!sleep_host_requested)
+    {
+        return false;
+    }
+
+    *wake_us = sleep_host_wake_us;
+    return true;
+}
+
+static esp_reset_reason_t reset_host_reason = ESP_RST_POWERON;
+
+void idf_host_boot(int cause)
+{
+    sleep_host_cause = (esp_sleep_wakeup_cause_t)cause;
+    sleep_host_requested = false;
+    if (cause != ESP_SLEEP_WAKEUP_UNDEFINED)
+    {
+        reset_host_reason = ESP_RST_DEEPSLEEP;
+    }
+}
+
+void idf_host_reset(int reason)
+{
+    reset_host_reason = (esp_reset_reason_t)reason;
+    idf_host_boot(ESP_SLEEP_WAKEUP_UNDEFINED);
+}
+
+esp_reset_reason_t esp_reset_reason(void)
+{
+    return reset_host_reason;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack, void *param, UBaseType_t priority, TaskHandle_t *handle)
+{
+    if (handle != NULL)
+    {
+        *handle = NULL;
+    }
+
+    return pdTRUE;
+}
+
+// Logging
+static esp_log_level_t log_level = ESP_LOG_INFO;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    if (strcmp(tag, "*") == 0)
+    {
+        log_level = level;
+    }
+}
+
+esp_log_level_t esp_log_level_get(void)
+{
+    return log_level;
+}
+
+static vprintf_like_t log_vprintf = vprintf;
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func)
+{
+    vprintf_like_t previous = log_vprintf;
+    log_vprintf = func;
+
+    return previous;
+}
+
+static void log_print(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    log_vprintf(format, args);
+    va_end(args);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    static const char letters[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+    char message[256];
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    // One call per line like ESP-IDF, which has the prefix in the format
+    log_print("%c (%lld.%03lld) %s: %s\n", letters[level], (long long)(host_time_us / 1000), (long long)(host_time_us % 1000), tag, message);
+}
+
+void esp_log_buffer_hex(const char *tag, const void *buffer, uint16_t buff_len)
+{
+    if (log_level < ESP_LOG_INFO)
+    {
+        return;
+    }
+
+    char line[16 * 3 + 1];
+    const uint8_t *data = (const uint8_t *)buffer;
+
+    for (int offset = 0; offset < buff_len; offset += 16)
+    {
+        int length = 0;
+        for (int i = offset; i < buff_len && i < offset + 16; i++)
+        {
+            length += sprintf(line + length, "%02x ", data[i]);
+        }
+
+        esp_log_write(ESP_LOG_INFO, tag, "%s", line);
+    }
+}
+
+// Errors
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code)
+    {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NVS_NOT_FOUND:
+        return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_NOT_ENOUGH_SPACE:
+        return "ESP_ERR_NVS_NOT_ENOUGH_SPACE";
+    case ESP_ERR_NVS_READ_ONLY:
+        return "ESP_ERR_NVS_READ_ONLY";
+    case ESP_ERR_NVS_INVALID_LENGTH:
+        return "ESP_ERR_NVS_INVALID_LENGTH";
+    }
+
+    return "UNKNOWN ERROR";
+}
+
+void _esp_error_check_failed(esp_err_t rc, const char *file, int line, const char *expression)
+{
+    printf("ESP_ERROR_CHECK failed: esp_err_t 0x%x (%s) at %s:%d\nexpression: %s\n", rc, esp_err_to_name(rc), file, line, expression);
+    abort();
+}
+
+// NVS, blobs are kept in memory, a commit is a no-op
+#define NVS_HOST_NAMESPACES (8)
+#define NVS_HOST_ENTRIES (32)
+#define NVS_HOST_NAME_MAX (16)
+#define NVS_HOST_BLOB_MAX (512)
+
+#define NVS_HOST_HANDLE_WRITE (0x100)
+
+struct nvs_host_entry
+{
+    bool used;
+    uint8_t ns;
+    char key[NVS_HOST_NAME_MAX];
+    size_t length;
+    uint8_t data[NVS_HOST_BLOB_MAX];
+};
+
+static char nvs_namespaces[NVS_HOST_NAMESPACES][NVS_HOST_NAME_MAX];
+static int nvs_namespace_count = 0;
+static struct nvs_host_entry nvs_entries[NVS_HOST_ENTRIES];
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    memset(nvs_entries, 0, sizeof(nvs_entries));
+    nvs_namespace_count = 0;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle)
+{
+    if (strlen(name) >= NVS_HOST_NAME_MAX)
+    {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    int ns = 0;
+    while (ns < nvs_namespace_count && strcmp(nvs_namespaces[ns], name) != 0)
+    {
+        ns++;
+    }
+
+    if (ns == nvs_namespace_count)
+    {
+        // A namespace only exists once it was opened for writing
+        if (open_mode == NVS_READONLY)
+        {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        if (nvs_namespace_count == NVS_HOST_NAMESPACES)
+        {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+
+        strcpy(nvs_namespaces[nvs_namespace_count++], name);
+    }
+
+    *out_handle = (ns + 1) | (open_mode == NVS_READWRITE ? NVS_HOST_HANDLE_WRITE : 0);
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    return ESP_OK;
+}
+
+static struct nvs_host_entry *nvs_host_find(nvs_handle handle, const char *key)
+{
+    uint8_t ns = handle & 0xFF;
+
+    for (int i = 0; i < NVS_HOST_ENTRIES; i++)
+    {
+        if (nvs_entries[i].used && nvs_entries[i].ns == ns && strcmp(nvs_entries[i].key, key) == 0)
+        {
+            return &nvs_entries[i];
+        }
+    }
+
+    return NULL;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length)
+{
+    struct nvs_host_entry *entry = nvs_host_find(handle, key);
+    if (entry == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    // Same as the real NVS: a NULL output only queries the length
+    if (out_value == NULL)
+    {
+        *length = entry->length;
+        return ESP_OK;
+    }
+    if (*length < entry->length)
+    {
+        *length = entry->length;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    memcpy(out_value, entry->data, entry->length);
+    *length = entry->length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length)
+{
+    if (!(handle & NVS_HOST_HANDLE_WRITE))
+    {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (strlen(key) >= NVS_HOST_NAME_MAX)
+    {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (length > NVS_HOST_BLOB_MAX)
+    {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    struct nvs_host_entry *entry = nvs_host_find(handle, key);
+    for (int i = 0; entry == NULL && i < NVS_HOST_ENTRIES; i++)
+    {
+        if (!nvs_entries[i].used)
+        {
+            entry = &nvs_entries[i];
+            entry->used = true;
+            entry->ns = handle & 0xFF;
+            strcpy(entry->key, key);
+        }
+    }
+
+    if (entry == NULL)
+    {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    memcpy(entry->data, value, length);
+    entry->length = length;
+    return ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle handle, const char *key)
+{
+    if (!(handle & NVS_HOST_HANDLE_WRITE))
+    {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+
+    struct nvs_host_entry *entry = nvs_host_find(handle, key);
+    if (entry == NULL)
+    {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    entry->used = false;
+    return ESP_OK;
+}
+
+// Flash partitions, only the shot log partition exists. It behaves like NOR flash: a write only clears bits, an erase sets
+// whole sectors back to 0xFF
+#define PARTITION_HOST_SECTOR (4096)
+#define PARTITION_HOST_SIZE (16 * PARTITION_HOST_SECTOR) // Small so the simulated runs wrap around
+
+static const esp_partition_t host_shot_log = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = 0x40,
+    .address = 0x110000,
+    .size = PARTITION_HOST_SIZE,
+    .label = "shotlog"};
+
+static uint8_t host_flash[PARTITION_HOST_SIZE];
+static bool host_flash_erased = false;
+
+const esp_partition_t *esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype, const char *label)
+{
+    if (type != host_shot_log.type || subtype != host_shot_log.subtype || (label != NULL && strcmp(label, host_shot_log.label) != 0))
+    {
+        return NULL;
+    }
+
+    // A new chip comes erased
+    if (!host_flash_erased)
+    {
+        memset(host_flash, 0xFF, sizeof(host_flash));
+        host_flash_erased = true;
+    }
+    return &host_shot_log;
+}
+
+static bool partition_host_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    return (partition == &host_shot_log && offset + size <= partition->size);
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *partition, size_t src_offset, void *dst, size_t size)
+{
+    if (!partition_host_range(partition, src_offset, size))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memcpy(dst, &host_flash[src_offset], size);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t *partition, size_t dst_offset, const void *src, size_t size)
+{
+    if (!partition_host_range(partition, dst_offset, size))
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const uint8_t *bytes = src;
+    for (size_t i = 0; i < size; i++)
+    {
+        host_flash[dst_offset + i] &= bytes[i];
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t *partition, size_t offset, size_t size)
+{
+    if (!partition_host_range(partition, offset, size) || (offset % PARTITION_HOST_SECTOR) != 0 || (size % PARTITION_HOST_SECTOR) != 0)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(&host_flash[offset], 0xFF, size);
+    return ESP_OK;
+}
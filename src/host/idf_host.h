@@ -0,0 +1,24 @@
+#ifndef _IDF_HOST_H_
+#define _IDF_HOST_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Host implementations of the ESP-IDF services the simulator build links against: logging, esp_timer, the RTC time, an in memory NVS,
+// FreeRTOS queues and mutexes, the power management locks, the deep sleep and the shot log partition
+void idf_host_set_time(int64_t time_us);
+
+// No ESP_PM_NO_LIGHT_SLEEP lock is held
+bool idf_host_light_sleep_allowed(void);
+
+// esp_deep_sleep_start was called since the last boot, wake_us is the esp_timer time the timer wakes the chip
+bool idf_host_deep_sleep(int64_t *wake_us);
+
+// The firmware is about to boot again, esp_sleep_get_wakeup_cause returns cause from here on (an esp_sleep_wakeup_cause_t)
+void idf_host_boot(int cause);
+
+// A reset without a deep sleep, esp_reset_reason returns reason from here on (an esp_reset_reason_t).
+// The RTC time of the host runs on, also for ESP_RST_POWERON
+void idf_host_reset(int reason);
+
+#endif /* _IDF_HOST_H_ */
@@ -0,0 +1,1651 @@
+// Runs canon_ble.c and app_ble.c against the simulated camera: pairing, connecting, trigger throughput, failure injection
+// a timelapse through an outage and a reset, the shot log of a timelapse and the energy counters of the battery mode
+// with light and deep sleep
+#include "camera_sim.h"
+#include "idf_host.h"
+
+#include "app_ble.h"
+#include "canon_ble.h"
+#include "app_event.h"
+#include "scan_table.h"
+#include "camera_store.h"
+#include "session.h"
+#include "journal.h"
+#include "shot_log.h"
+#include "power.h"
+#include "trace.h"
+#include "app_log.h"
+#include "timer.h"
+#include "config.h"
+
+#include "esp_sleep.h"
+#include "esp_system.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define MODE_PAIR (0)
+#define MODE_CONNECT (1)
+
+#define SEC (1000 * 1000)
+
+#define TRIGGER_SHOTS (100000)
+#define FAULT_SHOTS (20000)
+#define FAULT_INTERVAL_US (500 * 1000)
+#define REFUSE_SHOTS (2000)
+#define REORDER_RUNS (200)
+#define POLICY_BURST (12) // More than the command queue holds
+#define SCAN_TWINS (2)
+#define SCAN_CROWD (40)
+#define OUTAGE_INTERVAL_MS (2000)
+#define OUTAGE_START_US (20 * SEC)
+#define OUTAGE_US (60 * SEC)
+#define OUTAGE_RUN_US (120 * SEC)
+#define JOURNAL_INTERVAL_MS (2000)
+#define JOURNAL_RESET_US (45 * SEC)
+#define JOURNAL_DOWN_US (10 * SEC)
+#define SHOT_LOG_FILL (2500) // More records than the host partition holds
+#define SHOT_LOG_INTERVAL_MS (1000)
+#define SHOT_LOG_LOSS_US (20 * SEC)
+#define SHOT_LOG_DOWN_US (6 * SEC)
+#define SHOT_LOG_RUN_US (40 * SEC)
+#define SHOT_LOG_RECORDS (256)
+#define POWER_INTERVAL_MS (30 * 1000) // Long enough for the idle link
+#define POWER_RUN_US (600 * SEC)
+#define POWER_LOOK_US (20 * SEC) // Display on at the start of the run
+#define DEEP_INTERVAL_MS (5 * 60 * 1000)
+#define DEEP_SLEEPS (8)
+#define DEEP_BOOT_US (300 * 1000) // From the wake until app_main has the BLE stack up
+#define TRACE_INTERVAL_MS (1000)
+#define TRACE_SHOTS (3)
+#define LOG_SHOTS (20)
+#define LOG_FILL (LOG_BUFFER_SIZE / 8) // Lines of about 30 bytes, more than the ring holds
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do                                                                  \
+    {                                                                   \
+        if (!(cond))                                                    \
+        {                                                               \
+            printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond);      \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+static struct camera_sim_config config;
+
+// Application side, does what menu.c does with the canon callbacks
+static int mode;
+static int conn = -1;
+static bool ready;
+static bool pair_done;
+static bool pair_failed;
+static uint32_t scan_found;
+static uint32_t scan_reports;
+static uint32_t triggers_done;
+static uint32_t rounds_done; // Also the failed ones
+static uint32_t last_shot;
+static int64_t last_shot_time;
+static const char *dump_path = NULL; // -d, the shot log of the timelapse is written there for tools/shot_log.py
+static const char *trace_path = NULL; // -t, the trace of a few timer shots for tools/trace_chrome.py
+static uint32_t shot_interval_max;     // Connection interval at the shots
+static uint32_t tick_interval_max;     // Connection interval between them
+static uint32_t shots_awake;
+static uint32_t ticks_asleep;
+static uint32_t press_min;             // Press to release of the timer shots
+static uint32_t press_max;
+static bool deep_test;    // The hooks sleep deep like the timer page
+static bool deep_closing; // Links closed for the deep sleep
+
+static void on_connected(int camera)
+{
+    if (mode == MODE_PAIR)
+    {
+        canon_start_pair(camera);
+    }
+    else
+    {
+        canon_do_connect(camera);
+    }
+}
+
+static void on_pair_state(int camera, int state, bool success)
+{
+    if (!success)
+    {
+        pair_failed = true;
+    }
+    else if (state == PAIR_STATE_DONE)
+    {
+        pair_done = true;
+    }
+}
+
+static void on_auth(int camera)
+{
+    ready = true;
+    session_camera_restored(camera);
+    power_camera_linked(camera);
+
+    if (session_reconnecting() == 0)
+    {
+        power_deep_ready();
+    }
+}
+
+static void on_disconnected(int camera)
+{
+    ready = false;
+    if (deep_closing)
+    {
+        if (ble_connection_count() == 0)
+        {
+            power_deep_sleep();
+        }
+        return;
+    }
+
+    session_camera_lost(camera);
+}
+
+// What menu_page6_deep_sleep does, the display is always off
+static void deep_sleep_check()
+{
+    if (!deep_test || !power_deep_due())
+    {
+        return;
+    }
+
+    power_deep_begin();
+    app_timer_stop();
+    session_stop();
+    shot_log_flush(true);
+    deep_closing = true;
+
+    ble_disconnect(conn);
+    if (ble_connection_count() == 0)
+    {
+        power_deep_sleep();
+    }
+}
+
+static void on_scan(const char *name, int len, esp_bd_addr_t adr, int adr_type, int rssi)
+{
+    scan_reports++;
+    scan_table_update(adr, adr_type, rssi, name, len);
+
+    if (strcmp(name, config.name) == 0 && memcmp(adr, config.address, sizeof(esp_bd_addr_t)) == 0)
+    {
+        scan_found++;
+    }
+}
+
+static void on_trigger_done(struct app_event *event)
+{
+    power_trigger_done();
+    rounds_done++;
+
+    if (event->trigger.success)
+    {
+        triggers_done++;
+        journal_progress(last_shot, triggers_done);
+
+        press_min = (event->trigger.press_release_us < press_min ? event->trigger.press_release_us : press_min);
+        press_max = (event->trigger.press_release_us > press_max ? event->trigger.press_release_us : press_max);
+    }
+
+    deep_sleep_check();
+}
+
+static void on_timer_shot(uint32_t shot, int64_t deviation_us)
+{
+    struct app_event event = {.type = APP_EVENT_TIMER_SHOT};
+    event.timer.shot = shot;
+    event.timer.deviation_us = deviation_us;
+
+    if (!app_event_post(&event))
+    {
+        session_shot_lost(shot);
+    }
+}
+
+static void on_timer_tick()
+{
+    struct app_event event = {.type = APP_EVENT_TIMER_TICK};
+    app_event_post_lossy(&event);
+}
+
+static void on_shot_event(struct app_event *event)
+{
+    power_shot();
+
+    uint32_t interval = camera_sim_interval_us();
+    shot_interval_max = (interval > shot_interval_max ? interval : shot_interval_max);
+    shots_awake += (idf_host_light_sleep_allowed() ? 0 : 1);
+
+    session_shot(event->timer.shot, app_timer_shot_time(event->timer.shot));
+    power_trigger_done();
+
+    last_shot = event->timer.shot;
+    last_shot_time = camera_sim_time();
+    journal_progress(last_shot, triggers_done);
+
+    deep_sleep_check();
+}
+
+static void on_tick_event(struct app_event *event)
+{
+    uint32_t interval = camera_sim_interval_us();
+    tick_interval_max = (interval > tick_interval_max ? interval : tick_interval_max);
+    ticks_asleep += (idf_host_light_sleep_allowed() ? 1 : 0);
+
+    if (app_timer_time_to_next_shot() > SHOT_LOG_FLUSH_GUARD_MS * 1000)
+    {
+        journal_flush(false);
+        shot_log_flush(false);
+    }
+
+    deep_sleep_check();
+}
+
+// Stands in for the dispatcher task, the Bluedroid callbacks only posted the events
+static void dispatch_events(void)
+{
+    while (app_event_dispatch(0))
+    {
+    }
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Runs the simulation until the flag is set, nothing is left to do or the timeout passes
+static bool run_for(const bool *flag, int64_t timeout_us)
+{
+    int64_t deadline = camera_sim_time() + timeout_us;
+
+    while (!*flag && camera_sim_pending() > 0 && camera_sim_time() <= deadline)
+    {
+        camera_sim_step();
+    }
+
+    return *flag;
+}
+
+static void run_idle()
+{
+    while (camera_sim_step())
+    {
+    }
+}
+
+static bool connect_camera(int connect_mode, int64_t *duration)
+{
+    mode = connect_mode;
+    ready = false;
+    pair_done = false;
+    pair_failed = false;
+
+    int64_t start = camera_sim_time();
+    conn = ble_connect(config.address, BLE_ADDR_TYPE_PUBLIC);
+
+    bool done = run_for(connect_mode == MODE_PAIR ? &pair_done : &ready, 60 * SEC);
+    if (duration != NULL)
+    {
+        *duration = camera_sim_time() - start;
+    }
+
+    return done;
+}
+
+static void disconnect_camera()
+{
+    if (camera_sim_connected())
+    {
+        ble_disconnect(conn);
+    }
+    run_idle();
+}
+
+static void test_scan()
+{
+    // Two cameras of the same model and a crowd of phones around
+    config.twin_cameras = SCAN_TWINS;
+    config.crowd_devices = SCAN_CROWD;
+    camera_sim_set_config(&config);
+    camera_sim_reset_stats();
+
+    struct app_event_stats before, after;
+    struct camera_sim_stats sim_stats;
+    app_event_get_stats(APP_EVENT_BLE_GAP, &before);
+
+    scan_found = 0;
+    scan_reports = 0;
+    scan_table_clear();
+
+    ble_scan_start(on_scan);
+    camera_sim_run_until(camera_sim_time() + 1 * SEC);
+    ble_scan_stop();
+    run_idle();
+
+    app_event_get_stats(APP_EVENT_BLE_GAP, &after);
+    camera_sim_get_stats(&sim_stats);
+
+    // Every address once, the phones never reach the event queue
+    CHECK(scan_found == 1);
+    CHECK(scan_reports == 1 + SCAN_TWINS);
+    CHECK(scan_table_count() == 1 + SCAN_TWINS);
+    CHECK(sim_stats.reports == 1 + SCAN_TWINS + SCAN_CROWD);
+    CHECK(after.dropped == before.dropped);
+
+    const struct scan_entry *ranked[4];
+    int count = scan_table_ranked(ranked, 4);
+    CHECK(count == 1 + SCAN_TWINS);
+    for (int i = 1; i < count; i++)
+    {
+        CHECK(ranked[i - 1]->rssi >= ranked[i]->rssi);
+    }
+
+    printf("%-14s %u advertisers  %u passed the Canon filter  %u cameras listed  %u GAP events\n", "scan",
+           sim_stats.reports, scan_reports, scan_table_count(), after.handled - before.handled);
+
+    config.twin_cameras = 0;
+    config.crowd_devices = 0;
+    camera_sim_set_config(&config);
+}
+
+static void test_pair()
+{
+    int64_t duration;
+    bool done = connect_camera(MODE_PAIR, &duration);
+
+    CHECK(done);
+    CHECK(camera_sim_paired());
+
+    run_idle();
+    disconnect_camera();
+
+    printf("%-14s %s in %.2f s\n", "pair", done ? "done" : "FAILED", duration / 1e6);
+}
+
+static void test_connect()
+{
+    int64_t discovery, cached;
+
+    // Without the handle cache the services have to be searched
+    nvs_flash_erase();
+    CHECK(connect_camera(MODE_CONNECT, &discovery));
+    disconnect_camera();
+
+    CHECK(connect_camera(MODE_CONNECT, &cached));
+    disconnect_camera();
+
+    CHECK(cached < discovery);
+
+    // A camera firmware update moves the attributes, the cached handles are stale
+    int64_t stale;
+    config.handle_base = 0x0041;
+    camera_sim_set_config(&config);
+
+    CHECK(connect_camera(MODE_CONNECT, &stale));
+    disconnect_camera();
+
+    CHECK(connect_camera(MODE_CONNECT, &cached));
+    disconnect_camera();
+
+    // An update which also dropped a characteristic, the rediscovery fails and the set ends instead of waiting for it
+    config.handle_base = 0x0061;
+    config.trigger_config_missing = true;
+    camera_sim_set_config(&config);
+
+    CHECK(!connect_camera(MODE_CONNECT, NULL));
+    CHECK(canon_queue_depth() == 0);
+    disconnect_camera();
+
+    config.handle_base = 0x0041;
+    config.trigger_config_missing = false;
+    camera_sim_set_config(&config);
+
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    disconnect_camera();
+
+    printf("%-14s discovery %.2f s  cached %.2f s  stale cache %.2f s  missing characteristic ends the set\n", "connect",
+           discovery / 1e6, cached / 1e6, stale / 1e6);
+}
+
+static void test_bonded()
+{
+    // The pair page stores the name, the connect page stores the last camera
+    camera_store_save(config.address, BLE_ADDR_TYPE_PUBLIC, "EOS R6");
+
+    struct stored_camera cameras[4];
+    int count = camera_store_bonded(cameras, 4);
+    CHECK(count == 1);
+    CHECK(count == 1 && memcmp(cameras[0].bda, config.address, sizeof(esp_bd_addr_t)) == 0);
+    CHECK(count == 1 && strcmp(cameras[0].name, "EOS R6") == 0);
+
+    struct stored_camera last;
+    CHECK(!camera_store_last(&last));
+    camera_store_set_last(config.address);
+    CHECK(camera_store_last(&last));
+
+    // Behind the bond of another camera the last camera is still found and listed first, even in a list of one
+    static const esp_bd_addr_t other = {0x00, 0x9d, 0x6b, 0x44, 0x55, 0x66};
+    camera_sim_set_other_bonds(&other, 1);
+    camera_store_save((uint8_t *)other, BLE_ADDR_TYPE_PUBLIC, "EOS R5");
+
+    struct stored_camera both[4];
+    int both_count = camera_store_bonded(both, 4);
+    CHECK(both_count == 2 && memcmp(both[0].bda, config.address, sizeof(esp_bd_addr_t)) == 0);
+    CHECK(both_count == 2 && strcmp(both[1].name, "EOS R5") == 0);
+    CHECK(camera_store_bonded(both, 1) == 1 && memcmp(both[0].bda, config.address, sizeof(esp_bd_addr_t)) == 0);
+
+    memset(&last, 0, sizeof(last));
+    CHECK(camera_store_last(&last) && memcmp(last.bda, config.address, sizeof(esp_bd_addr_t)) == 0);
+    CHECK(strcmp(last.name, "EOS R6") == 0);
+
+    camera_store_set_last((uint8_t *)other);
+    CHECK(camera_store_last(&last) && strcmp(last.name, "EOS R5") == 0);
+    camera_store_set_last(config.address);
+    camera_sim_set_other_bonds(NULL, 0);
+    CHECK(camera_store_last(&last));
+
+    // Straight to the stored address, the camera never has to advertise
+    struct camera_sim_stats sim_stats;
+    camera_sim_reset_stats();
+
+    int64_t start = camera_sim_time();
+    mode = MODE_CONNECT;
+    ready = false;
+    conn = ble_connect(last.bda, last.addr_type);
+    CHECK(run_for(&ready, 60 * SEC));
+    int64_t duration = camera_sim_time() - start;
+    disconnect_camera();
+
+    camera_sim_get_stats(&sim_stats);
+    CHECK(sim_stats.reports == 0);
+
+    printf("%-14s %d camera listed without a scan, the last of %d first  connect %.2f s\n", "bonded", count, both_count, duration / 1e6);
+}
+
+static void test_trigger(const char *name, bool write_no_rsp)
+{
+    config.trigger_write_no_rsp = write_no_rsp;
+    camera_sim_set_config(&config);
+
+    // The trigger properties come from the discovery
+    nvs_flash_erase();
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    struct canon_trigger_stats before, after;
+    struct camera_sim_stats sim_stats;
+
+    canon_get_trigger_stats(&before);
+    camera_sim_reset_stats();
+    triggers_done = 0;
+
+    int64_t start_virtual = camera_sim_time();
+    double start = now_ns();
+
+    for (int i = 0; i < TRIGGER_SHOTS; i++)
+    {
+        canon_do_trigger();
+        while (canon_queue_depth() > 0 && camera_sim_step())
+        {
+        }
+    }
+    run_idle();
+
+    double elapsed_ns = now_ns() - start;
+    int64_t elapsed_virtual = camera_sim_time() - start_virtual;
+
+    canon_get_trigger_stats(&after);
+    camera_sim_get_stats(&sim_stats);
+
+    CHECK(sim_stats.shots == TRIGGER_SHOTS);
+    CHECK(triggers_done == TRIGGER_SHOTS);
+    CHECK(sim_stats.protocol_errors == 0);
+    CHECK((after.fast - before.fast) == (write_no_rsp ? TRIGGER_SHOTS : 0));
+    CHECK((after.rounds - before.rounds) == TRIGGER_SHOTS);
+    CHECK(after.max_skew_us == 0); // One camera, nothing to spread
+
+    printf("%-14s %u shots  %6.1f ms/shot  press-release %6.1f ms  %8.0f simulated shots/s\n",
+           name, sim_stats.shots, elapsed_virtual / 1e3 / TRIGGER_SHOTS, after.last_press_release_us / 1e3,
+           TRIGGER_SHOTS / (elapsed_ns / 1e9));
+
+    disconnect_camera();
+
+    if (write_no_rsp)
+    {
+        // The press went out without response, the release fails: only the release is repeated with a response
+        config.release_no_rsp_fails = 1;
+        camera_sim_set_config(&config);
+        CHECK(connect_camera(MODE_CONNECT, NULL));
+        run_idle();
+
+        canon_get_trigger_stats(&before);
+        camera_sim_reset_stats();
+        triggers_done = 0;
+
+        canon_do_trigger();
+        run_idle();
+
+        canon_get_trigger_stats(&after);
+        camera_sim_get_stats(&sim_stats);
+        CHECK(after.fallbacks - before.fallbacks == 1);
+        CHECK(sim_stats.writes_no_rsp == 1 && sim_stats.writes == 1);
+        CHECK(sim_stats.shots == 1 && sim_stats.protocol_errors == 0);
+        CHECK(triggers_done == 1);
+
+        printf("%-14s release failed without response, resent with a response  press-release %6.1f ms\n", "",
+               after.last_press_release_us / 1e3);
+
+        disconnect_camera();
+        config.release_no_rsp_fails = 0;
+    }
+
+    // The cached properties would still allow write without response
+    config.trigger_write_no_rsp = false;
+    camera_sim_set_config(&config);
+    nvs_flash_erase();
+}
+
+static void test_policy()
+{
+    static const int policies[] = {CANON_TRIGGER_QUEUE, CANON_TRIGGER_MERGE, CANON_TRIGGER_DROP};
+    static const uint32_t expected[] = {8, 2, 1};
+    uint32_t shots[3];
+
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    // A burst of 8 triggers while the first one is still running
+    for (int p = 0; p < 3; p++)
+    {
+        struct camera_sim_stats sim_stats;
+
+        canon_set_trigger_policy(policies[p]);
+        camera_sim_reset_stats();
+
+        for (int i = 0; i < 8; i++)
+        {
+            canon_do_trigger();
+        }
+        run_idle();
+
+        camera_sim_get_stats(&sim_stats);
+        shots[p] = sim_stats.shots;
+
+        CHECK(shots[p] == expected[p]);
+    }
+
+    // A burst longer than the command queue, the overflow is dropped and not counted as delayed too
+    struct canon_trigger_stats before, after;
+    struct camera_sim_stats sim_stats;
+
+    canon_set_trigger_policy(CANON_TRIGGER_QUEUE);
+    canon_get_trigger_stats(&before);
+    camera_sim_reset_stats();
+
+    for (int i = 0; i < POLICY_BURST; i++)
+    {
+        canon_do_trigger();
+    }
+    run_idle();
+
+    canon_get_trigger_stats(&after);
+    camera_sim_get_stats(&sim_stats);
+    uint32_t delayed = after.delayed - before.delayed;
+    uint32_t dropped = after.dropped - before.dropped;
+
+    CHECK(dropped > 0);
+    CHECK(sim_stats.shots == POLICY_BURST - dropped);
+    CHECK(delayed + dropped == POLICY_BURST - 1);
+
+    disconnect_camera();
+
+    printf("%-14s burst of 8: queue %u  merge %u  drop %u shots  burst of %d: %u delayed  %u dropped\n", "policy", shots[0],
+           shots[1], shots[2], POLICY_BURST, delayed, dropped);
+}
+
+static void test_faults()
+{
+    config.latency_us = 60 * 1000;
+    config.jitter_us = 40 * 1000;
+    config.fail_ppm = 5000;
+    config.drop_ppm = 500;
+    config.disconnect_ppm = 500;
+    config.bond_fail_ppm = 20000;
+    camera_sim_set_config(&config);
+    camera_sim_reset_stats();
+
+    struct canon_trigger_stats before, after;
+    canon_get_trigger_stats(&before);
+
+    uint32_t requested = 0, missed = 0, connects = 0, retries = 0;
+    bool connecting = false;
+    int64_t connect_start = 0;
+
+    // Shots on a fixed schedule, reconnecting like a user would whenever the camera is gone
+    int64_t start = camera_sim_time();
+    for (int i = 0; i < FAULT_SHOTS; i++)
+    {
+        camera_sim_run_until(start + (int64_t)i * FAULT_INTERVAL_US);
+
+        if (ready)
+        {
+            connecting = false;
+            canon_do_trigger();
+            requested++;
+            continue;
+        }
+
+        missed++;
+
+        if (connecting && camera_sim_time() - connect_start > 10 * SEC)
+        {
+            // Stuck connecting, start over
+            retries++;
+            connecting = false;
+            ble_disconnect(conn);
+        }
+        else if (!connecting && !camera_sim_connected())
+        {
+            connecting = true;
+            connect_start = camera_sim_time();
+            connects++;
+
+            mode = MODE_CONNECT;
+            conn = ble_connect(config.address, BLE_ADDR_TYPE_PUBLIC);
+        }
+    }
+    run_idle();
+
+    struct camera_sim_stats sim_stats;
+    camera_sim_get_stats(&sim_stats);
+    canon_get_trigger_stats(&after);
+
+    CHECK(sim_stats.shots <= requested);
+    CHECK(requested > FAULT_SHOTS / 2);
+
+    printf("%-14s %u requested  %u shots  %u lost  %u missed while disconnected  %u protocol errors\n",
+           "faults", requested, sim_stats.shots, requested - sim_stats.shots, missed, sim_stats.protocol_errors);
+    printf("%-14s %u failed  %u dropped  %u disconnects  %u connects  %u connect retries  %u queue drops\n",
+           "", sim_stats.failed, sim_stats.dropped, sim_stats.disconnects, connects, retries, after.dropped - before.dropped);
+
+    disconnect_camera();
+
+    camera_sim_default_config(&config);
+    camera_sim_set_config(&config);
+}
+
+// Writes the local stack refuses never get a write event, every trigger still has to end
+static void test_refused()
+{
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    config.refuse_ppm = 100000;
+    camera_sim_set_config(&config);
+    camera_sim_reset_stats();
+
+    struct canon_camera_stats before, after;
+    struct shot_log_stats log_before, log_after;
+    canon_get_camera_stats(0, &before);
+    shot_log_get_stats(&log_before);
+    uint32_t rounds = rounds_done;
+    uint32_t done = triggers_done;
+
+    int64_t start = camera_sim_time();
+    for (int i = 0; i < REFUSE_SHOTS; i++)
+    {
+        camera_sim_run_until(start + (int64_t)i * FAULT_INTERVAL_US);
+        canon_do_trigger();
+        dispatch_events();
+    }
+    run_idle();
+
+    struct camera_sim_stats sim_stats;
+    camera_sim_get_stats(&sim_stats);
+    canon_get_camera_stats(0, &after);
+    shot_log_get_stats(&log_after);
+    uint32_t failed = after.failed - before.failed;
+
+    // Nothing stalls behind a refused write, every shot has its TRIGGER_DONE and its record
+    CHECK(sim_stats.refused > 0);
+    CHECK(canon_queue_depth() == 0);
+    CHECK(rounds_done - rounds == REFUSE_SHOTS);
+    CHECK(failed > 0 && (triggers_done - done) + failed == REFUSE_SHOTS);
+    CHECK(log_after.records - log_before.records == REFUSE_SHOTS);
+
+    printf("%-14s %u shots  %u writes refused  %u failed  %u taken\n", "refused", REFUSE_SHOTS, sim_stats.refused, failed,
+           triggers_done - done);
+
+    config.refuse_ppm = 0;
+    camera_sim_set_config(&config);
+    disconnect_camera();
+}
+
+// A timelapse with the camera out of range for a while, returns the time from its return to the reconnect
+static int64_t run_outage(bool catch_up, struct session_stats *stats, struct camera_sim_stats *sim_stats)
+{
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+
+    session_set_catch_up(catch_up);
+    camera_sim_reset_stats();
+
+    int64_t start = camera_sim_time();
+    session_start();
+    app_timer_start(OUTAGE_INTERVAL_MS, on_timer_shot, NULL);
+
+    camera_sim_run_until(start + OUTAGE_START_US);
+
+    config.available = false;
+    camera_sim_set_config(&config);
+    camera_sim_link_loss();
+    camera_sim_run_until(start + OUTAGE_START_US + OUTAGE_US);
+
+    config.available = true;
+    camera_sim_set_config(&config);
+    int64_t back = camera_sim_time();
+    CHECK(run_for(&ready, 60 * SEC));
+    int64_t back_after = camera_sim_time() - back;
+
+    camera_sim_run_until(start + OUTAGE_RUN_US);
+
+    struct app_timer_stats timer_stats;
+    app_timer_get_stats(&timer_stats);
+    app_timer_stop();
+    session_stop();
+    run_idle();
+
+    session_get_stats(stats);
+    camera_sim_get_stats(sim_stats);
+    disconnect_camera();
+
+    // The schedule went on through the outage and the camera came back once
+    CHECK(timer_stats.missed == 0);
+    CHECK(stats->shots == OUTAGE_RUN_US / (OUTAGE_INTERVAL_MS * 1000));
+    CHECK(stats->outages == 1);
+    CHECK(stats->reconnects == 1);
+    CHECK(stats->missed > 0);
+    CHECK(stats->caught_up + stats->skipped == stats->missed);
+
+    // Only the shots sent before the supervision timeout reported the loss are lost on the way
+    uint32_t expected = stats->shots - stats->missed + stats->caught_up;
+    CHECK(sim_stats->shots <= expected);
+    CHECK(sim_stats->shots + 2 >= expected);
+
+    return back_after;
+}
+
+static void test_outage()
+{
+    struct session_stats stats;
+    struct camera_sim_stats sim_stats;
+
+    int64_t back_after = run_outage(false, &stats, &sim_stats);
+    CHECK(stats.caught_up == 0);
+    CHECK(back_after < 2 * SEC);
+
+    printf("%-14s %u scheduled  %u shots  %u missed  %u skipped  back %.2f s after the camera returned  %u attempts\n",
+           "outage skip", stats.shots, sim_stats.shots, stats.missed, stats.skipped, back_after / 1e6, stats.attempts);
+
+    back_after = run_outage(true, &stats, &sim_stats);
+    CHECK(stats.caught_up == (stats.missed < TIMER_CATCH_UP_MAX ? stats.missed : TIMER_CATCH_UP_MAX));
+
+    printf("%-14s %u scheduled  %u shots  %u missed  %u caught up  %u skipped\n",
+           "outage catch", stats.shots, sim_stats.shots, stats.missed, stats.caught_up, stats.skipped);
+}
+
+static void test_journal()
+{
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+
+    session_set_catch_up(false);
+    triggers_done = 0;
+    last_shot = 0;
+
+    int64_t start = camera_sim_time();
+    session_start();
+
+    struct session_peer peers[MAX_CAMERAS];
+    journal_begin(JOURNAL_INTERVAL_MS, peers, session_peers(peers, MAX_CAMERAS));
+    app_timer_start(JOURNAL_INTERVAL_MS, on_timer_shot, on_timer_tick);
+
+    camera_sim_run_until(start + JOURNAL_RESET_US);
+    uint32_t shots_before = last_shot;
+
+    // A watchdog reset, the RAM state is gone and the link drops with the radio, the RTC time runs on
+    struct journal_stats journal_stats;
+    journal_get_stats(&journal_stats);
+    app_timer_stop();
+    session_stop();
+    ble_disconnect(conn);
+    camera_sim_run_until(start + JOURNAL_RESET_US + JOURNAL_DOWN_US);
+    idf_host_reset(ESP_RST_TASK_WDT);
+
+    // Batched, at most one checkpoint behind
+    struct journal_session loaded;
+    CHECK(journal_load(&loaded));
+    CHECK(loaded.rtc_kept);
+    CHECK(loaded.interval_ms == JOURNAL_INTERVAL_MS);
+    CHECK(loaded.peer_count == 1 && memcmp(loaded.peers[0].bda, config.address, sizeof(esp_bd_addr_t)) == 0);
+    CHECK(loaded.shot <= shots_before && shots_before - loaded.shot < JOURNAL_CHECKPOINT_SHOTS);
+    CHECK(loaded.expo_count <= loaded.shot);
+    CHECK(journal_stats.checkpoints <= shots_before / JOURNAL_CHECKPOINT_SHOTS + 1);
+
+    // Resumed from the main menu after the reset
+    int64_t resume = camera_sim_time();
+    session_resume(loaded.peers, loaded.peer_count);
+    journal_resume(&loaded);
+    app_timer_start_at(loaded.interval_ms, journal_resume_start(&loaded), on_timer_shot, on_timer_tick);
+
+    ready = false;
+    CHECK(run_for(&ready, 60 * SEC));
+    int64_t reconnect = camera_sim_time() - resume;
+
+    // The first shot after the reset is on the original schedule
+    uint32_t expected_shot = (uint32_t)((resume - start) / (JOURNAL_INTERVAL_MS * 1000)) + 1;
+    last_shot = 0;
+    camera_sim_run_until(resume + JOURNAL_INTERVAL_MS * 1000);
+    CHECK(last_shot == expected_shot);
+    CHECK(last_shot_time == start + (int64_t)last_shot * JOURNAL_INTERVAL_MS * 1000);
+    uint32_t resumed_shot = last_shot;
+
+    // A power loss, decided at the load: the resume prompt then waits longer than the session ran
+    app_timer_stop();
+    session_stop();
+    ble_disconnect(conn);
+    run_idle();
+    idf_host_reset(ESP_RST_POWERON);
+    CHECK(journal_load(&loaded));
+    CHECK(!loaded.rtc_kept);
+    camera_sim_run_until(camera_sim_time() + (camera_sim_time() - start));
+
+    // The schedule goes on one interval after the last checkpoint
+    resume = camera_sim_time();
+    session_resume(loaded.peers, loaded.peer_count);
+    journal_resume(&loaded);
+    app_timer_start_at(loaded.interval_ms, journal_resume_start(&loaded), on_timer_shot, on_timer_tick);
+
+    ready = false;
+    CHECK(run_for(&ready, 60 * SEC));
+    last_shot = 0;
+    camera_sim_run_until(resume + JOURNAL_INTERVAL_MS * 1000);
+    CHECK(last_shot == loaded.shot + 1);
+    CHECK(last_shot_time == resume + JOURNAL_INTERVAL_MS * 1000);
+    uint32_t power_shot = last_shot;
+
+    app_timer_stop();
+    session_stop();
+    journal_end();
+    run_idle();
+    disconnect_camera();
+
+    CHECK(!journal_load(&loaded));
+
+    idf_host_reset(ESP_RST_SW);
+
+    printf("%-14s %u shots  %u checkpoints  resumed at shot %u on the original schedule  reconnect %.2f s  "
+           "shot %u after a power loss\n",
+           "journal", shots_before, journal_stats.checkpoints, resumed_shot, reconnect / 1e6, power_shot);
+}
+
+// Reads the records of a dump back, false if a line is damaged or the count doesn't match
+static bool read_dump(FILE *in, struct shot_record *records, int max, int *count, uint32_t *total)
+{
+    char line[128];
+    bool ok = true;
+    int end = -1;
+    *count = 0;
+    *total = 0;
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        char hex[2 * sizeof(struct shot_record) + 1];
+        unsigned int sum;
+
+        if (sscanf(line, "SHOTLOG END %d", &end) == 1)
+        {
+            break;
+        }
+        if (strncmp(line, "SHOT ", 5) != 0 || sscanf(line + 5, "%64s %x", hex, &sum) != 2)
+        {
+            continue;
+        }
+
+        uint8_t bytes[sizeof(struct shot_record)];
+        uint8_t check = 0;
+        for (int i = 0; i < sizeof(bytes); i++)
+        {
+            unsigned int byte;
+            sscanf(&hex[i * 2], "%2x", &byte);
+            bytes[i] = byte;
+            check += byte;
+        }
+        ok = ok && (check == sum);
+
+        // The newest records
+        memmove(&records[0], &records[*count == max ? 1 : 0], sizeof(struct shot_record) * (*count == max ? max - 1 : *count));
+        memcpy(&records[*count == max ? max - 1 : *count], bytes, sizeof(bytes));
+        if (*count < max)
+        {
+            (*count)++;
+        }
+        (*total)++;
+    }
+
+    return ok && end == (int)*total;
+}
+
+static FILE *dump_shot_log()
+{
+    FILE *dump = tmpfile();
+    shot_log_dump(dump);
+    rewind(dump);
+
+    if (dump_path != NULL)
+    {
+        FILE *out = fopen(dump_path, "w");
+        if (out != NULL)
+        {
+            shot_log_dump(out);
+            fclose(out);
+        }
+    }
+    return dump;
+}
+
+static void test_shot_log()
+{
+    static struct shot_record records[SHOT_LOG_RECORDS];
+    struct shot_log_stats before, after;
+    int count;
+    uint32_t total;
+
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    // Manual triggers until the partition wrapped, a reset finds the end again
+    shot_log_get_stats(&before);
+    for (int i = 0; i < SHOT_LOG_FILL; i++)
+    {
+        canon_do_trigger();
+        run_idle();
+        shot_log_flush(false);
+    }
+    shot_log_flush(true);
+    shot_log_get_stats(&after);
+    CHECK(after.records - before.records == SHOT_LOG_FILL);
+    CHECK(after.lost == before.lost);
+
+    shot_log_init();
+    FILE *dump = dump_shot_log();
+    CHECK(read_dump(dump, records, SHOT_LOG_RECORDS, &count, &total));
+    fclose(dump);
+
+    CHECK(total > 1800 && total < SHOT_LOG_FILL); // 16 sectors of 128 records, the oldest sector is erased next
+    CHECK(count > 0 && records[count - 1].status == SHOT_STATUS_OK && (records[count - 1].flags & SHOT_FLAG_MANUAL));
+    for (int i = 1; i < count; i++)
+    {
+        CHECK(records[i].sequence == records[i - 1].sequence + 1);
+    }
+    uint32_t last_sequence = records[count - 1].sequence;
+    uint32_t wrapped = total;
+
+    // A timelapse with the camera gone for a while
+    shot_log_clear();
+    shot_log_get_stats(&before);
+    camera_sim_reset_stats();
+    session_set_catch_up(false);
+
+    int64_t start = camera_sim_time();
+    session_start();
+    app_timer_start(SHOT_LOG_INTERVAL_MS, on_timer_shot, on_timer_tick);
+    camera_sim_run_until(start + SHOT_LOG_LOSS_US);
+
+    config.available = false;
+    camera_sim_set_config(&config);
+    camera_sim_link_loss();
+    camera_sim_run_until(start + SHOT_LOG_LOSS_US + SHOT_LOG_DOWN_US);
+
+    config.available = true;
+    camera_sim_set_config(&config);
+    camera_sim_run_until(start + SHOT_LOG_RUN_US);
+
+    app_timer_stop();
+    session_stop();
+    run_idle();
+    shot_log_flush(true);
+
+    struct session_stats session_stats;
+    struct camera_sim_stats sim_stats;
+    session_get_stats(&session_stats);
+    camera_sim_get_stats(&sim_stats);
+    shot_log_get_stats(&after);
+    disconnect_camera();
+
+    dump = dump_shot_log();
+    CHECK(read_dump(dump, records, SHOT_LOG_RECORDS, &count, &total));
+    fclose(dump);
+
+    CHECK(count == (int)(after.records - before.records));
+    CHECK(count > 0 && records[0].sequence == last_sequence + 1);
+
+    uint32_t ok = 0, missed = 0, failed = 0;
+    uint32_t max_write = 0, max_press = 0, max_release = 0;
+    for (int i = 0; i < count; i++)
+    {
+        struct shot_record *record = &records[i];
+        CHECK(i == 0 || record->sequence == records[i - 1].sequence + 1);
+        CHECK(record->shot > 0 && record->scheduled_us == start + (int64_t)record->shot * SHOT_LOG_INTERVAL_MS * 1000);
+
+        if (record->status == SHOT_STATUS_OK)
+        {
+            ok++;
+            CHECK(record->camera == 0);
+            CHECK(record->write_us <= record->press_us && record->press_us < record->release_us);
+            CHECK(record->rssi == BLE_RSSI_NONE || (record->rssi <= -62 && record->rssi >= -65));
+
+            max_write = (record->write_us > max_write ? record->write_us : max_write);
+            max_press = (record->press_us > max_press ? record->press_us : max_press);
+            max_release = (record->release_us > max_release ? record->release_us : max_release);
+        }
+        else if (record->status == SHOT_STATUS_MISSED)
+        {
+            missed++;
+            CHECK(record->camera == SHOT_LOG_NO_CAMERA && record->write_us == SHOT_LOG_NONE);
+        }
+        else if (record->status == SHOT_STATUS_FAILED)
+        {
+            failed++;
+        }
+    }
+
+    // Every scheduled shot left one record, the ones sent into the dead link failed
+    CHECK(ok + missed + failed == session_stats.shots);
+    CHECK(missed == session_stats.missed);
+    CHECK(ok == sim_stats.shots);
+    CHECK(max_write == 0); // The simulated timer is exact and the write goes out from the shot event
+
+    printf("%-14s %u wrapped records  timelapse %u ok  %u missed  %u failed  write %u us  press %.1f ms  release %.1f ms\n",
+           "shot log", wrapped, ok, missed, failed, max_write, max_press / 1e3, max_release / 1e3);
+}
+
+// A queue full of lossy events still takes the ones which must not be lost, a shot which does not fit leaves its record
+static void test_events()
+{
+    run_idle();
+
+    struct app_event frame = {.type = APP_EVENT_FRAME};
+    int lossy = 0, reserved = 0;
+    while (app_event_post_lossy(&frame))
+    {
+        lossy++;
+    }
+    while (app_event_post(&frame))
+    {
+        reserved++;
+    }
+    CHECK(lossy > 0 && reserved > 0);
+
+    struct shot_log_stats before, after;
+    struct shot_record records[1];
+    int count;
+    uint32_t total;
+    shot_log_get_stats(&before);
+    on_timer_shot(7, 0);
+    shot_log_get_stats(&after);
+    CHECK(after.records - before.records == 1);
+
+    FILE *dump = dump_shot_log();
+    CHECK(dump != NULL && read_dump(dump, records, 1, &count, &total) && count == 1);
+    CHECK(count == 1 && records[0].shot == 7 && records[0].status == SHOT_STATUS_DROPPED && records[0].camera == SHOT_LOG_NO_CAMERA);
+    if (dump != NULL)
+    {
+        fclose(dump);
+    }
+
+    dispatch_events();
+    CHECK(app_event_post_lossy(&frame));
+    dispatch_events();
+
+    printf("%-14s %d lossy events, %d more in the reserve, a shot on a full queue is logged as dropped\n", "event queue", lossy, reserved);
+}
+
+// The same timelapse with and without the battery mode, nobody looks at the display after a while
+static void run_power(bool battery, struct power_stats *stats, struct camera_sim_stats *sim_stats)
+{
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    power_set_battery_mode(battery);
+    session_set_catch_up(false);
+    camera_sim_reset_stats();
+    shot_interval_max = 0;
+    tick_interval_max = 0;
+    shots_awake = 0;
+    ticks_asleep = 0;
+    press_min = UINT32_MAX;
+    press_max = 0;
+
+    int64_t start = camera_sim_time();
+    session_start();
+    app_timer_start(POWER_INTERVAL_MS, on_timer_shot, on_timer_tick);
+    power_timer_start(POWER_INTERVAL_MS);
+
+    // What the menu does once the display times out
+    camera_sim_run_until(start + POWER_LOOK_US);
+    if (battery)
+    {
+        power_display(false);
+        app_timer_set_tick(POWER_IDLE_TICK_MS);
+    }
+    camera_sim_run_until(start + POWER_RUN_US);
+
+    app_timer_stop();
+    power_timer_stop();
+    session_stop();
+    run_idle();
+    power_display(true);
+
+    struct session_stats session_stats;
+    session_get_stats(&session_stats);
+    power_get_stats(stats);
+    camera_sim_get_stats(sim_stats);
+    disconnect_camera();
+    power_set_battery_mode(POWER_BATTERY_MODE);
+
+    CHECK(session_stats.shots == POWER_RUN_US / (POWER_INTERVAL_MS * 1000));
+    CHECK(sim_stats->shots == session_stats.shots);
+    CHECK(shots_awake == session_stats.shots);
+    CHECK(stats->run_us == POWER_RUN_US);
+}
+
+static void test_power()
+{
+    struct power_stats normal, battery;
+    struct camera_sim_stats sim_normal, sim_battery;
+
+    run_power(false, &normal, &sim_normal);
+    CHECK(normal.awake_us == normal.run_us && normal.display_on_us == normal.run_us);
+    CHECK(ticks_asleep == 0);
+
+    // One update at the start, the whole run at the short interval. Two acknowledged writes from the press to the
+    // release take four events, the spread is within one
+    CHECK(normal.param_updates == 1 && sim_normal.conn_updates == 1 && normal.wakeups == 0);
+    CHECK(shot_interval_max == POWER_ACTIVE_INTERVAL_MS * 1000 && tick_interval_max == POWER_ACTIVE_INTERVAL_MS * 1000);
+    CHECK(press_max - press_min <= POWER_ACTIVE_INTERVAL_MS * 1000 && press_max <= 4 * POWER_ACTIVE_INTERVAL_MS * 1000);
+    uint32_t normal_press = press_max;
+
+    run_power(true, &battery, &sim_battery);
+
+    // The short interval was in place at every shot, the idle one in between
+    CHECK(shot_interval_max == POWER_ACTIVE_INTERVAL_MS * 1000);
+    CHECK(tick_interval_max == POWER_IDLE_INTERVAL_MS * 1000);
+    CHECK(sim_battery.conn_updates == battery.param_updates);
+    CHECK(battery.wakeups == sim_battery.shots);
+    CHECK(press_max - press_min <= POWER_ACTIVE_INTERVAL_MS * 1000 && press_max <= 4 * POWER_ACTIVE_INTERVAL_MS * 1000);
+
+    // Awake while the display was on and for the triggers
+    CHECK(battery.display_on_us == POWER_LOOK_US);
+    CHECK(battery.awake_us >= POWER_LOOK_US && battery.awake_us < POWER_LOOK_US + battery.wakeups * SEC / 2);
+    CHECK(ticks_asleep > 0);
+    CHECK(battery.radio_events * 3 < normal.radio_events);
+
+    printf("%-14s normal: awake %.1f s  %u radio events  press %.1f ms   battery: awake %.1f s  display %.1f s  %u radio events  %u updates  %u wakeups  press %.1f ms\n",
+           "power", normal.awake_us / 1e6, normal.radio_events, normal_press / 1e3, battery.awake_us / 1e6, battery.display_on_us / 1e6,
+           battery.radio_events, battery.param_updates, battery.wakeups, press_max / 1e3);
+}
+
+// Parameter updates the link didn't take during a run, the links are asked again until the short interval is back
+static void test_link_params()
+{
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    power_set_battery_mode(false);
+    session_set_catch_up(false);
+    camera_sim_reset_stats();
+
+    int64_t start = camera_sim_time();
+    session_start();
+    app_timer_start(POWER_INTERVAL_MS, on_timer_shot, on_timer_tick);
+    power_timer_start(POWER_INTERVAL_MS);
+
+    // The camera changes the parameters while our request is pending, the request still ends with its own report
+    camera_sim_camera_update(24, 0, 400);
+    camera_sim_run_until(start + 2 * SEC);
+
+    struct power_stats stats;
+    power_get_stats(&stats);
+    CHECK(camera_sim_interval_us() == POWER_ACTIVE_INTERVAL_MS * 1000);
+    CHECK(stats.param_updates == 1 && stats.param_failures == 0);
+
+    // Later the camera goes back to a long interval on its own
+    camera_sim_camera_update(BLE_CONN_INTERVAL_DEFAULT, 0, 400);
+    camera_sim_run_until(start + 4 * SEC);
+
+    power_get_stats(&stats);
+    CHECK(camera_sim_interval_us() == POWER_ACTIVE_INTERVAL_MS * 1000);
+    CHECK(stats.param_updates == 2 && stats.param_failures == 1);
+
+    // Once more, and the first request to get the short interval back is rejected
+    config.update_rejects = 1;
+    camera_sim_set_config(&config);
+    camera_sim_camera_update(BLE_CONN_INTERVAL_DEFAULT, 0, 400);
+    camera_sim_run_until(start + 6 * SEC);
+
+    power_get_stats(&stats);
+    CHECK(camera_sim_interval_us() == POWER_ACTIVE_INTERVAL_MS * 1000);
+    CHECK(stats.param_updates == 4 && stats.param_failures == 3);
+
+    app_timer_stop();
+    power_timer_stop();
+    session_stop();
+    run_idle();
+
+    // Three of ours and three of the camera, the rejected one never reached its instant
+    struct camera_sim_stats sim_stats;
+    camera_sim_get_stats(&sim_stats);
+    CHECK(sim_stats.conn_updates == 6);
+    disconnect_camera();
+    power_set_battery_mode(POWER_BATTERY_MODE);
+
+    printf("%-14s %u requests  %u not taken  back at %u ms before every shot\n", "link params", stats.param_updates,
+           stats.param_failures, POWER_ACTIVE_INTERVAL_MS);
+}
+
+// A battery run of a long interval, the chip powers down between the shots and boots again ahead of each
+static void test_deep_sleep()
+{
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    power_set_battery_mode(true);
+    session_set_catch_up(false);
+    camera_sim_reset_stats();
+    triggers_done = 0;
+    last_shot = 0;
+
+    int64_t start = camera_sim_time();
+    session_start();
+
+    struct session_peer peers[MAX_CAMERAS];
+    journal_begin(DEEP_INTERVAL_MS, peers, session_peers(peers, MAX_CAMERAS));
+    app_timer_start(DEEP_INTERVAL_MS, on_timer_shot, on_timer_tick);
+    power_timer_start(DEEP_INTERVAL_MS);
+    power_display(false);
+    app_timer_set_tick(POWER_IDLE_TICK_MS);
+    deep_test = true;
+
+    struct power_stats stats;
+    uint32_t first_lead = 0;
+    uint32_t max_ready = 0;
+    for (int sleep = 0; sleep < DEEP_SLEEPS; sleep++)
+    {
+        int64_t wake;
+        deep_closing = false;
+        while (!idf_host_deep_sleep(&wake) && camera_sim_pending() > 0)
+        {
+            camera_sim_step();
+        }
+        if (!idf_host_deep_sleep(&wake))
+        {
+            CHECK(!"deep sleep");
+            break;
+        }
+
+        // Nothing runs on the chip until it has booted again
+        camera_sim_run_until(wake + DEEP_BOOT_US);
+        idf_host_boot(ESP_SLEEP_WAKEUP_TIMER);
+        deep_closing = false;
+        power_init();
+        CHECK(power_wake_reason() == POWER_WAKE_TIMER);
+
+        // What the menu does once the BLE stack is up
+        struct journal_session loaded;
+        CHECK(journal_load(&loaded));
+        triggers_done = loaded.expo_count;
+        last_shot = loaded.shot;
+        CHECK(loaded.shot == (uint32_t)sleep);
+
+        session_resume(loaded.peers, loaded.peer_count);
+        journal_resume(&loaded);
+        app_timer_start_at(loaded.interval_ms, journal_resume_start(&loaded), on_timer_shot, on_timer_tick);
+        power_timer_start(loaded.interval_ms);
+        power_display(false);
+        app_timer_set_tick(POWER_IDLE_TICK_MS);
+
+        // The first wake has the configured lead
+        power_get_stats(&stats);
+        first_lead = (sleep == 0 ? stats.lead_us : first_lead);
+
+        ready = false;
+        CHECK(run_for(&ready, 60 * SEC));
+        power_get_stats(&stats);
+        max_ready = (stats.wake_ready_us > max_ready ? stats.wake_ready_us : max_ready);
+    }
+
+    // The last shot without a sleep after it
+    deep_test = false;
+    camera_sim_run_until(start + (int64_t)DEEP_SLEEPS * DEEP_INTERVAL_MS * 1000 + 10 * SEC);
+
+    app_timer_stop();
+    power_timer_stop();
+    session_stop();
+    journal_end();
+    run_idle();
+
+    struct session_stats session_stats;
+    struct camera_sim_stats sim_stats;
+    session_get_stats(&session_stats);
+    power_get_stats(&stats);
+    camera_sim_get_stats(&sim_stats);
+    disconnect_camera();
+    power_set_battery_mode(POWER_BATTERY_MODE);
+    idf_host_boot(ESP_SLEEP_WAKEUP_UNDEFINED);
+
+    // Every shot on the original schedule, the exposure count went on over the sleeps
+    CHECK(last_shot == DEEP_SLEEPS);
+    CHECK(last_shot_time == start + (int64_t)last_shot * DEEP_INTERVAL_MS * 1000);
+    CHECK(sim_stats.shots == DEEP_SLEEPS && triggers_done == DEEP_SLEEPS);
+    CHECK(session_stats.missed == 0);
+    CHECK(stats.sleeps == DEEP_SLEEPS && stats.wakeups == DEEP_SLEEPS);
+
+    // The lead came down to what the wake takes
+    CHECK(first_lead == POWER_DEEP_LEAD_MS * 1000);
+    CHECK(stats.lead_us < first_lead && stats.lead_us >= max_ready);
+    CHECK(stats.wake_shutter_us > stats.wake_ready_us && stats.wake_shutter_us < stats.lead_us + SEC);
+    CHECK(stats.awake_us * 50 < stats.run_us && stats.asleep_us * 10 > stats.run_us * 9);
+
+    printf("%-14s %u shots  %u sleeps  asleep %.1f %%  awake %.1f s  ready %.2f s  lead %.1f -> %.2f s  wake to shutter %.2f s\n",
+           "deep sleep", sim_stats.shots, stats.sleeps, stats.asleep_us * 100.0 / stats.run_us, stats.awake_us / 1e6,
+           stats.wake_ready_us / 1e6, first_lead / 1e6, stats.lead_us / 1e6, stats.wake_shutter_us / 1e6);
+}
+
+// A few timer shots through the trace, from the esp_timer callback to the release of the shutter
+static void test_trace()
+{
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    trace_clear();
+    int64_t start = camera_sim_time();
+    session_start();
+    app_timer_start(TRACE_INTERVAL_MS, on_timer_shot, on_timer_tick);
+    camera_sim_run_until(start + TRACE_SHOTS * TRACE_INTERVAL_MS * 1000 + TRACE_INTERVAL_MS * 500);
+    app_timer_stop();
+    session_stop();
+    run_idle();
+
+    FILE *dump = tmpfile();
+    int count = trace_dump(dump);
+    rewind(dump);
+
+    // Decoded like tools/trace_chrome.py, the times of the first shot
+    uint32_t first[TRACE_EVENTS] = {0};
+    int records = 0, damaged = 0, begins = 0, ends = 0, shots = 0;
+    char line[128];
+    while (fgets(line, sizeof(line), dump) != NULL)
+    {
+        int core;
+        char hex[2 * sizeof(struct trace_record) + 1];
+        unsigned checksum;
+        if (sscanf(line, "TRACE %d %24s %x", &core, hex, &checksum) != 3)
+        {
+            continue;
+        }
+
+        struct trace_record record;
+        uint8_t *bytes = (uint8_t *)&record;
+        uint8_t sum = 0;
+        for (int i = 0; i < sizeof(record); i++)
+        {
+            unsigned value;
+            sscanf(&hex[2 * i], "%2x", &value);
+            bytes[i] = value;
+            sum += value;
+        }
+        if (sum != checksum)
+        {
+            damaged++;
+            continue;
+        }
+
+        records++;
+        uint16_t event = record.id & TRACE_ID_MASK;
+        begins += ((record.id & ~TRACE_ID_MASK) == TRACE_PHASE_BEGIN ? 1 : 0);
+        ends += ((record.id & ~TRACE_ID_MASK) == TRACE_PHASE_END ? 1 : 0);
+        shots += (event == TRACE_TIMER_SHOT ? 1 : 0);
+        if (event < TRACE_EVENTS && first[event] == 0)
+        {
+            first[event] = record.time_us;
+        }
+    }
+
+    if (trace_path != NULL)
+    {
+        FILE *out = fopen(trace_path, "w");
+        CHECK(out != NULL);
+        if (out != NULL)
+        {
+            trace_dump(out);
+            fclose(out);
+        }
+    }
+    fclose(dump);
+    disconnect_camera();
+
+    // Every span closed, the steps of the shot in order
+    CHECK(records == count && damaged == 0 && count <= TRACE_RECORDS);
+    CHECK(begins == ends && begins > 0);
+    CHECK(shots == TRACE_SHOTS);
+    CHECK(first[TRACE_TIMER_SHOT] != 0 && first[TRACE_TIMER_SHOT] <= first[TRACE_TRIGGER_WRITE]);
+    CHECK(first[TRACE_TRIGGER_WRITE] < first[TRACE_TRIGGER_PRESS] && first[TRACE_TRIGGER_PRESS] < first[TRACE_TRIGGER_RELEASE]);
+    CHECK(first[TRACE_GATTC_CB] != 0 && first[TRACE_CANON_SET] != 0 && first[TRACE_DISPATCH] != 0);
+
+    printf("%-14s %d records  shot to write %.1f ms  press %.1f ms  release %.1f ms\n", "trace", count,
+           (first[TRACE_TRIGGER_WRITE] - first[TRACE_TIMER_SHOT]) / 1e3, (first[TRACE_TRIGGER_PRESS] - first[TRACE_TIMER_SHOT]) / 1e3,
+           (first[TRACE_TRIGGER_RELEASE] - first[TRACE_TIMER_SHOT]) / 1e3);
+}
+
+static bool log_has(const char *log, const char *text)
+{
+    return strstr(log, text) != NULL;
+}
+
+// The deferred log of a few triggers at the most verbose runtime level, then a ring which overflows
+static void test_log()
+{
+    esp_log_level_t level = esp_log_level_get();
+    esp_log_level_set("*", ESP_LOG_VERBOSE);
+    app_log_init();
+
+    CHECK(connect_camera(MODE_CONNECT, NULL));
+    run_idle();
+
+    struct app_log_stats before, after;
+    FILE *out = tmpfile();
+    app_log_drain(out);
+    app_log_get_stats(&before);
+    long start = ftell(out);
+
+    for (int i = 0; i < LOG_SHOTS; i++)
+    {
+        canon_do_trigger();
+        while (canon_queue_depth() > 0 && camera_sim_step())
+        {
+        }
+    }
+    run_idle();
+
+    // Nothing is written until the log task drains the ring
+    CHECK(ftell(out) == start);
+    int shots_bytes = app_log_drain(out);
+    app_log_get_stats(&after);
+    disconnect_camera();
+
+    char log[2 * LOG_BUFFER_SIZE]; // The ring and the report of the dropped lines
+    fseek(out, start, SEEK_SET);
+    size_t length = fread(log, 1, sizeof(log) - 1, out);
+    log[length] = '\0';
+
+    // The command steps, the writes and the notifications are not compiled in at the default levels
+    CHECK(shots_bytes > 0 && after.dropped == before.dropped);
+    CHECK(log_has(log, "Round") && log_has(log, "done"));
+    CHECK(!log_has(log, "Executing command") && !log_has(log, "WRITE") && !log_has(log, "CommandSet"));
+    CHECK(!log_has(log, "ble_write_char") && !log_has(log, "notify"));
+
+    // A full ring drops whole lines and the drain reports them
+    app_log_get_stats(&before);
+    for (int i = 0; i < LOG_FILL; i++)
+    {
+        ESP_LOGI("SIM", "fill line %d", i);
+    }
+    app_log_get_stats(&after);
+    uint32_t dropped = after.dropped - before.dropped;
+
+    start = ftell(out);
+    int fill_bytes = app_log_drain(out);
+    fseek(out, start, SEEK_SET);
+    length = fread(log, 1, sizeof(log) - 1, out);
+    log[length] = '\0';
+
+    CHECK(dropped > 0 && (after.lines - before.lines) + dropped == LOG_FILL);
+    CHECK(after.max_used <= LOG_BUFFER_SIZE && after.cut == 0);
+    // The first lines made it, the ones after the ring was full did not
+    char last[32], next[32];
+    snprintf(last, sizeof(last), "fill line %u\n", after.lines - before.lines - 1);
+    snprintf(next, sizeof(next), "fill line %u\n", after.lines - before.lines);
+    CHECK(log_has(log, "fill line 0\n") && log_has(log, last) && !log_has(log, next));
+    CHECK(log_has(log, "lines dropped"));
+    CHECK(app_log_drain(out) == 0);
+
+    fclose(out);
+    esp_log_set_vprintf(vprintf);
+    esp_log_level_set("*", level);
+
+    printf("%-14s %d shots  %.0f bytes/shot  %d of %d lines dropped from a full ring  %d bytes drained\n", "log", LOG_SHOTS,
+           (double)shots_bytes / LOG_SHOTS, dropped, LOG_FILL, fill_bytes);
+}
+
+static void test_reorder()
+{
+    uint32_t done = 0, failed = 0, stalled = 0;
+
+    // Short confirmation time and a lot of jitter, the camera's answer may overtake the CCCD write response
+    config.jitter_us = 200 * 1000;
+    config.reorder = true;
+    config.confirm_us = 10 * 1000;
+
+    for (int run = 0; run < REORDER_RUNS; run++)
+    {
+        config.seed = run + 1;
+        camera_sim_set_config(&config);
+        camera_sim_forget_bond();
+        nvs_flash_erase();
+
+        if (connect_camera(MODE_PAIR, NULL))
+        {
+            done++;
+        }
+        else if (pair_failed)
+        {
+            failed++;
+        }
+        else
+        {
+            stalled++;
+        }
+
+        disconnect_camera();
+    }
+
+    // The camera accepts every request, an early answer is kept for the wait step
+    CHECK(done == REORDER_RUNS && failed == 0 && stalled == 0);
+
+    printf("%-14s %d runs  %u paired  %u failed  %u stalled\n", "reorder pair", REORDER_RUNS, done, failed, stalled);
+
+    camera_sim_default_config(&config);
+    camera_sim_set_config(&config);
+}
+
+int main(int argc, char **argv)
+{
+    esp_log_level_set("*", ESP_LOG_NONE);
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "-v") == 0)
+        {
+            esp_log_level_set("*", ESP_LOG_INFO);
+        }
+        else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc)
+        {
+            dump_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            trace_path = argv[++i];
+        }
+    }
+
+    camera_sim_default_config(&config);
+    camera_sim_init(&config);
+    nvs_flash_init();
+
+    app_event_init();
+    app_event_set_handler(APP_EVENT_TRIGGER_DONE, on_trigger_done);
+    app_event_set_handler(APP_EVENT_TIMER_SHOT, on_shot_event);
+    app_event_set_handler(APP_EVENT_TIMER_TICK, on_tick_event);
+    camera_sim_set_dispatch(dispatch_events);
+
+    canon_set_on_connected(on_connected);
+    canon_set_pair_state_callback(on_pair_state);
+    canon_set_on_disconnected(on_disconnected);
+    canon_set_on_auth(on_auth);
+
+    ble_init();
+    app_timer_init();
+    session_init();
+    shot_log_init();
+    power_init();
+    run_idle();
+
+    test_scan();
+    test_pair();
+    test_connect();
+    test_bonded();
+    test_trigger("trigger", false);
+    test_trigger("fast trigger", true);
+    test_policy();
+    test_faults();
+    test_events();
+    test_refused();
+    test_outage();
+    test_journal();
+    test_shot_log();
+    test_power();
+    test_link_params();
+    test_deep_sleep();
+    test_trace();
+    test_log();
+    test_reorder();
+
+    if (failures > 0)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+
+    return 0;
+}
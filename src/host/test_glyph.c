@@ -0,0 +1,89 @@
+// Host test of the glyph cache, every cached glyph blitted against the per-pixel path of SSD1306_drawChar
+// The glyph functions are static, the drawing core is built into the test
+#include "SSD1306.c"
+
+#include <stdio.h>
+
+#define FRAME_BYTES (SSD1306_LCDHEIGHT * SSD1306_LCDWIDTH / 8)
+
+static int failures = 0;
+
+#define CHECK(cond)                                              \
+	do                                                           \
+	{                                                            \
+		if (!(cond))                                             \
+		{                                                        \
+			printf("FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+			failures++;                                          \
+		}                                                        \
+	} while (0)
+
+// Half of the pixels set, BLACK and INVERSE change something everywhere
+static void fill_background(void)
+{
+	for (int i = 0; i < FRAME_BYTES; i++)
+	{
+		buffer[i] = (uint8_t)(0xA5 ^ i);
+	}
+}
+
+int main(int argc, char** argv)
+{
+	static const uint8_t colors[] = {WHITE, BLACK, INVERSE};
+	static uint8_t expected[FRAME_BYTES];
+	uint32_t compared = 0, differ = 0;
+
+	for (uint8_t size = 1; size <= GLYPH_MAX_SIZE; size++)
+	{
+		// Aligned, every unaligned row offset and a glyph cut by the right edge
+		int16_t xs[] = {0, 7, SSD1306_LCDWIDTH - 3 * size};
+		for (int xi = 0; xi < 3; xi++)
+		{
+			for (int16_t y = 8; y < 16; y++)
+			{
+				for (int ci = 0; ci < 3; ci++)
+				{
+					for (unsigned int c = GLYPH_FIRST; c <= GLYPH_LAST; c++)
+					{
+						fill_background();
+						SSD1306_drawCharPixels(xs[xi], y, c, size, colors[ci]);
+						memcpy(expected, buffer, FRAME_BYTES);
+
+						fill_background();
+						const uint8_t* glyph = SSD1306_getGlyph(c, size);
+						CHECK(glyph != NULL);
+						if (glyph == NULL)
+						{
+							continue;
+						}
+						SSD1306_blitGlyph(xs[xi], y, glyph, size, colors[ci]);
+
+						compared++;
+						if (memcmp(expected, buffer, FRAME_BYTES) != 0)
+						{
+							if (differ == 0)
+							{
+								printf("FAIL glyph 0x%02x size %u at %d,%d color %u\n", c, size, xs[xi], y, colors[ci]);
+							}
+							differ++;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Outside of printable ASCII and the cached sizes the pixel path draws
+	CHECK(SSD1306_getGlyph(0x7F, 2) == NULL && SSD1306_getGlyph(0x1F, 2) == NULL && SSD1306_getGlyph('A', GLYPH_MAX_SIZE + 1) == NULL);
+	CHECK(differ == 0);
+
+	printf("%-14s %u sizes  %u glyphs  %u blits compared  %u differ\n", "glyph", GLYPH_MAX_SIZE, GLYPH_COUNT, compared, differ);
+
+	if (failures > 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -3,25 +3,80 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include "esp_log.h"
-#include "esp_err.h"
 #include "ascii_font.h"
 
-static i2c_port_t i2c_port;
+static const struct SSD1306_transport* transport;
 
-#define ACK_CHECK_EN 0x1
-#define ACK_CHECK_DIS 0x0
-
-static int8_t _i2caddr;
 static uint8_t _vccstate;
+
+// Framebuffers: the draw functions write the back buffer, SSD1306_present copies it to the front buffer
+// and SSD1306_flush sends the front buffer to the panel. The shadow is a copy of what the panel currently shows
 static uint8_t buffer[SSD1306_LCDHEIGHT * SSD1306_LCDWIDTH / 8] = { 0 };
+static uint8_t front[SSD1306_LCDHEIGHT * SSD1306_LCDWIDTH / 8] = { 0 };
+static uint8_t shadow[SSD1306_LCDHEIGHT * SSD1306_LCDWIDTH / 8];
+static bool shadow_valid = false; // Panel RAM is unknown after power up
+
+// Dirty tracking, every page keeps the column range touched in the back buffer since the last present
+// and the range of the front buffer which was not flushed yet
+#define SSD1306_PAGES (SSD1306_LCDHEIGHT / 8)
+#define DIRTY_NONE_MIN (0xFF)
+#define DIRTY_NONE_MAX (0x00)
+
+static uint8_t dirty_min[SSD1306_PAGES];
+static uint8_t dirty_max[SSD1306_PAGES];
+static uint8_t pending_min[SSD1306_PAGES];
+static uint8_t pending_max[SSD1306_PAGES];
+
+// The front buffer and the pending ranges are shared between present and flush
+static void (*lock_fn)(void) = NULL;
+static void (*unlock_fn)(void) = NULL;
+
+// Display flush, every dirty page is sent in a single transaction
+#define SSD1306_WINDOW_CMDS (6)
+
+static inline void SSD1306_markDirty(uint8_t page, int16_t x0, int16_t x1)
+{
+	if (x0 < dirty_min[page])
+		dirty_min[page] = x0;
+	if (x1 > dirty_max[page])
+		dirty_max[page] = x1;
+}
+
+static void SSD1306_markAllDirty(uint8_t* rangeMin, uint8_t* rangeMax)
+{
+	memset(rangeMin, 0, SSD1306_PAGES);
+	memset(rangeMax, SSD1306_LCDWIDTH - 1, SSD1306_PAGES);
+}
+
+static inline void SSD1306_lock(void)
+{
+	if (lock_fn != NULL)
+		lock_fn();
+}
+
+static inline void SSD1306_unlock(void)
+{
+	if (unlock_fn != NULL)
+		unlock_fn();
+}
 
-void SSD1306_begin(uint8_t vccstate, uint8_t i2caddr, i2c_port_t i2c)
+void SSD1306_setLock(void (*lock)(void), void (*unlock)(void))
+{
+	lock_fn = lock;
+	unlock_fn = unlock;
+}
+
+void SSD1306_begin(uint8_t vccstate, const struct SSD1306_transport* t)
 {
 	_vccstate = vccstate;
-	_i2caddr = i2caddr;
 
-	i2c_port = i2c;
+	transport = t;
+
+	// Force a full redraw on the first flush
+	shadow_valid = false;
+	SSD1306_markAllDirty(dirty_min, dirty_max);
+	memset(pending_min, DIRTY_NONE_MIN, sizeof(pending_min));
+	memset(pending_max, DIRTY_NONE_MAX, sizeof(pending_max));
 
 	// Init sequence
 	SSD1306_command(SSD1306_DISPLAYOFF);                    // 0xAE
@@ -87,33 +142,9 @@ void SSD1306_begin(uint8_t vccstate, uint8_t i2caddr, i2c_port_t i2c)
 
 void SSD1306_command(uint8_t c)
 {
-    uint8_t data[] = {((_i2caddr << 1) | I2C_MASTER_WRITE), 0x00, c};
-
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write(cmd, data, 3, ACK_CHECK_DIS);
-    i2c_master_stop(cmd);
-
-    esp_err_t ret = i2c_master_cmd_begin(i2c_port, cmd, 10/portTICK_RATE_MS);
-    i2c_cmd_link_delete(cmd);
-
-    if (ret != ESP_OK) {
-        ESP_LOGI("DSP", "CMD FAIL %d", ret);
-    }
-}
-
-void SSD1306_buffer(uint8_t* buffer, int length)
-{
-    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-    i2c_master_start(cmd);
-    i2c_master_write_byte(cmd, ((_i2caddr << 1) | I2C_MASTER_WRITE), ACK_CHECK_DIS);
-    i2c_master_write(cmd, buffer, length, ACK_CHECK_DIS);
-    i2c_master_stop(cmd);
-
-    /*esp_err_t ret =*/ i2c_master_cmd_begin(i2c_port, cmd, 10/portTICK_RATE_MS);
-    i2c_cmd_link_delete(cmd);
-
-    // Ignore ret because it takes long it's always a timeout (???)
+	transport->begin(transport->ctx);
+	transport->commands(transport->ctx, &c, 1);
+	transport->end(transport->ctx);
 }
 
 void SSD1306_drawPixel(int16_t x, int16_t y, uint16_t color) 
@@ -122,6 +153,7 @@ void SSD1306_drawPixel(int16_t x, int16_t y, uint16_t color)
 		return;
 
     int index = x + (y / 8) * SSD1306_LCDWIDTH;
+    SSD1306_markDirty(y / 8, x, x);
     switch (color)
     {
 		  case WHITE:   buffer[index] |=  (1 << (y&7)); break;
@@ -163,43 +195,142 @@ void SSD1306_dim(bool dim)
 	SSD1306_command(contrast);
 }
 
-void SSD1306_display(void)
+// Queue one page window into the transaction: address setup as a command stream, then the data stream.
+// The command bytes and the data are referenced by the transport, both must stay valid until end returns
+static void SSD1306_queueWindow(uint8_t* window_cmds, const uint8_t* data, uint8_t page, uint8_t colStart, uint8_t colEnd)
 {
-	SSD1306_command(SSD1306_COLUMNADDR);
-	SSD1306_command(0);   // Column start address (0 = reset)
-	SSD1306_command(SSD1306_LCDWIDTH-1); // Column end address (127 = reset)
-
-	SSD1306_command(SSD1306_PAGEADDR);
-	SSD1306_command(0); // Page start address (0 = reset)
-	#if SSD1306_LCDHEIGHT == 64
-		SSD1306_command(7); // Page end address
-	#endif
-	#if SSD1306_LCDHEIGHT == 32
-		SSD1306_command(3); // Page end address
-	#endif
-	#if SSD1306_LCDHEIGHT == 16
-		SSD1306_command(1); // Page end address
-	#endif
+	window_cmds[0] = SSD1306_COLUMNADDR;
+	window_cmds[1] = colStart; // Column start address
+	window_cmds[2] = colEnd;   // Column end address
+	window_cmds[3] = SSD1306_PAGEADDR;
+	window_cmds[4] = page;     // Page start address
+	window_cmds[5] = page;     // Page end address
+
+	transport->commands(transport->ctx, window_cmds, SSD1306_WINDOW_CMDS);
+	transport->data(transport->ctx, data, colEnd - colStart + 1);
+}
 
-    // I2C
-    for (uint16_t i = 0; i < (SSD1306_LCDWIDTH*SSD1306_LCDHEIGHT/8); i++)
+void SSD1306_present(void)
+{
+	SSD1306_lock();
+
+	for (uint8_t page = 0; page < SSD1306_PAGES; page++)
+	{
+		int16_t start = dirty_min[page];
+		int16_t end = dirty_max[page];
+
+		dirty_min[page] = DIRTY_NONE_MIN;
+		dirty_max[page] = DIRTY_NONE_MAX;
+
+		if (start > end)
+			continue; // Nothing was drawn on this page
+
+		memcpy(&front[page * SSD1306_LCDWIDTH + start], &buffer[page * SSD1306_LCDWIDTH + start], end - start + 1);
+
+		if (start < pending_min[page])
+			pending_min[page] = start;
+		if (end > pending_max[page])
+			pending_max[page] = end;
+	}
+
+	SSD1306_unlock();
+}
+
+bool SSD1306_flush(void)
+{
+	static uint8_t window_cmds[SSD1306_PAGES][SSD1306_WINDOW_CMDS];
+
+	int16_t window_start[SSD1306_PAGES];
+	int16_t window_end[SSD1306_PAGES];
+	bool changed = false;
+
+	// Collect the changed columns into the shadow, the lock is only held for the copy and not the transfer
+	SSD1306_lock();
+
+	for (uint8_t page = 0; page < SSD1306_PAGES; page++)
 	{
-		uint8_t tmpBuf[17];
-		// SSD1306_SETSTARTLINE
-		tmpBuf[0] = 0x40;
-		// data
-		for (uint8_t j = 0; j < 16; j++) {
-			tmpBuf[j+1] = buffer[i];
-			i++;
+		int16_t start = pending_min[page];
+		int16_t end = pending_max[page];
+
+		pending_min[page] = DIRTY_NONE_MIN;
+		pending_max[page] = DIRTY_NONE_MAX;
+
+		// Trim the columns which are already on the panel, the page gets cleared and redrawn most of the time
+		uint8_t *pFront = &front[page * SSD1306_LCDWIDTH];
+		uint8_t *pShadow = &shadow[page * SSD1306_LCDWIDTH];
+		if (shadow_valid)
+		{
+			while (start <= end && pFront[start] == pShadow[start])
+				start++;
+			while (end >= start && pFront[end] == pShadow[end])
+				end--;
 		}
-		i--;
-		
-		SSD1306_buffer(tmpBuf, sizeof(tmpBuf));
-    }
+
+		window_start[page] = start;
+		window_end[page] = end;
+
+		if (start <= end)
+		{
+			// Send from the shadow, only the flush writes it so it doesn't change while the transfer is running
+			memcpy(&pShadow[start], &pFront[start], end - start + 1);
+			changed = true;
+		}
+	}
+
+	SSD1306_unlock();
+
+	if (!changed)
+		return true;
+
+	transport->begin(transport->ctx);
+
+	for (uint8_t page = 0; page < SSD1306_PAGES; page++)
+	{
+		if (window_start[page] <= window_end[page])
+		{
+			SSD1306_queueWindow(window_cmds[page], &shadow[page * SSD1306_LCDWIDTH + window_start[page]], page, window_start[page], window_end[page]);
+		}
+	}
+
+	if (!transport->end(transport->ctx))
+	{
+		// The panel contents are unknown, send everything next time
+		SSD1306_lock();
+		shadow_valid = false;
+		SSD1306_markAllDirty(pending_min, pending_max);
+		SSD1306_unlock();
+		return false;
+	}
+
+	shadow_valid = true;
+
+	return true;
+}
+
+bool SSD1306_display(void)
+{
+	SSD1306_present();
+	return SSD1306_flush();
 }
 
 void SSD1306_clearDisplay(void)
 {
+	// Only the columns which had something on them change
+	for (uint8_t page = 0; page < SSD1306_PAGES; page++)
+	{
+		uint8_t *pBuf = &buffer[page * SSD1306_LCDWIDTH];
+
+		int16_t start = 0;
+		int16_t end = SSD1306_LCDWIDTH - 1;
+		while (start <= end && pBuf[start] == 0)
+			start++;
+		while (end >= start && pBuf[end] == 0)
+			end--;
+
+		if (start <= end)
+			SSD1306_markDirty(page, start, end);
+	}
+
 	memset(buffer, 0, (SSD1306_LCDWIDTH*SSD1306_LCDHEIGHT/8));
 }
 
@@ -222,6 +353,8 @@ void SSD1306_drawFastHLine(int16_t x, int16_t y, int16_t w, uint16_t color)
 	// if our width is now negative, punt
 	if(w <= 0) { return; }
 
+	SSD1306_markDirty(y/8, x, x + w - 1);
+
 	// set up the pointer for  movement through the buffer
 	register uint8_t *pBuf = buffer;
 	// adjust the buffer pointer for the current row
@@ -261,6 +394,10 @@ void SSD1306_drawFastVLine(int16_t x, int16_t __y, int16_t __h, uint16_t color)
 		return;
 	}
 
+	for (int16_t page = __y / 8; page <= (__y + __h - 1) / 8; page++) {
+		SSD1306_markDirty(page, x, x);
+	}
+
 	// this display doesn't need ints for coordinates, use local byte registers for faster juggling
 	register uint8_t y = __y;
 	register uint8_t h = __h;
@@ -368,13 +505,113 @@ void SSD1306_outlineRect(int16_t x, int16_t y, int16_t w, int16_t h, uint16_t co
     SSD1306_drawFastHLine(x, y + h, w, color);
 }
 
-void SSD1306_drawChar(uint16_t x, uint16_t y, unsigned char c, uint8_t size, uint8_t color)
+// Glyph cache, font[] expanded into page aligned column bytes for size 1 to GLYPH_MAX_SIZE.
+// A glyph of size s is s pages high and 6*s columns wide, each scale is allocated and filled on first use.
+// Only printable ASCII is cached, 2.3 KB for the size 2 text of the menu, other characters take the pixel path
+#define GLYPH_COLUMNS (6)
+#define GLYPH_MAX_SIZE (3)
+#define GLYPH_BYTES(size) (GLYPH_COLUMNS * (size) * (size))
+#define GLYPH_FIRST (0x20)
+#define GLYPH_LAST (0x7E)
+#define GLYPH_COUNT (GLYPH_LAST - GLYPH_FIRST + 1)
+
+static uint8_t* glyph_cache[GLYPH_MAX_SIZE + 1] = { NULL };
+static uint8_t glyph_cached[GLYPH_MAX_SIZE + 1][(GLYPH_COUNT + 7) / 8];
+
+static void SSD1306_expandGlyph(uint8_t* glyph, unsigned char c, uint8_t size)
 {
-	if ((x >= SSD1306_LCDWIDTH) || (y >= SSD1306_LCDHEIGHT) || ((x + 5 * size - 1) < 0) || ((y + 8 * size - 1) < 0))
+	uint8_t width = GLYPH_COLUMNS * size;
+	uint32_t pixelMask = (1 << size) - 1;
+
+	for (uint8_t i = 0; i < GLYPH_COLUMNS; i++)
 	{
-		return;
+		uint8_t line = (i == 5 ? 0x0 : font[(c * 5) + i]);
+
+		// Every font pixel becomes size bits
+		uint32_t column = 0;
+		for (uint8_t j = 0; j < 8; j++)
+		{
+			if (line & (1 << j))
+				column |= pixelMask << (j * size);
+		}
+
+		for (uint8_t page = 0; page < size; page++)
+		{
+			uint8_t bits = (column >> (page * 8)) & 0xFF;
+			memset(&glyph[page * width + i * size], bits, size);
+		}
+	}
+}
+
+static const uint8_t* SSD1306_getGlyph(unsigned char c, uint8_t size)
+{
+	if (size == 0 || size > GLYPH_MAX_SIZE || c < GLYPH_FIRST || c > GLYPH_LAST)
+		return NULL;
+
+	if (glyph_cache[size] == NULL)
+	{
+		glyph_cache[size] = (uint8_t*)malloc(GLYPH_COUNT * GLYPH_BYTES(size));
+		if (glyph_cache[size] == NULL)
+			return NULL;
+	}
+
+	uint8_t index = c - GLYPH_FIRST;
+	uint8_t* glyph = &glyph_cache[size][index * GLYPH_BYTES(size)];
+	if (!(glyph_cached[size][index >> 3] & (1 << (index & 7))))
+	{
+		SSD1306_expandGlyph(glyph, c, size);
+		glyph_cached[size][index >> 3] |= (1 << (index & 7));
 	}
 
+	return glyph;
+}
+
+static inline void SSD1306_blitByte(uint8_t* pBuf, uint8_t bits, uint8_t color)
+{
+	switch (color)
+	{
+		case WHITE:   *pBuf |=  bits; break;
+		case BLACK:   *pBuf &= ~bits; break;
+		case INVERSE: *pBuf ^=  bits; break;
+	}
+}
+
+// Copy the glyph into the framebuffer a byte at a time, an unaligned y splits every byte between two pages
+static void SSD1306_blitGlyph(int16_t x, int16_t y, const uint8_t* glyph, uint8_t size, uint8_t color)
+{
+	int16_t width = GLYPH_COLUMNS * size;
+	int16_t x1 = x + width - 1;
+	if (x1 >= SSD1306_LCDWIDTH)
+		x1 = SSD1306_LCDWIDTH - 1;
+
+	uint8_t shift = y & 7;
+
+	for (int16_t glyphPage = 0; glyphPage < size; glyphPage++)
+	{
+		int16_t page = (y / 8) + glyphPage;
+		if (page >= SSD1306_PAGES)
+			break;
+
+		const uint8_t* pGlyph = &glyph[glyphPage * width];
+		uint8_t* pBuf = &buffer[page * SSD1306_LCDWIDTH + x];
+		bool spill = (shift != 0 && page + 1 < SSD1306_PAGES);
+
+		for (int16_t col = x; col <= x1; col++, pGlyph++, pBuf++)
+		{
+			SSD1306_blitByte(pBuf, (uint8_t)(*pGlyph << shift), color);
+			if (spill)
+				SSD1306_blitByte(pBuf + SSD1306_LCDWIDTH, *pGlyph >> (8 - shift), color);
+		}
+
+		SSD1306_markDirty(page, x, x1);
+		if (spill)
+			SSD1306_markDirty(page + 1, x, x1);
+	}
+}
+
+// Sizes and characters without a cached glyph are drawn pixel by pixel
+static void SSD1306_drawCharPixels(int16_t x, int16_t y, unsigned char c, uint8_t size, uint8_t color)
+{
 	for (int8_t i=0; i<6; i++ )
 	{
 		uint8_t line;
@@ -396,6 +633,23 @@ void SSD1306_drawChar(uint16_t x, uint16_t y, unsigned char c, uint8_t size, uin
 	}
 }
 
+void SSD1306_drawChar(uint16_t x, uint16_t y, unsigned char c, uint8_t size, uint8_t color)
+{
+	if ((x >= SSD1306_LCDWIDTH) || (y >= SSD1306_LCDHEIGHT) || ((x + 5 * size - 1) < 0) || ((y + 8 * size - 1) < 0))
+	{
+		return;
+	}
+
+	const uint8_t* glyph = SSD1306_getGlyph(c, size);
+	if (glyph != NULL)
+	{
+		SSD1306_blitGlyph(x, y, glyph, size, color);
+		return;
+	}
+
+	SSD1306_drawCharPixels(x, y, c, size, color);
+}
+
 void SSD1306_drawText(uint16_t x, uint16_t y, const char* text, uint8_t size, uint8_t color)
 {
 	int len = strlen(text);
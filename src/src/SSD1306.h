@@ -4,7 +4,6 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#include "driver/i2c.h"
 
 #define BLACK 0
 #define WHITE 1
@@ -86,13 +85,28 @@
 
 #define ssd1306_swap(a, b) { int16_t t = a; a = b; b = t; }
 
-void SSD1306_begin(uint8_t vccstate, uint8_t i2caddr, i2c_port_t i2c);
+// Transport used to talk to the panel, a transaction is any number of command and data streams.
+// Buffers passed to commands/data must stay valid until end returns.
+struct SSD1306_transport
+{
+	void (*begin)(void* ctx);                                    // Start a transaction
+	void (*commands)(void* ctx, const uint8_t* cmds, int length); // Queue a command stream
+	void (*data)(void* ctx, const uint8_t* data, int length);     // Queue a display data stream
+	bool (*end)(void* ctx);                                      // Execute the transaction, false on failure
+	void* ctx;
+};
+
+void SSD1306_begin(uint8_t vccstate, const struct SSD1306_transport* t);
 void SSD1306_command(uint8_t c);
-void SSD1306_buffer(uint8_t* buffer, int length);
 
 void SSD1306_clearDisplay(void);
 void SSD1306_invertDisplay(uint8_t i);
-void SSD1306_display(void);
+// Double buffering: draw into the back buffer, present it, then flush the presented frame to the panel.
+// SSD1306_display does both synchronously, the lock is needed when present and flush run in different tasks
+void SSD1306_setLock(void (*lock)(void), void (*unlock)(void));
+void SSD1306_present(void);
+bool SSD1306_flush(void);
+bool SSD1306_display(void);
 
 void SSD1306_dim(bool dim);
 
@@ -0,0 +1,98 @@
+#include "SSD1306_i2c.h"
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include "app_log.h"
+
+#define TAG "DSP"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+#define ACK_CHECK_EN 0x1
+
+#define SSD1306_I2C_TIMEOUT_MS (100) // A full frame is ~1100 bytes, ~25ms at 400kHz
+
+// Every transaction is a single command link, each stream is a (repeated) start, the address and the control byte
+struct SSD1306_i2c
+{
+	i2c_port_t port;
+	uint8_t addr;
+
+	i2c_cmd_handle_t cmd;
+	int64_t start_time;
+};
+
+static struct SSD1306_i2c i2c_state;
+
+static uint32_t frame_time_last = 0;
+static uint32_t frame_time_max = 0;
+
+static void SSD1306_i2c_stream(struct SSD1306_i2c* i2c, uint8_t control, const uint8_t* bytes, int length)
+{
+	i2c_master_start(i2c->cmd);
+	i2c_master_write_byte(i2c->cmd, ((i2c->addr << 1) | I2C_MASTER_WRITE), ACK_CHECK_EN);
+	i2c_master_write_byte(i2c->cmd, control, ACK_CHECK_EN);
+	i2c_master_write(i2c->cmd, (uint8_t*)bytes, length, ACK_CHECK_EN);
+}
+
+static void SSD1306_i2c_begin(void* ctx)
+{
+	struct SSD1306_i2c* i2c = (struct SSD1306_i2c*)ctx;
+
+	i2c->start_time = esp_timer_get_time();
+	i2c->cmd = i2c_cmd_link_create();
+}
+
+static void SSD1306_i2c_commands(void* ctx, const uint8_t* cmds, int length)
+{
+	SSD1306_i2c_stream((struct SSD1306_i2c*)ctx, 0x00, cmds, length); // Co = 0, D/C = 0: every following byte is a command
+}
+
+static void SSD1306_i2c_data(void* ctx, const uint8_t* data, int length)
+{
+	SSD1306_i2c_stream((struct SSD1306_i2c*)ctx, 0x40, data, length); // Co = 0, D/C = 1: every following byte is display data
+}
+
+static bool SSD1306_i2c_end(void* ctx)
+{
+	struct SSD1306_i2c* i2c = (struct SSD1306_i2c*)ctx;
+
+	i2c_master_stop(i2c->cmd);
+	esp_err_t ret = i2c_master_cmd_begin(i2c->port, i2c->cmd, pdMS_TO_TICKS(SSD1306_I2C_TIMEOUT_MS));
+	i2c_cmd_link_delete(i2c->cmd);
+	i2c->cmd = NULL;
+
+	if (ret != ESP_OK)
+	{
+		LOGE("I2C transaction FAIL %s", esp_err_to_name(ret));
+		return false;
+	}
+
+	frame_time_last = (uint32_t)(esp_timer_get_time() - i2c->start_time);
+	if (frame_time_last > frame_time_max)
+		frame_time_max = frame_time_last;
+
+	return true;
+}
+
+static const struct SSD1306_transport i2c_transport = {
+	.begin = SSD1306_i2c_begin,
+	.commands = SSD1306_i2c_commands,
+	.data = SSD1306_i2c_data,
+	.end = SSD1306_i2c_end,
+	.ctx = &i2c_state};
+
+const struct SSD1306_transport* SSD1306_i2c_transport(i2c_port_t i2c, uint8_t i2caddr)
+{
+	i2c_state.port = i2c;
+	i2c_state.addr = i2caddr;
+	i2c_state.cmd = NULL;
+
+	return &i2c_transport;
+}
+
+void SSD1306_i2c_getFrameTime(uint32_t* last, uint32_t* max)
+{
+	*last = frame_time_last;
+	*max = frame_time_max;
+}
@@ -0,0 +1,12 @@
+#ifndef _SSD1306_I2C_H_
+#define _SSD1306_I2C_H_
+
+#include "SSD1306.h"
+
+#include "driver/i2c.h"
+
+const struct SSD1306_transport* SSD1306_i2c_transport(i2c_port_t i2c, uint8_t i2caddr);
+
+void SSD1306_i2c_getFrameTime(uint32_t* last, uint32_t* max);
+
+#endif /* _SSD1306_I2C_H_ */
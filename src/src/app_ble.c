@@ -1,7 +1,17 @@
 #include "app_ble.h"
+
+#include "esp_timer.h"
+
 #include "canon_ble.h"
+#include "app_event.h"
+#include "trace.h"
+#include "config.h"
+#include "app_log.h"
 
 #define TAG "BLE"
+#define LOG_LEVEL (LOG_LEVEL_BLE)
+
+#define BLE_EVENT_WAIT_MS (100) // The Bluedroid task waits this long for a slot in a full event queue
 
 /*
 Connection process:
@@ -11,6 +21,23 @@ Connection process:
     4. ESP_GATTC_SEARCH_CMPL_EVT -> Discovery completed -> Get required characteristics
     5. Do any kind of request with ESP_GATT_AUTH_REQ_SIGNED_MITM -> Initiates BONDING
     6. ESP_GAP_BLE_AUTH_CMPL_EVT -> Bonding result -> If SUCCESS ready to communicate
+
+    If the camera has cached handles 2. skips the service search and continues with them,
+    the search only runs again if a write using the cached handles fails.
+
+    Every camera gets a connection slot in ble_connect, the slot index is the camera index used by canon_ble.
+    The open event is matched to the slot by the address, the later events by the connection id.
+
+    A link keeps the parameters Bluedroid opened it with until ble_update_conn_params, the connection events of the
+    energy accounting are counted from the interval in use and not measured.
+    Only one update runs per link, a request while one is pending replaces the queued one and is sent once
+    ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT reports the pending one. A request for the parameters in use is dropped.
+    The camera may start an update of its own at any time, the pending one only ends with a failure or with the
+    parameters it asked for. Once nothing is pending or queued the conn params handler learns whether the link has
+    the last requested parameters, after a failed update or a camera which changed them again it does not.
+
+    The Bluedroid callbacks only copy the event into the application event queue,
+    the events are handled on the dispatcher task together with the menu and canon_ble.
 */
 
 static esp_ble_scan_params_t ble_scan_params = {
@@ -19,17 +46,104 @@ static esp_ble_scan_params_t ble_scan_params = {
     .scan_filter_policy = BLE_SCAN_FILTER_ALLOW_ALL,
     .scan_interval = 0x50,
     .scan_window = 0x30,
-    .scan_duplicate = BLE_SCAN_DUPLICATE_DISABLE};
+    .scan_duplicate = BLE_SCAN_DUPLICATE_ENABLE}; // The controller reports every address once per scan
 
 static discovery_handler scan_handler;
+static ready_handler on_ready = NULL;
+static conn_params_handler on_conn_params = NULL;
 
 static esp_gatt_if_t gatt_if;
 
 static uint16_t gatt_handle = ESP_GATT_IF_NONE;
-static uint16_t conn_id;
-static esp_bd_addr_t remote_bda;
 
-static void ble_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+struct ble_connection
+{
+    bool used; // Taken by ble_connect, until the disconnect or the failed open
+    bool open;
+    uint16_t conn_id;
+    esp_bd_addr_t bda;
+    int addr_type;
+    int8_t rssi; // Last reading, BLE_RSSI_NONE until the first one
+    uint16_t interval; // Negotiated parameters, 1.25 ms units
+    uint16_t latency;
+    uint16_t timeout; // 10 ms units
+    int64_t events_since; // Start of the connection events which aren't counted yet
+    struct ble_conn_params requested; // Last request, sent or queued behind the pending update
+    struct ble_conn_params sent;      // Request of the pending update
+    bool update_pending;
+    bool update_queued;
+};
+
+static struct ble_connection connections[MAX_CAMERAS];
+static uint32_t radio_events;
+
+static int ble_conn_by_bda(esp_bd_addr_t bda)
+{
+    for (int conn = 0; conn < MAX_CAMERAS; conn++)
+    {
+        if (connections[conn].used && memcmp(connections[conn].bda, bda, sizeof(esp_bd_addr_t)) == 0)
+        {
+            return conn;
+        }
+    }
+
+    return -1;
+}
+
+static int ble_conn_by_id(uint16_t conn_id)
+{
+    for (int conn = 0; conn < MAX_CAMERAS; conn++)
+    {
+        if (connections[conn].open && connections[conn].conn_id == conn_id)
+        {
+            return conn;
+        }
+    }
+
+    return -1;
+}
+
+// Adds the connection events since the last count, the rest of an interval is left for the next one
+static void ble_count_events(struct ble_connection *connection)
+{
+    int64_t interval_us = (int64_t)connection->interval * 1250;
+    uint32_t events = (uint32_t)((esp_timer_get_time() - connection->events_since) / interval_us);
+
+    radio_events += events;
+    connection->events_since += events * interval_us;
+}
+
+// The timeout is the one from the last request until an update reports it
+static bool ble_conn_params_in_use(const struct ble_connection *connection, const struct ble_conn_params *params)
+{
+    return (connection->interval >= params->min_interval && connection->interval <= params->max_interval &&
+            connection->latency == params->latency && (connection->timeout == params->timeout || connection->timeout == 0));
+}
+
+static bool ble_send_conn_params(int conn)
+{
+    struct ble_connection *connection = &connections[conn];
+    esp_ble_conn_update_params_t update = {
+        .min_int = connection->requested.min_interval,
+        .max_int = connection->requested.max_interval,
+        .latency = connection->requested.latency,
+        .timeout = connection->requested.timeout};
+    memcpy(update.bda, connection->bda, sizeof(esp_bd_addr_t));
+
+    connection->update_queued = false;
+    esp_err_t err = esp_ble_gap_update_conn_params(&update);
+    if (err != ESP_OK)
+    {
+        LOGE("Connection %d parameter update, %d", conn, err);
+        return false;
+    }
+
+    connection->sent = connection->requested;
+    connection->update_pending = true;
+    return true;
+}
+
+static void ble_gap_event(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
     esp_err_t err;
 
@@ -38,33 +152,38 @@ static void ble_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
     case ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT:
         if (param->local_privacy_cmpl.status != ESP_BT_STATUS_SUCCESS)
         {
-            ESP_LOGE(TAG, "config local privacy failed, error code =%x", param->local_privacy_cmpl.status);
-            break;
+            LOGE("config local privacy failed, error code =%x", param->local_privacy_cmpl.status);
+        }
+
+        // Last step of the stack setup after the app registration
+        if (on_ready != NULL)
+        {
+            on_ready();
         }
         break;
     case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
         if (param->scan_start_cmpl.status != ESP_BT_STATUS_SUCCESS)
         {
-            ESP_LOGE(TAG, "scan start failed, error status = %x", param->scan_start_cmpl.status);
+            LOGE("scan start failed, error status = %x", param->scan_start_cmpl.status);
             break;
         }
-        ESP_LOGI(TAG, "Scan start success");
+        LOGI("Scan start success");
         break;
     case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
     {
         if ((err = param->scan_stop_cmpl.status) != ESP_BT_STATUS_SUCCESS)
         {
-            ESP_LOGE(TAG, "Scan stop failed: %s", esp_err_to_name(err));
+            LOGE("Scan stop failed: %s", esp_err_to_name(err));
         }
         else
         {
-            ESP_LOGI(TAG, "Stop scan successfully");
+            LOGI("Stop scan successfully");
         }
         break;
     }
     case ESP_GAP_BLE_OOB_REQ_EVT:
     {
-        ESP_LOGI(TAG, "ESP_GAP_BLE_OOB_REQ_EVT");
+        LOGI("ESP_GAP_BLE_OOB_REQ_EVT");
         uint8_t tk[16] = {1}; //If you paired with OOB, both devices need to use the same tk
         esp_ble_oob_req_reply(param->ble_security.ble_req.bd_addr, tk, sizeof(tk));
         break;
@@ -78,21 +197,86 @@ static void ble_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
         /* The app will receive this evt when the IO has DisplayYesNO capability and the peer device IO also has DisplayYesNo capability.
         show the passkey number to the user to confirm it with the number displayed by peer device. */
         esp_ble_confirm_reply(param->ble_security.ble_req.bd_addr, true);
-        ESP_LOGI(TAG, "ESP_GAP_BLE_NC_REQ_EVT, the passkey Notify number:%d", param->ble_security.key_notif.passkey);
+        LOGI("ESP_GAP_BLE_NC_REQ_EVT, the passkey Notify number:%d", param->ble_security.key_notif.passkey);
         break;
     case ESP_GAP_BLE_AUTH_CMPL_EVT:
     {
+        int conn = ble_conn_by_bda(param->ble_security.auth_cmpl.bd_addr);
+        if (conn < 0)
+        {
+            LOGW("Bond result for an unknown connection");
+            break;
+        }
+
         if (!param->ble_security.auth_cmpl.success)
         {
-            ESP_LOGI(TAG, "Bond FAIL reason = 0x%x", param->ble_security.auth_cmpl.fail_reason);
+            LOGI("Bond FAIL reason = 0x%x", param->ble_security.auth_cmpl.fail_reason);
         }
         else
         {
-            ESP_LOGI(TAG, "Bond DONE");
+            LOGI("Bond DONE");
+        }
+
+        canon_bond_result(conn, param->ble_security.auth_cmpl.success);
+
+        break;
+    }
+    case ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT:
+    {
+        int conn = ble_conn_by_bda(param->read_rssi_cmpl.remote_addr);
+        if (conn >= 0 && param->read_rssi_cmpl.status == ESP_BT_STATUS_SUCCESS)
+        {
+            connections[conn].rssi = param->read_rssi_cmpl.rssi;
+        }
+        break;
+    }
+    case ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT:
+    {
+        int conn = ble_conn_by_bda(param->update_conn_params.bda);
+        if (conn < 0 || !connections[conn].open)
+        {
+            break;
+        }
+
+        // Also reported for updates the camera started, those leave the pending one running
+        struct ble_connection *connection = &connections[conn];
+        if (param->update_conn_params.status != ESP_BT_STATUS_SUCCESS)
+        {
+            LOGW("Connection %d parameter update failed, status %x, asked for %u-%u us, latency %u", conn,
+                     param->update_conn_params.status, connection->sent.min_interval * 1250,
+                     connection->sent.max_interval * 1250, connection->sent.latency);
+            connection->update_pending = false;
         }
+        else
+        {
+            ble_count_events(connection);
+            connection->interval = param->update_conn_params.conn_int;
+            connection->latency = param->update_conn_params.latency;
+            connection->timeout = param->update_conn_params.timeout;
+
+            bool requested = (connection->update_pending && ble_conn_params_in_use(connection, &connection->sent));
+            if (requested)
+            {
+                connection->update_pending = false;
+            }
 
-        canon_bond_result(param->ble_security.auth_cmpl.success);
+            LOGI("Connection %d interval %u us, latency %u, timeout %u ms%s", conn,
+                     connection->interval * 1250, connection->latency, connection->timeout * 10,
+                     (requested ? "" : ", by the camera"));
+        }
 
+        if (connection->update_pending)
+        {
+            break;
+        }
+        if (connection->update_queued && ble_send_conn_params(conn))
+        {
+            break;
+        }
+        if (on_conn_params != NULL)
+        {
+            on_conn_params(conn, ble_conn_params_in_use(connection, &connection->requested));
+        }
         break;
     }
     case ESP_GAP_BLE_SCAN_RESULT_EVT:
@@ -109,7 +293,7 @@ static void ble_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
             adv_name_len = strlen((char *)adv_name); // adv_name_len != real string length
             adv_name[adv_name_len] = 0;
 
-            scan_handler((char *)adv_name, adv_name_len, scan_result->scan_rst.bda, scan_result->scan_rst.ble_addr_type);
+            scan_handler((char *)adv_name, adv_name_len, scan_result->scan_rst.bda, scan_result->scan_rst.ble_addr_type, scan_result->scan_rst.rssi);
         }
         break;
     }
@@ -118,9 +302,10 @@ static void ble_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *par
     }
 }
 
-static void ble_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+static void ble_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
 {
     esp_ble_gattc_cb_param_t *p_data = (esp_ble_gattc_cb_param_t *)param;
+    int conn;
 
     switch (event)
     {
@@ -129,17 +314,32 @@ static void ble_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
         break;
     case ESP_GATTC_OPEN_EVT:
     {
+        if ((conn = ble_conn_by_bda(p_data->open.remote_bda)) < 0 || connections[conn].open)
+        {
+            LOGW("Open event for an unknown connection");
+            break;
+        }
         if (param->open.status != ESP_GATT_OK)
         {
-            ESP_LOGE(TAG, "Connection failed, %x", p_data->open.status);
+            LOGE("Connection failed, %x", p_data->open.status);
+            connections[conn].used = false;
+
+            // Reported like a disconnect, the page or the reconnect waiting for it moves on
+            canon_disconnect(conn);
             break;
         }
-        ESP_LOGI(TAG, "Connection success");
+        LOGI("Connection %d success", conn);
 
         gatt_if = gattc_if;
 
-        conn_id = p_data->open.conn_id;
-        memcpy(remote_bda, p_data->open.remote_bda, sizeof(esp_bd_addr_t));
+        connections[conn].open = true;
+        connections[conn].conn_id = p_data->open.conn_id;
+        connections[conn].interval = BLE_CONN_INTERVAL_DEFAULT;
+        connections[conn].latency = 0;
+        connections[conn].timeout = 0;
+        connections[conn].events_since = esp_timer_get_time();
+        connections[conn].update_pending = false;
+        connections[conn].update_queued = false;
 
         ERR_CHECK(esp_ble_gattc_send_mtu_req(gattc_if, p_data->open.conn_id), "Send MTU");
         break;
@@ -148,82 +348,117 @@ static void ble_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
     {
         if (param->cfg_mtu.status != ESP_GATT_OK)
         {
-            ESP_LOGE(TAG, "MTU config failed, %x", param->cfg_mtu.status);
+            LOGE("MTU config failed, %x", param->cfg_mtu.status);
+        }
+        LOGI("ESP_GATTC_CFG_MTU_EVT, Status %d, MTU %d, conn_id %d", param->cfg_mtu.status, param->cfg_mtu.mtu, param->cfg_mtu.conn_id);
+
+        if ((conn = ble_conn_by_id(param->cfg_mtu.conn_id)) < 0)
+        {
+            break;
+        }
+        if (!canon_cached_discovery(conn, connections[conn].bda))
+        {
+            ble_search_services(conn);
         }
-        ESP_LOGI(TAG, "ESP_GATTC_CFG_MTU_EVT, Status %d, MTU %d, conn_id %d", param->cfg_mtu.status, param->cfg_mtu.mtu, param->cfg_mtu.conn_id);
-        esp_ble_gattc_search_service(gattc_if, param->cfg_mtu.conn_id, NULL); // NULL filter, find all services
         break;
     }
     case ESP_GATTC_SEARCH_RES_EVT:
     {
-        ESP_LOGI(TAG, "ESP_GATTC_SEARCH_RES_EVT: conn_id = %x is primary service %d", p_data->search_res.conn_id, p_data->search_res.is_primary);
-        ESP_LOGI(TAG, "start handle %d end handle %d current handle value %d", p_data->search_res.start_handle, p_data->search_res.end_handle, p_data->search_res.srvc_id.inst_id);
+        LOGI("ESP_GATTC_SEARCH_RES_EVT: conn_id = %x is primary service %d", p_data->search_res.conn_id, p_data->search_res.is_primary);
+        LOGI("start handle %d end handle %d current handle value %d", p_data->search_res.start_handle, p_data->search_res.end_handle, p_data->search_res.srvc_id.inst_id);
+
+        if ((conn = ble_conn_by_id(p_data->search_res.conn_id)) < 0)
+        {
+            break;
+        }
 
         // Find services and save their handles
         esp_bt_uuid_t serviceUUID = p_data->search_res.srvc_id.uuid;
 
-        canon_service_discovery(serviceUUID, p_data->search_res.start_handle, p_data->search_res.end_handle);
+        canon_service_discovery(conn, serviceUUID, p_data->search_res.start_handle, p_data->search_res.end_handle);
         break;
     }
     case ESP_GATTC_SEARCH_CMPL_EVT:
     {
         if (p_data->search_cmpl.status != ESP_GATT_OK)
         {
-            ESP_LOGE(TAG, "Search service failed, error status = %x", p_data->search_cmpl.status);
+            LOGE("Search service failed, error status = %x", p_data->search_cmpl.status);
             break;
         }
         if (p_data->search_cmpl.searched_service_source == ESP_GATT_SERVICE_FROM_REMOTE_DEVICE)
         {
-            ESP_LOGI(TAG, "Got service information from remote device");
+            LOGI("Got service information from remote device");
         }
         else if (p_data->search_cmpl.searched_service_source == ESP_GATT_SERVICE_FROM_NVS_FLASH)
         {
-            ESP_LOGI(TAG, "Got service information from flash");
+            LOGI("Got service information from flash");
         }
         else
         {
-            ESP_LOGI(TAG, "Unknown service source");
+            LOGI("Unknown service source");
+        }
+
+        if ((conn = ble_conn_by_id(p_data->search_cmpl.conn_id)) < 0)
+        {
+            break;
         }
 
-        canon_discovery_complete(gattc_if);
+        canon_discovery_complete(conn, gattc_if);
         break;
     }
     case ESP_GATTC_WRITE_CHAR_EVT:
     {
         if (p_data->write.status != ESP_GATT_OK)
         {
-            ESP_LOGE(TAG, "Write char failed, error status = %x", p_data->write.status);
+            LOGE("Write char failed, error status = %x", p_data->write.status);
         }
 
-        canon_char_write_result(p_data->write.status == ESP_GATT_OK);
+        if ((conn = ble_conn_by_id(p_data->write.conn_id)) >= 0)
+        {
+            canon_char_write_result(conn, p_data->write.status == ESP_GATT_OK);
+        }
         break;
     }
     case ESP_GATTC_WRITE_DESCR_EVT:
     {
         if (p_data->write.status != ESP_GATT_OK)
         {
-            ESP_LOGE(TAG, "write descr failed, error status = %x", p_data->write.status);
+            LOGE("write descr failed, error status = %x", p_data->write.status);
         }
         else
         {
-            ESP_LOGI(TAG, "write descr ok");
+            LOGI("write descr ok");
         }
 
-        canon_chardesc_write_result(p_data->write.status == ESP_GATT_OK);
+        if ((conn = ble_conn_by_id(p_data->write.conn_id)) >= 0)
+        {
+            canon_chardesc_write_result(conn, p_data->write.status == ESP_GATT_OK);
+        }
         break;
     }
     case ESP_GATTC_NOTIFY_EVT:
     {
-        ESP_LOGI(TAG, "ESP_GATTC_NOTIFY_EVT, receive notify value:");
-        esp_log_buffer_hex(TAG, p_data->notify.value, p_data->notify.value_len);
+        LOGD("Connection %d notify, handle %d, %d bytes:", p_data->notify.conn_id, p_data->notify.handle, p_data->notify.value_len);
+        LOGD_HEX(p_data->notify.value, p_data->notify.value_len);
 
-        canon_char_notify(p_data->notify.handle, p_data->notify.value, p_data->notify.value_len);
+        if ((conn = ble_conn_by_id(p_data->notify.conn_id)) >= 0)
+        {
+            canon_char_notify(conn, p_data->notify.handle, p_data->notify.value, p_data->notify.value_len);
+        }
         break;
     }
     case ESP_GATTC_DISCONNECT_EVT:
     {
-        ESP_LOGI(TAG, "ESP_GATTC_DISCONNECT_EVT");
-        canon_disconnect();
+        if ((conn = ble_conn_by_id(p_data->disconnect.conn_id)) < 0)
+        {
+            break;
+        }
+        LOGI("ESP_GATTC_DISCONNECT_EVT, connection %d", conn);
+
+        ble_count_events(&connections[conn]);
+        connections[conn].used = false;
+        connections[conn].open = false;
+        canon_disconnect(conn);
         break;
     }
     default:
@@ -231,7 +466,7 @@ static void ble_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp
     }
 }
 
-static void ble_main_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+static void ble_main_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
 {
     if (event == ESP_GATTC_REG_EVT)
     {
@@ -241,7 +476,7 @@ static void ble_main_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if
         }
         else
         {
-            ESP_LOGI(TAG, "Reg app failed, app_id %04x, status %d",
+            LOGI("Reg app failed, app_id %04x, status %d",
                      param->reg.app_id,
                      param->reg.status);
             return;
@@ -251,13 +486,90 @@ static void ble_main_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if
     if (gattc_if == ESP_GATT_IF_NONE || /* ESP_GATT_IF_NONE, not specify a certain gatt_if, need to call every profile cb function */
         gattc_if == gatt_handle)
     {
-        ble_gattc_cb(event, gattc_if, param);
+        ble_gattc_event(event, gattc_if, param);
+    }
+}
+
+// Bluedroid task, copy the event for the dispatcher
+static void ble_gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
+{
+    // Other devices are dropped before they take a place in the event queue
+    if (SCAN_CANON_ONLY && event == ESP_GAP_BLE_SCAN_RESULT_EVT &&
+        param->scan_rst.search_evt == ESP_GAP_SEARCH_INQ_RES_EVT && !canon_adv_match(param->scan_rst.ble_adv))
+    {
+        return;
+    }
+    TRACE_INSTANT(TRACE_GAP_CB, event, 0);
+
+    struct app_event app_event = {.type = APP_EVENT_BLE_GAP};
+    app_event.gap.event = event;
+    app_event.gap.param = *param;
+
+    // The next advertisement reports the device again
+    if (event == ESP_GAP_BLE_SCAN_RESULT_EVT)
+    {
+        app_event_post_lossy(&app_event);
+    }
+    else if (!app_event_post_wait(&app_event, BLE_EVENT_WAIT_MS / portTICK_RATE_MS))
+    {
+        LOGE("GAP event %d lost, event queue full", event);
+    }
+}
+
+static void ble_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+{
+    TRACE_INSTANT(TRACE_GATTC_CB, event, 0);
+
+    struct app_event app_event = {.type = APP_EVENT_BLE_GATTC};
+    app_event.gattc.event = event;
+    app_event.gattc.gatt_if = gattc_if;
+    app_event.gattc.param = *param;
+
+    // The notification value is only valid during the callback
+    if (event == ESP_GATTC_NOTIFY_EVT)
+    {
+        uint16_t len = param->notify.value_len;
+        if (len > APP_EVENT_VALUE_LEN)
+        {
+            LOGW("Notification of %d bytes cut to %d", len, APP_EVENT_VALUE_LEN);
+            len = APP_EVENT_VALUE_LEN;
+        }
+
+        memcpy(app_event.gattc.value, param->notify.value, len);
+        app_event.gattc.param.notify.value_len = len;
+        app_event.gattc.param.notify.value = NULL;
+    }
+
+    if (!app_event_post_wait(&app_event, BLE_EVENT_WAIT_MS / portTICK_RATE_MS))
+    {
+        LOGE("GATTC event %d lost, event queue full", event);
+    }
+}
+
+// Dispatcher task
+static void ble_gap_dispatch(struct app_event *app_event)
+{
+    TRACE_BEGIN(TRACE_GAP, app_event->gap.event, 0);
+    ble_gap_event(app_event->gap.event, &app_event->gap.param);
+    TRACE_END(TRACE_GAP, app_event->gap.event, 0);
+}
+
+static void ble_gattc_dispatch(struct app_event *app_event)
+{
+    if (app_event->gattc.event == ESP_GATTC_NOTIFY_EVT)
+    {
+        app_event->gattc.param.notify.value = app_event->gattc.value;
     }
+
+    TRACE_BEGIN(TRACE_GATTC, app_event->gattc.event, 0);
+    ble_main_gattc_event(app_event->gattc.event, app_event->gattc.gatt_if, &app_event->gattc.param);
+    TRACE_END(TRACE_GATTC, app_event->gattc.event, 0);
 }
 
-int ble_get_chars(esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t service_end, uint8_t *searchUUIDs, int numUUIDs, uint16_t *resultHandles)
+int ble_get_chars(int conn, esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t service_end, uint8_t *searchUUIDs, int numUUIDs, uint16_t *resultHandles, uint8_t *resultProperties)
 {
     int found = 0;
+    uint16_t conn_id = connections[conn].conn_id;
 
     uint16_t count = 0;
     uint16_t offset = 0;
@@ -266,7 +578,7 @@ int ble_get_chars(esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t servic
     esp_gatt_status_t ret = esp_ble_gattc_get_attr_count(gatt_if, conn_id, ESP_GATT_DB_CHARACTERISTIC, service_start, service_end, INVALID_HANDLE, &count);
     if (ret != ESP_GATT_OK)
     {
-        ESP_LOGE(TAG, "esp_ble_gattc_get_attr_count error, %d", __LINE__);
+        LOGE("esp_ble_gattc_get_attr_count error, %d", __LINE__);
     }
     else
     {
@@ -276,7 +588,7 @@ int ble_get_chars(esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t servic
             esp_gattc_char_elem_t *char_elem_result = (esp_gattc_char_elem_t *)malloc(sizeof(esp_gattc_char_elem_t) * count);
             if (!char_elem_result)
             {
-                ESP_LOGE(TAG, "ble_get_chars no mem");
+                LOGE("ble_get_chars no mem");
             }
             else
             {
@@ -284,7 +596,7 @@ int ble_get_chars(esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t servic
                 ret = esp_ble_gattc_get_all_char(gatt_if, conn_id, service_start, service_end, char_elem_result, &count, offset);
                 if (ret != ESP_GATT_OK)
                 {
-                    ESP_LOGE(TAG, "esp_ble_gattc_get_all_char error, %d", __LINE__);
+                    LOGE("esp_ble_gattc_get_all_char error, %d", __LINE__);
                 }
                 if (count > 0)
                 {
@@ -302,6 +614,10 @@ int ble_get_chars(esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t servic
                                 if (memcmp(chr_uuid.uuid.uuid128, uuidPtr, ESP_UUID_LEN_128) == 0)
                                 {
                                     resultHandles[findIndex] = char_elem_result[i].char_handle;
+                                    if (resultProperties != NULL)
+                                    {
+                                        resultProperties[findIndex] = char_elem_result[i].properties;
+                                    }
 
                                     found++;
                                 }
@@ -309,7 +625,7 @@ int ble_get_chars(esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t servic
                         }
                         else
                         {
-                            ESP_LOGW(TAG, "Only 128bit characteristics UUIDs supported!");
+                            LOGW("Only 128bit characteristics UUIDs supported!");
                         }
                     }
                 }
@@ -334,9 +650,11 @@ void ble_init()
     ERR_CHECK(esp_bluedroid_init(), "bd_init");
     ERR_CHECK(esp_bluedroid_enable(), "bd_enable");
 
-    // Register callbacks
+    // Register callbacks, the events are handled on the dispatcher task
+    app_event_set_handler(APP_EVENT_BLE_GAP, ble_gap_dispatch);
+    app_event_set_handler(APP_EVENT_BLE_GATTC, ble_gattc_dispatch);
     ERR_CHECK(esp_ble_gap_register_callback(ble_gap_cb), "gap_cb");
-    ERR_CHECK(esp_ble_gattc_register_callback(ble_main_gattc_cb), "gatt_cb");
+    ERR_CHECK(esp_ble_gattc_register_callback(ble_gattc_cb), "gatt_cb");
 
     // Register GATTC app
     ERR_CHECK(esp_ble_gattc_app_register(APP_BLE_APP_ID), "gatt_app_reg");
@@ -362,6 +680,16 @@ void ble_init()
     esp_ble_gap_set_scan_params(&ble_scan_params);
 }
 
+void ble_set_on_ready(ready_handler handler)
+{
+    on_ready = handler;
+}
+
+void ble_set_on_conn_params(conn_params_handler handler)
+{
+    on_conn_params = handler;
+}
+
 void ble_scan_start(discovery_handler handler)
 {
     scan_handler = handler;
@@ -374,40 +702,204 @@ void ble_scan_stop()
     esp_ble_gap_stop_scanning();
 }
 
-void ble_connect(uint8_t *address, int type)
+int ble_connect(uint8_t *address, int type)
 {
     esp_bd_addr_t *esp_adr = (esp_bd_addr_t *)address;
 
-    esp_ble_gattc_open(gatt_handle, *esp_adr, (esp_ble_addr_type_t)type, true);
+    if (ble_conn_by_bda(*esp_adr) >= 0)
+    {
+        LOGW("Already connected to the camera");
+        return -1;
+    }
+
+    int conn = 0;
+    while (conn < MAX_CAMERAS && connections[conn].used)
+    {
+        conn++;
+    }
+    if (conn == MAX_CAMERAS)
+    {
+        LOGW("No free connection");
+        return -1;
+    }
+
+    if (esp_ble_gattc_open(gatt_handle, *esp_adr, (esp_ble_addr_type_t)type, true) != ESP_OK)
+    {
+        LOGE("Open failed");
+        return -1;
+    }
+
+    connections[conn].used = true;
+    connections[conn].open = false;
+    memcpy(connections[conn].bda, *esp_adr, sizeof(esp_bd_addr_t));
+    connections[conn].addr_type = type;
+    connections[conn].rssi = BLE_RSSI_NONE;
+
+    return conn;
+}
+
+bool ble_get_peer(int conn, esp_bd_addr_t bda, int *type)
+{
+    if (conn < 0 || conn >= MAX_CAMERAS || !connections[conn].used)
+    {
+        return false;
+    }
+
+    memcpy(bda, connections[conn].bda, sizeof(esp_bd_addr_t));
+    *type = connections[conn].addr_type;
+    return true;
+}
+
+void ble_read_rssi(int conn)
+{
+    if (conn < 0 || conn >= MAX_CAMERAS || !connections[conn].open)
+    {
+        return;
+    }
+
+    esp_ble_gap_read_rssi(connections[conn].bda);
+}
+
+int8_t ble_get_rssi(int conn)
+{
+    if (conn < 0 || conn >= MAX_CAMERAS || !connections[conn].used)
+    {
+        return BLE_RSSI_NONE;
+    }
+
+    return connections[conn].rssi;
+}
+
+bool ble_update_conn_params(int conn, const struct ble_conn_params *params)
+{
+    if (conn < 0 || conn >= MAX_CAMERAS || !connections[conn].open)
+    {
+        return false;
+    }
+
+    struct ble_connection *connection = &connections[conn];
+    connection->requested = *params;
+
+    if (connection->update_pending)
+    {
+        connection->update_queued = true;
+        return true;
+    }
+
+    // Nothing to change
+    if (ble_conn_params_in_use(connection, params))
+    {
+        connection->update_queued = false;
+        return true;
+    }
+
+    return ble_send_conn_params(conn);
+}
+
+bool ble_get_conn_params(int conn, struct ble_conn_params *params)
+{
+    if (conn < 0 || conn >= MAX_CAMERAS || !connections[conn].open)
+    {
+        return false;
+    }
+
+    params->min_interval = connections[conn].interval;
+    params->max_interval = connections[conn].interval;
+    params->latency = connections[conn].latency;
+    params->timeout = connections[conn].timeout;
+    return true;
+}
+
+uint32_t ble_get_conn_interval_us(int conn)
+{
+    if (conn < 0 || conn >= MAX_CAMERAS || !connections[conn].open)
+    {
+        return 0;
+    }
+
+    return connections[conn].interval * 1250;
+}
+
+uint32_t ble_radio_events()
+{
+    for (int conn = 0; conn < MAX_CAMERAS; conn++)
+    {
+        if (connections[conn].open)
+        {
+            ble_count_events(&connections[conn]);
+        }
+    }
+
+    return radio_events;
+}
+
+void ble_disconnect(int conn)
+{
+    if (conn < 0 || conn >= MAX_CAMERAS || !connections[conn].used)
+    {
+        return;
+    }
+
+    esp_ble_gattc_close(gatt_if, connections[conn].conn_id);
+
+    // A connection still being opened reports no disconnect
+    if (!connections[conn].open)
+    {
+        connections[conn].used = false;
+    }
 }
 
-void ble_disconnect()
+int ble_connection_count()
 {
-    esp_ble_gattc_close(gatt_if, conn_id);
+    int count = 0;
+    for (int conn = 0; conn < MAX_CAMERAS; conn++)
+    {
+        if (connections[conn].used)
+        {
+            count++;
+        }
+    }
+
+    return count;
 }
 
-bool ble_write_char(uint16_t handle, uint8_t *data, int dataLength)
+bool ble_write_char(int conn, uint16_t handle, uint8_t *data, int dataLength)
 {
-    ESP_LOGI(TAG, "ble_write_char %d %d", handle, dataLength);
+    // Debug level, the trigger fan-out writes to all cameras back to back
+    LOGD("ble_write_char %d %d %d", conn, handle, dataLength);
+
+    esp_err_t err = esp_ble_gattc_write_char(gatt_if, connections[conn].conn_id, handle, dataLength, data, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+    return (err == ESP_OK);
+}
 
-    esp_err_t err = esp_ble_gattc_write_char(gatt_if, conn_id, handle, dataLength, data, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
+bool ble_write_char_no_rsp(int conn, uint16_t handle, uint8_t *data, int dataLength)
+{
+    // Completes locally with ESP_GATTC_WRITE_CHAR_EVT once the packet is queued, without waiting for the camera
+    esp_err_t err = esp_ble_gattc_write_char(gatt_if, connections[conn].conn_id, handle, dataLength, data, ESP_GATT_WRITE_TYPE_NO_RSP, ESP_GATT_AUTH_REQ_NONE);
     return (err == ESP_OK);
 }
 
-bool ble_write_char_secure(uint16_t handle, uint8_t *data, int dataLength)
+bool ble_write_char_secure(int conn, uint16_t handle, uint8_t *data, int dataLength)
+{
+    return (esp_ble_gattc_write_char(gatt_if, connections[conn].conn_id, handle, dataLength, data, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_SIGNED_MITM) == ESP_OK);
+}
+
+void ble_search_services(int conn)
 {
-    return (esp_ble_gattc_write_char(gatt_if, conn_id, handle, dataLength, data, ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_SIGNED_MITM) == ESP_OK);
+    ERR_CHECK(esp_ble_gattc_search_service(gatt_if, connections[conn].conn_id, NULL), "search_service"); // NULL filter, find all services
 }
 
-static void write_chr_desc(uint16_t service_start, uint16_t service_end, uint16_t handle, uint16_t value, bool safe)
+uint16_t ble_find_cccd(int conn, uint16_t service_start, uint16_t service_end, uint16_t handle)
 {
+    uint16_t conn_id = connections[conn].conn_id;
+    uint16_t cccd_handle = INVALID_HANDLE;
     uint16_t count = 0;
     uint16_t offset = 0;
 
     esp_gatt_status_t ret_status = esp_ble_gattc_get_attr_count(gatt_if, conn_id, ESP_GATT_DB_DESCRIPTOR, service_start, service_end, handle, &count);
     if (ret_status != ESP_GATT_OK)
     {
-        ESP_LOGE(TAG, "esp_ble_gattc_get_attr_count error, %d", __LINE__);
+        LOGE("esp_ble_gattc_get_attr_count error, %d", __LINE__);
     }
 
     if (count > 0)
@@ -415,14 +907,14 @@ static void write_chr_desc(uint16_t service_start, uint16_t service_end, uint16_
         esp_gattc_descr_elem_t *descr_elem_result = malloc(sizeof(esp_gattc_descr_elem_t) * count);
         if (!descr_elem_result)
         {
-            ESP_LOGE(TAG, "ble_enable_indication no mem");
+            LOGE("ble_find_cccd no mem");
         }
         else
         {
             ret_status = esp_ble_gattc_get_all_descr(gatt_if, conn_id, handle, descr_elem_result, &count, offset);
             if (ret_status != ESP_GATT_OK)
             {
-                ESP_LOGE(TAG, "esp_ble_gattc_get_all_descr error, %d %x", __LINE__, ret_status);
+                LOGE("esp_ble_gattc_get_all_descr error, %d %x", __LINE__, ret_status);
             }
 
             for (int i = 0; i < count; ++i)
@@ -431,24 +923,8 @@ static void write_chr_desc(uint16_t service_start, uint16_t service_end, uint16_
 
                 if (cuuid.len == ESP_UUID_LEN_16 && cuuid.uuid.uuid16 == 0x2902) // Characteristic settings
                 {
-                    // Register for notification
-                    esp_err_t err = esp_ble_gattc_register_for_notify(gatt_if, remote_bda, handle);
-                    if (err != ESP_OK)
-                    {
-                        ESP_LOGI(TAG, "esp_ble_gattc_register_for_notify FAIL %d", err);
-                    }
-
-                    ESP_LOGI(TAG, "Writing 0x2902");
-
-                    // Write the indication flag
-                    err = esp_ble_gattc_write_char_descr(gatt_if, conn_id, descr_elem_result[i].handle,
-                                                         sizeof(value), (uint8_t *)&value,
-                                                         ESP_GATT_WRITE_TYPE_RSP, safe ?  ESP_GATT_AUTH_REQ_SIGNED_MITM : ESP_GATT_AUTH_REQ_NONE);
-
-                    if (err != ESP_OK)
-                    {
-                        ESP_LOGI(TAG, "esp_ble_gattc_write_char_descr FAIL %d", err);
-                    }
+                    cccd_handle = descr_elem_result[i].handle;
+                    break;
                 }
             }
         }
@@ -456,16 +932,40 @@ static void write_chr_desc(uint16_t service_start, uint16_t service_end, uint16_
     }
     else
     {
-        ESP_LOGE(TAG, "No descs got!");
+        LOGE("No descs got!");
+    }
+
+    return cccd_handle;
+}
+
+static void write_chr_desc(int conn, uint16_t handle, uint16_t cccd_handle, uint16_t value, bool safe)
+{
+    // Register for notification
+    esp_err_t err = esp_ble_gattc_register_for_notify(gatt_if, connections[conn].bda, handle);
+    if (err != ESP_OK)
+    {
+        LOGI("esp_ble_gattc_register_for_notify FAIL %d", err);
+    }
+
+    LOGI("Writing 0x2902");
+
+    // Write the indication flag
+    err = esp_ble_gattc_write_char_descr(gatt_if, connections[conn].conn_id, cccd_handle,
+                                         sizeof(value), (uint8_t *)&value,
+                                         ESP_GATT_WRITE_TYPE_RSP, safe ?  ESP_GATT_AUTH_REQ_SIGNED_MITM : ESP_GATT_AUTH_REQ_NONE);
+
+    if (err != ESP_OK)
+    {
+        LOGI("esp_ble_gattc_write_char_descr FAIL %d", err);
     }
 }
 
-void ble_enable_indication(uint16_t service_start, uint16_t service_end, uint16_t handle)
+void ble_enable_indication(int conn, uint16_t handle, uint16_t cccd_handle)
 {
-    write_chr_desc(service_start, service_end, handle, BLE_INDICATION, false);
+    write_chr_desc(conn, handle, cccd_handle, BLE_INDICATION, false);
 }
 
-void ble_enable_notification(uint16_t service_start, uint16_t service_end, uint16_t handle, bool safe)
+void ble_enable_notification(int conn, uint16_t handle, uint16_t cccd_handle, bool safe)
 {
-    write_chr_desc(service_start, service_end, handle, BLE_NOTIFICATION, safe);
+    write_chr_desc(conn, handle, cccd_handle, BLE_NOTIFICATION, safe);
 }
\ No newline at end of file
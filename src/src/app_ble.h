@@ -36,7 +36,22 @@
                                uid.uuid.uuid128[6], uid.uuid.uuid128[7], uid.uuid.uuid128[8], uid.uuid.uuid128[9], uid.uuid.uuid128[10], uid.uuid.uuid128[11], \
                                uid.uuid.uuid128[12], uid.uuid.uuid128[13], uid.uuid.uuid128[14], uid.uuid.uuid128[15]);
 
-typedef void (*discovery_handler)(const char *name, int len, esp_bd_addr_t adr, int adr_type);
+typedef void (*discovery_handler)(const char *name, int len, esp_bd_addr_t adr, int adr_type, int rssi);
+typedef void (*ready_handler)();
+typedef void (*conn_params_handler)(int conn, bool requested); // requested: the link has the last requested parameters
+
+#define BLE_RSSI_NONE (127) // HCI value for a RSSI which isn't available
+
+#define BLE_CONN_INTERVAL_DEFAULT (40) // Interval Bluedroid opens a connection with, until the first parameter update
+
+// Connection parameters, the intervals in 1.25 ms units and the timeout in 10 ms units
+struct ble_conn_params
+{
+    uint16_t min_interval;
+    uint16_t max_interval;
+    uint16_t latency; // Connection events the camera may skip when it has nothing to send
+    uint16_t timeout;
+};
 
 #define BLE_NOTIFICATION 0x0001
 #define BLE_INDICATION 0x0002
@@ -46,18 +61,48 @@ char *ble_auth_req_to_str(esp_ble_auth_req_t auth_req);
 
 void ble_init();
 
+// Called once the stack can connect, ble_connect fails before
+void ble_set_on_ready(ready_handler handler);
+
 void ble_scan_start(discovery_handler handler);
 void ble_scan_stop();
 
-void ble_connect(uint8_t *address, int type);
-void ble_disconnect();
+// Returns the connection, which is also the camera index in canon_ble, or -1 if no connection is free
+int ble_connect(uint8_t *address, int type);
+void ble_disconnect(int conn);
+int ble_connection_count(); // Connections taken, open or being opened
+
+// Address of the camera on the connection, false if the connection is free
+bool ble_get_peer(int conn, esp_bd_addr_t bda, int *type);
+
+// Requests a new reading, ble_get_rssi returns the last one
+void ble_read_rssi(int conn);
+int8_t ble_get_rssi(int conn);
+
+// Asks the camera for new parameters, ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT reports what it took.
+// Queued behind a pending update, false if the connection isn't open or the request couldn't be sent
+bool ble_update_conn_params(int conn, const struct ble_conn_params *params);
+
+// Called on the dispatcher task once a parameter update is reported and no request of ours is left in flight
+void ble_set_on_conn_params(conn_params_handler handler);
+
+// Parameters in use, min and max interval are the negotiated one, false if the connection isn't open
+bool ble_get_conn_params(int conn, struct ble_conn_params *params);
+uint32_t ble_get_conn_interval_us(int conn); // 0 if the connection isn't open
+
+// Connection events of all links since boot, counted from the negotiated intervals
+uint32_t ble_radio_events();
+
+void ble_search_services(int conn);
 
-int ble_get_chars(esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t service_end, uint8_t* searchUUIDs, int numUUIDs, uint16_t* resultHandles);
+int ble_get_chars(int conn, esp_gatt_if_t gatt_if, uint16_t service_start, uint16_t service_end, uint8_t* searchUUIDs, int numUUIDs, uint16_t* resultHandles, uint8_t* resultProperties);
 
-bool ble_write_char(uint16_t handle, uint8_t *data, int dataLength);
-bool ble_write_char_secure(uint16_t handle, uint8_t *data, int dataLength);
+bool ble_write_char(int conn, uint16_t handle, uint8_t *data, int dataLength);
+bool ble_write_char_no_rsp(int conn, uint16_t handle, uint8_t *data, int dataLength);
+bool ble_write_char_secure(int conn, uint16_t handle, uint8_t *data, int dataLength);
 
-void ble_enable_indication(uint16_t service_start, uint16_t service_end, uint16_t handle);
-void ble_enable_notification(uint16_t service_start, uint16_t service_end, uint16_t handle, bool safe);
+uint16_t ble_find_cccd(int conn, uint16_t service_start, uint16_t service_end, uint16_t handle);
+void ble_enable_indication(int conn, uint16_t handle, uint16_t cccd_handle);
+void ble_enable_notification(int conn, uint16_t handle, uint16_t cccd_handle, bool safe);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include "app_event.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+
+#include "trace.h"
+#include "app_log.h"
+
+#define TAG "EVENT"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+#define APP_EVENT_QUEUE_LEN (24)
+#define APP_EVENT_RESERVED (8) // Slots the lossy events leave free for the ones which must not be lost
+#define APP_EVENT_TASK_PRIORITY (10)
+#define APP_EVENT_TASK_STACK (1024 * 8)
+
+/*
+Event loop:
+    1. Input, the timers and the Bluedroid callbacks only copy what happened into an event and post it
+    2. The dispatcher task takes the events in order and runs the handler of the event type
+    3. The menu, canon_ble and app_ble state is only touched from the handlers, so it needs no locks
+
+    The handlers must not block, the time from posting to the handler and the handling time are measured per type.
+
+Full queue:
+    1. Scan results, input, ticks and frames are posted lossy, they only take a slot while APP_EVENT_RESERVED are free
+    2. Everything else may use the reserve: a lost write or open event stalls the camera, a lost shot is missing from
+       the shot log. The Bluedroid task waits a bit for a slot, the timer and the handlers can't
+    3. A lost event is counted as dropped, the poster logs or records it
+*/
+
+static xQueueHandle event_queue = NULL;
+static app_event_handler handlers[APP_EVENT_COUNT];
+static struct app_event_stats stats[APP_EVENT_COUNT];
+
+static const char *type_names[APP_EVENT_COUNT] = {
+    "input",
+    "tick",
+    "shot",
+    "gap",
+    "gattc",
+    "trigger",
+    "frame",
+    "reconnect",
+    "power"};
+
+static void app_event_task(void *arg)
+{
+    while (true)
+    {
+        app_event_dispatch(portMAX_DELAY);
+    }
+}
+
+void app_event_init()
+{
+    event_queue = xQueueCreate(APP_EVENT_QUEUE_LEN, sizeof(struct app_event));
+}
+
+void app_event_start()
+{
+    xTaskCreate(app_event_task, "event_task", APP_EVENT_TASK_STACK, NULL, APP_EVENT_TASK_PRIORITY, NULL);
+}
+
+void app_event_set_handler(uint8_t type, app_event_handler handler)
+{
+    handlers[type] = handler;
+}
+
+bool app_event_post_wait(struct app_event *event, TickType_t wait)
+{
+    event->posted_us = esp_timer_get_time();
+
+    if (xQueueSend(event_queue, event, wait) != pdTRUE)
+    {
+        stats[event->type].dropped++;
+        return false;
+    }
+
+    return true;
+}
+
+bool app_event_post(struct app_event *event)
+{
+    return app_event_post_wait(event, 0);
+}
+
+bool app_event_post_lossy(struct app_event *event)
+{
+    // Two posters may both see the last free slot above the reserve, the reserve only shrinks by a few
+    if (uxQueueMessagesWaiting(event_queue) >= APP_EVENT_QUEUE_LEN - APP_EVENT_RESERVED)
+    {
+        stats[event->type].dropped++;
+        return false;
+    }
+
+    return app_event_post_wait(event, 0);
+}
+
+bool app_event_post_type(uint8_t type)
+{
+    struct app_event event = {.type = type};
+    return app_event_post(&event);
+}
+
+bool app_event_dispatch(TickType_t wait)
+{
+    struct app_event event;
+
+    if (xQueueReceive(event_queue, &event, wait) != pdTRUE)
+    {
+        return false;
+    }
+
+    if (event.type >= APP_EVENT_COUNT)
+    {
+        LOGE("Unknown event type %d", event.type);
+        return true;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    TRACE_BEGIN(TRACE_DISPATCH, event.type, 0);
+    if (handlers[event.type] != NULL)
+    {
+        handlers[event.type](&event);
+    }
+    TRACE_END(TRACE_DISPATCH, event.type, 0);
+
+    int64_t end = esp_timer_get_time();
+
+    struct app_event_stats *s = &stats[event.type];
+    uint32_t wait_us = (uint32_t)(start - event.posted_us);
+    uint32_t handle_us = (uint32_t)(end - start);
+
+    s->handled++;
+    s->total_handle_us += handle_us;
+    if (wait_us > s->max_wait_us)
+    {
+        s->max_wait_us = wait_us;
+    }
+    if (handle_us > s->max_handle_us)
+    {
+        s->max_handle_us = handle_us;
+    }
+
+    return true;
+}
+
+bool app_event_take_next(uint8_t type, struct app_event *event)
+{
+    // The dispatcher is the only reader, the peeked event can't be taken by anyone else
+    if (xQueuePeek(event_queue, event, 0) != pdTRUE || event->type != type)
+    {
+        return false;
+    }
+
+    xQueueReceive(event_queue, event, 0);
+    stats[type].merged++;
+
+    return true;
+}
+
+void app_event_get_stats(uint8_t type, struct app_event_stats *out)
+{
+    *out = stats[type];
+}
+
+void app_event_log_stats()
+{
+    for (int type = 0; type < APP_EVENT_COUNT; type++)
+    {
+        struct app_event_stats *s = &stats[type];
+        if (s->handled == 0 && s->dropped == 0 && s->merged == 0)
+        {
+            continue;
+        }
+
+        uint32_t avg_us = (uint32_t)(s->total_handle_us / (s->handled > 0 ? s->handled : 1));
+
+        LOGI("%-8s %u handled, %u merged, %u dropped, avg %u us, max %u us, max wait %u us",
+                 type_names[type], s->handled, s->merged, s->dropped, avg_us, s->max_handle_us, s->max_wait_us);
+    }
+}
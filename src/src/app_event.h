@@ -0,0 +1,98 @@
+#ifndef __APP_EVENT__
+#define __APP_EVENT__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_gattc_api.h"
+#include "esp_gap_ble_api.h"
+#include "freertos/FreeRTOS.h"
+
+#include "input.h"
+
+#define APP_EVENT_INPUT (0)        // Decoded rotary encoder or button input
+#define APP_EVENT_TIMER_TICK (1)   // Countdown refresh of the interval timer
+#define APP_EVENT_TIMER_SHOT (2)   // Interval timer deadline
+#define APP_EVENT_BLE_GAP (3)      // Copy of a Bluedroid GAP callback
+#define APP_EVENT_BLE_GATTC (4)    // Copy of a Bluedroid GATTC callback
+#define APP_EVENT_TRIGGER_DONE (5) // A trigger finished on all cameras it was sent to
+#define APP_EVENT_FRAME (6)        // The frame period is over, render the pending frame
+#define APP_EVENT_RECONNECT (7)    // The reconnect backoff of a lost camera is over
+#define APP_EVENT_POWER (8)        // Wake up ahead of the next shot of a battery run
+#define APP_EVENT_COUNT (9)
+
+#define APP_EVENT_VALUE_LEN (32) // Notification payload copied into the event, longer values are cut
+
+struct app_event
+{
+    uint8_t type;
+    int64_t posted_us;
+
+    union
+    {
+        struct input_event input;
+
+        struct
+        {
+            uint32_t shot;
+            int64_t deviation_us;
+        } timer;
+
+        struct
+        {
+            esp_gap_ble_cb_event_t event;
+            esp_ble_gap_cb_param_t param;
+        } gap;
+
+        struct
+        {
+            esp_gattc_cb_event_t event;
+            esp_gatt_if_t gatt_if;
+            esp_ble_gattc_cb_param_t param;
+            uint8_t value[APP_EVENT_VALUE_LEN]; // param.notify.value points here once dispatched
+        } gattc;
+
+        struct
+        {
+            bool success;              // At least one camera took the shot
+            uint8_t cameras;           // Cameras the trigger was sent to
+            uint8_t failed;
+            uint32_t press_release_us; // Slowest camera
+            uint32_t skew_us;          // Spread of the press over the cameras
+        } trigger;
+    };
+};
+
+typedef void (*app_event_handler)(struct app_event *event);
+
+struct app_event_stats
+{
+    uint32_t handled;
+    uint32_t dropped;      // Queue full when posted, or only the reserve left for a lossy event
+    uint32_t merged;       // Taken by the handler of an earlier event with app_event_take_next
+    uint32_t max_wait_us;  // From posting to the start of the handler
+    uint32_t max_handle_us;
+    uint64_t total_handle_us;
+};
+
+void app_event_init();
+void app_event_start();
+void app_event_set_handler(uint8_t type, app_event_handler handler);
+
+// May take the reserved slots, false if the queue is full
+bool app_event_post(struct app_event *event);
+bool app_event_post_wait(struct app_event *event, TickType_t wait);
+bool app_event_post_type(uint8_t type);
+
+// For events which can be lost or come again soon, false once only the reserved slots are left
+bool app_event_post_lossy(struct app_event *event);
+
+bool app_event_dispatch(TickType_t wait);
+
+// Only for handlers, takes the next queued event if it has the given type
+bool app_event_take_next(uint8_t type, struct app_event *event);
+
+void app_event_get_stats(uint8_t type, struct app_event_stats *stats);
+void app_event_log_stats();
+
+#endif
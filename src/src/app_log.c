@@ -0,0 +1,172 @@
+#include "app_log.h"
+
+#include <string.h>
+#include <stdarg.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#define TAG "LOG"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+#define LOG_TASK_PRIORITY (1) // Only above idle, writing the log never delays a shot
+#define LOG_TASK_STACK (3072)
+
+/*
+Deferred log:
+    esp_log_set_vprintf sends every log line, the ones of ESP-IDF and Bluedroid too, to log_vprintf.
+    1. The line is formatted on the stack of the caller and copied into the byte ring, a line which does not fit is
+       dropped and counted. The caller never waits for the UART
+    2. The log task is notified and writes the ring to stdout, it only runs when nothing else wants the CPU
+    3. Once the ring is empty the task logs how many lines were dropped
+
+    The caller formats the line, a va_list does not outlive the call and a %s argument may point to its stack.
+    Formatting takes a few microseconds, the UART takes 87 us per character at 115200 baud.
+*/
+
+static char ring[LOG_BUFFER_SIZE];
+static uint32_t head = 0; // Bytes written, both only grow
+static uint32_t tail = 0; // Bytes read
+static portMUX_TYPE ring_mux = portMUX_INITIALIZER_UNLOCKED;
+static struct app_log_stats stats;
+static uint32_t reported = 0; // Dropped lines already logged
+
+static SemaphoreHandle_t drain_lock = NULL; // The log task and app_log_flush
+static TaskHandle_t log_task_handle = NULL;
+
+static int log_vprintf(const char *format, va_list args)
+{
+    char line[LOG_LINE_MAX];
+
+    int length = vsnprintf(line, sizeof(line), format, args);
+    if (length <= 0)
+    {
+        return length;
+    }
+
+    bool cut = (length >= sizeof(line));
+    if (cut)
+    {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+    }
+
+    portENTER_CRITICAL(&ring_mux);
+    uint32_t used = head - tail;
+    bool stored = (used + length <= LOG_BUFFER_SIZE);
+    if (stored)
+    {
+        uint32_t offset = head % LOG_BUFFER_SIZE;
+        uint32_t first = (length < LOG_BUFFER_SIZE - offset ? length : LOG_BUFFER_SIZE - offset);
+        memcpy(&ring[offset], line, first);
+        memcpy(ring, &line[first], length - first);
+        head += length;
+
+        stats.lines++;
+        stats.cut += (cut ? 1 : 0);
+        if (used + length > stats.max_used)
+        {
+            stats.max_used = used + length;
+        }
+    }
+    else
+    {
+        stats.dropped++;
+    }
+    portEXIT_CRITICAL(&ring_mux);
+
+    if (stored && log_task_handle != NULL)
+    {
+        xTaskNotifyGive(log_task_handle);
+    }
+
+    return length;
+}
+
+int app_log_drain(FILE *out)
+{
+    if (drain_lock == NULL)
+    {
+        return 0;
+    }
+
+    xSemaphoreTake(drain_lock, portMAX_DELAY);
+
+    int written = 0;
+    while (true)
+    {
+        portENTER_CRITICAL(&ring_mux);
+        uint32_t end = head;
+        uint32_t dropped = stats.dropped;
+        portEXIT_CRITICAL(&ring_mux);
+
+        // The writers only add behind head, the bytes up to it stay put until tail passes them
+        if (end != tail)
+        {
+            uint32_t offset = tail % LOG_BUFFER_SIZE;
+            uint32_t length = end - tail;
+            if (length > LOG_BUFFER_SIZE - offset)
+            {
+                length = LOG_BUFFER_SIZE - offset;
+            }
+
+            fwrite(&ring[offset], 1, length, out);
+            written += length;
+
+            portENTER_CRITICAL(&ring_mux);
+            tail += length;
+            portEXIT_CRITICAL(&ring_mux);
+            continue;
+        }
+
+        // The ring has room for the report now, it goes out in the next round
+        if (dropped != reported)
+        {
+            LOGW("%u lines dropped, the log ring was full", dropped - reported);
+            reported = dropped;
+            continue;
+        }
+
+        break;
+    }
+
+    fflush(out);
+    xSemaphoreGive(drain_lock);
+
+    return written;
+}
+
+static void log_task(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        app_log_drain(stdout);
+    }
+}
+
+void app_log_init()
+{
+    if (!LOG_DEFERRED)
+    {
+        return;
+    }
+
+    drain_lock = xSemaphoreCreateMutex();
+    xTaskCreate(log_task, "log_task", LOG_TASK_STACK, NULL, LOG_TASK_PRIORITY, &log_task_handle);
+
+    esp_log_set_vprintf(log_vprintf);
+}
+
+void app_log_flush()
+{
+    app_log_drain(stdout);
+}
+
+void app_log_get_stats(struct app_log_stats *out)
+{
+    portENTER_CRITICAL(&ring_mux);
+    *out = stats;
+    portEXIT_CRITICAL(&ring_mux);
+}
@@ -0,0 +1,62 @@
+#ifndef __APP_LOG__
+#define __APP_LOG__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "config.h"
+
+/*
+Log levels:
+    Every module defines LOG_LEVEL next to its TAG, one of the LOG_LEVEL_* of config.h.
+    1. LOGE .. LOGV compare it with the level of the line at compile time, a line above it is not compiled in,
+       its arguments are not even evaluated
+    2. The lines below it go through ESP_LOGx, the runtime level of esp_log_level_set still applies
+*/
+#define LOG_AT(level, log, format, ...)           \
+    do                                            \
+    {                                             \
+        if (LOG_LEVEL >= (level))                 \
+        {                                         \
+            log(TAG, format, ##__VA_ARGS__);      \
+        }                                         \
+    } while (0)
+
+#define LOGE(format, ...) LOG_AT(ESP_LOG_ERROR, ESP_LOGE, format, ##__VA_ARGS__)
+#define LOGW(format, ...) LOG_AT(ESP_LOG_WARN, ESP_LOGW, format, ##__VA_ARGS__)
+#define LOGI(format, ...) LOG_AT(ESP_LOG_INFO, ESP_LOGI, format, ##__VA_ARGS__)
+#define LOGD(format, ...) LOG_AT(ESP_LOG_DEBUG, ESP_LOGD, format, ##__VA_ARGS__)
+#define LOGV(format, ...) LOG_AT(ESP_LOG_VERBOSE, ESP_LOGV, format, ##__VA_ARGS__)
+
+// Hex dump at the debug level
+#define LOGD_HEX(buffer, length)                                                \
+    do                                                                          \
+    {                                                                           \
+        if (LOG_LEVEL >= ESP_LOG_DEBUG)                                         \
+        {                                                                       \
+            ESP_LOG_BUFFER_HEX_LEVEL(TAG, (buffer), (length), ESP_LOG_DEBUG);   \
+        }                                                                       \
+    } while (0)
+
+struct app_log_stats
+{
+    uint32_t lines;   // Lines put into the ring
+    uint32_t dropped; // Lines lost to a full ring
+    uint32_t cut;     // Lines longer than LOG_LINE_MAX
+    uint32_t max_used; // Most bytes waiting in the ring
+};
+
+// With LOG_DEFERRED the ESP-IDF log output goes to a ring, a low priority task writes it to the console
+void app_log_init();
+
+// Writes what waits in the ring to out, the log task does this for stdout. Returns the bytes written
+int app_log_drain(FILE *out);
+
+// Writes the ring out from the caller, before the chip powers down
+void app_log_flush();
+
+void app_log_get_stats(struct app_log_stats *stats);
+
+#endif
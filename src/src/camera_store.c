@@ -0,0 +1,222 @@
+#include "camera_store.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_gap_ble_api.h"
+#include "nvs.h"
+
+#include "app_log.h"
+
+#define TAG "STORE"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+/*
+Camera store:
+    The BLE stack keeps the bonds but not the names, so the Connect page would have to scan until each camera
+    advertised again. The names and address types are stored in NVS per camera address next to the address of
+    the last connected camera, the bond list of the stack decides which cameras are offered.
+*/
+
+#define CAMERA_STORE_NAMESPACE "cameras"
+#define CAMERA_STORE_VERSION (1)
+#define CAMERA_STORE_LAST_KEY "last"
+
+struct camera_record
+{
+    uint8_t version;
+    uint8_t addr_type;
+    char name[CAMERA_STORE_NAME_LEN + 1];
+};
+
+static void camera_key(const uint8_t *bda, char *key)
+{
+    sprintf(key, "%02x%02x%02x%02x%02x%02x", bda[0], bda[1], bda[2], bda[3], bda[4], bda[5]);
+}
+
+static bool camera_load(nvs_handle handle, esp_bd_addr_t bda, struct stored_camera *camera)
+{
+    char key[13];
+    camera_key(bda, key);
+
+    memcpy(camera->bda, bda, sizeof(esp_bd_addr_t));
+
+    struct camera_record record;
+    size_t length = sizeof(record);
+    if (nvs_get_blob(handle, key, &record, &length) != ESP_OK || length != sizeof(record) || record.version != CAMERA_STORE_VERSION)
+    {
+        // Bonded before the names were stored
+        camera->addr_type = BLE_ADDR_TYPE_PUBLIC;
+        sprintf(camera->name, "Cam %02x%02x%02x", bda[3], bda[4], bda[5]);
+        return false;
+    }
+
+    camera->addr_type = record.addr_type;
+    memcpy(camera->name, record.name, sizeof(camera->name));
+    camera->name[CAMERA_STORE_NAME_LEN] = 0;
+    return true;
+}
+
+void camera_store_save(esp_bd_addr_t bda, int addr_type, const char *name)
+{
+    nvs_handle handle;
+    if (nvs_open(CAMERA_STORE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        LOGE("Camera store open failed");
+        return;
+    }
+
+    char key[13];
+    camera_key(bda, key);
+
+    struct camera_record record = {.version = CAMERA_STORE_VERSION, .addr_type = addr_type};
+    strncpy(record.name, name, CAMERA_STORE_NAME_LEN);
+
+    if (nvs_set_blob(handle, key, &record, sizeof(record)) != ESP_OK || nvs_commit(handle) != ESP_OK)
+    {
+        LOGE("Camera store failed");
+    }
+    nvs_close(handle);
+}
+
+void camera_store_set_last(esp_bd_addr_t bda)
+{
+    nvs_handle handle;
+    if (nvs_open(CAMERA_STORE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return;
+    }
+
+    // Skip the flash write if it didn't change
+    esp_bd_addr_t last;
+    size_t length = sizeof(last);
+    if (nvs_get_blob(handle, CAMERA_STORE_LAST_KEY, last, &length) != ESP_OK || memcmp(last, bda, sizeof(last)) != 0)
+    {
+        nvs_set_blob(handle, CAMERA_STORE_LAST_KEY, bda, sizeof(esp_bd_addr_t));
+        nvs_commit(handle);
+    }
+    nvs_close(handle);
+}
+
+// The bond list of the stack, NULL without bonds. The caller frees it
+static esp_ble_bond_dev_t *bond_list(int *bonds)
+{
+    *bonds = esp_ble_get_bond_device_num();
+    if (*bonds <= 0)
+    {
+        return NULL;
+    }
+
+    esp_ble_bond_dev_t *list = (esp_ble_bond_dev_t *)malloc(sizeof(esp_ble_bond_dev_t) * *bonds);
+    if (!list)
+    {
+        LOGE("Bond list no mem");
+        return NULL;
+    }
+    if (esp_ble_get_bond_device_list(bonds, list) != ESP_OK || *bonds <= 0)
+    {
+        free(list);
+        return NULL;
+    }
+
+    return list;
+}
+
+static bool read_last(nvs_handle handle, esp_bd_addr_t last)
+{
+    size_t length = sizeof(esp_bd_addr_t);
+    return (nvs_get_blob(handle, CAMERA_STORE_LAST_KEY, last, &length) == ESP_OK && length == sizeof(esp_bd_addr_t));
+}
+
+static void camera_fill(nvs_handle handle, bool opened, esp_bd_addr_t bda, struct stored_camera *camera)
+{
+    if (opened)
+    {
+        camera_load(handle, bda, camera);
+    }
+    else
+    {
+        memcpy(camera->bda, bda, sizeof(esp_bd_addr_t));
+        camera->addr_type = BLE_ADDR_TYPE_PUBLIC;
+        sprintf(camera->name, "Cam %02x%02x%02x", bda[3], bda[4], bda[5]);
+    }
+}
+
+int camera_store_bonded(struct stored_camera *cameras, int max)
+{
+    int bonds;
+    esp_ble_bond_dev_t *list = bond_list(&bonds);
+    if (list == NULL)
+    {
+        return 0;
+    }
+
+    nvs_handle handle;
+    bool opened = (nvs_open(CAMERA_STORE_NAMESPACE, NVS_READONLY, &handle) == ESP_OK);
+
+    // The whole list is searched for the last camera, it is listed even if max cuts the others
+    esp_bd_addr_t last;
+    int first = -1;
+    if (opened && read_last(handle, last))
+    {
+        for (int i = 0; i < bonds && first < 0; i++)
+        {
+            first = (memcmp(list[i].bd_addr, last, sizeof(last)) == 0 ? i : -1);
+        }
+    }
+
+    int count = 0;
+    if (first >= 0 && max > 0)
+    {
+        camera_fill(handle, opened, list[first].bd_addr, &cameras[count++]);
+    }
+    for (int i = 0; i < bonds && count < max; i++)
+    {
+        if (i != first)
+        {
+            camera_fill(handle, opened, list[i].bd_addr, &cameras[count++]);
+        }
+    }
+
+    if (opened)
+    {
+        nvs_close(handle);
+    }
+    free(list);
+
+    return count;
+}
+
+bool camera_store_last(struct stored_camera *camera)
+{
+    nvs_handle handle;
+    if (nvs_open(CAMERA_STORE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    esp_bd_addr_t last;
+    bool found = false;
+    int bonds;
+    esp_ble_bond_dev_t *list = NULL;
+
+    // Only if the stack still has its bond, wherever it is in the list
+    if (read_last(handle, last) && (list = bond_list(&bonds)) != NULL)
+    {
+        for (int i = 0; i < bonds && !found; i++)
+        {
+            found = (memcmp(list[i].bd_addr, last, sizeof(last)) == 0);
+        }
+    }
+
+    if (found)
+    {
+        camera_load(handle, last, camera);
+    }
+
+    nvs_close(handle);
+    free(list);
+
+    return found;
+}
@@ -0,0 +1,28 @@
+#ifndef __CAMERA_STORE__
+#define __CAMERA_STORE__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_bt_defs.h"
+
+#define CAMERA_STORE_NAME_LEN (16)
+
+struct stored_camera
+{
+    esp_bd_addr_t bda;
+    int addr_type;
+    char name[CAMERA_STORE_NAME_LEN + 1];
+};
+
+// Remembers the name and address type of a paired camera, the bond itself is kept by the BLE stack
+void camera_store_save(esp_bd_addr_t bda, int addr_type, const char *name);
+void camera_store_set_last(esp_bd_addr_t bda);
+
+// The cameras bonded in the BLE stack with their stored names, the last connected camera first even if max cuts the list
+int camera_store_bonded(struct stored_camera *cameras, int max);
+
+// The last connected camera, if it is still bonded
+bool camera_store_last(struct stored_camera *camera);
+
+#endif
@@ -1,6 +1,14 @@
 #include "canon_ble.h"
+#include "app_event.h"
+#include "config.h"
+#include "shot_log.h"
+#include "trace.h"
+#include "app_log.h"
+
+#include "esp_timer.h"
 
 #define TAG "CAN"
+#define LOG_LEVEL (LOG_LEVEL_CANON)
 
 static uint8_t pair_name[] = {0x01, 'T', 'I', 'M', 'E', 'R'};
 static uint8_t pair_platform[] = {0x05, 0x02}; // Android
@@ -14,22 +22,29 @@ static uint8_t trig_seq1[] = {0x00, 0x02};
 
 static uint8_t *get_char_data(int data_type, int *data_length);
 
+struct canon_camera;
+
 // Forward declarations
-static uint16_t get_char_handle(uint8_t can_type);
-static void execute_current_command();
+static uint16_t get_char_handle(struct canon_camera *cam, uint8_t can_type);
+static uint16_t get_char_cccd(struct canon_camera *cam, uint8_t can_type);
+static void execute_current_command(struct canon_camera *cam);
+static void fast_trigger_fallback(struct canon_camera *cam);
+static void clear_fast_flag(struct canon_camera *cam);
+static void trigger_round_camera_done(struct canon_camera *cam, uint8_t round, bool success, uint32_t press_release_us);
+static void pair_result(struct canon_camera *cam, bool accepted);
 
-static void callback_pair(bool accepted);
-static void callback_pair_complete(bool dontcare);
+static void callback_pair(struct canon_camera *cam, bool accepted);
+static void callback_pair_complete(struct canon_camera *cam, bool dontcare);
 
-static void callback_camera_connect_auth(bool dontcare);
+static void callback_camera_connect_auth(struct canon_camera *cam, bool dontcare);
 
 // Handlers
-static simple_callback on_connected_handler = NULL;
+static canon_camera_callback on_connected_handler = NULL;
 static canon_pair_state_callback on_pair_state_handler = NULL;
-static simple_callback on_disconnected_handler = NULL;
-static simple_callback on_auth_handler = NULL;
+static canon_camera_callback on_disconnected_handler = NULL;
+static canon_camera_callback on_auth_handler = NULL;
 
-void canon_set_on_connected(simple_callback handler)
+void canon_set_on_connected(canon_camera_callback handler)
 {
     on_connected_handler = handler;
 }
@@ -39,12 +54,12 @@ void canon_set_pair_state_callback(canon_pair_state_callback handler)
     on_pair_state_handler = handler;
 }
 
-void canon_set_on_disconnected(simple_callback handler)
+void canon_set_on_disconnected(canon_camera_callback handler)
 {
     on_disconnected_handler = handler;
 }
 
-void canon_set_on_auth(simple_callback handler)
+void canon_set_on_auth(canon_camera_callback handler)
 {
     on_auth_handler = handler;
 }
@@ -57,6 +72,7 @@ void canon_set_on_auth(simple_callback handler)
 #define BLE_CMD_WAIT_INDICATION (4)
 #define BLE_CMD_ENABLE_NOTIFICATION (5)
 #define BLE_CMD_ENABLE_NOTIFICATION_SAFE (6)
+#define BLE_CMD_WRITE_NO_RSP (7)
 
 #define CAN_CHR_NONE (0)
 #define CAN_CHR_PAIR_COMMAND (1)
@@ -80,12 +96,15 @@ struct canon_command
     uint8_t can_data;
 };
 
+typedef void (*canon_done_callback)(struct canon_camera *cam, bool result);
+
 struct canon_commandset
 {
     uint8_t id;
     uint8_t num;
     struct canon_command *set;
-    simple_statue_callback on_done;
+    canon_done_callback on_done;
+    uint8_t round; // Trigger round of a trigger set
 };
 
 static struct canon_command cmdset_pair_request[] = {
@@ -129,6 +148,12 @@ static struct canon_command cmdset_trigger[] = {
     {.ble_type = BLE_CMD_WRITE, .can_chr = CAN_CHR_TRIG, .can_data = CAN_DATA_TRIG1},
 };
 
+static struct canon_command cmdset_trigger_fast[] = {
+    // Same sequence without waiting for the camera to acknowledge the writes, both go out in the next connection events
+    {.ble_type = BLE_CMD_WRITE_NO_RSP, .can_chr = CAN_CHR_TRIG, .can_data = CAN_DATA_TRIG0},
+    {.ble_type = BLE_CMD_WRITE_NO_RSP, .can_chr = CAN_CHR_TRIG, .can_data = CAN_DATA_TRIG1},
+};
+
 #define CMD_PAIR (0)
 #define CMD_PAIR_INFO (1)
 #define CMD_CONNECT (2)
@@ -150,147 +175,740 @@ static struct canon_command cmdset_trigger[] = {
     {                                                                       \
         .id = CMD_TRIGGER, .num = 2, .set = cmdset_trigger, .on_done = NULL \
     }
+#define CMDSET_TRIGGER_FAST                                                      \
+    {                                                                            \
+        .id = CMD_TRIGGER, .num = 2, .set = cmdset_trigger_fast, .on_done = NULL \
+    }
 
-static struct canon_command *active_cmdset = NULL;
-static uint8_t command_id;
-static uint8_t current_command;
-static uint8_t num_command;
-static simple_statue_callback ondone_cmdset = NULL;
+// Command set queue, a set only starts after the previous one is done
+// Everything here runs on the event dispatcher task, the queue needs no lock
+#define CMD_QUEUE_LEN (8)
 
-static void execute_command_set(struct canon_commandset cmdset)
+// Services and characteristics
+struct canon_service
 {
-    ESP_LOGI(TAG, "Executing command set %d", cmdset.id);
+    uint16_t start_handle;
+    uint16_t end_handle;
+};
 
-    active_cmdset = cmdset.set;
-    command_id = cmdset.id;
-    current_command = 0;
-    num_command = cmdset.num;
-    ondone_cmdset = cmdset.on_done;
+struct canon_handles
+{
+    struct canon_service pair_service;
+    struct canon_service trigger_service;
+
+    uint16_t pair_service_chars[2];
+    uint16_t trigger_service_chars[3];
+    uint8_t trigger_service_props[3];
+
+    // Client characteristic configuration descriptors of the PAIR command and TRIGGER notification characteristics
+    uint16_t pair_command_cccd;
+    uint16_t trigger_notif_cccd;
+};
 
-    execute_current_command();
+// Per connection context, the index is the connection of app_ble
+struct canon_camera
+{
+    int index;
+
+    struct canon_command *active_cmdset;
+    uint8_t command_id;
+    uint8_t current_command;
+    uint8_t num_command;
+    canon_done_callback ondone_cmdset;
+    uint8_t round;
+
+    struct canon_commandset cmd_queue[CMD_QUEUE_LEN];
+    uint8_t cmd_queue_head;
+    uint8_t cmd_queue_count;
+    bool cmdset_active;
+
+    struct canon_handles handles;
+    esp_bd_addr_t bda;
+    bool handles_from_cache;
+    bool rediscovering;
+
+    // The pair result indication overtook the response of the CCCD write which enabled it, taken by the wait step
+    bool indication_early;
+    bool indication_accepted;
+
+    bool authenticated; // The connect set is done, the camera takes part in the trigger fan-out
+    bool fast_trigger_supported;
+    int64_t trigger_press_time;
+
+    struct canon_camera_stats stats;
+};
+
+static struct canon_camera cameras[MAX_CAMERAS];
+
+static int trigger_policy = CANON_TRIGGER_QUEUE;
+static struct canon_trigger_stats trigger_stats;
+
+// Low latency triggers, only used if the camera declares write without response on the trigger characteristic
+static bool fast_trigger_enabled = CANON_FAST_TRIGGER;
+
+// The index is kept in the context for the ble_* calls and the logs
+static struct canon_camera *get_camera(int camera)
+{
+    struct canon_camera *cam = &cameras[camera];
+    cam->index = camera;
+    return cam;
 }
 
-// Services and characteristics
-struct canon_service
+static void load_command_set(struct canon_camera *cam, struct canon_commandset cmdset)
 {
-    uint16_t start_handle;
-    uint16_t end_handle;
+    cam->active_cmdset = cmdset.set;
+    cam->command_id = cmdset.id;
+    cam->current_command = 0;
+    cam->num_command = cmdset.num;
+    cam->ondone_cmdset = cmdset.on_done;
+    cam->round = cmdset.round;
+    cam->cmdset_active = true;
+    cam->indication_early = false;
+
+    TRACE_BEGIN(TRACE_CANON_SET, cam->index, cmdset.id);
+}
+
+// Returns true if the set has to be started by the caller
+static bool queue_command_set(struct canon_camera *cam, struct canon_commandset cmdset, bool *queued)
+{
+    *queued = true;
+
+    if (!cam->cmdset_active)
+    {
+        load_command_set(cam, cmdset);
+        return true;
+    }
+
+    if (cam->cmd_queue_count == CMD_QUEUE_LEN)
+    {
+        *queued = false;
+        return false;
+    }
+
+    cam->cmd_queue[(cam->cmd_queue_head + cam->cmd_queue_count) % CMD_QUEUE_LEN] = cmdset;
+    cam->cmd_queue_count++;
+
+    return false;
+}
+
+static void execute_command_set(struct canon_camera *cam, struct canon_commandset cmdset)
+{
+    bool queued;
+    bool start = queue_command_set(cam, cmdset, &queued);
+
+    if (!queued)
+    {
+        LOGE("Camera %d command queue full, set %d dropped", cam->index, cmdset.id);
+    }
+    else if (start)
+    {
+        LOGD("Camera %d executing command set %d", cam->index, cmdset.id);
+        execute_current_command(cam);
+    }
+    else
+    {
+        LOGD("Camera %d command set %d queued", cam->index, cmdset.id);
+    }
+}
+
+static void start_next_command_set(struct canon_camera *cam)
+{
+    bool start = false;
+
+    if (cam->cmd_queue_count > 0)
+    {
+        load_command_set(cam, cam->cmd_queue[cam->cmd_queue_head]);
+        cam->cmd_queue_head = (cam->cmd_queue_head + 1) % CMD_QUEUE_LEN;
+        cam->cmd_queue_count--;
+        start = true;
+    }
+    else
+    {
+        cam->cmdset_active = false;
+    }
+
+    if (start)
+    {
+        LOGD("Camera %d executing queued command set %d", cam->index, cam->command_id);
+        execute_current_command(cam);
+    }
+}
+
+// The done callback runs before the next set is loaded, it still sees the finished set and may queue a follow up
+static void complete_command_set(struct canon_camera *cam, bool result)
+{
+    TRACE_END(TRACE_CANON_SET, cam->index, cam->command_id);
+
+    if (cam->ondone_cmdset != NULL)
+    {
+        cam->ondone_cmdset(cam, result);
+    }
+
+    start_next_command_set(cam);
+}
+
+// A step failed, drop the rest of the set without calling the done callback
+static void abort_command_set(struct canon_camera *cam)
+{
+    LOGI("Camera %d CommandSet %d ABORT at %d", cam->index, cam->command_id, cam->current_command);
+    TRACE_END(TRACE_CANON_SET, cam->index, cam->command_id);
+
+    if (cam->command_id == CMD_TRIGGER)
+    {
+        trigger_round_camera_done(cam, cam->round, false, 0);
+    }
+
+    start_next_command_set(cam);
+}
+
+// Nothing queued can complete without the connection, the triggers count as failed in their rounds
+static void clear_command_queue(struct canon_camera *cam)
+{
+    if (cam->cmdset_active)
+    {
+        TRACE_END(TRACE_CANON_SET, cam->index, cam->command_id);
+    }
+    if (cam->cmdset_active && cam->command_id == CMD_TRIGGER)
+    {
+        trigger_round_camera_done(cam, cam->round, false, 0);
+    }
+
+    for (int i = 0; i < cam->cmd_queue_count; i++)
+    {
+        struct canon_commandset *queued = &cam->cmd_queue[(cam->cmd_queue_head + i) % CMD_QUEUE_LEN];
+        if (queued->id == CMD_TRIGGER)
+        {
+            trigger_round_camera_done(cam, queued->round, false, 0);
+        }
+    }
+
+    cam->cmd_queue_head = 0;
+    cam->cmd_queue_count = 0;
+    cam->cmdset_active = false;
+}
+
+// GATT handle cache, stored in NVS per camera address so a reconnect can skip the service discovery
+#define HANDLE_CACHE_NAMESPACE "canon_gatt"
+#define HANDLE_CACHE_VERSION (2)
+
+struct canon_handle_cache
+{
+    uint8_t version;
+    struct canon_handles handles;
+};
+
+static void handle_cache_key(struct canon_camera *cam, char *key)
+{
+    sprintf(key, "%02x%02x%02x%02x%02x%02x", cam->bda[0], cam->bda[1], cam->bda[2], cam->bda[3], cam->bda[4], cam->bda[5]);
+}
+
+static bool handle_cache_load(struct canon_camera *cam)
+{
+    nvs_handle handle;
+    if (nvs_open(HANDLE_CACHE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    char key[13];
+    handle_cache_key(cam, key);
+
+    struct canon_handle_cache cache;
+    size_t length = sizeof(cache);
+    esp_err_t err = nvs_get_blob(handle, key, &cache, &length);
+    nvs_close(handle);
+
+    if (err != ESP_OK || length != sizeof(cache) || cache.version != HANDLE_CACHE_VERSION)
+    {
+        return false;
+    }
+
+    cam->handles = cache.handles;
+
+    return true;
+}
+
+static void handle_cache_store(struct canon_camera *cam)
+{
+    nvs_handle handle;
+    if (nvs_open(HANDLE_CACHE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        LOGE("Handle cache open failed");
+        return;
+    }
+
+    char key[13];
+    handle_cache_key(cam, key);
+
+    struct canon_handle_cache cache = {
+        .version = HANDLE_CACHE_VERSION,
+        .handles = cam->handles};
+
+    if (nvs_set_blob(handle, key, &cache, sizeof(cache)) != ESP_OK || nvs_commit(handle) != ESP_OK)
+    {
+        LOGE("Handle cache store failed");
+    }
+    nvs_close(handle);
+}
+
+static void handle_cache_erase(struct canon_camera *cam)
+{
+    nvs_handle handle;
+    if (nvs_open(HANDLE_CACHE_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return;
+    }
+
+    char key[13];
+    handle_cache_key(cam, key);
+
+    nvs_erase_key(handle, key);
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+// A step using the cached handles failed, the handles may be stale: search the services and retry the step
+static bool rediscover_on_failure(struct canon_camera *cam)
+{
+    if (!cam->handles_from_cache)
+    {
+        return false;
+    }
+
+    LOGI("Camera %d cached handles failed, rediscovering", cam->index);
+
+    handle_cache_erase(cam);
+    cam->handles_from_cache = false;
+    cam->rediscovering = true;
+
+    ble_search_services(cam->index);
+    return true;
+}
+
+static void update_fast_trigger_support(struct canon_camera *cam)
+{
+    cam->fast_trigger_supported = ((cam->handles.trigger_service_props[0] & ESP_GATT_CHAR_PROP_BIT_WRITE_NR) != 0);
+
+    LOGI("Camera %d write without response trigger %s", cam->index, cam->fast_trigger_supported ? "supported" : "not supported");
+}
+
+// The camera didn't take a write without response, repeat the failed step with acknowledged writes
+static void fast_trigger_fallback(struct canon_camera *cam)
+{
+    LOGI("Camera %d fast trigger failed at %d, falling back to acknowledged writes", cam->index, cam->current_command);
+
+    cam->fast_trigger_supported = false;
+
+    // Replace the active set in place so the trigger keeps its position ahead of the queued sets and its round.
+    // A press which already went out is not sent again, only the release is
+    struct canon_commandset cmd = CMDSET_TRIGGER;
+    cmd.round = cam->round;
+    uint8_t step = cam->current_command;
+    clear_fast_flag(cam);
+
+    trigger_stats.fallbacks++;
+    load_command_set(cam, cmd);
+    cam->current_command = step;
+
+    execute_current_command(cam);
+}
+
+/* Trigger fan-out:
+    1. canon_do_trigger opens a round and queues a trigger set on every authenticated camera
+    2. The cameras which are idle get their trig_seq0 write back to back, before anything else is done
+    3. The completion of the trig_seq0 write is taken per camera, the skew is the spread of these times
+    4. Once every camera released or failed the round is done and one APP_EVENT_TRIGGER_DONE is posted
+    5. Every camera leaves a record in the shot log, also the ones the policy dropped or merged
+
+    The completion is the write response for acknowledged writes and the hand over to the controller for
+    writes without response. Each link keeps its own connection events, so the skew includes their offsets.
+*/
+#define TRIGGER_ROUNDS (16) // More than the trigger sets a camera can hold, divides the 8 bit round id
+
+struct trigger_round
+{
+    bool active;
+    uint8_t cameras; // Cameras the trigger was queued on
+    uint8_t pending;
+    uint8_t failed;
+    int64_t start;
+    int64_t write_time[MAX_CAMERAS]; // trig_seq0 write, 0 if the camera didn't get there
+    int64_t press_time[MAX_CAMERAS]; // trig_seq0 completion
+    uint32_t press_release_us;       // Slowest camera
+
+    // Shot log
+    uint32_t shot;
+    int64_t scheduled;
+    uint8_t flags[MAX_CAMERAS];
 };
 
-static struct canon_service pair_service;
-static struct canon_service trigger_service;
+static struct trigger_round trigger_rounds[TRIGGER_ROUNDS];
+static uint8_t trigger_round_next = 0;
+
+static void clear_fast_flag(struct canon_camera *cam)
+{
+    trigger_rounds[cam->round % TRIGGER_ROUNDS].flags[cam->index] &= ~SHOT_FLAG_FAST;
+}
+
+static uint32_t shot_offset(struct trigger_round *round, int64_t time)
+{
+    if (time == 0)
+    {
+        return SHOT_LOG_NONE;
+    }
+    return (time > round->scheduled ? (uint32_t)(time - round->scheduled) : 0);
+}
+
+static void log_trigger(struct trigger_round *round, int camera, uint8_t status, int64_t release_time)
+{
+    struct shot_record record = {
+        .shot = round->shot,
+        .scheduled_us = round->scheduled,
+        .write_us = shot_offset(round, round->write_time[camera]),
+        .press_us = shot_offset(round, round->press_time[camera]),
+        .release_us = shot_offset(round, release_time),
+        .camera = camera,
+        .status = status,
+        .rssi = ble_get_rssi(camera),
+        .flags = round->flags[camera]};
+
+    shot_log_add(&record);
+}
+
+static void post_trigger_done(struct trigger_round *round, uint32_t skew_us)
+{
+    struct app_event event = {.type = APP_EVENT_TRIGGER_DONE};
+    event.trigger.success = (round->failed < round->cameras);
+    event.trigger.cameras = round->cameras;
+    event.trigger.failed = round->failed;
+    event.trigger.press_release_us = round->press_release_us;
+    event.trigger.skew_us = skew_us;
+
+    // Posted by a handler, it can't wait for the dispatcher. The round has its shot records already
+    if (!app_event_post(&event))
+    {
+        LOGE("Trigger done event lost, event queue full");
+    }
+}
+
+static void trigger_round_finish(uint8_t id, struct trigger_round *round)
+{
+    int64_t first = 0;
+    int64_t last = 0;
+
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        int64_t time = round->press_time[i];
+        if (time == 0)
+        {
+            continue;
+        }
+        if (first == 0 || time < first)
+        {
+            first = time;
+        }
+        if (time > last)
+        {
+            last = time;
+        }
+    }
+
+    uint32_t skew_us = (uint32_t)(last - first);
+
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        if (round->press_time[i] == 0)
+        {
+            continue;
+        }
+
+        struct canon_camera_stats *stats = &cameras[i].stats;
+        stats->last_skew_us = (uint32_t)(round->press_time[i] - first);
+        if (stats->last_skew_us > stats->max_skew_us)
+        {
+            stats->max_skew_us = stats->last_skew_us;
+        }
+
+        LOGD("Round %d camera %d press after %u us, skew %u us", id, i, (uint32_t)(round->press_time[i] - round->start), stats->last_skew_us);
+    }
+
+    trigger_stats.rounds++;
+    trigger_stats.last_skew_us = skew_us;
+    if (skew_us > trigger_stats.max_skew_us)
+    {
+        trigger_stats.max_skew_us = skew_us;
+    }
+
+    LOGI("Round %d done, %d cameras, %d failed, skew %u us", id, round->cameras, round->failed, skew_us);
+
+    round->active = false;
+    post_trigger_done(round, skew_us);
+}
+
+static void trigger_round_camera_done(struct canon_camera *cam, uint8_t id, bool success, uint32_t press_release_us)
+{
+    struct trigger_round *round = &trigger_rounds[id % TRIGGER_ROUNDS];
+    if (!round->active || round->pending == 0)
+    {
+        return;
+    }
+
+    log_trigger(round, cam->index, (success ? SHOT_STATUS_OK : SHOT_STATUS_FAILED), (success ? esp_timer_get_time() : 0));
+
+    if (success)
+    {
+        cam->stats.triggers++;
+        if (press_release_us > round->press_release_us)
+        {
+            round->press_release_us = press_release_us;
+        }
+
+        // For the record of the next shot, the link is idle now
+        ble_read_rssi(cam->index);
+    }
+    else
+    {
+        cam->stats.failed++;
+        round->failed++;
+        round->press_time[cam->index] = 0;
+    }
+
+    round->pending--;
+    if (round->pending == 0)
+    {
+        trigger_round_finish(id, round);
+    }
+}
+
+static void record_trigger_write(struct canon_camera *cam)
+{
+    cam->trigger_press_time = esp_timer_get_time();
+    TRACE_INSTANT(TRACE_TRIGGER_WRITE, cam->index, 0);
+
+    struct trigger_round *round = &trigger_rounds[cam->round % TRIGGER_ROUNDS];
+    if (round->active)
+    {
+        round->write_time[cam->index] = cam->trigger_press_time;
+    }
+}
+
+static void record_trigger_press(struct canon_camera *cam)
+{
+    TRACE_INSTANT(TRACE_TRIGGER_PRESS, cam->index, 0);
+
+    struct trigger_round *round = &trigger_rounds[cam->round % TRIGGER_ROUNDS];
+    if (round->active)
+    {
+        round->press_time[cam->index] = esp_timer_get_time();
+    }
+}
+
+static void record_trigger_release(struct canon_camera *cam)
+{
+    TRACE_INSTANT(TRACE_TRIGGER_RELEASE, cam->index, 0);
+
+    uint32_t press_to_release = (uint32_t)(esp_timer_get_time() - cam->trigger_press_time);
+
+    trigger_stats.last_press_release_us = press_to_release;
+    if (press_to_release > trigger_stats.max_press_release_us)
+    {
+        trigger_stats.max_press_release_us = press_to_release;
+    }
+    if (cam->active_cmdset == cmdset_trigger_fast)
+    {
+        trigger_stats.fast++;
+    }
+
+    LOGD("Camera %d trigger press to release %u us", cam->index, press_to_release);
 
-static uint16_t pair_service_chars[2] = {0};
-static uint16_t trigger_service_chars[3] = {0};
+    trigger_round_camera_done(cam, cam->round, true, press_to_release);
+}
 
-static void execute_next()
+static void execute_next(struct canon_camera *cam)
 {
-    current_command++;
-    if (current_command < num_command)
+    cam->current_command++;
+    if (cam->current_command < cam->num_command)
     {
-        ESP_LOGI(TAG, "CommandSet NEXT");
+        LOGD("Camera %d CommandSet NEXT", cam->index);
 
-        execute_current_command();
+        execute_current_command(cam);
     }
     else
     {
-        ESP_LOGI(TAG, "CommandSet DONE");
+        LOGD("Camera %d CommandSet DONE", cam->index);
 
-        if (ondone_cmdset != NULL)
+        complete_command_set(cam, true);
+    }
+}
+
+// The first step of a trigger set, kept free of logging so the fan-out issues the presses back to back
+static void execute_trigger_press(struct canon_camera *cam)
+{
+    struct canon_command current = cam->active_cmdset[0];
+
+    uint16_t handle = get_char_handle(cam, current.can_chr);
+    record_trigger_write(cam);
+
+    if (current.ble_type == BLE_CMD_WRITE_NO_RSP)
+    {
+        if (!ble_write_char_no_rsp(cam->index, handle, trig_seq0, sizeof(trig_seq0)))
         {
-            ondone_cmdset(true);
+            fast_trigger_fallback(cam);
         }
     }
+    else if (!ble_write_char(cam->index, handle, trig_seq0, sizeof(trig_seq0)))
+    {
+        // The stack refused it, no write event will end the set
+        LOGI("Camera %d trigger write fail", cam->index);
+        abort_command_set(cam);
+    }
 }
 
-static void execute_current_command()
+static void execute_current_command(struct canon_camera *cam)
 {
-    struct canon_command current = active_cmdset[current_command];
+    struct canon_command current = cam->active_cmdset[cam->current_command];
+    TRACE_INSTANT(TRACE_CANON_STEP, cam->index, (current.ble_type << 8) | cam->current_command);
 
     switch (current.ble_type)
     {
     case BLE_CMD_WRITE:
     {
-        ESP_LOGI(TAG, "Executing command BLE_CMD_WRITE");
+        LOGD("Executing command BLE_CMD_WRITE");
 
-        uint16_t handle = get_char_handle(current.can_chr);
+        uint16_t handle = get_char_handle(cam, current.can_chr);
 
         int length = 0;
         uint8_t *data_pointer = get_char_data(current.can_data, &length);
 
-        ESP_LOGI(TAG, "WRITE %d %d", handle, length);
+        LOGD("Camera %d WRITE %d %d", cam->index, handle, length);
 
         if (data_pointer == NULL)
         {
-            ESP_LOGI(TAG, "NULL data to write!");
+            LOGI("NULL data to write!");
+            abort_command_set(cam);
         }
-        else
+        else if (!ble_write_char(cam->index, handle, data_pointer, length))
         {
-            // Write the characteristic
-            if (!ble_write_char(handle, data_pointer, length))
+            // Refused locally, no write event will end the set
+            LOGI("BLE_CMD_WRITE fail");
+            if (cam->command_id == CMD_PAIR)
             {
-                ESP_LOGI(TAG, "BLE_CMD_WRITE fail");
+                on_pair_state_handler(cam->index, PAIR_STATE_REQUEST, false);
             }
+            abort_command_set(cam);
+        }
+        else if (current.can_data == CAN_DATA_TRIG0)
+        {
+            record_trigger_write(cam);
+        }
+        break;
+    }
+    case BLE_CMD_WRITE_NO_RSP:
+    {
+        uint16_t handle = get_char_handle(cam, current.can_chr);
+
+        int length = 0;
+        uint8_t *data_pointer = get_char_data(current.can_data, &length);
+
+        if (current.can_data == CAN_DATA_TRIG0)
+        {
+            record_trigger_write(cam);
+        }
+
+        if (data_pointer == NULL || !ble_write_char_no_rsp(cam->index, handle, data_pointer, length))
+        {
+            fast_trigger_fallback(cam);
         }
         break;
     }
     case BLE_CMD_WRITE_SECURE_BOND:
     {
-        ESP_LOGI(TAG, "Executing command BLE_CMD_WRITE_SECURE_BOND");
+        LOGD("Executing command BLE_CMD_WRITE_SECURE_BOND");
 
-        uint16_t handle = get_char_handle(current.can_chr);
+        uint16_t handle = get_char_handle(cam, current.can_chr);
 
         int length = 0;
         uint8_t *data_pointer = get_char_data(current.can_data, &length);
 
         if (data_pointer == NULL)
         {
-            ESP_LOGI(TAG, "NULL data to write!");
+            LOGI("NULL data to write!");
+            abort_command_set(cam);
         }
-        else
+        else if (!ble_write_char_secure(cam->index, handle, data_pointer, length)) // Write the characteristic secure, this initiates bonding
         {
-            ble_write_char_secure(handle, data_pointer, length); // Write the characteristic secure, this initiates bonding
+            LOGI("BLE_CMD_WRITE_SECURE_BOND fail");
+            if (cam->command_id == CMD_PAIR)
+            {
+                on_pair_state_handler(cam->index, PAIR_STATE_BOND, false);
+            }
+            abort_command_set(cam);
         }
         break;
     }
     case BLE_CMD_ENABLE_INDICATION:
     {
-        ESP_LOGI(TAG, "Executing command BLE_CMD_ENABLE_INDICATION");
+        LOGD("Executing command BLE_CMD_ENABLE_INDICATION");
 
-        uint16_t handle = get_char_handle(current.can_chr);
+        uint16_t handle = get_char_handle(cam, current.can_chr);
 
-        ble_enable_indication(pair_service.start_handle, pair_service.end_handle, handle);
+        ble_enable_indication(cam->index, handle, get_char_cccd(cam, current.can_chr));
 
         break;
     }
     case BLE_CMD_ENABLE_NOTIFICATION:
     case BLE_CMD_ENABLE_NOTIFICATION_SAFE:
     {
-        ESP_LOGI(TAG, "Executing command BLE_CMD_ENABLE_NOTIFICATION");
+        LOGD("Executing command BLE_CMD_ENABLE_NOTIFICATION");
 
-        uint16_t handle = get_char_handle(current.can_chr);
+        uint16_t handle = get_char_handle(cam, current.can_chr);
 
-        ble_enable_notification(pair_service.start_handle, pair_service.end_handle, handle, (current.ble_type == BLE_CMD_ENABLE_NOTIFICATION_SAFE));
+        ble_enable_notification(cam->index, handle, get_char_cccd(cam, current.can_chr), (current.ble_type == BLE_CMD_ENABLE_NOTIFICATION_SAFE));
+
+        break;
+    }
+    case BLE_CMD_WAIT_INDICATION:
+    {
+        LOGD("Executing command BLE_CMD_WAIT_INDICATION");
+
+        if (cam->indication_early)
+        {
+            cam->indication_early = false;
+            pair_result(cam, cam->indication_accepted);
+        }
 
         break;
     }
     }
 }
 
-static uint16_t get_char_handle(uint8_t can_type)
+static uint16_t get_char_handle(struct canon_camera *cam, uint8_t can_type)
 {
     switch (can_type)
     {
     case CAN_CHR_PAIR_COMMAND:
-        return pair_service_chars[0];
+        return cam->handles.pair_service_chars[0];
     case CAN_CHR_PAIR_DATA:
-        return pair_service_chars[1];
+        return cam->handles.pair_service_chars[1];
     case CAN_CHR_TRIG:
-        return trigger_service_chars[0];
+        return cam->handles.trigger_service_chars[0];
     case CAN_CHR_TRIG_NOTIF:
-        return trigger_service_chars[1];
+        return cam->handles.trigger_service_chars[1];
     case CAN_CHR_TRIG_CONFIG:
-        return trigger_service_chars[2];
+        return cam->handles.trigger_service_chars[2];
+    }
+
+    return 0;
+}
+
+static uint16_t get_char_cccd(struct canon_camera *cam, uint8_t can_type)
+{
+    switch (can_type)
+    {
+    case CAN_CHR_PAIR_COMMAND:
+        return cam->handles.pair_command_cccd;
+    case CAN_CHR_TRIG_NOTIF:
+        return cam->handles.trigger_notif_cccd;
     }
 
     return 0;
@@ -336,42 +954,90 @@ static uint8_t *get_char_data(int data_type, int *data_length)
     return NULL;
 }
 
-void canon_service_discovery(esp_bt_uuid_t uuid, uint16_t startHandle, uint16_t endHandle)
+bool canon_adv_match(uint8_t *adv)
 {
+    uint8_t length = 0;
+
+    uint8_t *data = esp_ble_resolve_adv_data(adv, ESP_BLE_AD_MANUFACTURER_SPECIFIC_TYPE, &length);
+    if (data != NULL && length >= 2 && (data[0] | (data[1] << 8)) == CANON_COMPANY_ID)
+    {
+        return true;
+    }
+
+    const uint8_t pairServiceUUID[] = {CANON_PAIR_SERVICE};
+    const uint8_t types[] = {ESP_BLE_AD_TYPE_128SRV_CMPL, ESP_BLE_AD_TYPE_128SRV_PART};
+    for (int t = 0; t < sizeof(types); t++)
+    {
+        data = esp_ble_resolve_adv_data(adv, types[t], &length);
+        for (int i = 0; data != NULL && i + ESP_UUID_LEN_128 <= length; i += ESP_UUID_LEN_128)
+        {
+            if (memcmp(&data[i], pairServiceUUID, ESP_UUID_LEN_128) == 0)
+            {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+void canon_service_discovery(int camera, esp_bt_uuid_t uuid, uint16_t startHandle, uint16_t endHandle)
+{
+    struct canon_camera *cam = get_camera(camera);
+
     // Is this the PAIR service?
     const uint8_t pairServiceUUID[] = {CANON_PAIR_SERVICE};
     if (uuid.len == ESP_UUID_LEN_128 && memcmp(uuid.uuid.uuid128, pairServiceUUID, ESP_UUID_LEN_128) == 0)
     {
-        pair_service.start_handle = startHandle;
-        pair_service.end_handle = endHandle;
+        cam->handles.pair_service.start_handle = startHandle;
+        cam->handles.pair_service.end_handle = endHandle;
 
-        ESP_LOGI(TAG, "PAIR service found");
+        LOGI("Camera %d PAIR service found", camera);
     }
 
     // Is this the TRIGGER service?
     const uint8_t triggerServiceUUID[] = {CANON_TRIG_SERVICE};
     if (uuid.len == ESP_UUID_LEN_128 && memcmp(uuid.uuid.uuid128, triggerServiceUUID, ESP_UUID_LEN_128) == 0)
     {
-        trigger_service.start_handle = startHandle;
-        trigger_service.end_handle = endHandle;
+        cam->handles.trigger_service.start_handle = startHandle;
+        cam->handles.trigger_service.end_handle = endHandle;
 
-        ESP_LOGI(TAG, "TRIGGER service found");
+        LOGI("Camera %d TRIGGER service found", camera);
+    }
+}
+
+// The search found no usable Canon services, a set waiting for the rediscovery can't go on
+static void discovery_failed(struct canon_camera *cam)
+{
+    if (!cam->rediscovering)
+    {
+        return;
+    }
+
+    cam->rediscovering = false;
+    if (cam->cmdset_active)
+    {
+        abort_command_set(cam);
     }
 }
 
-void canon_discovery_complete(esp_gatt_if_t gatt_if)
+void canon_discovery_complete(int camera, esp_gatt_if_t gatt_if)
 {
-    ESP_LOGI(TAG, "Discovery complete");
+    struct canon_camera *cam = get_camera(camera);
+    struct canon_handles *handles = &cam->handles;
+
+    LOGI("Camera %d discovery complete", camera);
 
     // Find PAIR characteristics
     uint8_t pair_findUUIDs[ESP_UUID_LEN_128 * 2] = {
         CANON_PAIR_COMMAND_CHARACTERISTIC,
         CANON_PAIR_DATA_CHARACTERISTIC};
 
-    int result = ble_get_chars(gatt_if, pair_service.start_handle, pair_service.end_handle, pair_findUUIDs, 2, pair_service_chars);
+    int result = ble_get_chars(camera, gatt_if, handles->pair_service.start_handle, handles->pair_service.end_handle, pair_findUUIDs, 2, handles->pair_service_chars, NULL);
     if (result != 2)
     {
-        ESP_LOGI(TAG, "Failed to find PAIR characteristics!");
+        LOGI("Failed to find PAIR characteristics!");
+        discovery_failed(cam);
         return;
     }
 
@@ -381,153 +1047,455 @@ void canon_discovery_complete(esp_gatt_if_t gatt_if)
         CANON_TRIG_NOTIFICATION_CHARACTERISTIC,
         CANON_TRIG_CONFIG_CHARACTERISTIC};
 
-    result = ble_get_chars(gatt_if, trigger_service.start_handle, trigger_service.end_handle, trig_findUUIDs, 3, trigger_service_chars);
+    result = ble_get_chars(camera, gatt_if, handles->trigger_service.start_handle, handles->trigger_service.end_handle, trig_findUUIDs, 3, handles->trigger_service_chars, handles->trigger_service_props);
     if (result != 3)
     {
-        ESP_LOGI(TAG, "Failed to find TRIGGER characteristics!");
+        LOGI("Failed to find TRIGGER characteristics!");
+        discovery_failed(cam);
         return;
     }
 
-    ESP_LOGI(TAG, "Characteristics found");
+    LOGI("Characteristics found");
+
+    handles->pair_command_cccd = ble_find_cccd(camera, handles->pair_service.start_handle, handles->pair_service.end_handle, handles->pair_service_chars[0]);
+    handles->trigger_notif_cccd = ble_find_cccd(camera, handles->trigger_service.start_handle, handles->trigger_service.end_handle, handles->trigger_service_chars[1]);
+
+    handle_cache_store(cam);
+    update_fast_trigger_support(cam);
+
+    if (cam->rediscovering)
+    {
+        // Retry the step which failed with the stale handles
+        cam->rediscovering = false;
+        execute_current_command(cam);
+        return;
+    }
 
     // The discovery is complete ready to communicate with the camera
-    on_connected_handler();
+    on_connected_handler(camera);
 }
 
-void canon_bond_result(bool success)
+bool canon_cached_discovery(int camera, esp_bd_addr_t bda)
 {
+    struct canon_camera *cam = get_camera(camera);
+
+    memcpy(cam->bda, bda, sizeof(esp_bd_addr_t));
+    cam->rediscovering = false;
+    cam->authenticated = false;
+
+    cam->handles_from_cache = handle_cache_load(cam);
+    if (!cam->handles_from_cache)
+    {
+        return false;
+    }
+
+    LOGI("Camera %d using cached handles", camera);
+    update_fast_trigger_support(cam);
+
+    // Same as a completed discovery
+    on_connected_handler(camera);
+    return true;
+}
+
+void canon_bond_result(int camera, bool success)
+{
+    struct canon_camera *cam = get_camera(camera);
+
+    if (!cam->cmdset_active)
+    {
+        return;
+    }
+
     // Re-execute the current command, but now no security is required
-    if (active_cmdset[current_command].ble_type == BLE_CMD_WRITE_SECURE_BOND)
+    if (cam->active_cmdset[cam->current_command].ble_type == BLE_CMD_WRITE_SECURE_BOND)
     {
-        if (command_id == CMD_PAIR)
+        if (cam->command_id == CMD_PAIR)
         {
-            on_pair_state_handler(PAIR_STATE_BOND, success);
+            on_pair_state_handler(camera, PAIR_STATE_BOND, success);
         }
 
         if (success)
         {
-            execute_next();
+            execute_next(cam);
         }
     }
-    else if (active_cmdset[current_command].ble_type == BLE_CMD_ENABLE_NOTIFICATION_SAFE)
+    else if (cam->active_cmdset[cam->current_command].ble_type == BLE_CMD_ENABLE_NOTIFICATION_SAFE)
     {
-        if (command_id == CMD_CONNECT && success)
+        if (cam->command_id == CMD_CONNECT && success)
         {
-            execute_next();
+            execute_next(cam);
         }
     }
 }
 
-void canon_char_write_result(bool success)
+void canon_char_write_result(int camera, bool success)
 {
-    if (active_cmdset[current_command].ble_type == BLE_CMD_WRITE)
+    struct canon_camera *cam = get_camera(camera);
+
+    if (!cam->cmdset_active)
     {
-        if (command_id == CMD_PAIR)
+        return;
+    }
+
+    struct canon_command current = cam->active_cmdset[cam->current_command];
+
+    if (current.ble_type == BLE_CMD_WRITE)
+    {
+        if (cam->command_id == CMD_PAIR)
         {
-            on_pair_state_handler(PAIR_STATE_REQUEST, success);
+            on_pair_state_handler(camera, PAIR_STATE_REQUEST, success);
         }
 
         if (success)
         {
-            execute_next();
+            if (current.can_data == CAN_DATA_TRIG0)
+            {
+                record_trigger_press(cam);
+            }
+            else if (current.can_data == CAN_DATA_TRIG1)
+            {
+                record_trigger_release(cam);
+            }
+
+            execute_next(cam);
+        }
+        else if (!rediscover_on_failure(cam))
+        {
+            abort_command_set(cam);
+        }
+    }
+    else if (current.ble_type == BLE_CMD_WRITE_NO_RSP)
+    {
+        // Completes as soon as the write is queued for the link
+        if (success)
+        {
+            if (current.can_data == CAN_DATA_TRIG0)
+            {
+                record_trigger_press(cam);
+            }
+            else if (current.can_data == CAN_DATA_TRIG1)
+            {
+                record_trigger_release(cam);
+            }
+
+            execute_next(cam);
+        }
+        else
+        {
+            fast_trigger_fallback(cam);
         }
     }
 }
 
-void canon_chardesc_write_result(bool success)
+void canon_chardesc_write_result(int camera, bool success)
 {
-    if (active_cmdset[current_command].ble_type == BLE_CMD_ENABLE_INDICATION)
+    struct canon_camera *cam = get_camera(camera);
+
+    if (!cam->cmdset_active)
     {
-        if (command_id == CMD_PAIR)
+        return;
+    }
+
+    if (cam->active_cmdset[cam->current_command].ble_type == BLE_CMD_ENABLE_INDICATION)
+    {
+        if (cam->command_id == CMD_PAIR)
         {
-            on_pair_state_handler(PAIR_STATE_WAIT, success);
+            on_pair_state_handler(camera, PAIR_STATE_WAIT, success);
         }
 
         if (success)
         {
-            execute_next();
+            execute_next(cam);
+        }
+        else if (!rediscover_on_failure(cam))
+        {
+            abort_command_set(cam);
         }
     }
-    else if (active_cmdset[current_command].ble_type == BLE_CMD_ENABLE_NOTIFICATION)
+    else if (cam->active_cmdset[cam->current_command].ble_type == BLE_CMD_ENABLE_NOTIFICATION)
     {
-        if (command_id == CMD_CONNECT && success)
+        if (cam->command_id == CMD_CONNECT && success)
         {
-            execute_next();
+            execute_next(cam);
+        }
+        else if (!success && !rediscover_on_failure(cam))
+        {
+            abort_command_set(cam);
         }
     }
 }
 
-void canon_char_notify(uint16_t handle, uint8_t *data, uint16_t data_len)
+static void pair_result(struct canon_camera *cam, bool accepted)
 {
-    if (active_cmdset[current_command].ble_type == BLE_CMD_WAIT_INDICATION)
+    LOGI("Camera %d PAIR result %d", cam->index, accepted);
+
+    if (cam->command_id == CMD_PAIR)
     {
-        bool pair_result = (data_len >= 1 && data[0] == PAIR_ACCEPTED);
+        on_pair_state_handler(cam->index, PAIR_STATE_INFO, accepted);
 
-        ESP_LOGI(TAG, "PAIR result %d", pair_result);
+        // Pairing is done
+        complete_command_set(cam, accepted);
+    }
+}
 
-        if (command_id == CMD_PAIR)
-        {
-            on_pair_state_handler(PAIR_STATE_INFO, pair_result);
+void canon_char_notify(int camera, uint16_t handle, uint8_t *data, uint16_t data_len)
+{
+    struct canon_camera *cam = get_camera(camera);
 
-            // Pairing is done
-            ondone_cmdset(pair_result);
-        }
+    if (!cam->cmdset_active)
+    {
+        return;
+    }
+
+    bool accepted = (data_len >= 1 && data[0] == PAIR_ACCEPTED);
+    uint8_t current = cam->current_command;
+
+    if (cam->active_cmdset[current].ble_type == BLE_CMD_WAIT_INDICATION)
+    {
+        pair_result(cam, accepted);
+    }
+    else if (cam->active_cmdset[current].ble_type == BLE_CMD_ENABLE_INDICATION && current + 1 < cam->num_command &&
+             cam->active_cmdset[current + 1].ble_type == BLE_CMD_WAIT_INDICATION)
+    {
+        // The camera answered before the CCCD write response arrived
+        LOGD("Camera %d PAIR result ahead of the CCCD write response", camera);
+
+        cam->indication_early = true;
+        cam->indication_accepted = accepted;
     }
 }
 
-void canon_start_pair()
+void canon_start_pair(int camera)
 {
-    ESP_LOGI(TAG, "canon_start_pair");
+    LOGI("canon_start_pair %d", camera);
 
     struct canon_commandset cmd = CMDSET_PAIR_REQUEST;
-    execute_command_set(cmd);
+    execute_command_set(get_camera(camera), cmd);
 }
 
-static void callback_pair(bool accepted)
+static void callback_pair(struct canon_camera *cam, bool accepted)
 {
-    ESP_LOGI(TAG, "callback_pair %d", accepted);
+    LOGI("callback_pair %d", accepted);
 
     if (accepted) // If pairing is accepted, send the info required by the camera
     {
         struct canon_commandset cmd = CMDSET_PAIR_INFO;
-        execute_command_set(cmd);
+        execute_command_set(cam, cmd);
     }
 }
 
-static void callback_pair_complete(bool dontcare)
+static void callback_pair_complete(struct canon_camera *cam, bool dontcare)
 {
-    ESP_LOGI(TAG, "CANON PAIR DONE!");
+    LOGI("CANON PAIR DONE!");
 
-    if (command_id == CMD_PAIR_INFO)
+    if (cam->command_id == CMD_PAIR_INFO)
     {
-        on_pair_state_handler(PAIR_STATE_DONE, true);
+        on_pair_state_handler(cam->index, PAIR_STATE_DONE, true);
     }
 }
 
-void canon_disconnect()
+void canon_disconnect(int camera)
 {
+    struct canon_camera *cam = get_camera(camera);
+
+    clear_command_queue(cam);
+    cam->authenticated = false;
+
     if (on_disconnected_handler != NULL)
     {
-        on_disconnected_handler();
+        on_disconnected_handler(camera);
     }
 }
 
-void canon_do_connect()
+void canon_do_connect(int camera)
 {
     struct canon_commandset cmd = CMDSET_CONNECT;
-    execute_command_set(cmd);
+    execute_command_set(get_camera(camera), cmd);
 }
 
-static void callback_camera_connect_auth(bool dontcare)
+static void callback_camera_connect_auth(struct canon_camera *cam, bool dontcare)
 {
+    cam->authenticated = true;
+
     if (on_auth_handler != NULL)
     {
-        on_auth_handler();
+        on_auth_handler(cam->index);
     }
 }
 
-void canon_do_trigger()
+// Applies the trigger policy on one camera, returns true if the press has to be issued now
+static bool trigger_queue(struct canon_camera *cam, struct trigger_round *round, uint8_t id)
 {
     struct canon_commandset cmd = CMDSET_TRIGGER;
-    execute_command_set(cmd);
+    bool fast = (fast_trigger_enabled && cam->fast_trigger_supported);
+    if (fast)
+    {
+        struct canon_commandset fast_cmd = CMDSET_TRIGGER_FAST;
+        cmd = fast_cmd;
+    }
+    cmd.round = id;
+
+    bool merge = false;
+    if (cam->cmdset_active)
+    {
+        if (trigger_policy == CANON_TRIGGER_MERGE)
+        {
+            // Merge into a trigger which is waiting in the queue
+            for (int i = 0; i < cam->cmd_queue_count; i++)
+            {
+                if (cam->cmd_queue[(cam->cmd_queue_head + i) % CMD_QUEUE_LEN].id == CMD_TRIGGER)
+                {
+                    merge = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    if (cam->cmdset_active && trigger_policy == CANON_TRIGGER_DROP)
+    {
+        trigger_stats.dropped++;
+        log_trigger(round, cam->index, SHOT_STATUS_DROPPED, 0);
+        return false;
+    }
+    if (merge)
+    {
+        trigger_stats.merged++;
+        log_trigger(round, cam->index, SHOT_STATUS_MERGED, 0);
+        return false;
+    }
+
+    // The flags only describe a trigger which got into the queue, a dropped one is only counted as dropped
+    bool queued = false;
+    bool start = queue_command_set(cam, cmd, &queued);
+    if (!queued)
+    {
+        trigger_stats.dropped++;
+        log_trigger(round, cam->index, SHOT_STATUS_DROPPED, 0);
+        return false;
+    }
+    if (fast)
+    {
+        round->flags[cam->index] |= SHOT_FLAG_FAST;
+    }
+    if (!start)
+    {
+        trigger_stats.delayed++;
+        round->flags[cam->index] |= SHOT_FLAG_DELAYED;
+    }
+
+    round->cameras++;
+    return start;
+}
+
+void canon_do_trigger()
+{
+    canon_do_shot(0, esp_timer_get_time(), SHOT_FLAG_MANUAL);
+}
+
+void canon_do_shot(uint32_t shot, int64_t scheduled_us, uint8_t flags)
+{
+    trigger_stats.requested++;
+
+    uint8_t id = trigger_round_next++;
+    struct trigger_round *round = &trigger_rounds[id % TRIGGER_ROUNDS];
+    if (round->active)
+    {
+        LOGE("Round %d still running, its result is lost", (uint8_t)(id - TRIGGER_ROUNDS));
+    }
+    memset(round, 0, sizeof(*round));
+
+    round->shot = shot;
+    round->scheduled = scheduled_us;
+    memset(round->flags, flags, sizeof(round->flags));
+
+    struct canon_camera *start[MAX_CAMERAS];
+    int start_count = 0;
+    bool any = false;
+
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        struct canon_camera *cam = &cameras[i];
+        if (!cam->authenticated)
+        {
+            continue;
+        }
+
+        any = true;
+        if (trigger_queue(cam, round, id))
+        {
+            start[start_count++] = cam;
+        }
+    }
+
+    if (!any)
+    {
+        LOGW("No camera to trigger");
+    }
+    if (round->cameras == 0)
+    {
+        return;
+    }
+
+    round->active = true;
+    round->pending = round->cameras;
+    round->start = esp_timer_get_time();
+
+    // Back to back, the presses go out in the next connection event of every link
+    for (int i = 0; i < start_count; i++)
+    {
+        execute_trigger_press(start[i]);
+    }
+
+    LOGD("Round %d: %d cameras, %d pressed", id, round->cameras, start_count);
+}
+
+bool canon_camera_ready(int camera)
+{
+    return cameras[camera].authenticated;
+}
+
+int canon_camera_count()
+{
+    int count = 0;
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        if (cameras[i].authenticated)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void canon_set_trigger_policy(int policy)
+{
+    trigger_policy = policy;
+}
+
+void canon_set_fast_trigger(bool enabled)
+{
+    fast_trigger_enabled = enabled;
+}
+
+int canon_queue_depth()
+{
+    int depth = 0;
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        depth += cameras[i].cmd_queue_count + (cameras[i].cmdset_active ? 1 : 0);
+    }
+
+    return depth;
+}
+
+void canon_get_trigger_stats(struct canon_trigger_stats *stats)
+{
+    *stats = trigger_stats;
+}
+
+void canon_get_camera_stats(int camera, struct canon_camera_stats *stats)
+{
+    *stats = cameras[camera].stats;
 }
@@ -12,32 +12,80 @@
 #define CANON_TRIG_NOTIFICATION_CHARACTERISTIC 0x21, 0xa8, 0xff, 0x2f, 0x49, 0xd8, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x31, 0x00, 0x03, 0x00
 #define CANON_TRIG_CONFIG_CHARACTERISTIC       0x21, 0xa8, 0xff, 0x2f, 0x49, 0xd8, 0x00, 0x00, 0x00, 0x10, 0x00, 0x00, 0x10, 0x00, 0x03, 0x00
 
-typedef void (*simple_callback)();
-typedef void (*simple_statue_callback)(bool);
+// The camera index is the connection returned by ble_connect
+typedef void (*canon_camera_callback)(int camera);
 
 #define PAIR_STATE_BOND (1)
 #define PAIR_STATE_REQUEST (2)
 #define PAIR_STATE_WAIT (3)
 #define PAIR_STATE_INFO (4)
 #define PAIR_STATE_DONE (5)
-typedef void (*canon_pair_state_callback)(int, bool);
+typedef void (*canon_pair_state_callback)(int camera, int state, bool success);
 
-void canon_set_on_connected(simple_callback handler);
+#define CANON_COMPANY_ID (0x01A9) // Bluetooth SIG company identifier of Canon Inc.
+
+// Only parses the packet, safe to call from the Bluedroid task
+bool canon_adv_match(uint8_t *adv);
+
+void canon_set_on_connected(canon_camera_callback handler);
 void canon_set_pair_state_callback(canon_pair_state_callback handler);
-void canon_set_on_disconnected(simple_callback handler);
-void canon_set_on_auth(simple_callback handler);
+void canon_set_on_disconnected(canon_camera_callback handler);
+void canon_set_on_auth(canon_camera_callback handler);
+
+bool canon_cached_discovery(int camera, esp_bd_addr_t bda);
+void canon_service_discovery(int camera, esp_bt_uuid_t uuid, uint16_t startHandle, uint16_t endHandle);
+void canon_discovery_complete(int camera, esp_gatt_if_t gatt_if);
+void canon_bond_result(int camera, bool success);
+void canon_char_write_result(int camera, bool success);
+void canon_chardesc_write_result(int camera, bool success);
+void canon_char_notify(int camera, uint16_t handle, uint8_t* data, uint16_t data_len);
+void canon_disconnect(int camera);
+
+void canon_start_pair(int camera);
+
+void canon_do_connect(int camera);
+void canon_do_trigger(); // Triggers all authenticated cameras together, logged as a manual shot
+
+// Same for shot n of the timer, scheduled_us is the esp_timer time it was due and flags are SHOT_FLAG_* of shot_log.h
+void canon_do_shot(uint32_t shot, int64_t scheduled_us, uint8_t flags);
+
+bool canon_camera_ready(int camera);
+int canon_camera_count(); // Authenticated cameras
+
+// What happens to a trigger requested while another command set is still running
+#define CANON_TRIGGER_QUEUE (0) // Queue it, it runs after the pending sets
+#define CANON_TRIGGER_MERGE (1) // Merge it into a trigger which is already waiting, queue it otherwise
+#define CANON_TRIGGER_DROP (2)  // Drop it
+
+struct canon_trigger_stats
+{
+    uint32_t requested; // canon_do_trigger calls
+    uint32_t delayed;   // Queued behind another command set, counted per camera
+    uint32_t merged;    // Merged into a waiting trigger, counted per camera
+    uint32_t dropped;   // Dropped by the policy or because the queue was full, counted per camera
+
+    uint32_t fast;                  // Sent with write without response
+    uint32_t fallbacks;             // Write without response failed, repeated with acknowledged writes
+    uint32_t last_press_release_us; // From the trig_seq0 write to the completion of the trig_seq1 write
+    uint32_t max_press_release_us;
 
-void canon_service_discovery(esp_bt_uuid_t uuid, uint16_t startHandle, uint16_t endHandle);
-void canon_discovery_complete(esp_gatt_if_t gatt_if);
-void canon_bond_result(bool success);
-void canon_char_write_result(bool success);
-void canon_chardesc_write_result(bool success);
-void canon_char_notify(uint16_t handle, uint8_t* data, uint16_t data_len);
-void canon_disconnect();
+    uint32_t rounds;       // Triggers which reached at least one camera
+    uint32_t last_skew_us; // Spread of the trig_seq0 completions over the cameras of a round
+    uint32_t max_skew_us;
+};
 
-void canon_start_pair();
+struct canon_camera_stats
+{
+    uint32_t triggers;     // Trigger sets completed
+    uint32_t failed;       // Trigger sets aborted or cut by a disconnect
+    uint32_t last_skew_us; // trig_seq0 completion after the first camera of the round
+    uint32_t max_skew_us;
+};
 
-void canon_do_connect();
-void canon_do_trigger();
+void canon_set_trigger_policy(int policy);
+void canon_set_fast_trigger(bool enabled);
+int canon_queue_depth();
+void canon_get_trigger_stats(struct canon_trigger_stats *stats);
+void canon_get_camera_stats(int camera, struct canon_camera_stats *stats);
 
 #endif
\ No newline at end of file
@@ -5,10 +5,63 @@
 #define BUTTON (34)
 #define ROTARY1 (35)
 
+#define ROTARY_PCNT (true)       // Decode the encoder with the pulse counter, the GPIO interrupts are used otherwise
+#define ROTARY_PCNT_UNIT (PCNT_UNIT_0)
+#define ROTARY_FILTER (1023)     // Pulse counter glitch filter in APB cycles, 1023 = 12.8us
+#define ROTARY_COUNTS_PER_DETENT (4)
+
 #define DISPLAY_I2C (I2C_NUM_0)
 #define DISPLAY_I2C_SCL (25)
 #define DISPLAY_I2C_SDA (26)
 #define DISPLAY_I2C_FREQ (400000)
 #define DISPLAY_ADR 0x3C  // 011110+SA0+RW - 0x3C or 0x3D
+#define DISPLAY_FRAME_MS (40) // Minimum time between two rendered frames, a full frame takes ~25ms on the bus
+
+#define TIMER_INTERVAL_MIN_MS (500)     // Two acknowledged trigger writes have to fit into one interval
+#define TIMER_INTERVAL_MAX_MS (60 * 60 * 1000)
+#define TIMER_CATCH_UP (false)  // Take the shots missed while no camera was connected once one is back, skip them otherwise
+#define TIMER_CATCH_UP_MAX (4)  // Catch-up shots after one outage, the rest is skipped
+
+#define RECONNECT_BACKOFF_MIN_MS (500)       // Wait before the first attempt after a lost link, doubles with every failure
+#define RECONNECT_BACKOFF_MAX_MS (30 * 1000)
+#define RECONNECT_ATTEMPT_MS (35 * 1000)     // A bit longer than the 30s the stack takes to give up a direct connection
+
+#define JOURNAL_CHECKPOINT_SHOTS (10)     // Progress is written to flash every few shots or after the time below, what came after is lost on a reset
+#define JOURNAL_CHECKPOINT_MS (60 * 1000)
+
+#define SHOT_LOG_RING (128)           // Shot records kept in RAM until they are written to flash
+#define SHOT_LOG_BLOCK (32)           // Records written to flash at once, 1 KB
+#define SHOT_LOG_FLUSH_GUARD_MS (200) // No flash write from the tick this close to the next shot
+
+#define POWER_BATTERY_MODE (false)        // Light sleep and a slow BLE link between the shots of a timer run, see power.c
+#define POWER_CPU_MAX_MHZ (240)
+#define POWER_CPU_MIN_MHZ (80)            // Frequency while nothing holds the CPU up
+#define POWER_ACTIVE_INTERVAL_MS (15)     // Connection interval around the shots, the trigger writes go out within one event
+#define POWER_IDLE_INTERVAL_MS (500)      // Connection interval between the shots of long intervals
+#define POWER_IDLE_LATENCY (4)            // Connection events the camera may skip on the idle link
+#define POWER_LINK_TIMEOUT_MS (6000)      // Supervision timeout of both, more than twice the idle interval times the latency + 1
+#define POWER_DISPLAY_OFF_MS (15 * 1000)  // The display goes off this long after the last input of a battery run
+#define POWER_IDLE_TICK_MS (10 * 1000)    // Countdown tick while the display is off
+#define POWER_DEEP_SLEEP (true)           // Battery runs of long intervals power down between the shots, see power.c
+#define POWER_DEEP_INTERVAL_MS (2 * 60 * 1000) // Shortest interval which sleeps deep
+#define POWER_DEEP_LEAD_MS (4000)         // Wake up this long ahead of the shot until the wake to ready time is measured
+#define POWER_DEEP_LEAD_MAX_MS (30 * 1000)
+#define POWER_DEEP_GUARD_MS (500)         // Added to the measured wake to ready time
+#define POWER_DEEP_CLOSE_MS (2000)        // Longest wait for the links to close before the deep sleep
+
+#define LOG_LEVEL_DEFAULT (ESP_LOG_INFO) // Compile-time log level of the modules, the lines above it are not built in, see app_log.h
+#define LOG_LEVEL_CANON (ESP_LOG_INFO)   // canon_ble.c, every command step and trigger write logs at the debug level
+#define LOG_LEVEL_BLE (ESP_LOG_INFO)     // app_ble.c, every write and notification logs at the debug level
+#define LOG_DEFERRED (true)              // A low priority task writes the log to the UART, see app_log.c
+#define LOG_BUFFER_SIZE (4096)           // Log ring in bytes, a power of two
+#define LOG_LINE_MAX (160)               // Longer lines are cut
+
+#define TRACE_ENABLE (true)  // Binary event trace of the input, display, timer, canon and BLE paths, see trace.c
+#define TRACE_RECORDS (512)  // Per core, a power of two, 12 bytes each
+
+#define CANON_FAST_TRIGGER (true) // Trigger with write without response if the camera supports it
+#define MAX_CAMERAS (3)           // Cameras connected at the same time, at most CONFIG_BTDM_CTRL_BLE_MAX_CONN
+#define SCAN_CANON_ONLY (true)    // Only report advertisements with Canon manufacturer data or the Canon pair service
+#define AUTO_CONNECT_LAST (false) // Connect to the last connected camera at boot if it is still bonded
 
 #endif
@@ -0,0 +1,146 @@
+#include "console.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_vfs_dev.h"
+#include "driver/uart.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sdkconfig.h"
+
+#include "shot_log.h"
+#include "trace.h"
+#include "app_log.h"
+
+#define TAG "CONSOLE"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+#define CONSOLE_TASK_PRIORITY (1) // Below the dispatcher, a long dump never delays a shot
+#define CONSOLE_TASK_STACK (4096)
+#define CONSOLE_LINE_MAX (64)
+
+/*
+Console commands:
+    shots       - Dump the shot log, tools/shot_log.py turns it into CSV and latency histograms
+    shots stats - Record and flash counters
+    shots clear - Erase the shot log
+    trace       - Dump the event trace, tools/trace_chrome.py turns it into a Chrome trace
+    trace clear - Start the trace over
+    log         - Counters of the log ring
+*/
+
+typedef void (*console_handler)(const char *args);
+
+struct console_command
+{
+    const char *name;
+    console_handler handler;
+};
+
+static void console_shots(const char *args)
+{
+    if (strcmp(args, "clear") == 0)
+    {
+        shot_log_clear();
+    }
+    else if (strcmp(args, "stats") == 0)
+    {
+        struct shot_log_stats stats;
+        shot_log_get_stats(&stats);
+
+        printf("records %u lost %u blocks %u failed %u\n", stats.records, stats.lost, stats.blocks, stats.failed);
+    }
+    else
+    {
+        shot_log_dump(stdout);
+    }
+    fflush(stdout);
+}
+
+static void console_trace(const char *args)
+{
+    if (strcmp(args, "clear") == 0)
+    {
+        trace_clear();
+    }
+    else
+    {
+        trace_dump(stdout);
+    }
+    fflush(stdout);
+}
+
+static void console_log(const char *args)
+{
+    struct app_log_stats stats;
+    app_log_get_stats(&stats);
+
+    printf("lines %u dropped %u cut %u max used %u of %u bytes\n", stats.lines, stats.dropped, stats.cut, stats.max_used, LOG_BUFFER_SIZE);
+    fflush(stdout);
+}
+
+static const struct console_command commands[] = {
+    {"shots", console_shots},
+    {"trace", console_trace},
+    {"log", console_log},
+};
+
+static void console_execute(char *line)
+{
+    line[strcspn(line, "\r\n")] = 0;
+
+    char *args = strchr(line, ' ');
+    if (args != NULL)
+    {
+        *args++ = 0;
+    }
+    else
+    {
+        args = "";
+    }
+
+    if (line[0] == 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < sizeof(commands) / sizeof(commands[0]); i++)
+    {
+        if (strcmp(line, commands[i].name) == 0)
+        {
+            commands[i].handler(args);
+            return;
+        }
+    }
+
+    printf("Unknown command %s\n", line);
+}
+
+static void console_task(void *arg)
+{
+    char line[CONSOLE_LINE_MAX];
+
+    while (true)
+    {
+        if (fgets(line, sizeof(line), stdin) != NULL)
+        {
+            console_execute(line);
+        }
+    }
+}
+
+void console_init()
+{
+    // Blocking reads through the UART driver, without it stdin returns at once
+    esp_err_t err = uart_driver_install(CONFIG_ESP_CONSOLE_UART_NUM, 256, 0, 0, NULL, 0);
+    if (err != ESP_OK)
+    {
+        LOGE("UART driver install failed: %s", esp_err_to_name(err));
+        return;
+    }
+    esp_vfs_dev_uart_use_driver(CONFIG_ESP_CONSOLE_UART_NUM);
+    setvbuf(stdin, NULL, _IONBF, 0);
+
+    xTaskCreate(console_task, "console_task", CONSOLE_TASK_STACK, NULL, CONSOLE_TASK_PRIORITY, NULL);
+}
@@ -0,0 +1,7 @@
+#ifndef __CONSOLE__
+#define __CONSOLE__
+
+// Line commands on the console UART, next to the log output
+void console_init();
+
+#endif
@@ -0,0 +1,101 @@
+#include "display.h"
+#include "SSD1306.h"
+#include "trace.h"
+#include "app_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#define TAG "DISPLAY"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+#define DISPLAY_TASK_PRIORITY (1)
+
+/*
+Display flush:
+    1. Any task draws into the back buffer and calls display_present, this copies the frame and returns immediately
+    2. The flush task wakes up and sends the presented frame over I2C
+    3. Presents while a flush is running are coalesced into a single flush of the latest frame
+    4. The panel is switched off and on by the flush task as well, the frames presented while it is off wait for it
+*/
+
+static SemaphoreHandle_t display_mutex = NULL;
+static TaskHandle_t display_task_handle = NULL;
+static volatile bool display_on = true; // Requested state
+static bool panel_on = true;
+
+static void display_lock()
+{
+    xSemaphoreTake(display_mutex, portMAX_DELAY);
+}
+
+static void display_unlock()
+{
+    xSemaphoreGive(display_mutex);
+}
+
+static void display_flush_task(void *arg)
+{
+    while (true)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        bool on = display_on;
+        if (!on)
+        {
+            if (panel_on)
+            {
+                SSD1306_command(SSD1306_DISPLAYOFF);
+                panel_on = false;
+            }
+            continue;
+        }
+
+        TRACE_BEGIN(TRACE_DISPLAY, 0, 0);
+        if (!SSD1306_flush())
+        {
+            LOGE("Flush failed");
+        }
+        TRACE_END(TRACE_DISPLAY, 0, 0);
+
+        // After the flush, the panel comes back with the current frame
+        if (!panel_on)
+        {
+            SSD1306_command(SSD1306_DISPLAYON);
+            panel_on = true;
+        }
+    }
+}
+
+void display_flush_init()
+{
+    display_mutex = xSemaphoreCreateMutex();
+    SSD1306_setLock(display_lock, display_unlock);
+
+    xTaskCreate(display_flush_task, "display_task", 3072, NULL, DISPLAY_TASK_PRIORITY, &display_task_handle);
+}
+
+void display_present()
+{
+    SSD1306_present();
+
+    if (display_task_handle != NULL)
+    {
+        xTaskNotifyGive(display_task_handle);
+    }
+    else
+    {
+        SSD1306_flush(); // Not started yet, flush synchronously
+    }
+}
+
+void display_set_power(bool on)
+{
+    display_on = on;
+
+    if (display_task_handle != NULL)
+    {
+        xTaskNotifyGive(display_task_handle);
+    }
+}
@@ -0,0 +1,12 @@
+#ifndef __DISPLAY__
+#define __DISPLAY__
+
+#include <stdbool.h>
+
+void display_flush_init();
+void display_present();
+
+// The panel only draws while it is on, the command goes out from the flush task
+void display_set_power(bool on);
+
+#endif
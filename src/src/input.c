@@ -1,144 +1,433 @@
 #include "input.h"
 
-#include "esp_log.h"
 #include "esp_gatt_defs.h"
 #include "esp_timer.h"
+#include "esp_sleep.h"
 #include "driver/gpio.h"
+#include "driver/pcnt.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/queue.h"
+#include "soc/gpio_reg.h"
+#include "soc/gpio_struct.h"
 
 #include "config.h"
 #include "main.h"
+#include "trace.h"
+#include "app_log.h"
+
+#define TAG "INPUT"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
 
 #define BUTTON_TIME_MIN 30000
 #define BUTTON_TIME_MAX 780000
 
-static xQueueHandle gpio_evt_queue = NULL;
+#define ROTARY_POLL_MS (10)                                 // Pulse counter read interval
+#define ROTARY_PCNT_LIMIT (ROTARY_COUNTS_PER_DETENT * 1000) // The counter wraps to 0 at +-limit, a whole number of detents
+#define ROTARY_ACCEL_IDLE_US (150000)                       // A pause this long ends the acceleration
+
+#define EDGE_RING_LEN (64) // Power of two
+
+// Pin levels captured by the interrupt
+#define LEVEL_BUTTON (1 << 0)
+#define LEVEL_ROTARY1 (1 << 1)
+#define LEVEL_ROTARY2 (1 << 2)
+
+/*
+Rotary encoder:
+    Both encoder pins step through the Gray code 11 -> 10 -> 00 -> 01 -> 11 for one detent to the right (ROTARY2 leads)
+    and through the reverse sequence to the left.
+
+    With ROTARY_PCNT the pulse counter decodes all four edges of a detent in hardware with its glitch filter, the input
+    task reads the counter every ROTARY_POLL_MS and no edge costs CPU time.
+    Without it the pin interrupts feed the same Gray code sequence through a state table, bounces step back and forth
+    and cancel out, impossible transitions (both pins changed) are ignored.
+
+Edges:
+    The pin interrupt takes the time and the levels of all input pins right away and puts them into a single producer,
+    single consumer ring. The input task drains the ring in batches, so the button timing and the encoder order are
+    those of the real edges, no matter how late the task runs. A full ring drops the edge and counts it.
+
+Sleep:
+    Light sleep only wakes up on a pin level. While the display is off the button interrupt is switched to the low
+    level and the pulse counter isn't polled, the first interrupt switches the button back to both edges, so the
+    press which woke the chip is still decoded.
+
+Acceleration:
+    The detents per second are smoothed while the encoder keeps turning, the steps of an input event are the detents
+    multiplied by the factor for the current speed. Lists move by detents, values like the timer interval by steps.
+*/
+
+struct edge
+{
+    int64_t time;
+    uint8_t levels;
+};
+
+// head is only written by the interrupt, tail only by the task
+static struct edge edge_ring[EDGE_RING_LEN];
+static volatile uint32_t edge_head = 0;
+static volatile uint32_t edge_tail = 0;
+static volatile uint32_t edge_overflows = 0;
+static uint32_t edge_overflows_reported = 0;
+
+static TaskHandle_t gpio_task_handle = NULL;
+static volatile bool sleeping = false;
 
-static bool input_states[3] = {true};
+static bool button_state = true;
 static uint64_t buttonHILO;
 
-// How to rotary encoder?? help
-static uint64_t rotary1HILO;
-static uint64_t rotary2HILO;
+// Indexed by (previous state << 2) | state with state = (ROTARY1 << 1) | ROTARY2, +1 is a quarter detent right
+static const int8_t rotary_table[16] = {
+    0, 1, -1, 0,
+    -1, 0, 0, 1,
+    1, 0, 0, -1,
+    0, -1, 1, 0};
 
-static uint64_t rotary1LOHI;
-static uint64_t rotary2LOHI;
+static uint8_t rotary_state = 0x3;
+static int rotary_counts = 0;
+static int16_t rotary_pcnt_last = 0;
 
-static void check_rotary()
+// Speed in detents per second for the acceleration
+struct rotary_accel
 {
-	if (rotary2HILO < rotary1HILO && rotary2HILO < rotary2LOHI && rotary2HILO < rotary1LOHI &&
-		rotary1HILO < rotary2LOHI && rotary1HILO < rotary1LOHI &&
-		rotary2LOHI < rotary1LOHI)
-	{
-		main_input(INPUT_RIGHT);
-	}
-	else if (rotary1HILO < rotary2HILO && rotary1HILO < rotary1LOHI && rotary1HILO < rotary2LOHI &&
-		rotary2HILO < rotary1LOHI && rotary2HILO < rotary2LOHI &&
-		rotary1LOHI < rotary2LOHI)
-	{
-		main_input(INPUT_LEFT);
-	}
+    uint16_t rate;
+    uint16_t factor;
+};
+
+static const struct rotary_accel accel_table[] = {
+    {0, 1},
+    {8, 2},
+    {15, 10},
+    {25, 40},
+    {40, 100}};
+
+static int64_t rotary_last_time = 0;
+static int rotary_last_dir = 0;
+static uint32_t rotary_speed = 0; // Smoothed detents per second
+
+static uint16_t rotary_accel_factor(int dir, int detents, int64_t now)
+{
+    int64_t elapsed = now - rotary_last_time;
+
+    if (dir != rotary_last_dir || elapsed > ROTARY_ACCEL_IDLE_US)
+    {
+        rotary_speed = 0;
+    }
+    else if (elapsed > 0)
+    {
+        uint32_t rate = (uint32_t)(detents * 1000000LL / elapsed);
+        rotary_speed = (rotary_speed * 3 + rate) / 4;
+    }
+
+    rotary_last_time = now;
+    rotary_last_dir = dir;
+
+    uint16_t factor = 1;
+    for (int i = 0; i < sizeof(accel_table) / sizeof(accel_table[0]); i++)
+    {
+        if (rotary_speed >= accel_table[i].rate)
+        {
+            factor = accel_table[i].factor;
+        }
+    }
+
+    return factor;
+}
+
+static void rotary_emit(int counts)
+{
+    rotary_counts += counts;
+
+    int detents = rotary_counts / ROTARY_COUNTS_PER_DETENT;
+    if (detents == 0)
+    {
+        return;
+    }
+
+    rotary_counts -= detents * ROTARY_COUNTS_PER_DETENT;
+
+    int dir = (detents > 0 ? 1 : -1);
+    uint16_t count = (uint16_t)(detents * dir);
+    uint16_t factor = rotary_accel_factor(dir, count, esp_timer_get_time());
+
+    struct input_event input = {
+        .button = (dir > 0 ? INPUT_RIGHT : INPUT_LEFT),
+        .detents = count,
+        .steps = count * factor};
+    main_input(&input);
+}
+
+static void rotary_edge(uint8_t levels)
+{
+    uint8_t state = ((levels & LEVEL_ROTARY1) ? 0x2 : 0) | ((levels & LEVEL_ROTARY2) ? 0x1 : 0);
+
+    int8_t delta = rotary_table[(rotary_state << 2) | state];
+    rotary_state = state;
+
+    if (delta != 0)
+    {
+        rotary_emit(delta);
+    }
+}
+
+static void rotary_poll()
+{
+    int16_t count;
+    if (pcnt_get_counter_value(ROTARY_PCNT_UNIT, &count) != ESP_OK)
+    {
+        return;
+    }
+
+    // Undo the wrap at the counter limits
+    int delta = count - rotary_pcnt_last;
+    if (delta > ROTARY_PCNT_LIMIT / 2)
+    {
+        delta -= ROTARY_PCNT_LIMIT;
+    }
+    else if (delta < -ROTARY_PCNT_LIMIT / 2)
+    {
+        delta += ROTARY_PCNT_LIMIT;
+    }
+    rotary_pcnt_last = count;
+
+    if (delta != 0)
+    {
+        rotary_emit(delta);
+    }
+}
+
+static void button_edge(uint8_t levels, int64_t time)
+{
+    bool pin_state = ((levels & LEVEL_BUTTON) != 0);
+    if (button_state == pin_state)
+    {
+        return;
+    }
+
+    if (!pin_state) //HI->LO
+    {
+        buttonHILO = time;
+    }
+    else //LO->HI
+    {
+        uint64_t dif = time - buttonHILO;
+        if (dif >= BUTTON_TIME_MIN && dif <= BUTTON_TIME_MAX)
+        {
+            struct input_event input = {.button = INPUT_BUTTON, .detents = 1, .steps = 1};
+            main_input(&input);
+        }
+    }
+
+    button_state = pin_state;
+}
+
+static void edge_drain()
+{
+    uint32_t head = __atomic_load_n(&edge_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = edge_tail;
+
+    while (tail != head)
+    {
+        struct edge *edge = &edge_ring[tail % EDGE_RING_LEN];
+
+        // Every edge carries all levels, the handlers ignore the pins which didn't change
+        button_edge(edge->levels, edge->time);
+        if (!ROTARY_PCNT)
+        {
+            rotary_edge(edge->levels);
+        }
+
+        tail++;
+    }
+
+    __atomic_store_n(&edge_tail, tail, __ATOMIC_RELEASE);
+
+    uint32_t overflows = edge_overflows;
+    if (overflows != edge_overflows_reported)
+    {
+        LOGW("%u edges lost, ring full", overflows - edge_overflows_reported);
+        edge_overflows_reported = overflows;
+    }
 }
 
 static void gpio_task(void *arg)
 {
-    uint32_t io_num;
     for (;;)
     {
-        if (xQueueReceive(gpio_evt_queue, &io_num, portMAX_DELAY))
+        // Wake up for the pulse counter even without pin interrupts, unless the chip may sleep
+        TickType_t wait = (ROTARY_PCNT && !sleeping ? ROTARY_POLL_MS / portTICK_RATE_MS : portMAX_DELAY);
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        TRACE_BEGIN(TRACE_GPIO_TASK, 0, 0);
+        edge_drain();
+
+        if (ROTARY_PCNT)
         {
-            int input = 0;
-            switch (io_num)
-            {
-            case BUTTON:
-                input = 0;
-                break;
-            case ROTARY1:
-                input = 1;
-                break;
-            case ROTARY2:
-                input = 2;
-                break;
-            }
-
-            bool pin_state = gpio_get_level(io_num);
-            if (input_states[input] != pin_state) // Pin changed?
-            {
-                switch (io_num)
-                {
-                case BUTTON:
-                    if (!pin_state && input_states[input]) //HI->LO
-                    {
-                        buttonHILO = esp_timer_get_time();
-                    }
-                    else if (pin_state && !input_states[input]) //LO->HI
-                    {
-                        uint64_t dif = esp_timer_get_time() - buttonHILO;
-                        if (dif >= BUTTON_TIME_MIN && dif <= BUTTON_TIME_MAX)
-                        {
-                            main_input(INPUT_BUTTON);
-                        }
-                    }
-                    break;
-                case ROTARY1:
-                    if (!pin_state && input_states[input]) //HI->LO
-                    {
-                        rotary1HILO = esp_timer_get_time();
-                    }
-                    else if (pin_state && !input_states[input]) //LO->HI
-                    {
-                        rotary1LOHI = esp_timer_get_time();
-                    }
-
-                    check_rotary();
-                    break;
-                case ROTARY2:
-                    if (!pin_state && input_states[input]) //HI->LO
-                    {
-                        rotary2HILO = esp_timer_get_time();
-                    }
-                    else if (pin_state && !input_states[input]) //LO->HI
-                    {
-                        rotary2LOHI = esp_timer_get_time();
-                    }
-
-                    check_rotary();
-                    break;
-                }
-
-                input_states[input] = pin_state;
-            }
+            rotary_poll();
         }
+        TRACE_END(TRACE_GPIO_TASK, 0, 0);
     }
 }
 
+static inline bool IRAM_ATTR pin_level(uint32_t in, uint32_t in1, int pin)
+{
+    return (pin < 32 ? (in >> pin) : (in1 >> (pin - 32))) & 1;
+}
+
 static void IRAM_ATTR gpio_isr_handler(void *arg)
 {
-    uint32_t gpio_num = (uint32_t)arg;
-    xQueueSendFromISR(gpio_evt_queue, &gpio_num, NULL);
+    int64_t time = esp_timer_get_time();
+    uint32_t in = REG_READ(GPIO_IN_REG);
+    uint32_t in1 = REG_READ(GPIO_IN1_REG);
+
+    // The level interrupt would fire again right away
+    if (sleeping)
+    {
+        GPIO.pin[BUTTON].wakeup_enable = 0;
+        GPIO.pin[BUTTON].int_type = GPIO_INTR_ANYEDGE;
+        sleeping = false;
+    }
+
+    uint32_t head = edge_head;
+    if (head - __atomic_load_n(&edge_tail, __ATOMIC_ACQUIRE) >= EDGE_RING_LEN)
+    {
+        edge_overflows++;
+        return;
+    }
+
+    struct edge *edge = &edge_ring[head % EDGE_RING_LEN];
+    edge->time = time;
+    edge->levels = (pin_level(in, in1, BUTTON) ? LEVEL_BUTTON : 0) |
+                   (pin_level(in, in1, ROTARY1) ? LEVEL_ROTARY1 : 0) |
+                   (pin_level(in, in1, ROTARY2) ? LEVEL_ROTARY2 : 0);
+
+    __atomic_store_n(&edge_head, head + 1, __ATOMIC_RELEASE);
+    TRACE_INSTANT(TRACE_GPIO_ISR, edge->levels, 0);
+
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(gpio_task_handle, &woken);
+    if (woken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void rotary_pcnt_init()
+{
+    // Channel 0 counts the ROTARY2 edges and channel 1 the ROTARY1 edges, the other pin gives the direction
+    pcnt_config_t config = {
+        .pulse_gpio_num = ROTARY2,
+        .ctrl_gpio_num = ROTARY1,
+        .channel = PCNT_CHANNEL_0,
+        .unit = ROTARY_PCNT_UNIT,
+        .pos_mode = PCNT_COUNT_DEC,
+        .neg_mode = PCNT_COUNT_INC,
+        .lctrl_mode = PCNT_MODE_REVERSE,
+        .hctrl_mode = PCNT_MODE_KEEP,
+        .counter_h_lim = ROTARY_PCNT_LIMIT,
+        .counter_l_lim = -ROTARY_PCNT_LIMIT};
+    ESP_ERROR_CHECK(pcnt_unit_config(&config));
+
+    config.pulse_gpio_num = ROTARY1;
+    config.ctrl_gpio_num = ROTARY2;
+    config.channel = PCNT_CHANNEL_1;
+    config.pos_mode = PCNT_COUNT_INC;
+    config.neg_mode = PCNT_COUNT_DEC;
+    ESP_ERROR_CHECK(pcnt_unit_config(&config));
+
+    pcnt_set_filter_value(ROTARY_PCNT_UNIT, ROTARY_FILTER);
+    pcnt_filter_enable(ROTARY_PCNT_UNIT);
+
+    pcnt_counter_pause(ROTARY_PCNT_UNIT);
+    pcnt_counter_clear(ROTARY_PCNT_UNIT);
+    pcnt_counter_resume(ROTARY_PCNT_UNIT);
+}
+
+bool input_merge(struct input_event *into, const struct input_event *next)
+{
+    if (into->button == INPUT_BUTTON || next->button == INPUT_BUTTON)
+    {
+        return false;
+    }
+
+    // Net turn, opposite directions cancel out
+    int detents = (into->button == INPUT_RIGHT ? into->detents : -into->detents);
+    int steps = (into->button == INPUT_RIGHT ? into->steps : -into->steps);
+
+    detents += (next->button == INPUT_RIGHT ? next->detents : -next->detents);
+    steps += (next->button == INPUT_RIGHT ? next->steps : -next->steps);
+
+    into->button = (steps >= 0 ? INPUT_RIGHT : INPUT_LEFT);
+    into->detents = (uint16_t)(detents >= 0 ? detents : -detents);
+    into->steps = (uint16_t)(steps >= 0 ? steps : -steps);
+
+    return true;
 }
 
 void input_init()
 {
+    // The interrupts are enabled per pin below, the encoder pins don't need any with the pulse counter
     gpio_config_t io_conf;
-    io_conf.intr_type = GPIO_INTR_ANYEDGE;
+    io_conf.intr_type = GPIO_INTR_DISABLE;
     io_conf.mode = GPIO_MODE_INPUT;
     io_conf.pin_bit_mask = ((uint64_t)1 << BUTTON) | ((uint64_t)1 << ROTARY1) | ((uint64_t)1 << ROTARY2);
     io_conf.pull_down_en = 0;
     io_conf.pull_up_en = 1;
     gpio_config(&io_conf);
 
-    gpio_set_intr_type(BUTTON, GPIO_INTR_ANYEDGE);
-    gpio_set_intr_type(ROTARY1, GPIO_INTR_ANYEDGE);
-    gpio_set_intr_type(ROTARY2, GPIO_INTR_ANYEDGE);
+    button_state = gpio_get_level(BUTTON);
 
-    gpio_evt_queue = xQueueCreate(10, sizeof(uint32_t));
-    xTaskCreate(gpio_task, "gpio_task", 2048, NULL, 10, NULL);
+    xTaskCreate(gpio_task, "gpio_task", 2048, NULL, 10, &gpio_task_handle);
 
     gpio_install_isr_service(0);
+
+    gpio_set_intr_type(BUTTON, GPIO_INTR_ANYEDGE);
     gpio_isr_handler_add(BUTTON, gpio_isr_handler, (void *)BUTTON);
-    gpio_isr_handler_add(ROTARY1, gpio_isr_handler, (void *)ROTARY1);
-    gpio_isr_handler_add(ROTARY2, gpio_isr_handler, (void *)ROTARY2);
+    gpio_intr_enable(BUTTON);
+
+    // No pin wakes the chip until input_set_sleep arms the button
+    esp_sleep_enable_gpio_wakeup();
+
+    if (ROTARY_PCNT)
+    {
+        rotary_pcnt_init();
+
+        LOGI("Rotary encoder on the pulse counter");
+    }
+    else
+    {
+        rotary_state = (gpio_get_level(ROTARY1) << 1) | gpio_get_level(ROTARY2);
+
+        gpio_set_intr_type(ROTARY1, GPIO_INTR_ANYEDGE);
+        gpio_set_intr_type(ROTARY2, GPIO_INTR_ANYEDGE);
+        gpio_isr_handler_add(ROTARY1, gpio_isr_handler, (void *)ROTARY1);
+        gpio_isr_handler_add(ROTARY2, gpio_isr_handler, (void *)ROTARY2);
+        gpio_intr_enable(ROTARY1);
+        gpio_intr_enable(ROTARY2);
+    }
+}
+
+void input_set_sleep(bool sleep)
+{
+    if (sleep == sleeping)
+    {
+        return;
+    }
+
+    if (sleep)
+    {
+        sleeping = true;
+        gpio_wakeup_enable(BUTTON, GPIO_INTR_LOW_LEVEL);
+    }
+    else
+    {
+        gpio_intr_disable(BUTTON);
+        sleeping = false;
+        gpio_wakeup_disable(BUTTON);
+        gpio_set_intr_type(BUTTON, GPIO_INTR_ANYEDGE);
+        gpio_intr_enable(BUTTON);
+    }
+
+    // Picks up the poll period
+    xTaskNotifyGive(gpio_task_handle);
 }
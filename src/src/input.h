@@ -1,10 +1,26 @@
 #ifndef __INPUT__
 #define __INPUT__
 
+#include <stdint.h>
+#include <stdbool.h>
+
 #define INPUT_LEFT 0
 #define INPUT_RIGHT 1
 #define INPUT_BUTTON 2
 
+struct input_event
+{
+    uint8_t button;   // INPUT_LEFT, INPUT_RIGHT or INPUT_BUTTON
+    uint16_t detents; // Encoder detents turned, 1 for the button
+    uint16_t steps;   // Detents multiplied by the acceleration, for entering values
+};
+
 void input_init(void);
 
+// Only the button works while the chip may light sleep, the turns of the encoder are lost
+void input_set_sleep(bool sleep);
+
+// Adds the turn in next to into, false if one of them is a button press
+bool input_merge(struct input_event *into, const struct input_event *next);
+
 #endif
@@ -0,0 +1,252 @@
+#include "journal.h"
+
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp32/clk.h"
+#include "nvs.h"
+
+#include "app_log.h"
+
+#define TAG "JOURNAL"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+/*
+Session journal:
+    NVS already writes every value as a new entry and erases pages in turns, so the journal is two keys in its own namespace:
+    1. The session parameters, written once when the timer starts
+    2. The progress, written every JOURNAL_CHECKPOINT_SHOTS shots or JOURNAL_CHECKPOINT_MS from a tick
+       at least SHOT_LOG_FLUSH_GUARD_MS ahead of the next shot, never from a shot
+
+    An entry is only valid once it is completely written, a reset during a write keeps the previous checkpoint.
+    The start is kept as RTC time, which runs on over software, panic and watchdog resets. After a power loss or a
+    brownout the RTC starts over and the schedule continues one interval after the last checkpoint instead. The reset
+    reason and the RTC time are looked at in journal_load, at boot: once the user took a while on the resume prompt
+    a new RTC time may well be past the old checkpoint.
+
+    The progress is mirrored to RTC memory on every shot. It only survives a deep sleep, after the wake of a battery
+    run journal_load takes the shot and exposure count from there, without writing NVS every cycle.
+*/
+
+#define JOURNAL_NAMESPACE "journal"
+#define JOURNAL_SESSION_KEY "session"
+#define JOURNAL_PROGRESS_KEY "progress"
+#define JOURNAL_VERSION (1)
+
+struct journal_header
+{
+    uint8_t version;
+    uint32_t interval_ms;
+    uint64_t start_rtc_us;
+    uint8_t peer_count;
+    struct session_peer peers[MAX_CAMERAS];
+};
+
+struct journal_progress
+{
+    uint64_t start_rtc_us; // Session the checkpoint belongs to
+    uint32_t shot;
+    uint32_t expo_count;
+    uint64_t rtc_us;
+};
+
+static bool active = false;
+static struct journal_progress progress;
+static struct journal_progress written;
+static int64_t written_time;
+static struct journal_progress loaded; // Checkpoint of the last journal_load, journal_resume counts from it
+
+static RTC_DATA_ATTR struct journal_progress rtc_progress;
+
+static struct journal_stats stats;
+
+static bool journal_write(const char *key, const void *value, size_t length)
+{
+    nvs_handle handle;
+    if (nvs_open(JOURNAL_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        stats.failed++;
+        return false;
+    }
+
+    bool ok = (nvs_set_blob(handle, key, value, length) == ESP_OK && nvs_commit(handle) == ESP_OK);
+    nvs_close(handle);
+
+    if (!ok)
+    {
+        LOGE("Journal write failed");
+        stats.failed++;
+    }
+    return ok;
+}
+
+void journal_begin(uint32_t interval_ms, const struct session_peer *peers, int count)
+{
+    struct journal_header header = {
+        .version = JOURNAL_VERSION,
+        .interval_ms = interval_ms,
+        .start_rtc_us = esp_clk_rtc_time(),
+        .peer_count = count};
+    memcpy(header.peers, peers, sizeof(struct session_peer) * count);
+
+    memset(&stats, 0, sizeof(stats));
+    memset(&progress, 0, sizeof(progress));
+    progress.start_rtc_us = header.start_rtc_us;
+    active = true;
+
+    // A reset in between leaves a checkpoint of the old session, the start time tells them apart
+    journal_write(JOURNAL_SESSION_KEY, &header, sizeof(header));
+    journal_flush(true);
+}
+
+void journal_resume(const struct journal_session *session)
+{
+    memset(&stats, 0, sizeof(stats));
+
+    progress.start_rtc_us = session->start_rtc_us;
+    progress.shot = session->shot;
+    progress.expo_count = session->expo_count;
+    progress.rtc_us = session->checkpoint_rtc_us;
+
+    // The RTC copy may be ahead of the checkpoint, the next one is due counted from what NVS has
+    written = (loaded.start_rtc_us == session->start_rtc_us ? loaded : progress);
+    written_time = esp_timer_get_time();
+    active = true;
+}
+
+void journal_progress(uint32_t shot, uint32_t expo_count)
+{
+    progress.shot = shot;
+    progress.expo_count = expo_count;
+    rtc_progress = progress;
+}
+
+void journal_flush(bool force)
+{
+    if (!active)
+    {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (!force)
+    {
+        if (progress.shot == written.shot && progress.expo_count == written.expo_count)
+        {
+            return;
+        }
+        if (progress.shot - written.shot < JOURNAL_CHECKPOINT_SHOTS && now - written_time < (int64_t)JOURNAL_CHECKPOINT_MS * 1000)
+        {
+            return;
+        }
+    }
+
+    progress.rtc_us = esp_clk_rtc_time();
+    if (journal_write(JOURNAL_PROGRESS_KEY, &progress, sizeof(progress)))
+    {
+        stats.checkpoints++;
+    }
+
+    written = progress;
+    written_time = now;
+    rtc_progress = progress;
+}
+
+void journal_end()
+{
+    active = false;
+    memset(&rtc_progress, 0, sizeof(rtc_progress));
+
+    nvs_handle handle;
+    if (nvs_open(JOURNAL_NAMESPACE, NVS_READWRITE, &handle) != ESP_OK)
+    {
+        return;
+    }
+
+    nvs_erase_key(handle, JOURNAL_SESSION_KEY);
+    nvs_erase_key(handle, JOURNAL_PROGRESS_KEY);
+    nvs_commit(handle);
+    nvs_close(handle);
+
+    LOGI("Session ended, %u checkpoints", stats.checkpoints);
+}
+
+bool journal_load(struct journal_session *session)
+{
+    nvs_handle handle;
+    if (nvs_open(JOURNAL_NAMESPACE, NVS_READONLY, &handle) != ESP_OK)
+    {
+        return false;
+    }
+
+    struct journal_header header;
+    struct journal_progress last;
+    size_t header_length = sizeof(header);
+    size_t last_length = sizeof(last);
+
+    bool found = (nvs_get_blob(handle, JOURNAL_SESSION_KEY, &header, &header_length) == ESP_OK &&
+                  header_length == sizeof(header) && header.version == JOURNAL_VERSION && header.peer_count <= MAX_CAMERAS);
+
+    // Reset before the first checkpoint
+    if (nvs_get_blob(handle, JOURNAL_PROGRESS_KEY, &last, &last_length) != ESP_OK || last_length != sizeof(last) ||
+        (found && last.start_rtc_us != header.start_rtc_us))
+    {
+        memset(&last, 0, sizeof(last));
+    }
+    nvs_close(handle);
+
+    if (!found)
+    {
+        return false;
+    }
+
+    last.start_rtc_us = header.start_rtc_us;
+    loaded = last;
+
+    // RTC memory only keeps its content over a deep sleep
+    if (esp_sleep_get_wakeup_cause() != ESP_SLEEP_WAKEUP_UNDEFINED && rtc_progress.start_rtc_us == header.start_rtc_us &&
+        rtc_progress.shot >= last.shot)
+    {
+        last = rtc_progress;
+    }
+
+    session->interval_ms = header.interval_ms;
+    session->start_rtc_us = header.start_rtc_us;
+    session->peer_count = header.peer_count;
+    memcpy(session->peers, header.peers, sizeof(header.peers));
+    session->shot = last.shot;
+    session->expo_count = last.expo_count;
+    session->checkpoint_rtc_us = (last.rtc_us != 0 ? last.rtc_us : header.start_rtc_us);
+
+    esp_reset_reason_t reason = esp_reset_reason();
+    session->rtc_kept = (reason != ESP_RST_POWERON && reason != ESP_RST_BROWNOUT && reason != ESP_RST_UNKNOWN &&
+                         esp_clk_rtc_time() >= session->checkpoint_rtc_us);
+
+    return true;
+}
+
+int64_t journal_resume_start(const struct journal_session *session)
+{
+    uint64_t rtc_now = esp_clk_rtc_time();
+    int64_t now = esp_timer_get_time();
+
+    if (session->rtc_kept)
+    {
+        // Same RTC time base, the esp_timer started over at the reset
+        int64_t elapsed = (int64_t)(rtc_now - session->start_rtc_us);
+        LOGI("Resuming %lld s after the start", (long long)(elapsed / 1000000));
+        return now - elapsed;
+    }
+
+    // The RTC started over, the time without power is unknown
+    LOGW("RTC time lost, resuming after shot %u", session->shot);
+    return now - (int64_t)session->shot * session->interval_ms * 1000;
+}
+
+void journal_get_stats(struct journal_stats *out)
+{
+    *out = stats;
+}
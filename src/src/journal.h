@@ -0,0 +1,52 @@
+#ifndef __JOURNAL__
+#define __JOURNAL__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "session.h"
+#include "config.h"
+
+struct journal_session
+{
+    uint32_t interval_ms;
+    uint64_t start_rtc_us; // RTC time of the start, the schedule is aligned to it
+    uint8_t peer_count;
+    struct session_peer peers[MAX_CAMERAS];
+
+    // Last checkpoint
+    uint32_t shot; // Last scheduled shot
+    uint32_t expo_count;
+    uint64_t checkpoint_rtc_us;
+
+    bool rtc_kept; // The RTC time ran on over the reset, decided by journal_load at boot
+};
+
+struct journal_stats
+{
+    uint32_t checkpoints; // Progress writes
+    uint32_t failed;      // Writes NVS refused
+};
+
+// A new session, its parameters are written right away
+void journal_begin(uint32_t interval_ms, const struct session_peer *peers, int count);
+
+// Continues a loaded session after a reset
+void journal_resume(const struct journal_session *session);
+
+// Only kept in RAM, journal_flush writes it once a checkpoint is due
+void journal_progress(uint32_t shot, uint32_t expo_count);
+void journal_flush(bool force);
+
+// The session ended, nothing to resume
+void journal_end();
+
+bool journal_load(struct journal_session *session);
+
+// esp_timer time of the start of a loaded session, from the last checkpoint if the RTC time didn't survive the reset.
+// Only the decision of journal_load counts, the user may spend any time on the resume prompt before this
+int64_t journal_resume_start(const struct journal_session *session);
+
+void journal_get_stats(struct journal_stats *stats);
+
+#endif
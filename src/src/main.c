@@ -6,20 +6,30 @@
 
 #include "esp_bt.h"
 #include "nvs_flash.h"
-#include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "driver/i2c.h"
 
 #include "config.h"
 #include "input.h"
 #include "SSD1306.h"
+#include "SSD1306_i2c.h"
+#include "display.h"
 #include "menu.h"
 #include "app_ble.h"
 #include "timer.h"
-
-void main_input(int button)
+#include "app_event.h"
+#include "session.h"
+#include "shot_log.h"
+#include "console.h"
+#include "power.h"
+#include "app_log.h"
+
+void main_input(const struct input_event *input)
 {
-    menu_input(button);
+    struct app_event event = {.type = APP_EVENT_INPUT};
+    event.input = *input;
+
+    app_event_post_lossy(&event);
 }
 
 bool i2c_init()
@@ -55,20 +65,41 @@ bool i2c_init()
 
 void display_init()
 {
-     SSD1306_begin(SSD1306_SWITCHCAPVCC, DISPLAY_ADR, DISPLAY_I2C);
+     SSD1306_begin(SSD1306_SWITCHCAPVCC, SSD1306_i2c_transport(DISPLAY_I2C, DISPLAY_ADR));
 
     SSD1306_clearDisplay();
-    SSD1306_drawText(0, 0, "BOOTING", 2, WHITE);
+
+    // The wake of a deep sleeping run keeps the display dark
+    if (power_wake_reason() != POWER_WAKE_TIMER)
+    {
+        SSD1306_drawText(0, 0, "BOOTING", 2, WHITE);
+    }
     SSD1306_display();
+
+    display_flush_init();
+
+    if (power_wake_reason() == POWER_WAKE_TIMER)
+    {
+        display_set_power(false);
+    }
 }
 
 void app_main()
 {
+    // First, the lines of the init go through the log ring already
+    app_log_init();
+
     ESP_LOGI("MAIN", "[BOOT]");
 
     ESP_ERROR_CHECK(nvs_flash_init());
     ESP_ERROR_CHECK(esp_bt_controller_mem_release(ESP_BT_MODE_CLASSIC_BT));
 
+    // Events posted during the init wait in the queue until the dispatcher starts
+    app_event_init();
+
+    // Before the display, it tells a deep sleep wake from a reset
+    power_init();
+
     menu_init();
 
     i2c_init();
@@ -79,6 +110,13 @@ void app_main()
     ble_init();
 
     app_timer_init();
+    session_init();
+    shot_log_init();
+
+    console_init();
 
     menu_set(MENU_MAIN);
+
+    // From here on the menu, canon and BLE state is only touched by the dispatcher task
+    app_event_start();
 }
@@ -1,6 +1,8 @@
 #ifndef __MAIN__
 #define __MAIN__
 
-void main_input(int button);
+#include "input.h"
+
+void main_input(const struct input_event *input);
 
 #endif
\ No newline at end of file
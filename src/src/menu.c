@@ -1,26 +1,118 @@
 #include "menu.h"
 #include "main.h"
 #include "SSD1306.h"
+#include "display.h"
 #include "input.h"
 #include "app_ble.h"
 #include "canon_ble.h"
 #include "timer.h"
-
-#include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
+#include "app_event.h"
+#include "scan_table.h"
+#include "camera_store.h"
+#include "session.h"
+#include "journal.h"
+#include "shot_log.h"
+#include "power.h"
+#include "trace.h"
+#include "app_log.h"
+#include "config.h"
+
+#include "esp_timer.h"
 
 #define TAG "MENU"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
 
 #define MIN(a, b) (a < b ? a : b)
 #define MAX(a, b) (a > b ? a : b)
 
+#define FRAME_US (DISPLAY_FRAME_MS * 1000)
+
+/*
+Drawing:
+    The pages don't render when their state changes, they request a frame with menu_draw and the render function.
+    A frame is rendered right away if the last one is at least a frame period old, otherwise the frame timer renders
+    the latest requested function once the period is over. Any number of changes in between cost a single render.
+*/
+static esp_timer_handle_t frame_timer;
+static bool frame_pending = false;
+static int64_t frame_last = 0;
+static void (*frame_render)() = NULL;
+
+static void menu_frame()
+{
+    frame_pending = false;
+    frame_last = esp_timer_get_time();
+
+    if (frame_render != NULL)
+    {
+        frame_render();
+    }
+}
+
+static void menu_draw(void (*render)())
+{
+    frame_render = render;
+
+    if (frame_pending)
+    {
+        return;
+    }
+
+    int64_t wait = frame_last + FRAME_US - esp_timer_get_time();
+    if (wait <= 0)
+    {
+        menu_frame();
+    }
+    else
+    {
+        frame_pending = true;
+        esp_timer_start_once(frame_timer, wait);
+    }
+}
+
+// esp_timer task
+static void frame_timer_callback(void *arg)
+{
+    struct app_event event = {.type = APP_EVENT_FRAME};
+    if (!app_event_post_lossy(&event))
+    {
+        esp_timer_start_once(frame_timer, FRAME_US); // Queue full, try again next period
+    }
+}
+
+/*
+Display power:
+    During a battery run the display goes off POWER_DISPLAY_OFF_MS after the last input and the countdown ticks slower.
+    The next input only turns it on again, it doesn't reach the page.
+*/
+static bool display_off = false;
+static int64_t input_last = 0;
+
+static void menu_display_sleep()
+{
+    display_off = true;
+    display_set_power(false);
+    input_set_sleep(true);
+    power_display(false);
+    app_timer_set_tick(POWER_IDLE_TICK_MS);
+}
+
+static void menu_display_wake()
+{
+    display_off = false;
+    input_set_sleep(false);
+    power_display(true);
+    app_timer_set_tick(0);
+    display_set_power(true);
+}
+
 // Menu list
 static uint8_t menulist_selected;
 static uint8_t menulist_scroll;
 static uint8_t menulist_count;
 static char **menulist_items;
 
-static void menulist_draw()
+static void menulist_render()
 {
     SSD1306_clearDisplay();
 
@@ -40,7 +132,7 @@ static void menulist_draw()
         }
     }
 
-    SSD1306_display();
+    display_present();
 }
 
 static void menulist_init(char **items, uint8_t count)
@@ -50,23 +142,21 @@ static void menulist_init(char **items, uint8_t count)
     menulist_items = items;
     menulist_count = count;
 
-    menulist_draw();
+    menu_draw(menulist_render);
 }
 
-static int16_t menulist_input(uint8_t button)
+static int16_t menulist_input(const struct input_event *input)
 {
-    switch (button)
+    // Lists move one item per detent and wrap around, the acceleration is not used here
+    uint8_t move = input->detents % menulist_count;
+
+    switch (input->button)
     {
     case INPUT_LEFT:
-        if (menulist_selected == 0)
-            menulist_selected = menulist_count - 1;
-        else
-            menulist_selected--;
+        menulist_selected = (menulist_selected + menulist_count - move) % menulist_count;
         break;
     case INPUT_RIGHT:
-        menulist_selected++;
-        if (menulist_selected == menulist_count)
-            menulist_selected = 0;
+        menulist_selected = (menulist_selected + move) % menulist_count;
         break;
     case INPUT_BUTTON:
         return menulist_selected;
@@ -77,29 +167,72 @@ static int16_t menulist_input(uint8_t button)
     if (menulist_selected > menulist_scroll + 2)
         menulist_scroll = MAX(0, menulist_selected - 2);
 
-    menulist_draw();
+    menu_draw(menulist_render);
 
     return -1;
 }
 
-static void menu_camera_disconnect()
+static uint8_t activeMenu;
+
+static bool menu_page6_sleeping = false;
+static void menu_page6_render();
+
+// The scan lists are left alone, the user disconnected the camera and went back there
+static void menu_camera_disconnect(int camera)
 {
-    menu_set(MENU_MAIN);
+    LOGI("Camera %d disconnected", camera);
+
+    // Closed for the deep sleep, the chip powers down after the last one
+    if (menu_page6_sleeping)
+    {
+        if (ble_connection_count() == 0)
+        {
+            power_deep_sleep();
+        }
+        return;
+    }
+
+    // A running timelapse keeps its schedule while the session reconnects the camera
+    if (activeMenu == MENU_CAMERA_TIMER && session_camera_lost(camera))
+    {
+        menu_draw(menu_page6_render);
+        return;
+    }
+
+    if (activeMenu == MENU_PAIR || activeMenu == MENU_CONNECT)
+    {
+        return;
+    }
+
+    // Keep the timer running with the cameras that are left
+    if (canon_camera_count() == 0)
+    {
+        menu_set(MENU_MAIN);
+    }
+    else if (activeMenu != MENU_CAMERA_MAIN && activeMenu != MENU_CAMERA_TIMER)
+    {
+        menu_set(MENU_CAMERA_MAIN);
+    }
 }
 
 // Main menu
 static char *menu_page0_items[] = {
     (char *)"Connect",
-    (char *)"Pair"};
+    (char *)"Pair",
+    (char *)"Resume"};
+
+// A timelapse the last reset interrupted, offered until a new one starts
+static struct journal_session menu_resume;
+static bool menu_resume_pending = false;
 
 static void menu_page0_activate()
 {
-    menulist_init(menu_page0_items, 2);
+    menulist_init(menu_page0_items, journal_load(&menu_resume) ? 3 : 2);
 }
 
-static void menu_page0_input(uint8_t button)
+static void menu_page0_input(const struct input_event *input)
 {
-    int16_t selected = menulist_input(button);
+    int16_t selected = menulist_input(input);
     if (selected != -1)
     {
         switch (selected)
@@ -110,6 +243,10 @@ static void menu_page0_input(uint8_t button)
         case 1:
             menu_set(MENU_PAIR);
             break;
+        case 2:
+            menu_resume_pending = true;
+            menu_set(MENU_CAMERA_TIMER);
+            break;
         }
     }
 }
@@ -128,37 +265,34 @@ static char **menu_page1_items = NULL;
 static struct ble_adr menu_page1_addrs[MENU1_NAME_COUNT];
 static uint8_t menu_page1_selected;
 
-static void menu_page1_scancallback(const char *name, int len, esp_bd_addr_t addr, int addrType)
+// The strongest devices of the scan table, the names and addresses are copied so the list stays stable until the next change
+static void menu_page1_scancallback(const char *name, int len, esp_bd_addr_t addr, int addrType, int rssi)
 {
-    bool changed = false;
-
-    for (int x = MENU1_NAME_START; x < MENU1_NAME_START + MENU1_NAME_COUNT; x++)
+    if (!scan_table_update(addr, addrType, rssi, name, len))
     {
-        if (strlen(menu_page1_items[x]) == 0)
-        {
-            // Empty slot, copy the name into here
-            memset(menu_page1_items[x], 0, MENU1_NAME_LEN);
-            strncpy(menu_page1_items[x], name, MIN(len, MENU1_NAME_LEN));
+        return;
+    }
 
-            memcpy(menu_page1_addrs[x - MENU1_NAME_START].address, &addr[0], 6);
-            menu_page1_addrs[x - MENU1_NAME_START].type = addrType;
+    const struct scan_entry *entries[MENU1_NAME_COUNT];
+    int count = scan_table_ranked(entries, MENU1_NAME_COUNT);
 
-            changed = true;
-            break;
-        }
-        else if (strcmp(menu_page1_items[x], name) == 0)
+    for (int i = 0; i < MENU1_NAME_COUNT; i++)
+    {
+        char *item = menu_page1_items[MENU1_NAME_START + i];
+        memset(item, 0, MENU1_NAME_LEN);
+
+        if (i < count)
         {
-            break; // Name already found
+            strncpy(item, entries[i]->name, MENU1_NAME_LEN - 1);
+            memcpy(menu_page1_addrs[i].address, entries[i]->bda, 6);
+            menu_page1_addrs[i].type = entries[i]->addr_type;
         }
     }
 
-    if (changed)
-    {
-        menulist_draw();
-    }
+    menu_draw(menulist_render);
 }
 
-static void menu_page1_activate()
+static void menu_page1_clear()
 {
     if (menu_page1_items == NULL)
     {
@@ -172,6 +306,12 @@ static void menu_page1_activate()
     {
         strcpy(menu_page1_items[x], "");
     }
+}
+
+static void menu_page1_activate()
+{
+    menu_page1_clear();
+    scan_table_clear();
 
     menulist_init(menu_page1_items, 7);
     ble_scan_start(menu_page1_scancallback);
@@ -182,9 +322,9 @@ static void menu_page1_deactivate()
     ble_scan_stop();
 }
 
-static void menu_page1_input(uint8_t button)
+static void menu_page1_input(const struct input_event *input)
 {
-    int16_t selected = menulist_input(button);
+    int16_t selected = menulist_input(input);
     if (selected != -1)
     {
         if (selected == 0)
@@ -209,6 +349,7 @@ static void menu_page1_input(uint8_t button)
 
 static int menu_page2_state = PAGE2_STATE_WORKING;
 static int mneu_page2_current = 0;
+static int menu_page2_camera = -1;
 static char *menu_page2_states[] = {
     (char *)"Connecting",
     (char *)"Bonding", // PAIR_STATE_BOND
@@ -218,7 +359,7 @@ static char *menu_page2_states[] = {
     (char *)"Done"     // PAIR_STATE_DONE
 };
 
-static void menu_page2_draw()
+static void menu_page2_render()
 {
     SSD1306_clearDisplay();
     if (menu_page2_state == PAGE2_STATE_FAIL)
@@ -231,20 +372,20 @@ static void menu_page2_draw()
     }
 
     SSD1306_drawText(0, 16, menu_page1_items[menu_page1_selected + 1], 2, WHITE);
-    SSD1306_display();
+    display_present();
 }
 
-static void menu_page2_camera_connected()
+static void menu_page2_camera_connected(int camera)
 {
-    ESP_LOGI(TAG, "Camera connected, start bonding and canon pair");
+    LOGI("Camera connected, start bonding and canon pair");
 
     mneu_page2_current = 1;
-    canon_start_pair();
+    canon_start_pair(camera);
 
-    menu_page2_draw();
+    menu_draw(menu_page2_render);
 }
 
-static void menu_page2_camera_pair(int state, bool status)
+static void menu_page2_camera_pair(int camera, int state, bool status)
 {
     mneu_page2_current = state;
 
@@ -256,9 +397,13 @@ static void menu_page2_camera_pair(int state, bool status)
     if (state == PAIR_STATE_DONE)
     {
         menu_page2_state = PAGE2_STATE_OK;
+
+        // The Connect page lists the bonded cameras by this name without scanning
+        camera_store_save(menu_page1_addrs[menu_page1_selected].address, menu_page1_addrs[menu_page1_selected].type,
+                          menu_page1_items[menu_page1_selected + 1]);
     }
 
-    menu_page2_draw();
+    menu_draw(menu_page2_render);
 }
 
 static void menu_page2_activate()
@@ -268,35 +413,76 @@ static void menu_page2_activate()
     mneu_page2_current = 0;
 
     // Update UI
-    menu_page2_draw();
+    menu_draw(menu_page2_render);
 
     // Starting pair
-    canon_set_on_connected(menu_page2_camera_connected);                                                        // Set the camera connect callback
-    canon_set_pair_state_callback(menu_page2_camera_pair);                                                      // Set the pair state callback
-    canon_set_on_disconnected(menu_camera_disconnect);                                                          // Set the disconnect handler
-    ble_connect(&menu_page1_addrs[menu_page1_selected].address[0], menu_page1_addrs[menu_page1_selected].type); // Connect to the camera
+    canon_set_on_connected(menu_page2_camera_connected);   // Set the camera connect callback
+    canon_set_pair_state_callback(menu_page2_camera_pair); // Set the pair state callback
+    canon_set_on_disconnected(menu_camera_disconnect);     // Set the disconnect handler
+    menu_page2_camera = ble_connect(&menu_page1_addrs[menu_page1_selected].address[0], menu_page1_addrs[menu_page1_selected].type); // Connect to the camera
+
+    if (menu_page2_camera < 0)
+    {
+        menu_page2_state = PAGE2_STATE_FAIL;
+        menu_draw(menu_page2_render);
+    }
 }
 
-static void menu_page2_input(uint8_t input)
+static void menu_page2_input(const struct input_event *input)
 {
-    if (input == INPUT_BUTTON)
+    if (input->button == INPUT_BUTTON)
     {
-        canon_set_on_disconnected(NULL);
-        ble_disconnect();
+        ble_disconnect(menu_page2_camera);
 
         menu_set(MENU_PAIR);
     }
 }
 
 // Connect to camera page
-static void menu_page3_input(uint8_t button)
+static bool menu_page3_scanning = false;
+
+static void menu_page3_activate()
+{
+    struct stored_camera cameras[MENU1_NAME_COUNT];
+    int count = camera_store_bonded(cameras, MENU1_NAME_COUNT);
+
+    if (count == 0)
+    {
+        // Nothing bonded, the scan still lists the cameras in range
+        menu_page3_scanning = true;
+        menu_page1_activate();
+        return;
+    }
+
+    menu_page3_scanning = false;
+    menu_page1_clear();
+    for (int i = 0; i < count; i++)
+    {
+        strncpy(menu_page1_items[MENU1_NAME_START + i], cameras[i].name, MENU1_NAME_LEN - 1);
+        memcpy(menu_page1_addrs[i].address, cameras[i].bda, 6);
+        menu_page1_addrs[i].type = cameras[i].addr_type;
+    }
+
+    menulist_init(menu_page1_items, 7);
+}
+
+static void menu_page3_deactivate()
+{
+    if (menu_page3_scanning)
+    {
+        ble_scan_stop();
+    }
+}
+
+static void menu_page3_input(const struct input_event *input)
 {
-    int16_t selected = menulist_input(button);
+    int16_t selected = menulist_input(input);
     if (selected != -1)
     {
         if (selected == 0)
         {
-            menu_set(MENU_MAIN);
+            // Also the list to add a camera
+            menu_set(canon_camera_count() > 0 ? MENU_CAMERA_MAIN : MENU_MAIN);
         }
         else
         {
@@ -311,47 +497,56 @@ static void menu_page3_input(uint8_t button)
 
 // DO connect page
 static bool menu_page4_auth = false;
+static int menu_page4_camera = -1;
 
-static void menu_page4_draw()
+static void menu_page4_render()
 {
     // Draw a basic display
     SSD1306_clearDisplay();
     SSD1306_drawText(0, 0, menu_page4_auth ? "Auth" : "Connecting", 2, WHITE);
     SSD1306_drawText(0, 16, menu_page1_items[menu_page1_selected + 1], 2, WHITE);
-    SSD1306_display();
+    display_present();
 }
 
-static void menu_page4_camera_connected()
+static void menu_page4_camera_connected(int camera)
 {
     menu_page4_auth = true;
-    menu_page4_draw();
+    menu_draw(menu_page4_render);
 
-    canon_do_connect();
+    canon_do_connect(camera);
 }
 
-static void menu_page4_camera_auth()
+static void menu_page4_camera_auth(int camera)
 {
+    camera_store_set_last(menu_page1_addrs[menu_page1_selected].address);
+
     menu_set(MENU_CAMERA_MAIN);
 }
 
 static void menu_page4_activate()
 {
-    menu_page4_draw();
+    menu_page4_auth = false;
+    menu_draw(menu_page4_render);
 
     // Start connecting
     canon_set_on_connected(menu_page4_camera_connected); // Set the camera connect callback
     canon_set_pair_state_callback(NULL);
     canon_set_on_disconnected(menu_camera_disconnect); // Set the disconnect handler
     canon_set_on_auth(menu_page4_camera_auth);
-    ble_connect(&menu_page1_addrs[menu_page1_selected].address[0], menu_page1_addrs[menu_page1_selected].type); // Connect to the camera
+    menu_page4_camera = ble_connect(&menu_page1_addrs[menu_page1_selected].address[0], menu_page1_addrs[menu_page1_selected].type); // Connect to the camera
+
+    if (menu_page4_camera < 0)
+    {
+        // Already connected or no connection left
+        menu_set(MENU_CONNECT);
+    }
 }
 
-static void menu_page4_input(uint8_t input)
+static void menu_page4_input(const struct input_event *input)
 {
-    if (input == INPUT_BUTTON)
+    if (input->button == INPUT_BUTTON)
     {
-        canon_set_on_disconnected(NULL);
-        ble_disconnect();
+        ble_disconnect(menu_page4_camera);
 
         menu_set(MENU_CONNECT);
     }
@@ -361,30 +556,36 @@ static void menu_page4_input(uint8_t input)
 static char *menu_page5_items[] = {
     (char *)"Trigger",
     (char *)"Timer",
+    (char *)"Add camera",
     (char *)"Disconnect",
 };
 
 static void menu_page5_activate()
 {
-    menulist_init(menu_page5_items, 3);
+    menulist_init(menu_page5_items, 4);
 }
 
-static void menu_page5_input(uint8_t button)
+static void menu_page5_input(const struct input_event *input)
 {
-    int16_t selected = menulist_input(button);
+    int16_t selected = menulist_input(input);
     if (selected != -1)
     {
         switch (selected)
         {
-        case 0: // Trigger - Do one trigger
+        case 0: // Trigger - Do one trigger on all cameras
             canon_do_trigger();
             break;
         case 1: // Timer - goto the timer page
             menu_set(MENU_CAMERA_TIMER);
             break;
-        case 2: // Disconnect - go back
-            canon_set_on_disconnected(NULL);
-            ble_disconnect(); // Make sure we disconnect from the camera
+        case 2: // Add camera - connect one more, the connect page returns here
+            menu_set(MENU_CONNECT);
+            break;
+        case 3: // Disconnect - go back
+            for (int camera = 0; camera < MAX_CAMERAS; camera++)
+            {
+                ble_disconnect(camera); // Make sure we disconnect from all cameras
+            }
 
             menu_set(MENU_CONNECT);
             break;
@@ -401,82 +602,93 @@ static void menu_page5_input(uint8_t button)
 static int menu_page6_selected = MENU_PAGE_6_TIME;
 static bool menu_page6_selected_active = false;
 
-static int menu_page6_timer_interval = 5;
+static int menu_page6_timer_interval = 5000; // ms
 static bool menu_page6_timer_running = false;
 
-static int menu_page6_timer_countdown;
+static int menu_page6_timer_countdown; // Seconds until the next shot
 static int menu_page6_expo_count;
+static uint32_t menu_page6_last_shot;
 
-static SemaphoreHandle_t menu_page6_display_semaphore = NULL;
-
-static SemaphoreHandle_t menu_page6_timer_semaphore = NULL;
-static bool menu_page6_timer_trigger = false;
-
-static void menu_page6_draw();
-
-static void menu_page6_timer_callback()
+// Timer callbacks, they run on the esp_timer task and only post the event
+static void menu_page6_timer_tick()
 {
-    ESP_LOGI(TAG, "Trigger");
-
-    menu_page6_timer_trigger = true;
-    xSemaphoreGive(menu_page6_timer_semaphore);
+    struct app_event event = {.type = APP_EVENT_TIMER_TICK};
+    app_event_post_lossy(&event);
 }
 
-static void menu_page6_timer_task()
+static void menu_page6_timer_shot(uint32_t shot, int64_t deviation_us)
 {
-    while (true)
-    {
-        ESP_LOGI(TAG, "Waiting for trigger");
-        while (xSemaphoreTake(menu_page6_timer_semaphore, portMAX_DELAY) != pdPASS)
-        {
-            // Do nothing
-        }
-
-        ESP_LOGI(TAG, "Got trigger");
-        menu_page6_timer_trigger = false;
-        xSemaphoreGive(menu_page6_timer_semaphore);
-        xSemaphoreTake(menu_page6_timer_semaphore, portMAX_DELAY);
-
-        menu_page6_timer_countdown--;
-        if (menu_page6_timer_countdown <= 0)
-        {
-            menu_page6_timer_countdown = menu_page6_timer_interval;
-
-            menu_page6_expo_count++;
+    struct app_event event = {.type = APP_EVENT_TIMER_SHOT};
+    event.timer.shot = shot;
+    event.timer.deviation_us = deviation_us;
 
-            canon_do_trigger();
-        }
-
-        menu_page6_draw();
+    if (!app_event_post(&event))
+    {
+        session_shot_lost(shot);
     }
 }
 
-static void menu_page6_init_timer_task()
+static void menu_page6_timer_start()
 {
-    ESP_LOGI(TAG, "Page6 semaphore init");
+    menu_page6_timer_countdown = (menu_page6_timer_interval + 999) / 1000;
+    menu_page6_last_shot = 0;
 
-    menu_page6_display_semaphore = xSemaphoreCreateMutex();
-    menu_page6_timer_semaphore = xSemaphoreCreateBinary();
+    session_start();
 
-    menu_page6_timer_trigger = false;
-    xSemaphoreTake(menu_page6_timer_semaphore, (TickType_t)20);
+    struct session_peer peers[MAX_CAMERAS];
+    journal_begin(menu_page6_timer_interval, peers, session_peers(peers, MAX_CAMERAS));
 
-    ESP_LOGI(TAG, "Page6 task create");
-    xTaskCreate(menu_page6_timer_task, "timer_task", 1024 * 8, NULL, 10, NULL);
+    app_timer_start(menu_page6_timer_interval, menu_page6_timer_shot, menu_page6_timer_tick);
+    power_timer_start(menu_page6_timer_interval);
+    menu_page6_timer_running = true;
 }
 
-static void menu_page6_timer_start()
+// Continues the journaled timelapse, the cameras are connected by the session
+static void menu_page6_timer_resume()
 {
-    menu_page6_timer_countdown = menu_page6_timer_interval;
+    menu_page6_timer_interval = menu_resume.interval_ms;
+    menu_page6_expo_count = menu_resume.expo_count;
+    menu_page6_last_shot = menu_resume.shot;
 
-    app_timer_start(menu_page6_timer_callback);
+    session_resume(menu_resume.peers, menu_resume.peer_count);
+    journal_resume(&menu_resume);
+
+    app_timer_start_at(menu_page6_timer_interval, journal_resume_start(&menu_resume), menu_page6_timer_shot, menu_page6_timer_tick);
+    power_timer_start(menu_page6_timer_interval);
+    menu_page6_timer_countdown = (int)((app_timer_time_to_next_shot() + 999999) / 1000000);
     menu_page6_timer_running = true;
 }
 
 static void menu_page6_timer_stop()
 {
     app_timer_stop();
+    power_timer_stop();
+    session_stop();
+    journal_end();
+    shot_log_flush(true);
     menu_page6_timer_running = false;
+
+    app_event_log_stats();
+}
+
+// The run goes on after the wake, the journal has it in RTC memory and the shot log goes to flash now
+static void menu_page6_deep_sleep()
+{
+    power_deep_begin();
+    app_timer_stop();
+    session_stop();
+    shot_log_flush(true);
+    menu_page6_sleeping = true;
+
+    for (int camera = 0; camera < MAX_CAMERAS; camera++)
+    {
+        ble_disconnect(camera);
+    }
+
+    if (ble_connection_count() == 0)
+    {
+        power_deep_sleep();
+    }
 }
 
 static void menu_page6_button(uint16_t x, uint16_t y, uint16_t w, uint16_t h, const char *text, bool selected)
@@ -494,74 +706,189 @@ static void menu_page6_button(uint16_t x, uint16_t y, uint16_t w, uint16_t h, co
     SSD1306_drawText((w / 2) - ((textlen * 12) / 2) + x, (h / 2) - (12 / 2) + y, text, 2, (selected ? BLACK : WHITE));
 }
 
-static void menu_page6_draw()
+static void menu_page6_format_interval(char *buf, int interval)
 {
-    if (menu_page6_display_semaphore != NULL)
+    if (interval % 1000 == 0)
+    {
+        sprintf(buf, "%d", interval / 1000);
+    }
+    else
     {
-        // Take semaphore is possible, avoids issue when the input and the timer wants to redraw the UI at the same time
-        if (xSemaphoreTake(menu_page6_display_semaphore, (TickType_t)20) == pdTRUE)
+        sprintf(buf, "%d.%d", interval / 1000, (interval % 1000) / 100);
+    }
+}
+
+static void menu_page6_render()
+{
+    SSD1306_clearDisplay();
+
+    // Interval setting
+    {
+        int textColor = ((menu_page6_selected == MENU_PAGE_6_TIME && menu_page6_selected_active) ? BLACK : WHITE);
+
+        if (menu_page6_selected == MENU_PAGE_6_TIME && menu_page6_selected_active)
         {
-            SSD1306_clearDisplay();
+            SSD1306_fillRect(0, 0, SSD1306_LCDWIDTH, 19, WHITE);
+        }
 
-            // Interval setting
-            {
-                int textColor = ((menu_page6_selected == MENU_PAGE_6_TIME && menu_page6_selected_active) ? BLACK : WHITE);
-
-                if (menu_page6_selected == MENU_PAGE_6_TIME && menu_page6_selected_active)
-                {
-                    SSD1306_fillRect(0, 0, SSD1306_LCDWIDTH, 19, WHITE);
-                }
-
-                SSD1306_drawText(2, 2, "Set:", 2, textColor);
-                char intervalBuf[16];
-                sprintf(intervalBuf, "%d", menu_page6_timer_interval);
-                SSD1306_drawText(48, 2, intervalBuf, 2, textColor);
-
-                if (menu_page6_selected == MENU_PAGE_6_TIME && !menu_page6_selected_active)
-                {
-                    SSD1306_drawFastHLine(0, 17, SSD1306_LCDWIDTH, WHITE);
-                    SSD1306_drawFastHLine(0, 18, SSD1306_LCDWIDTH, WHITE);
-                }
-            }
+        SSD1306_drawText(2, 2, "Set:", 2, textColor);
+        char intervalBuf[16];
+        menu_page6_format_interval(intervalBuf, menu_page6_timer_interval);
+        SSD1306_drawText(48, 2, intervalBuf, 2, textColor);
 
-            // Countdown
-            if (menu_page6_timer_running)
-            {
-                char countdownBuffer[16];
-                sprintf(countdownBuffer, "%ds", menu_page6_timer_countdown);
+        if (menu_page6_selected == MENU_PAGE_6_TIME && !menu_page6_selected_active)
+        {
+            SSD1306_drawFastHLine(0, 17, SSD1306_LCDWIDTH, WHITE);
+            SSD1306_drawFastHLine(0, 18, SSD1306_LCDWIDTH, WHITE);
+        }
+    }
 
-                int textlen = strlen(countdownBuffer);
-                SSD1306_drawText((SSD1306_LCDWIDTH / 4) - ((textlen * 12) / 2), (12 / 2) + 18, countdownBuffer, 2, WHITE);
-            }
+    // Countdown, or the lost link while no camera is left to take the shot
+    if (menu_page6_timer_running)
+    {
+        char countdownBuffer[16];
+        if (canon_camera_count() == 0 && session_reconnecting() > 0)
+        {
+            strcpy(countdownBuffer, "Lost");
+        }
+        else
+        {
+            sprintf(countdownBuffer, "%ds", menu_page6_timer_countdown);
+        }
 
-            // Expo count
-            {
-                char expoBuffer[16];
-                sprintf(expoBuffer, "%d", menu_page6_expo_count);
+        int textlen = strlen(countdownBuffer);
+        SSD1306_drawText((SSD1306_LCDWIDTH / 4) - ((textlen * 12) / 2), (12 / 2) + 18, countdownBuffer, 2, WHITE);
+    }
 
-                int textlen = strlen(expoBuffer);
-                SSD1306_drawText((SSD1306_LCDWIDTH / 2) + (SSD1306_LCDWIDTH / 4) - ((textlen * 12) / 2), (12 / 2) + 18, expoBuffer, 2, WHITE);
-            }
+    // Expo count
+    {
+        char expoBuffer[16];
+        sprintf(expoBuffer, "%d", menu_page6_expo_count);
+
+        int textlen = strlen(expoBuffer);
+        SSD1306_drawText((SSD1306_LCDWIDTH / 2) + (SSD1306_LCDWIDTH / 4) - ((textlen * 12) / 2), (12 / 2) + 18, expoBuffer, 2, WHITE);
+    }
+
+    menu_page6_button(0, 43, SSD1306_LCDHEIGHT, 21, "Back", (menu_page6_selected == MENU_PAGE_6_BACK));
+    menu_page6_button(64, 43, SSD1306_LCDHEIGHT, 21, (menu_page6_timer_running ? "Stop" : "Start"), (menu_page6_selected == MENU_PAGE_6_START));
+    display_present();
+}
+
+static void menu_page6_event(struct app_event *event)
+{
+    switch (event->type)
+    {
+    case APP_EVENT_TIMER_SHOT:
+    {
+        if (!menu_page6_timer_running)
+        {
+            return; // Posted before the timer was stopped
+        }
+
+        power_shot();
+        session_shot(event->timer.shot, app_timer_shot_time(event->timer.shot));
+        power_trigger_done(); // Nothing was sent if no camera is connected
+
+        menu_page6_last_shot = event->timer.shot;
+        journal_progress(menu_page6_last_shot, menu_page6_expo_count);
+
+        LOGI("Trigger %u, deviation %lld us", event->timer.shot, (long long)event->timer.deviation_us);
+        break;
+    }
+    case APP_EVENT_TIMER_TICK:
+    {
+        if (!menu_page6_timer_running)
+        {
+            return;
+        }
 
-            menu_page6_button(0, 43, SSD1306_LCDHEIGHT, 21, "Back", (menu_page6_selected == MENU_PAGE_6_BACK));
-            menu_page6_button(64, 43, SSD1306_LCDHEIGHT, 21, (menu_page6_timer_running ? "Stop" : "Start"), (menu_page6_selected == MENU_PAGE_6_START));
-            SSD1306_display();
+        if (power_battery_mode() && !display_off && esp_timer_get_time() - input_last > POWER_DISPLAY_OFF_MS * 1000LL)
+        {
+            menu_display_sleep();
+        }
 
-            // Release the semaphore
-            xSemaphoreGive(menu_page6_display_semaphore);
+        // Erasing a sector takes tens of ms, keep it away from the next shot. A NVS commit may erase a page too,
+        // the checkpoint waits for the next tick with room
+        if (app_timer_time_to_next_shot() > SHOT_LOG_FLUSH_GUARD_MS * 1000)
+        {
+            journal_flush(false);
+            shot_log_flush(false);
         }
+        break;
     }
-    else
+    case APP_EVENT_TRIGGER_DONE:
+    {
+        power_trigger_done();
+
+        if (!event->trigger.success)
+        {
+            LOGW("Trigger failed");
+            return;
+        }
+        if (event->trigger.failed > 0)
+        {
+            LOGW("Trigger failed on %d of %d cameras", event->trigger.failed, event->trigger.cameras);
+        }
+
+        // Counts the shots the camera took, not the requested ones
+        menu_page6_expo_count++;
+        journal_progress(menu_page6_last_shot, menu_page6_expo_count);
+        break;
+    }
+    default:
+        return;
+    }
+
+    if (menu_page6_timer_running && display_off && power_deep_due())
+    {
+        menu_page6_deep_sleep();
+        return;
+    }
+
+    // Round up, the countdown shows 1s until the shot
+    if (menu_page6_timer_running)
     {
-        ESP_LOGE(TAG, "PAGE6 semaphore null");
+        menu_page6_timer_countdown = (int)((app_timer_time_to_next_shot() + 999999) / 1000000);
     }
+
+    menu_draw(menu_page6_render);
+}
+
+// A camera reconnected by the session
+static void menu_page6_camera_connected(int camera)
+{
+    canon_do_connect(camera);
+}
+
+static void menu_page6_camera_auth(int camera)
+{
+    session_camera_restored(camera);
+    power_camera_linked(camera);
+
+    if (session_reconnecting() == 0)
+    {
+        power_deep_ready();
+    }
+
+    menu_draw(menu_page6_render);
 }
 
 static void menu_page6_activate()
 {
     menu_page6_expo_count = 0;
 
-    menu_page6_draw();
+    canon_set_on_connected(menu_page6_camera_connected);
+    canon_set_pair_state_callback(NULL);
+    canon_set_on_disconnected(menu_camera_disconnect);
+    canon_set_on_auth(menu_page6_camera_auth);
+
+    if (menu_resume_pending)
+    {
+        menu_resume_pending = false;
+        menu_page6_timer_resume();
+    }
+
+    menu_draw(menu_page6_render);
 }
 
 static void menu_page6_button_press()
@@ -578,7 +905,9 @@ static void menu_page6_button_press()
     case MENU_PAGE_6_BACK:
     {
         redraw = false;
-        menu_set(MENU_CAMERA_MAIN);
+
+        // Cameras still lost when the timelapse stops are gone
+        menu_set(canon_camera_count() > 0 ? MENU_CAMERA_MAIN : MENU_MAIN);
         break;
     }
     case MENU_PAGE_6_START:
@@ -598,11 +927,11 @@ static void menu_page6_button_press()
 
     if (redraw)
     {
-        menu_page6_draw();
+        menu_draw(menu_page6_render);
     }
 }
 
-static void menu_page6_time_input(uint8_t button)
+static void menu_page6_time_input(const struct input_event *input)
 {
     if (menu_page6_selected != MENU_PAGE_6_TIME)
     {
@@ -610,7 +939,8 @@ static void menu_page6_time_input(uint8_t button)
         return;
     }
 
-    switch (button)
+    // Accelerated, a fast turn moves through many steps
+    switch (input->button)
     {
     case INPUT_BUTTON:
     {
@@ -619,34 +949,47 @@ static void menu_page6_time_input(uint8_t button)
     }
     case INPUT_LEFT:
     {
-        if (menu_page6_timer_interval > 1)
+        for (int i = 0; i < input->steps; i++)
         {
-            menu_page6_timer_interval--;
+            // 0.1s steps below 1s, 1s steps above
+            int step = (menu_page6_timer_interval <= 1000 ? 100 : 1000);
+            if (menu_page6_timer_interval - step < TIMER_INTERVAL_MIN_MS)
+            {
+                break;
+            }
+            menu_page6_timer_interval -= step;
         }
         break;
     }
     case INPUT_RIGHT:
     {
-        if (menu_page6_timer_interval < 60 * 60)
+        for (int i = 0; i < input->steps; i++)
         {
-            menu_page6_timer_interval++;
+            int step = (menu_page6_timer_interval < 1000 ? 100 : 1000);
+            if (menu_page6_timer_interval + step > TIMER_INTERVAL_MAX_MS)
+            {
+                break;
+            }
+            menu_page6_timer_interval += step;
         }
         break;
     }
     }
 }
 
-static void menu_page6_input(uint8_t button)
+static void menu_page6_input(const struct input_event *input)
 {
     if (menu_page6_selected_active)
     {
-        menu_page6_time_input(button);
+        menu_page6_time_input(input);
 
-        menu_page6_draw();
+        menu_draw(menu_page6_render);
     }
     else
     {
-        switch (button)
+        uint8_t move = input->detents % (MENU_PAGE_6_MAX + 1);
+
+        switch (input->button)
         {
         case INPUT_BUTTON:
         {
@@ -655,22 +998,16 @@ static void menu_page6_input(uint8_t button)
         }
         case INPUT_LEFT:
         {
-            if (menu_page6_selected == 0)
-                menu_page6_selected = MENU_PAGE_6_MAX;
-            else
-                menu_page6_selected--;
+            menu_page6_selected = (menu_page6_selected + MENU_PAGE_6_MAX + 1 - move) % (MENU_PAGE_6_MAX + 1);
 
-            menu_page6_draw();
+            menu_draw(menu_page6_render);
             break;
         }
         case INPUT_RIGHT:
         {
-            if (menu_page6_selected == MENU_PAGE_6_MAX)
-                menu_page6_selected = 0;
-            else
-                menu_page6_selected++;
+            menu_page6_selected = (menu_page6_selected + move) % (MENU_PAGE_6_MAX + 1);
 
-            menu_page6_draw();
+            menu_draw(menu_page6_render);
             break;
         }
         }
@@ -689,28 +1026,142 @@ static void menu_page6_deactivate()
 struct menu_page
 {
     void (*activate)();
-    void (*input)(uint8_t button);
+    void (*input)(const struct input_event *input);
     void (*deactivate)();
+    void (*event)(struct app_event *event); // Timer and trigger events
 };
 
-static uint8_t activeMenu;
 static struct menu_page pages[] = {
     {.activate = menu_page0_activate, .input = menu_page0_input, .deactivate = NULL},                  // Main menu
     {.activate = menu_page1_activate, .input = menu_page1_input, .deactivate = menu_page1_deactivate}, // Pair menu
     {.activate = menu_page2_activate, .input = menu_page2_input, .deactivate = NULL},                  // Do pair menu
-    {.activate = menu_page1_activate, .input = menu_page3_input, .deactivate = menu_page1_deactivate}, // Connect menu - Copy of Pair menu
+    {.activate = menu_page3_activate, .input = menu_page3_input, .deactivate = menu_page3_deactivate}, // Connect menu - Bonded cameras
     {.activate = menu_page4_activate, .input = menu_page4_input, .deactivate = NULL},                  // Do connect menu
     {.activate = menu_page5_activate, .input = menu_page5_input, .deactivate = NULL},                  // Camera main menu
-    {.activate = menu_page6_activate, .input = menu_page6_input, .deactivate = menu_page6_deactivate}, // Timer menu
+    {.activate = menu_page6_activate, .input = menu_page6_input, .deactivate = menu_page6_deactivate, .event = menu_page6_event}, // Timer menu
 };
 
+static void menu_input_event(struct app_event *event)
+{
+    struct input_event input = event->input;
+
+    input_last = esp_timer_get_time();
+    if (display_off)
+    {
+        // The turns which came with it are dropped as well
+        struct app_event next;
+        while (app_event_take_next(APP_EVENT_INPUT, &next))
+        {
+        }
+
+        menu_display_wake();
+        return;
+    }
+
+    // Turns queued behind this one are applied together, a button press ends the batch to keep the order
+    struct app_event next;
+    while (app_event_take_next(APP_EVENT_INPUT, &next))
+    {
+        if (!input_merge(&input, &next.input))
+        {
+            menu_input(&input);
+            input = next.input;
+        }
+    }
+
+    menu_input(&input);
+}
+
+static void menu_frame_event(struct app_event *event)
+{
+    menu_frame();
+}
+
+static void menu_page_event(struct app_event *event)
+{
+    if (pages[activeMenu].event != NULL)
+    {
+        pages[activeMenu].event(event);
+    }
+}
+
+// Connects to the last camera once the BLE stack is up, unless the user already left the main menu
+static void menu_auto_connect()
+{
+    // An interrupted timelapse is offered on the main menu instead
+    struct stored_camera camera;
+    if (activeMenu != MENU_MAIN || journal_load(&menu_resume) || !camera_store_last(&camera))
+    {
+        return;
+    }
+
+    LOGI("Auto connect to %s", camera.name);
+
+    menu_page1_clear();
+    strncpy(menu_page1_items[MENU1_NAME_START], camera.name, MENU1_NAME_LEN - 1);
+    memcpy(menu_page1_addrs[0].address, camera.bda, 6);
+    menu_page1_addrs[0].type = camera.addr_type;
+    menu_page1_selected = 0;
+
+    menu_set(MENU_CONNECT_DO);
+}
+
+// A run woken from the deep sleep goes on, with the display off unless the button woke it
+static void menu_ble_ready()
+{
+    uint8_t wake = power_wake_reason();
+    if (wake != POWER_WAKE_NONE && activeMenu == MENU_MAIN && journal_load(&menu_resume))
+    {
+        LOGI("Woken from deep sleep, resuming the timer");
+
+        input_last = esp_timer_get_time();
+        menu_resume_pending = true;
+        menu_set(MENU_CAMERA_TIMER);
+
+        if (wake == POWER_WAKE_TIMER)
+        {
+            menu_display_sleep();
+        }
+        return;
+    }
+
+    // main kept the display dark for the run which isn't there
+    if (wake == POWER_WAKE_TIMER)
+    {
+        display_set_power(true);
+    }
+
+    if (AUTO_CONNECT_LAST)
+    {
+        menu_auto_connect();
+    }
+}
+
 void menu_init()
 {
-    menu_page6_init_timer_task();
+    app_event_set_handler(APP_EVENT_INPUT, menu_input_event);
+    app_event_set_handler(APP_EVENT_TIMER_TICK, menu_page_event);
+    app_event_set_handler(APP_EVENT_TIMER_SHOT, menu_page_event);
+    app_event_set_handler(APP_EVENT_TRIGGER_DONE, menu_page_event);
+    app_event_set_handler(APP_EVENT_FRAME, menu_frame_event);
+
+    ble_set_on_ready(menu_ble_ready);
+
+    esp_timer_create_args_t frame_args = {
+        .callback = frame_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "frame"};
+    ESP_ERROR_CHECK(esp_timer_create(&frame_args, &frame_timer));
 }
 
 void menu_set(uint8_t index)
 {
+    if (display_off)
+    {
+        menu_display_wake();
+    }
+
     if (pages[activeMenu].deactivate != NULL)
     {
         pages[activeMenu].deactivate();
@@ -724,10 +1175,12 @@ void menu_set(uint8_t index)
     }
 }
 
-void menu_input(uint8_t button)
+void menu_input(const struct input_event *input)
 {
+    TRACE_BEGIN(TRACE_INPUT, input->button, input->steps);
     if (pages[activeMenu].input != NULL)
     {
-        pages[activeMenu].input(button);
+        pages[activeMenu].input(input);
     }
+    TRACE_END(TRACE_INPUT, input->button, input->steps);
 }
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "input.h"
+
 #define MENU_MAIN 0
 
 #define MENU_PAIR 1
@@ -17,6 +19,6 @@
 
 void menu_init();
 void menu_set(uint8_t index);
-void menu_input(uint8_t button);
+void menu_input(const struct input_event *input);
 
 #endif
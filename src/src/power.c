@@ -0,0 +1,579 @@
+#include "power.h"
+
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_err.h"
+#include "esp_pm.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "esp32/clk.h"
+
+#include "app_ble.h"
+#include "app_event.h"
+#include "canon_ble.h"
+#include "timer.h"
+#include "config.h"
+#include "app_log.h"
+
+#define TAG "POWER"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+/*
+Battery mode:
+    Between the shots of a timer run nothing holds the chip up, the idle task lets it light sleep until the next
+    esp_timer deadline or the button.
+    1. Outside of a battery run the locks are held, the chip runs at full speed like without power management
+    2. The display keeps the chip awake until the menu turns it off after POWER_DISPLAY_OFF_MS without input
+    3. For long intervals the links get the idle parameters, a long interval with slave latency, between the shots
+    4. The prepare timer fires POWER_LEAD_US before the shot and asks for the active parameters, the chip sleeps on
+    5. The shot keeps the chip awake until the trigger is done, then the links go idle again
+
+    The ESP32 is the central, the slave latency lets the camera skip the idle connection events, the ESP32 saves
+    the radio events of the long interval. The controller only allows light sleep with a 32 kHz crystal as its low
+    power clock, with the main crystal it holds its own lock and the chip stays at POWER_CPU_MIN_MHZ with modem sleep.
+
+Link parameters:
+    Bluedroid opens a link at BLE_CONN_INTERVAL_DEFAULT, the trigger writes would wait for that spacing. A timer run
+    asks every link for the active parameters, the press goes out in the next POWER_ACTIVE_INTERVAL_MS event.
+    1. Without the battery mode the links stay active for the whole run
+    2. A battery run relaxes them to the idle parameters between the shots and tightens them POWER_LEAD_US ahead
+    3. Intervals shorter than twice the lead keep them active, a burst of shots never waits for an update
+    4. A link which doesn't end up with the requested parameters, the update failed or the camera changed them, is
+       asked again right away up to POWER_PARAMS_RETRIES times, after that with the next change of the link state
+    Links outside of a run are left alone.
+
+Deep sleep:
+    For intervals of POWER_DEEP_INTERVAL_MS and more the chip powers down completely between the shots.
+    1. After the trigger, with the display off, the menu closes the links and the chip sleeps until the lead time
+       before the next shot, the RTC timer or the button wakes it
+    2. The wake is a reset, the journal has the session and its RTC copy of the progress, the menu resumes the run
+    3. The bonds and the GATT handle cache are in NVS, the cameras are back without pairing or service discovery
+    4. The time from the wake until every camera is back is averaged, the lead is that plus POWER_DEEP_GUARD_MS.
+       A shot due before the cameras are back doubles the lead
+*/
+
+// The controller puts the instant of an update latency + 6 events ahead, so a camera skipping events still gets it
+#define POWER_LEAD_US ((int64_t)(POWER_IDLE_LATENCY + 8) * POWER_IDLE_INTERVAL_MS * 1000)
+
+// Reasons to stay awake
+#define POWER_HOLD_IDLE (1 << 0)    // No battery run
+#define POWER_HOLD_DISPLAY (1 << 1) // The display is on
+#define POWER_HOLD_SHOT (1 << 2)    // From the shot until its trigger is done
+
+#define POWER_DEEP_MAGIC (0x44534c50)
+
+#define POWER_PARAMS_NONE (0) // Not requested since the link came up
+#define POWER_PARAMS_ACTIVE (1)
+#define POWER_PARAMS_IDLE (2)
+#define POWER_PARAMS_RETRIES (3) // Requests in a row the link didn't take
+
+static const struct ble_conn_params active_params = {
+    .min_interval = POWER_ACTIVE_INTERVAL_MS * 4 / 5,
+    .max_interval = POWER_ACTIVE_INTERVAL_MS * 4 / 5,
+    .latency = 0,
+    .timeout = POWER_LINK_TIMEOUT_MS / 10};
+
+static const struct ble_conn_params idle_params = {
+    .min_interval = POWER_IDLE_INTERVAL_MS * 4 / 5,
+    .max_interval = POWER_IDLE_INTERVAL_MS * 4 / 5,
+    .latency = POWER_IDLE_LATENCY,
+    .timeout = POWER_LINK_TIMEOUT_MS / 10};
+
+static esp_pm_lock_handle_t sleep_lock = NULL;
+static esp_pm_lock_handle_t cpu_lock = NULL;
+static esp_timer_handle_t prepare_timer;
+
+static bool battery_mode = POWER_BATTERY_MODE;
+static bool running = false;
+static bool battery_run = false; // The running timer uses the battery mode
+static bool idle_link = false;   // The interval leaves time to switch the links to the idle parameters and back
+static bool prepared = false;    // The links were asked for the active parameters of the next shot
+static uint32_t hold = 0;
+static uint8_t link_params[MAX_CAMERAS];
+static uint8_t link_retries[MAX_CAMERAS];
+
+static bool display_on = true;
+static int64_t run_start;
+static int64_t awake_since;
+static int64_t display_since;
+static uint32_t radio_start;
+static struct power_stats stats;
+
+// Kept over the deep sleep, zero after a power on or reset
+struct power_deep_state
+{
+    uint32_t magic;        // POWER_DEEP_MAGIC from the sleep until the wake
+    uint64_t sleep_rtc_us;
+    uint64_t wake_rtc_us;  // Planned wake
+    int64_t lead_us;
+    int64_t ready_us;      // Average wake to ready time, 0 until measured
+    struct power_stats stats;
+};
+
+static RTC_DATA_ATTR struct power_deep_state deep;
+
+static bool deep_sleep = POWER_DEEP_SLEEP;
+static bool deep_run = false;     // The running timer sleeps deep between the shots
+static bool closing = false;      // Waiting for the links to close
+static uint8_t wake_reason = POWER_WAKE_NONE;
+static bool woken = false;        // The next timer start continues the run which slept
+static bool wake_pending = false; // The wake to ready time isn't measured yet
+static bool shutter_pending = false;
+static uint64_t boot_rtc_us;
+
+static void power_hold(uint32_t reason)
+{
+    if (hold == 0)
+    {
+        esp_pm_lock_acquire(sleep_lock);
+        esp_pm_lock_acquire(cpu_lock);
+        awake_since = esp_timer_get_time();
+    }
+    hold |= reason;
+}
+
+static void power_release(uint32_t reason)
+{
+    if ((hold & reason) == 0)
+    {
+        return;
+    }
+
+    hold &= ~reason;
+    if (hold == 0)
+    {
+        stats.awake_us += esp_timer_get_time() - awake_since;
+        esp_pm_lock_release(cpu_lock);
+        esp_pm_lock_release(sleep_lock);
+    }
+}
+
+// The parameters the links should have now
+static uint8_t power_link_state()
+{
+    if (!running)
+    {
+        return POWER_PARAMS_NONE;
+    }
+    if (!battery_run)
+    {
+        return POWER_PARAMS_ACTIVE;
+    }
+    return ((idle_link && !prepared && (hold & POWER_HOLD_SHOT) == 0) ? POWER_PARAMS_IDLE : POWER_PARAMS_ACTIVE);
+}
+
+static void power_set_link(int camera, uint8_t params)
+{
+    if (params == POWER_PARAMS_NONE || link_params[camera] == params)
+    {
+        return;
+    }
+
+    if (ble_update_conn_params(camera, (params == POWER_PARAMS_IDLE ? &idle_params : &active_params)))
+    {
+        link_params[camera] = params;
+        stats.param_updates++;
+    }
+}
+
+// The link didn't end up with what power_set_link asked for, it is asked again
+static void power_link_result(int camera, bool requested)
+{
+    if (camera < 0 || camera >= MAX_CAMERAS || link_params[camera] == POWER_PARAMS_NONE)
+    {
+        return;
+    }
+    if (requested)
+    {
+        link_retries[camera] = 0;
+        return;
+    }
+
+    LOGW("Camera %d link parameters not taken", camera);
+    stats.param_failures++;
+    link_params[camera] = POWER_PARAMS_NONE;
+
+    if (link_retries[camera] < POWER_PARAMS_RETRIES)
+    {
+        link_retries[camera]++;
+        power_set_link(camera, power_link_state());
+    }
+}
+
+static void power_set_links(uint8_t params)
+{
+    for (int camera = 0; camera < MAX_CAMERAS; camera++)
+    {
+        power_set_link(camera, params);
+    }
+}
+
+static void power_prepare_schedule()
+{
+    int64_t wait = app_timer_time_to_next_shot() - POWER_LEAD_US;
+    esp_timer_start_once(prepare_timer, (wait > 0 ? wait : 0));
+}
+
+// esp_timer task
+static void prepare_timer_callback(void *arg)
+{
+    app_event_post_type(APP_EVENT_POWER);
+}
+
+static void power_prepare_event(struct app_event *event)
+{
+    if (closing)
+    {
+        power_deep_sleep();
+    }
+    else if (battery_run)
+    {
+        prepared = true;
+        power_set_links(power_link_state());
+    }
+}
+
+void power_init()
+{
+#ifdef CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t config = {
+        .max_freq_mhz = POWER_CPU_MAX_MHZ,
+        .min_freq_mhz = POWER_CPU_MIN_MHZ,
+#ifdef CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true
+#endif
+    };
+    ERR_CHECK(esp_pm_configure(&config), "pm_configure");
+#endif
+
+    ERR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "power_sleep", &sleep_lock), "pm_lock");
+    ERR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "power_cpu", &cpu_lock), "pm_lock");
+
+    esp_timer_create_args_t prepare_args = {
+        .callback = prepare_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "prepare"};
+    ESP_ERROR_CHECK(esp_timer_create(&prepare_args, &prepare_timer));
+
+    app_event_set_handler(APP_EVENT_POWER, power_prepare_event);
+    ble_set_on_conn_params(power_link_result);
+
+    power_hold(POWER_HOLD_IDLE);
+
+    boot_rtc_us = esp_clk_rtc_time();
+    if (deep.magic == POWER_DEEP_MAGIC)
+    {
+        esp_sleep_wakeup_cause_t cause = esp_sleep_get_wakeup_cause();
+        wake_reason = (cause == ESP_SLEEP_WAKEUP_TIMER ? POWER_WAKE_TIMER : (cause == ESP_SLEEP_WAKEUP_EXT0 ? POWER_WAKE_BUTTON : POWER_WAKE_NONE));
+    }
+    else
+    {
+        wake_reason = POWER_WAKE_NONE;
+    }
+
+    // A reset from here on starts over
+    deep.magic = 0;
+    woken = (wake_reason != POWER_WAKE_NONE);
+}
+
+void power_set_battery_mode(bool enabled)
+{
+    battery_mode = enabled;
+}
+
+bool power_battery_mode()
+{
+    return battery_mode;
+}
+
+void power_set_deep_sleep(bool enabled)
+{
+    deep_sleep = enabled;
+}
+
+uint8_t power_wake_reason()
+{
+    return wake_reason;
+}
+
+void power_timer_start(uint32_t interval_ms)
+{
+    int64_t now = esp_timer_get_time();
+
+    memset(&stats, 0, sizeof(stats));
+    running = true;
+    run_start = now;
+    awake_since = now;
+    display_since = now;
+    radio_start = ble_radio_events();
+
+    battery_run = battery_mode;
+    deep_run = (battery_run && deep_sleep && interval_ms >= POWER_DEEP_INTERVAL_MS);
+    wake_pending = false;
+    shutter_pending = false;
+
+    if (woken)
+    {
+        // The counters go on, the time asleep counts to the run but not as awake
+        stats = deep.stats;
+        stats.asleep_us += (int64_t)(boot_rtc_us - deep.sleep_rtc_us);
+        run_start = now - stats.run_us - (int64_t)(esp_clk_rtc_time() - deep.sleep_rtc_us);
+        radio_start -= stats.radio_events;
+        wake_pending = (wake_reason == POWER_WAKE_TIMER);
+        shutter_pending = wake_pending;
+        woken = false;
+    }
+    if (deep.lead_us == 0)
+    {
+        deep.lead_us = (int64_t)POWER_DEEP_LEAD_MS * 1000;
+    }
+    stats.lead_us = deep.lead_us;
+    memset(link_params, POWER_PARAMS_NONE, sizeof(link_params));
+    memset(link_retries, 0, sizeof(link_retries));
+
+    if (!battery_run)
+    {
+        power_set_links(POWER_PARAMS_ACTIVE);
+        return;
+    }
+
+    idle_link = ((int64_t)interval_ms * 1000 >= 2 * POWER_LEAD_US);
+    // Woken ahead of the shot, the links come up with the active parameters
+    prepared = wake_pending;
+
+    if (display_on)
+    {
+        power_hold(POWER_HOLD_DISPLAY);
+    }
+    power_release(POWER_HOLD_IDLE);
+    power_set_links(power_link_state());
+
+    if (idle_link)
+    {
+        power_prepare_schedule();
+    }
+
+    LOGI("Battery run, %s between the shots", (deep_run ? "deep sleep" : (idle_link ? "idle link" : "active link")));
+}
+
+void power_timer_stop()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    esp_timer_stop(prepare_timer);
+    closing = false;
+
+    power_hold(POWER_HOLD_IDLE);
+    power_release(POWER_HOLD_DISPLAY | POWER_HOLD_SHOT);
+
+    // Short intervals for the menu
+    power_set_links(POWER_PARAMS_ACTIVE);
+
+    power_get_stats(&stats);
+    running = false;
+    battery_run = false;
+    deep_run = false;
+
+    LOGI("Run %lld ms: awake %lld ms, display on %lld ms, %u radio events, %u parameter updates (%u not taken), %u wakeups, "
+             "%u deep sleeps",
+             (long long)(stats.run_us / 1000), (long long)(stats.awake_us / 1000), (long long)(stats.display_on_us / 1000),
+             stats.radio_events, stats.param_updates, stats.param_failures, stats.wakeups, stats.sleeps);
+}
+
+void power_shot()
+{
+    if (!battery_run)
+    {
+        return;
+    }
+
+    if ((hold & POWER_HOLD_SHOT) == 0)
+    {
+        stats.wakeups++;
+        power_hold(POWER_HOLD_SHOT);
+    }
+
+    if (wake_pending)
+    {
+        wake_pending = false;
+        deep.lead_us = (2 * deep.lead_us < (int64_t)POWER_DEEP_LEAD_MAX_MS * 1000 ? 2 * deep.lead_us : (int64_t)POWER_DEEP_LEAD_MAX_MS * 1000);
+        stats.lead_us = deep.lead_us;
+        LOGW("Shot due before the cameras were back, lead %lld ms", (long long)(deep.lead_us / 1000));
+    }
+
+    esp_timer_stop(prepare_timer);
+    power_set_links(power_link_state());
+}
+
+void power_trigger_done()
+{
+    if (!battery_run || (hold & POWER_HOLD_SHOT) == 0 || canon_queue_depth() > 0)
+    {
+        return;
+    }
+
+    power_release(POWER_HOLD_SHOT);
+    prepared = false;
+    power_set_links(power_link_state());
+
+    if (shutter_pending)
+    {
+        shutter_pending = false;
+        stats.wake_shutter_us = (uint32_t)(esp_clk_rtc_time() - deep.wake_rtc_us);
+        LOGI("Wake to shutter %u ms", stats.wake_shutter_us / 1000);
+    }
+
+    if (idle_link)
+    {
+        power_prepare_schedule();
+    }
+}
+
+// A new link starts with the parameters Bluedroid opened it with
+void power_camera_linked(int camera)
+{
+    if (camera < 0 || camera >= MAX_CAMERAS)
+    {
+        return;
+    }
+
+    link_params[camera] = POWER_PARAMS_NONE;
+    link_retries[camera] = 0;
+    power_set_link(camera, power_link_state());
+}
+
+void power_display(bool on)
+{
+    if (on == display_on)
+    {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    if (running && display_on)
+    {
+        stats.display_on_us += now - display_since;
+    }
+    display_since = now;
+    display_on = on;
+
+    if (!battery_run)
+    {
+        return;
+    }
+
+    if (on)
+    {
+        power_hold(POWER_HOLD_DISPLAY);
+    }
+    else
+    {
+        power_release(POWER_HOLD_DISPLAY);
+    }
+}
+
+bool power_deep_due()
+{
+    if (!deep_run || closing || hold != 0)
+    {
+        return false;
+    }
+
+    // A sleep shorter than the lead doesn't pay for the reconnect
+    return (app_timer_time_to_next_shot() > 2 * deep.lead_us + (int64_t)POWER_DEEP_CLOSE_MS * 1000);
+}
+
+void power_deep_begin()
+{
+    if (!deep_run || closing)
+    {
+        return;
+    }
+
+    // Planned before the caller stops the timer
+    deep.wake_rtc_us = esp_clk_rtc_time() + app_timer_time_to_next_shot() - deep.lead_us;
+    closing = true;
+
+    esp_timer_stop(prepare_timer);
+    esp_timer_start_once(prepare_timer, (uint64_t)POWER_DEEP_CLOSE_MS * 1000);
+}
+
+void power_deep_sleep()
+{
+    if (!closing)
+    {
+        return;
+    }
+
+    closing = false;
+    esp_timer_stop(prepare_timer);
+
+    uint64_t rtc_now = esp_clk_rtc_time();
+    uint64_t wait = (deep.wake_rtc_us > rtc_now ? deep.wake_rtc_us - rtc_now : 0);
+
+    stats.sleeps++;
+    power_get_stats(&deep.stats);
+    deep.sleep_rtc_us = rtc_now;
+    deep.magic = POWER_DEEP_MAGIC;
+
+    // Left like a reset finds it, the host simulator boots again in the same process
+    running = false;
+    battery_run = false;
+    deep_run = false;
+    power_release(POWER_HOLD_IDLE | POWER_HOLD_DISPLAY | POWER_HOLD_SHOT);
+
+    LOGI("Deep sleep for %llu ms, %lld ms ahead of the shot", (unsigned long long)(wait / 1000), (long long)(deep.lead_us / 1000));
+
+    // The lines still in the ring would be lost with the RAM
+    app_log_flush();
+
+    esp_sleep_enable_timer_wakeup(wait);
+    esp_sleep_enable_ext0_wakeup(BUTTON, 0);
+    esp_deep_sleep_start();
+}
+
+void power_deep_ready()
+{
+    if (!wake_pending)
+    {
+        return;
+    }
+
+    wake_pending = false;
+    int64_t ready = (int64_t)(esp_clk_rtc_time() - deep.wake_rtc_us);
+    deep.ready_us = (deep.ready_us == 0 ? ready : (3 * deep.ready_us + ready) / 4);
+
+    // The average follows slow changes, a single slow wake still gets its time the next time
+    int64_t lead = (ready > deep.ready_us ? ready : deep.ready_us) + (int64_t)POWER_DEEP_GUARD_MS * 1000;
+    deep.lead_us = (lead < (int64_t)POWER_DEEP_LEAD_MAX_MS * 1000 ? lead : (int64_t)POWER_DEEP_LEAD_MAX_MS * 1000);
+
+    stats.wake_ready_us = (uint32_t)ready;
+    stats.lead_us = (uint32_t)deep.lead_us;
+    LOGI("Cameras back %lld ms after the wake, lead %lld ms", (long long)(ready / 1000), (long long)(deep.lead_us / 1000));
+}
+
+void power_get_stats(struct power_stats *out)
+{
+    *out = stats;
+    if (!running)
+    {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+    out->run_us = now - run_start;
+    out->radio_events = ble_radio_events() - radio_start;
+    if (hold != 0)
+    {
+        out->awake_us += now - awake_since;
+    }
+    if (display_on)
+    {
+        out->display_on_us += now - display_since;
+    }
+}
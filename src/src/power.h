@@ -0,0 +1,57 @@
+#ifndef __POWER__
+#define __POWER__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Energy counters of a timer run, to compare configurations
+struct power_stats
+{
+    int64_t run_us;
+    int64_t awake_us;        // The firmware kept the chip out of light sleep
+    int64_t display_on_us;
+    uint32_t radio_events;   // Connection events of all links, counted from the negotiated intervals
+    uint32_t param_updates;  // Connection parameter requests
+    uint32_t param_failures; // Requests the link didn't end up with
+    uint32_t wakeups;        // Shots the chip was woken up for
+
+    // Deep sleep, the counters above go on over the sleeps of a run
+    uint32_t sleeps;
+    int64_t asleep_us;
+    uint32_t wake_ready_us;   // Last wake until every camera was back
+    uint32_t wake_shutter_us; // Last wake until the trigger was done
+    uint32_t lead_us;         // Wake ahead of the shot, adapted to the wake to ready time
+};
+
+#define POWER_WAKE_NONE (0)   // Power on or reset
+#define POWER_WAKE_TIMER (1)  // Deep sleep of a timer run, ahead of its next shot
+#define POWER_WAKE_BUTTON (2) // Deep sleep of a timer run, the button was pressed
+
+void power_init();
+
+// Takes effect with the next timer run
+void power_set_battery_mode(bool enabled);
+bool power_battery_mode();
+void power_set_deep_sleep(bool enabled);
+
+// How this boot started, a woken run is resumed from the journal
+uint8_t power_wake_reason();
+
+// Hooks of a timer run, all on the dispatcher task
+void power_timer_start(uint32_t interval_ms);
+void power_timer_stop();
+void power_shot();         // The shot is due, stays awake until the trigger is done
+void power_trigger_done(); // Sleeps again once no trigger is queued
+void power_camera_linked(int camera);
+void power_display(bool on);
+
+// Deep sleep of a battery run, all on the dispatcher task
+bool power_deep_due();   // After the trigger: the display is off and the next shot is far enough away
+void power_deep_begin(); // The caller closes the links, power_deep_sleep follows them or POWER_DEEP_CLOSE_MS
+void power_deep_sleep(); // Doesn't return on the chip
+void power_deep_ready(); // Every camera is back after the wake
+
+// Of the running timer, or the last one once it stopped
+void power_get_stats(struct power_stats *stats);
+
+#endif
@@ -0,0 +1,165 @@
+#include "scan_table.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "app_log.h"
+
+#define TAG "SCAN"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+/*
+Scan table:
+    The devices are keyed by their address in an open addressing hash table with linear probing,
+    two cameras of the same model are two entries. Entries are only removed by scan_table_clear,
+    so a lookup ends at the first free slot. Once the table is full a new device only replaces
+    the weakest one if it is stronger.
+*/
+
+static struct scan_entry table[SCAN_TABLE_SIZE];
+static int count = 0;
+
+static uint32_t scan_hash(const uint8_t *bda)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < sizeof(esp_bd_addr_t); i++)
+    {
+        hash = (hash ^ bda[i]) * 16777619u;
+    }
+
+    return hash & (SCAN_TABLE_SIZE - 1);
+}
+
+static struct scan_entry *scan_find(const uint8_t *bda, struct scan_entry **free_slot)
+{
+    uint32_t index = scan_hash(bda);
+
+    *free_slot = NULL;
+    for (int probe = 0; probe < SCAN_TABLE_SIZE; probe++)
+    {
+        struct scan_entry *entry = &table[(index + probe) & (SCAN_TABLE_SIZE - 1)];
+        if (!entry->used)
+        {
+            *free_slot = entry;
+            return NULL;
+        }
+        if (memcmp(entry->bda, bda, sizeof(esp_bd_addr_t)) == 0)
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static struct scan_entry *scan_weakest()
+{
+    struct scan_entry *weakest = &table[0];
+    for (int i = 1; i < SCAN_TABLE_SIZE; i++)
+    {
+        if (table[i].rssi < weakest->rssi)
+        {
+            weakest = &table[i];
+        }
+    }
+
+    return weakest;
+}
+
+void scan_table_clear()
+{
+    memset(table, 0, sizeof(table));
+    count = 0;
+}
+
+bool scan_table_update(esp_bd_addr_t bda, int addr_type, int rssi, const char *name, int name_len)
+{
+    bool changed = false;
+
+    struct scan_entry *free_slot;
+    struct scan_entry *entry = scan_find(bda, &free_slot);
+    if (entry == NULL)
+    {
+        entry = free_slot;
+        if (entry == NULL)
+        {
+            // Full, keep the strongest devices
+            entry = scan_weakest();
+            if (rssi <= entry->rssi)
+            {
+                return false;
+            }
+
+            LOGD("Table full, replacing a device at %d dBm", entry->rssi);
+        }
+        else
+        {
+            count++;
+        }
+
+        memset(entry, 0, sizeof(struct scan_entry));
+        entry->used = true;
+        memcpy(entry->bda, bda, sizeof(esp_bd_addr_t));
+        changed = true;
+    }
+
+    if (name_len > SCAN_NAME_LEN)
+    {
+        name_len = SCAN_NAME_LEN;
+    }
+    if (strncmp(entry->name, name, name_len) != 0 || entry->name[name_len] != 0)
+    {
+        memcpy(entry->name, name, name_len);
+        entry->name[name_len] = 0;
+        changed = true;
+    }
+
+    entry->addr_type = addr_type;
+    entry->rssi = rssi;
+    entry->last_seen = esp_timer_get_time();
+
+    return changed;
+}
+
+int scan_table_ranked(const struct scan_entry **entries, int max)
+{
+    int found = 0;
+
+    // Insertion into the short result list, the table itself is never sorted
+    for (int i = 0; i < SCAN_TABLE_SIZE; i++)
+    {
+        const struct scan_entry *entry = &table[i];
+        if (!entry->used)
+        {
+            continue;
+        }
+
+        int pos = found;
+        while (pos > 0 && entries[pos - 1]->rssi < entry->rssi)
+        {
+            if (pos < max)
+            {
+                entries[pos] = entries[pos - 1];
+            }
+            pos--;
+        }
+
+        if (pos < max)
+        {
+            entries[pos] = entry;
+            if (found < max)
+            {
+                found++;
+            }
+        }
+    }
+
+    return found;
+}
+
+int scan_table_count()
+{
+    return count;
+}
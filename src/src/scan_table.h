@@ -0,0 +1,31 @@
+#ifndef __SCAN_TABLE__
+#define __SCAN_TABLE__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_bt_defs.h"
+
+#define SCAN_TABLE_SIZE (32) // Power of two
+#define SCAN_NAME_LEN (16)
+
+struct scan_entry
+{
+    bool used;
+    esp_bd_addr_t bda;
+    int addr_type;
+    int8_t rssi;       // Of the last report
+    int64_t last_seen; // esp_timer time of the last report
+    char name[SCAN_NAME_LEN + 1];
+};
+
+void scan_table_clear();
+
+// Adds or refreshes the device, returns true if it is new or its name changed
+bool scan_table_update(esp_bd_addr_t bda, int addr_type, int rssi, const char *name, int name_len);
+
+// Fills entries with up to max devices, strongest first, returns the number of entries
+int scan_table_ranked(const struct scan_entry **entries, int max);
+int scan_table_count();
+
+#endif
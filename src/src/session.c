@@ -0,0 +1,385 @@
+#include "session.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "app_ble.h"
+#include "canon_ble.h"
+#include "app_event.h"
+#include "shot_log.h"
+#include "timer.h"
+#include "config.h"
+#include "app_log.h"
+
+#define TAG "SESSION"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+/*
+Session:
+    A running timelapse keeps its schedule when a camera drops out of range.
+    1. The cameras connected at the start are remembered by their address
+    2. A lost camera gets a direct connection attempt after a backoff, the backoff doubles with every failed attempt
+    3. A connection is followed by the connect set, the cached handles skip the service discovery
+    4. Shots scheduled while no camera is connected are skipped or taken once a camera is back
+*/
+
+struct session_camera
+{
+    bool used;
+    esp_bd_addr_t bda;
+    int addr_type;
+
+    int conn;         // Connection while linked or connecting, -1 while waiting for the next attempt
+    bool linked;      // Authenticated, takes part in the triggers
+    uint8_t failures; // Failed attempts since the link was lost
+    int64_t next_us;  // Next attempt, or the deadline of the running one
+    int64_t lost_us;
+};
+
+static struct session_camera session_cameras[MAX_CAMERAS];
+static bool running = false;
+static bool catch_up = TIMER_CATCH_UP;
+static uint32_t missed = 0; // Missed shots not caught up or skipped yet
+
+static esp_timer_handle_t reconnect_timer;
+static struct session_stats stats;
+
+static void reconnect_timer_callback(void *arg)
+{
+    app_event_post_type(APP_EVENT_RECONNECT);
+}
+
+static int64_t reconnect_backoff(uint8_t failures)
+{
+    int64_t backoff = (int64_t)RECONNECT_BACKOFF_MIN_MS * 1000;
+    for (int i = 0; i < failures && backoff < (int64_t)RECONNECT_BACKOFF_MAX_MS * 1000; i++)
+    {
+        backoff *= 2;
+    }
+
+    return (backoff < (int64_t)RECONNECT_BACKOFF_MAX_MS * 1000 ? backoff : (int64_t)RECONNECT_BACKOFF_MAX_MS * 1000);
+}
+
+// One timer for all cameras, armed for the earliest attempt or deadline
+static void reconnect_arm()
+{
+    esp_timer_stop(reconnect_timer);
+
+    int64_t next = INT64_MAX;
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        struct session_camera *cam = &session_cameras[i];
+        if (cam->used && !cam->linked && cam->next_us < next)
+        {
+            next = cam->next_us;
+        }
+    }
+
+    if (next != INT64_MAX)
+    {
+        int64_t wait = next - esp_timer_get_time();
+        esp_timer_start_once(reconnect_timer, (wait > 0 ? wait : 0));
+    }
+}
+
+static void reconnect_failed(struct session_camera *cam)
+{
+    cam->conn = -1;
+    cam->next_us = esp_timer_get_time() + reconnect_backoff(cam->failures);
+
+    if (cam->failures < UINT8_MAX)
+    {
+        cam->failures++;
+    }
+}
+
+static void reconnect_event(struct app_event *event)
+{
+    if (!running)
+    {
+        return;
+    }
+
+    int64_t now = esp_timer_get_time();
+
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        struct session_camera *cam = &session_cameras[i];
+        if (!cam->used || cam->linked || cam->next_us > now)
+        {
+            continue;
+        }
+
+        if (cam->conn >= 0)
+        {
+            // The stack never reported the attempt, give it up
+            LOGW("Reconnect attempt timed out");
+            ble_disconnect(cam->conn);
+            reconnect_failed(cam);
+            continue;
+        }
+
+        stats.attempts++;
+        cam->conn = ble_connect(cam->bda, cam->addr_type);
+        if (cam->conn < 0)
+        {
+            reconnect_failed(cam);
+        }
+        else
+        {
+            cam->next_us = now + (int64_t)RECONNECT_ATTEMPT_MS * 1000;
+        }
+    }
+
+    reconnect_arm();
+}
+
+void session_init()
+{
+    app_event_set_handler(APP_EVENT_RECONNECT, reconnect_event);
+
+    esp_timer_create_args_t reconnect_args = {
+        .callback = reconnect_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "reconnect"};
+    ESP_ERROR_CHECK(esp_timer_create(&reconnect_args, &reconnect_timer));
+}
+
+void session_start()
+{
+    memset(session_cameras, 0, sizeof(session_cameras));
+    memset(&stats, 0, sizeof(stats));
+    missed = 0;
+
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        struct session_camera *cam = &session_cameras[i];
+        cam->conn = -1;
+
+        if (canon_camera_ready(i) && ble_get_peer(i, cam->bda, &cam->addr_type))
+        {
+            cam->used = true;
+            cam->linked = true;
+            cam->conn = i;
+        }
+    }
+
+    running = true;
+}
+
+void session_stop()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    running = false;
+    esp_timer_stop(reconnect_timer);
+
+    // Give up the attempts which are still running
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        struct session_camera *cam = &session_cameras[i];
+        if (cam->used && !cam->linked && cam->conn >= 0)
+        {
+            ble_disconnect(cam->conn);
+        }
+    }
+
+    LOGI("Stop, %u shots, %u missed, %u caught up, %u skipped, %u outages, %u reconnects in %u attempts",
+             stats.shots, stats.missed, stats.caught_up, stats.skipped, stats.outages, stats.reconnects, stats.attempts);
+}
+
+bool session_running()
+{
+    return running;
+}
+
+void session_resume(const struct session_peer *peers, int count)
+{
+    memset(session_cameras, 0, sizeof(session_cameras));
+    memset(&stats, 0, sizeof(stats));
+    missed = 0;
+
+    int64_t now = esp_timer_get_time();
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        struct session_camera *cam = &session_cameras[i];
+        cam->conn = -1;
+
+        if (i < count)
+        {
+            cam->used = true;
+            memcpy(cam->bda, peers[i].bda, sizeof(esp_bd_addr_t));
+            cam->addr_type = peers[i].addr_type;
+            cam->lost_us = now;
+            cam->next_us = now;
+        }
+    }
+
+    running = true;
+    reconnect_arm();
+}
+
+int session_peers(struct session_peer *peers, int max)
+{
+    int count = 0;
+    for (int i = 0; i < MAX_CAMERAS && count < max; i++)
+    {
+        if (session_cameras[i].used)
+        {
+            memcpy(peers[count].bda, session_cameras[i].bda, sizeof(esp_bd_addr_t));
+            peers[count].addr_type = session_cameras[i].addr_type;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void session_shot(uint32_t shot, int64_t scheduled_us)
+{
+    stats.shots++;
+
+    if (canon_camera_count() == 0)
+    {
+        stats.missed++;
+        missed++;
+
+        struct shot_record record = {
+            .shot = shot,
+            .scheduled_us = scheduled_us,
+            .write_us = SHOT_LOG_NONE,
+            .press_us = SHOT_LOG_NONE,
+            .release_us = SHOT_LOG_NONE,
+            .camera = SHOT_LOG_NO_CAMERA,
+            .status = SHOT_STATUS_MISSED,
+            .rssi = BLE_RSSI_NONE};
+        shot_log_add(&record);
+        return;
+    }
+
+    canon_do_shot(shot, scheduled_us, 0);
+}
+
+void session_shot_lost(uint32_t shot)
+{
+    struct shot_record record = {
+        .shot = shot,
+        .scheduled_us = app_timer_shot_time(shot),
+        .write_us = SHOT_LOG_NONE,
+        .press_us = SHOT_LOG_NONE,
+        .release_us = SHOT_LOG_NONE,
+        .camera = SHOT_LOG_NO_CAMERA,
+        .status = SHOT_STATUS_DROPPED,
+        .rssi = BLE_RSSI_NONE};
+    shot_log_add(&record);
+}
+
+bool session_camera_lost(int camera)
+{
+    if (!running)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        struct session_camera *cam = &session_cameras[i];
+        if (!cam->used || cam->conn != camera)
+        {
+            continue;
+        }
+
+        if (cam->linked)
+        {
+            LOGW("Camera %d lost, reconnecting", camera);
+
+            cam->linked = false;
+            cam->failures = 0;
+            cam->lost_us = esp_timer_get_time();
+            stats.outages++;
+        }
+
+        reconnect_failed(cam);
+        reconnect_arm();
+        break;
+    }
+
+    // Also a camera this session doesn't know, the schedule goes on with the others
+    return true;
+}
+
+bool session_camera_restored(int camera)
+{
+    if (!running)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        struct session_camera *cam = &session_cameras[i];
+        if (!cam->used || cam->linked || cam->conn != camera)
+        {
+            continue;
+        }
+
+        int64_t outage = esp_timer_get_time() - cam->lost_us;
+        LOGI("Camera %d back after %u ms", camera, (uint32_t)(outage / 1000));
+
+        cam->linked = true;
+        cam->failures = 0;
+        stats.reconnects++;
+        if (outage > stats.max_outage_us)
+        {
+            stats.max_outage_us = outage;
+        }
+
+        reconnect_arm();
+        break;
+    }
+
+    // The missed shots are settled once the first camera is back
+    if (missed > 0)
+    {
+        uint32_t shots = (catch_up ? (missed < TIMER_CATCH_UP_MAX ? missed : TIMER_CATCH_UP_MAX) : 0);
+        for (uint32_t i = 0; i < shots; i++)
+        {
+            canon_do_shot(0, esp_timer_get_time(), SHOT_FLAG_CATCH_UP);
+        }
+
+        stats.caught_up += shots;
+        stats.skipped += missed - shots;
+        missed = 0;
+    }
+
+    return true;
+}
+
+int session_reconnecting()
+{
+    int count = 0;
+    for (int i = 0; i < MAX_CAMERAS; i++)
+    {
+        if (session_cameras[i].used && !session_cameras[i].linked)
+        {
+            count++;
+        }
+    }
+
+    return (running ? count : 0);
+}
+
+void session_set_catch_up(bool enabled)
+{
+    catch_up = enabled;
+}
+
+void session_get_stats(struct session_stats *out)
+{
+    *out = stats;
+}
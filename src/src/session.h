@@ -0,0 +1,55 @@
+#ifndef __SESSION__
+#define __SESSION__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "esp_bt_defs.h"
+
+struct session_stats
+{
+    uint32_t shots;     // Scheduled shots
+    uint32_t missed;    // Scheduled while no camera was connected
+    uint32_t caught_up; // Missed shots taken after a reconnect
+    uint32_t skipped;   // Missed shots given up
+
+    uint32_t outages;    // Links lost during the session
+    uint32_t reconnects; // Cameras authenticated again
+    uint32_t attempts;   // Connection attempts
+    int64_t max_outage_us;
+};
+
+// A camera of the session
+struct session_peer
+{
+    esp_bd_addr_t bda;
+    int addr_type;
+};
+
+void session_init();
+
+// Watches the cameras connected now, a lost one is reconnected until the session stops
+void session_start();
+void session_stop();
+bool session_running();
+
+// Starts with all cameras lost, they are connected like after an outage
+void session_resume(const struct session_peer *peers, int count);
+int session_peers(struct session_peer *peers, int max);
+
+// Shot n of the timer due at scheduled_us, triggers the connected cameras or counts the shot as missed
+void session_shot(uint32_t shot, int64_t scheduled_us);
+
+// From the canon disconnect and auth callbacks, false if no session is running and the caller handles it
+bool session_camera_lost(int camera);
+bool session_camera_restored(int camera);
+
+int session_reconnecting(); // Cameras waiting for their link
+
+void session_set_catch_up(bool enabled);
+void session_get_stats(struct session_stats *stats);
+
+// From the timer task, the event of the shot did not fit into the queue. Only leaves its shot record
+void session_shot_lost(uint32_t shot);
+
+#endif
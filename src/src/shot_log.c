@@ -0,0 +1,325 @@
+#include "shot_log.h"
+
+#include <string.h>
+
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#include "config.h"
+#include "app_log.h"
+
+#define TAG "SHOTLOG"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+/*
+Shot log:
+    Every trigger leaves one fixed size record per camera, the missed shots one without a camera.
+    1. shot_log_add puts the record into a RAM ring, nothing else happens on the trigger path
+    2. shot_log_flush writes the ring to the "shotlog" partition in blocks of SHOT_LOG_BLOCK records, from the timer tick
+    3. The partition is a ring of flash sectors, the sector ahead of the write position is erased when it is reached
+
+    The end of the log is found at boot from the sequence numbers, erased flash reads as SHOT_LOG_NONE.
+    The dump runs on the console task, the lock keeps it away from the dispatcher while it reads.
+*/
+
+#define SHOT_LOG_PARTITION "shotlog"
+#define SHOT_LOG_SUBTYPE (0x40)
+#define SHOT_LOG_SECTOR (4096)
+#define SHOT_LOG_SECTOR_RECORDS (SHOT_LOG_SECTOR / sizeof(struct shot_record))
+#define SHOT_LOG_DUMP_CHUNK (8) // Records read from flash at a time
+
+_Static_assert(sizeof(struct shot_record) == 32, "shot_record is stored as 32 bytes");
+
+static const esp_partition_t *partition = NULL;
+static SemaphoreHandle_t lock = NULL;
+
+static uint32_t slot_count;  // Records the partition holds
+static uint32_t write_slot;  // Next record written to flash
+static uint32_t next_sequence;
+
+static struct shot_record ring[SHOT_LOG_RING];
+static uint32_t ring_head; // Oldest record not in flash
+static uint32_t ring_count;
+
+static struct shot_log_stats stats;
+
+static uint32_t read_sequence(uint32_t slot)
+{
+    uint32_t sequence = SHOT_LOG_NONE;
+    if (esp_partition_read(partition, slot * sizeof(struct shot_record), &sequence, sizeof(sequence)) != ESP_OK)
+    {
+        stats.failed++;
+        return SHOT_LOG_NONE;
+    }
+    return sequence;
+}
+
+// The newest sector starts with the highest sequence, its first erased record is the end of the log
+static void find_end()
+{
+    uint32_t sectors = slot_count / SHOT_LOG_SECTOR_RECORDS;
+    uint32_t newest = SHOT_LOG_NONE;
+    uint32_t newest_sequence = 0;
+
+    for (uint32_t i = 0; i < sectors; i++)
+    {
+        uint32_t sequence = read_sequence(i * SHOT_LOG_SECTOR_RECORDS);
+        if (sequence != SHOT_LOG_NONE && (newest == SHOT_LOG_NONE || sequence > newest_sequence))
+        {
+            newest = i;
+            newest_sequence = sequence;
+        }
+    }
+
+    write_slot = 0;
+    next_sequence = 0;
+    if (newest == SHOT_LOG_NONE)
+    {
+        return;
+    }
+
+    uint32_t slot = newest * SHOT_LOG_SECTOR_RECORDS;
+    uint32_t end = slot + SHOT_LOG_SECTOR_RECORDS;
+    next_sequence = newest_sequence + 1;
+
+    for (slot++; slot < end; slot++)
+    {
+        uint32_t sequence = read_sequence(slot);
+        if (sequence == SHOT_LOG_NONE)
+        {
+            break;
+        }
+        next_sequence = sequence + 1;
+    }
+
+    write_slot = slot % slot_count;
+}
+
+void shot_log_init()
+{
+    lock = xSemaphoreCreateMutex();
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, (esp_partition_subtype_t)SHOT_LOG_SUBTYPE, SHOT_LOG_PARTITION);
+    if (partition == NULL)
+    {
+        LOGW("No %s partition, the shot log is only kept in RAM", SHOT_LOG_PARTITION);
+        return;
+    }
+
+    slot_count = (partition->size / SHOT_LOG_SECTOR) * SHOT_LOG_SECTOR_RECORDS;
+    find_end();
+
+    LOGI("%u records of %u used, next sequence %u", write_slot, slot_count, next_sequence);
+}
+
+void shot_log_add(struct shot_record *record)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    if (ring_count == SHOT_LOG_RING)
+    {
+        ring_head = (ring_head + 1) % SHOT_LOG_RING;
+        ring_count--;
+        stats.lost++;
+    }
+
+    record->sequence = next_sequence++;
+    ring[(ring_head + ring_count) % SHOT_LOG_RING] = *record;
+    ring_count++;
+    stats.records++;
+
+    xSemaphoreGive(lock);
+}
+
+// Writes up to count records, never across the end of the ring, the partition or a sector
+static bool flush_records(uint32_t count)
+{
+    uint32_t sector_left = SHOT_LOG_SECTOR_RECORDS - (write_slot % SHOT_LOG_SECTOR_RECORDS);
+    uint32_t ring_left = SHOT_LOG_RING - ring_head;
+
+    uint32_t n = count;
+    n = (n < sector_left ? n : sector_left);
+    n = (n < ring_left ? n : ring_left);
+
+    size_t offset = write_slot * sizeof(struct shot_record);
+    if ((write_slot % SHOT_LOG_SECTOR_RECORDS) == 0 && esp_partition_erase_range(partition, offset, SHOT_LOG_SECTOR) != ESP_OK)
+    {
+        stats.failed++;
+        return false;
+    }
+    if (esp_partition_write(partition, offset, &ring[ring_head], n * sizeof(struct shot_record)) != ESP_OK)
+    {
+        stats.failed++;
+        return false;
+    }
+
+    ring_head = (ring_head + n) % SHOT_LOG_RING;
+    ring_count -= n;
+    write_slot = (write_slot + n) % slot_count;
+    return true;
+}
+
+static void flush_locked(bool force)
+{
+    if (partition == NULL)
+    {
+        return;
+    }
+
+    while (ring_count >= (force ? 1 : SHOT_LOG_BLOCK))
+    {
+        uint32_t block = (force ? ring_count : SHOT_LOG_BLOCK);
+        while (block > 0)
+        {
+            uint32_t before = ring_count;
+            if (!flush_records(block))
+            {
+                LOGE("Flash write failed, %u records kept in RAM", ring_count);
+                return;
+            }
+            block -= before - ring_count;
+        }
+        stats.blocks++;
+    }
+}
+
+void shot_log_flush(bool force)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    flush_locked(force);
+    xSemaphoreGive(lock);
+}
+
+static void dump_record(FILE *out, const struct shot_record *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    char line[2 * sizeof(struct shot_record) + 1];
+    uint8_t sum = 0;
+
+    for (int i = 0; i < sizeof(struct shot_record); i++)
+    {
+        sprintf(&line[i * 2], "%02x", bytes[i]);
+        sum += bytes[i];
+    }
+
+    fprintf(out, "SHOT %s %02x\n", line, sum);
+}
+
+// Without the partition the log is the RAM ring
+static int dump_ram(FILE *out)
+{
+    int count = 0;
+    uint32_t index = 0;
+
+    while (true)
+    {
+        xSemaphoreTake(lock, portMAX_DELAY);
+        bool more = (index < ring_count);
+        struct shot_record record;
+        if (more)
+        {
+            record = ring[(ring_head + index) % SHOT_LOG_RING];
+        }
+        xSemaphoreGive(lock);
+
+        if (!more)
+        {
+            return count;
+        }
+
+        dump_record(out, &record);
+        index++;
+        count++;
+    }
+}
+
+// Everything is flushed first, then read from the oldest sector up to the write position at the time of the command
+static int dump_flash(FILE *out)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    flush_locked(true);
+    uint32_t end = write_slot;
+    xSemaphoreGive(lock);
+
+    // The sector of the end is erased once the end gets there, until then it still holds the oldest records
+    uint32_t slot = end;
+    if ((end % SHOT_LOG_SECTOR_RECORDS) != 0)
+    {
+        slot = ((end / SHOT_LOG_SECTOR_RECORDS + 1) * SHOT_LOG_SECTOR_RECORDS) % slot_count;
+    }
+
+    int count = 0;
+    uint32_t left = (end + slot_count - slot) % slot_count;
+    if (left == 0)
+    {
+        left = slot_count;
+    }
+
+    while (left > 0)
+    {
+        struct shot_record records[SHOT_LOG_DUMP_CHUNK];
+        uint32_t n = (left < SHOT_LOG_DUMP_CHUNK ? left : SHOT_LOG_DUMP_CHUNK);
+        n = (n < slot_count - slot ? n : slot_count - slot);
+
+        xSemaphoreTake(lock, portMAX_DELAY);
+        esp_err_t err = esp_partition_read(partition, slot * sizeof(struct shot_record), records, n * sizeof(struct shot_record));
+        xSemaphoreGive(lock);
+
+        if (err != ESP_OK)
+        {
+            fprintf(out, "SHOTLOG ERROR %d\n", err);
+            return count;
+        }
+
+        for (uint32_t i = 0; i < n; i++)
+        {
+            if (records[i].sequence != SHOT_LOG_NONE)
+            {
+                dump_record(out, &records[i]);
+                count++;
+            }
+        }
+
+        slot = (slot + n) % slot_count;
+        left -= n;
+    }
+
+    return count;
+}
+
+int shot_log_dump(FILE *out)
+{
+    fprintf(out, "SHOTLOG BEGIN %d %d\n", SHOT_LOG_VERSION, (int)sizeof(struct shot_record));
+
+    int count = (partition != NULL ? dump_flash(out) : dump_ram(out));
+
+    fprintf(out, "SHOTLOG END %d\n", count);
+    return count;
+}
+
+// The sequence goes on, a decoder can still tell the records of a later dump apart
+void shot_log_clear()
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+
+    if (partition != NULL && esp_partition_erase_range(partition, 0, (slot_count / SHOT_LOG_SECTOR_RECORDS) * SHOT_LOG_SECTOR) != ESP_OK)
+    {
+        stats.failed++;
+    }
+
+    write_slot = 0;
+    ring_head = 0;
+    ring_count = 0;
+
+    xSemaphoreGive(lock);
+
+    LOGI("Cleared");
+}
+
+void shot_log_get_stats(struct shot_log_stats *out)
+{
+    xSemaphoreTake(lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGive(lock);
+}
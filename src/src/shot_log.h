@@ -0,0 +1,64 @@
+#ifndef __SHOT_LOG__
+#define __SHOT_LOG__
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SHOT_LOG_VERSION (1)
+
+#define SHOT_LOG_NONE (0xFFFFFFFF) // Time of a step the trigger didn't get to
+#define SHOT_LOG_NO_CAMERA (0xFF)  // Missed shot, no camera was connected
+
+// Outcome of a trigger on one camera
+#define SHOT_STATUS_OK (0)
+#define SHOT_STATUS_FAILED (1)  // Aborted or cut by a disconnect
+#define SHOT_STATUS_DROPPED (2) // Dropped by the trigger policy, a full command queue or a full event queue
+#define SHOT_STATUS_MERGED (3)  // Merged into a trigger which was already waiting
+#define SHOT_STATUS_MISSED (4)  // Scheduled while no camera was connected
+
+#define SHOT_FLAG_FAST (0x01)     // Sent with write without response
+#define SHOT_FLAG_MANUAL (0x02)   // Triggered from the menu, not by the timer
+#define SHOT_FLAG_CATCH_UP (0x04) // Taken after a reconnect for a missed shot
+#define SHOT_FLAG_DELAYED (0x08)  // Queued behind another command set
+
+// One trigger on one camera, 32 bytes little endian, the layout is the same in flash and in the dump
+struct shot_record
+{
+    uint32_t sequence;    // Number of the record, SHOT_LOG_NONE marks erased flash
+    uint32_t shot;        // Timer shot, 0 for the manual and catch-up triggers
+    int64_t scheduled_us; // esp_timer time the shot was due
+    // After scheduled_us
+    uint32_t write_us;   // ble_write_char of trig_seq0
+    uint32_t press_us;   // ESP_GATTC_WRITE_CHAR_EVT of trig_seq0
+    uint32_t release_us; // ESP_GATTC_WRITE_CHAR_EVT of trig_seq1
+    uint8_t camera;
+    uint8_t status;
+    int8_t rssi; // Last reading before the shot, BLE_RSSI_NONE if there was none
+    uint8_t flags;
+};
+
+struct shot_log_stats
+{
+    uint32_t records; // Since boot
+    uint32_t lost;    // Overwritten in RAM before they were flushed
+    uint32_t blocks;  // Flash writes
+    uint32_t failed;  // Flash operations which failed
+};
+
+// Finds the end of the log in the partition, without the partition the records are only kept in RAM
+void shot_log_init();
+
+// From the dispatcher task, only touches RAM
+void shot_log_add(struct shot_record *record);
+
+// Writes the complete blocks to flash, all records if forced
+void shot_log_flush(bool force);
+
+// Writes the records from flash and RAM as text lines, the oldest first, safe to call from another task
+int shot_log_dump(FILE *out);
+void shot_log_clear();
+
+void shot_log_get_stats(struct shot_log_stats *stats);
+
+#endif
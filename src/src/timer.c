@@ -1,35 +1,173 @@
 #include "timer.h"
-#include "esp_log.h"
-#include "freertos/FreeRTOS.h"
-#include "freertos/timers.h"
+
+#include <string.h>
+
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include "trace.h"
+#include "app_log.h"
 
 #define TAG "TIMER"
+#define LOG_LEVEL (LOG_LEVEL_DEFAULT)
+
+#define TIMER_TICK_US (1000 * 1000) // UI refresh, not used for the shots
+
+/*
+Interval scheduler:
+    The shots are scheduled at absolute deadlines (start + n * interval) with a one shot esp_timer which is re-armed
+    from the callback. The error of a single shot never carries over to the next one, so long runs don't drift.
+    A separate periodic timer ticks every second to refresh the countdown, slower while nobody looks at it.
+*/
+
+static esp_timer_handle_t shot_timer;
+static esp_timer_handle_t tick_timer;
+
+static timer_shot_callback_ptr shot_callback = NULL;
+static timer_callback_ptr tick_callback = NULL;
+
+static volatile bool running = false;
+static int64_t tick_us = TIMER_TICK_US;
+static int64_t start_time;
+static int64_t interval_us;
+static uint32_t next_shot;
+
+static struct app_timer_stats stats;
+
+static int64_t shot_deadline(uint32_t shot)
+{
+    return start_time + (int64_t)shot * interval_us;
+}
+
+static void shot_timer_callback(void *arg)
+{
+    if (!running)
+    {
+        return; // Stopped while the callback was already pending
+    }
+
+    int64_t now = esp_timer_get_time();
+    uint32_t shot = next_shot;
+    TRACE_INSTANT(TRACE_TIMER_SHOT, 0, shot);
+    int64_t deviation = now - shot_deadline(shot);
+
+    // Arm the next deadline, skip the ones which are already in the past
+    next_shot++;
+    if (shot_deadline(next_shot) <= now)
+    {
+        uint32_t skip = (uint32_t)((now - shot_deadline(next_shot)) / interval_us) + 1;
+
+        stats.missed += skip;
+        next_shot += skip;
+    }
 
-static TimerHandle_t timer;
-static timer_callback_ptr callback = NULL;
+    int64_t wait = shot_deadline(next_shot) - esp_timer_get_time();
+    esp_timer_start_once(shot_timer, (wait > 0 ? wait : 0));
+
+    stats.shots++;
+    stats.last_deviation_us = deviation;
+    if (deviation > stats.max_deviation_us)
+    {
+        stats.max_deviation_us = deviation;
+    }
+
+    if (shot_callback != NULL)
+    {
+        shot_callback(shot, deviation);
+    }
+}
 
-static void timer_callback()
+static void tick_timer_callback(void *arg)
 {
-    if (callback != NULL)
+    TRACE_INSTANT(TRACE_TIMER_TICK, 0, 0);
+    if (tick_callback != NULL)
     {
-        callback();
+        tick_callback();
     }
 }
 
 void app_timer_init()
 {
-    timer = xTimerCreate("SEC", pdMS_TO_TICKS(1000), pdTRUE, (void *)0, timer_callback);
+    esp_timer_create_args_t shot_args = {
+        .callback = shot_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "shot"};
+    ESP_ERROR_CHECK(esp_timer_create(&shot_args, &shot_timer));
+
+    esp_timer_create_args_t tick_args = {
+        .callback = tick_timer_callback,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "tick"};
+    ESP_ERROR_CHECK(esp_timer_create(&tick_args, &tick_timer));
+}
+
+void app_timer_start(uint32_t interval_ms, timer_shot_callback_ptr shot_cb, timer_callback_ptr tick_cb)
+{
+    // The first shot is one interval after the start
+    app_timer_start_at(interval_ms, esp_timer_get_time(), shot_cb, tick_cb);
 }
 
-void app_timer_start(timer_callback_ptr cb)
+void app_timer_start_at(uint32_t interval_ms, int64_t start, timer_shot_callback_ptr shot_cb, timer_callback_ptr tick_cb)
 {
-    callback = cb;
+    shot_callback = shot_cb;
+    tick_callback = tick_cb;
+
+    memset(&stats, 0, sizeof(stats));
+
+    tick_us = TIMER_TICK_US;
+    interval_us = (int64_t)interval_ms * 1000;
+    start_time = start;
+
+    // The first deadline still ahead, a resumed schedule keeps its shot numbers
+    int64_t now = esp_timer_get_time();
+    next_shot = (now > start_time ? (uint32_t)((now - start_time) / interval_us) : 0) + 1;
+    running = true;
 
-    xTimerStart(timer, 0);
+    int64_t wait = shot_deadline(next_shot) - now;
+    esp_timer_start_once(shot_timer, (wait > 0 ? wait : 0));
+    esp_timer_start_periodic(tick_timer, tick_us);
+
+    LOGI("Start, interval %u ms, next shot %u", interval_ms, next_shot);
 }
 
 void app_timer_stop()
 {
-    xTimerStop(timer, 0);
-    callback = NULL;
-}
\ No newline at end of file
+    running = false;
+
+    esp_timer_stop(shot_timer);
+    esp_timer_stop(tick_timer);
+
+    shot_callback = NULL;
+    tick_callback = NULL;
+
+    LOGI("Stop, %u shots, %u missed, max deviation %lld us", stats.shots, stats.missed, (long long)stats.max_deviation_us);
+}
+
+void app_timer_set_tick(uint32_t period_ms)
+{
+    tick_us = (period_ms > 0 ? (int64_t)period_ms * 1000 : TIMER_TICK_US);
+
+    if (running)
+    {
+        esp_timer_stop(tick_timer);
+        esp_timer_start_periodic(tick_timer, tick_us);
+    }
+}
+
+int64_t app_timer_time_to_next_shot()
+{
+    int64_t remaining = shot_deadline(next_shot) - esp_timer_get_time();
+    return (remaining > 0 ? remaining : 0);
+}
+
+int64_t app_timer_shot_time(uint32_t shot)
+{
+    return shot_deadline(shot);
+}
+
+void app_timer_get_stats(struct app_timer_stats *out)
+{
+    *out = stats;
+}
@@ -1,10 +1,32 @@
 #ifndef __TIMER__
 #define __TIMER__
 
+#include <stdint.h>
+
+// Shot n is scheduled at start + n * interval, deviation is the measured lateness of the callback
+typedef void (*timer_shot_callback_ptr)(uint32_t shot, int64_t deviation_us);
 typedef void (*timer_callback_ptr)();
 
+struct app_timer_stats
+{
+    uint32_t shots;            // Shots fired
+    uint32_t missed;           // Deadlines skipped because the callback ran later than a whole interval
+    int64_t last_deviation_us; // Deviation of the last shot
+    int64_t max_deviation_us;  // Worst deviation since start
+};
+
 void app_timer_init();
-void app_timer_start(timer_callback_ptr cb);
+void app_timer_start(uint32_t interval_ms, timer_shot_callback_ptr shot_cb, timer_callback_ptr tick_cb);
+
+// Continues a schedule started at an earlier esp_timer time, the shots already due are not taken
+void app_timer_start_at(uint32_t interval_ms, int64_t start, timer_shot_callback_ptr shot_cb, timer_callback_ptr tick_cb);
 void app_timer_stop();
 
-#endif
\ No newline at end of file
+// Period of the countdown tick of the running timer, 0 and every start go back to one second
+void app_timer_set_tick(uint32_t period_ms);
+
+int64_t app_timer_time_to_next_shot();
+int64_t app_timer_shot_time(uint32_t shot); // esp_timer time shot n is due
+void app_timer_get_stats(struct app_timer_stats *stats);
+
+#endif
@@ -0,0 +1,124 @@
+#include "trace.h"
+
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+/*
+Trace buffer:
+    Every core has a ring of TRACE_RECORDS records, a writer takes the ring of the core it runs on.
+    1. The slot is taken with an atomic increment of the head, an interrupt between taking and filling a slot takes
+       the next one. A task moved to the other core in between still writes a slot of its own
+    2. The ring overwrites the oldest records, the head counts all of them
+    3. The dump stops the writers first, a record being filled when they stopped may be torn
+
+    The records are only ordered per core, the decoder merges the cores by time.
+*/
+
+#define TRACE_VERSION (1)
+
+struct trace_ring
+{
+    uint32_t head;
+    struct trace_record records[TRACE_RECORDS];
+};
+
+static struct trace_ring rings[portNUM_PROCESSORS];
+static volatile bool tracing = TRACE_ENABLE;
+
+static const char *names[TRACE_EVENTS] = {
+    [TRACE_GPIO_ISR] = "gpio_isr",
+    [TRACE_GPIO_TASK] = "gpio_task",
+    [TRACE_INPUT] = "menu_input",
+    [TRACE_DISPLAY] = "display_flush",
+    [TRACE_DISPATCH] = "dispatch",
+    [TRACE_TIMER_SHOT] = "timer_shot",
+    [TRACE_TIMER_TICK] = "timer_tick",
+    [TRACE_CANON_SET] = "canon_set",
+    [TRACE_CANON_STEP] = "canon_step",
+    [TRACE_TRIGGER_WRITE] = "trigger_write",
+    [TRACE_TRIGGER_PRESS] = "trigger_press",
+    [TRACE_TRIGGER_RELEASE] = "trigger_release",
+    [TRACE_GAP_CB] = "gap_cb",
+    [TRACE_GATTC_CB] = "gattc_cb",
+    [TRACE_GAP] = "gap",
+    [TRACE_GATTC] = "gattc"};
+
+void IRAM_ATTR trace_event(uint16_t id, uint16_t arg0, uint32_t arg1)
+{
+    if (!tracing)
+    {
+        return;
+    }
+
+    struct trace_ring *ring = &rings[xPortGetCoreID()];
+    uint32_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+
+    struct trace_record *record = &ring->records[index % TRACE_RECORDS];
+    record->time_us = (uint32_t)esp_timer_get_time();
+    record->id = id;
+    record->arg0 = arg0;
+    record->arg1 = arg1;
+}
+
+static void dump_record(FILE *out, int core, const struct trace_record *record)
+{
+    const uint8_t *bytes = (const uint8_t *)record;
+    char line[2 * sizeof(struct trace_record) + 1];
+    uint8_t sum = 0;
+
+    for (int i = 0; i < sizeof(struct trace_record); i++)
+    {
+        sprintf(&line[i * 2], "%02x", bytes[i]);
+        sum += bytes[i];
+    }
+
+    fprintf(out, "TRACE %d %s %02x\n", core, line, sum);
+}
+
+int trace_dump(FILE *out)
+{
+    tracing = false;
+    vTaskDelay(1); // A writer which passed the check finishes its record
+
+    fprintf(out, "TRACE BEGIN %d %d %d\n", TRACE_VERSION, (int)sizeof(struct trace_record), portNUM_PROCESSORS);
+    for (int id = 1; id < TRACE_EVENTS; id++)
+    {
+        fprintf(out, "TRACE NAME %d %s\n", id, names[id]);
+    }
+
+    int count = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        struct trace_ring *ring = &rings[core];
+        uint32_t head = ring->head;
+        uint32_t first = (head > TRACE_RECORDS ? head - TRACE_RECORDS : 0);
+
+        fprintf(out, "TRACE CORE %d %u overwritten\n", core, first);
+        for (uint32_t index = first; index < head; index++)
+        {
+            dump_record(out, core, &ring->records[index % TRACE_RECORDS]);
+            count++;
+        }
+    }
+
+    fprintf(out, "TRACE END %d\n", count);
+
+    tracing = TRACE_ENABLE;
+    return count;
+}
+
+void trace_clear()
+{
+    tracing = false;
+    vTaskDelay(1);
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        rings[core].head = 0;
+    }
+
+    tracing = TRACE_ENABLE;
+}
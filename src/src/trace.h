@@ -0,0 +1,79 @@
+#ifndef __TRACE__
+#define __TRACE__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "config.h"
+
+// Events, the phase bits of a record tell spans from instants
+#define TRACE_GPIO_ISR (1)      // Instant, arg0 pin levels
+#define TRACE_GPIO_TASK (2)     // Span, the edges of one wakeup
+#define TRACE_INPUT (3)         // Span of menu_input, arg0 button, arg1 steps
+#define TRACE_DISPLAY (4)       // Span of the flush to the panel
+#define TRACE_DISPATCH (5)      // Span of an event handler, arg0 app_event type
+#define TRACE_TIMER_SHOT (6)    // Instant in the esp_timer task, arg1 shot
+#define TRACE_TIMER_TICK (7)    // Instant in the esp_timer task
+#define TRACE_CANON_SET (8)     // Span of a command set, arg0 camera, arg1 set id
+#define TRACE_CANON_STEP (9)    // Instant, arg0 camera, arg1 BLE_CMD_* << 8 | step
+#define TRACE_TRIGGER_WRITE (10) // Instant, arg0 camera, trig_seq0 written
+#define TRACE_TRIGGER_PRESS (11) // Instant, arg0 camera, trig_seq0 acknowledged
+#define TRACE_TRIGGER_RELEASE (12) // Instant, arg0 camera, trig_seq1 acknowledged
+#define TRACE_GAP_CB (13)       // Instant in the Bluedroid task, arg0 GAP event
+#define TRACE_GATTC_CB (14)     // Instant in the Bluedroid task, arg0 GATTC event
+#define TRACE_GAP (15)          // Span of the GAP handler, arg0 event
+#define TRACE_GATTC (16)        // Span of the GATTC handler, arg0 event
+#define TRACE_EVENTS (17)
+
+#define TRACE_PHASE_INSTANT (0 << 14)
+#define TRACE_PHASE_BEGIN (1 << 14)
+#define TRACE_PHASE_END (2 << 14)
+#define TRACE_ID_MASK (0x3fff)
+
+// 12 bytes, the low 32 bits of the esp_timer time wrap after 71 minutes, the decoder unwraps them
+struct trace_record
+{
+    uint32_t time_us;
+    uint16_t id; // Event and phase
+    uint16_t arg0;
+    uint32_t arg1;
+};
+
+// Any task or interrupt on either core, never blocks
+void trace_event(uint16_t id, uint16_t arg0, uint32_t arg1);
+
+// Compiled out without TRACE_ENABLE
+#define TRACE_INSTANT(event, arg0, arg1)                                  \
+    do                                                                    \
+    {                                                                     \
+        if (TRACE_ENABLE)                                                 \
+        {                                                                 \
+            trace_event((event) | TRACE_PHASE_INSTANT, (arg0), (arg1));   \
+        }                                                                 \
+    } while (0)
+
+#define TRACE_BEGIN(event, arg0, arg1)                                    \
+    do                                                                    \
+    {                                                                     \
+        if (TRACE_ENABLE)                                                 \
+        {                                                                 \
+            trace_event((event) | TRACE_PHASE_BEGIN, (arg0), (arg1));     \
+        }                                                                 \
+    } while (0)
+
+#define TRACE_END(event, arg0, arg1)                                      \
+    do                                                                    \
+    {                                                                     \
+        if (TRACE_ENABLE)                                                 \
+        {                                                                 \
+            trace_event((event) | TRACE_PHASE_END, (arg0), (arg1));       \
+        }                                                                 \
+    } while (0)
+
+// Writes the records of both cores as text lines, the oldest first, tools/trace_chrome.py converts them.
+// Tracing pauses during the dump
+int trace_dump(FILE *out);
+void trace_clear();
+
+#endif
@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+"""Decodes the shot log dump of the timer into CSV and latency histograms.
+
+The dump comes from the "shots" console command on the UART, either from a capture of the serial
+monitor or read directly from the port (needs pyserial). The log lines around it are ignored.
+
+    shot_log.py capture.txt --csv shots.csv
+    shot_log.py --port /dev/ttyUSB0 --csv shots.csv
+"""
+
+import argparse
+import csv
+import struct
+import sys
+
+RECORD = struct.Struct("<IIqIIIBBbB")  # struct shot_record of shot_log.h
+NONE = 0xFFFFFFFF
+NO_CAMERA = 0xFF
+RSSI_NONE = 127
+
+STATUS = {0: "ok", 1: "failed", 2: "dropped", 3: "merged", 4: "missed"}
+FLAGS = [(0x01, "fast"), (0x02, "manual"), (0x04, "catch-up"), (0x08, "delayed")]
+
+FIELDS = ["sequence", "shot", "scheduled_us", "write_us", "press_us", "release_us", "camera", "status", "rssi", "flags"]
+
+
+def parse(lines):
+    """Returns the records of all dumps in the lines by sequence, and the number of damaged lines"""
+    records = {}
+    damaged = 0
+
+    for line in lines:
+        parts = line.strip().split()
+        if len(parts) != 3 or parts[0] != "SHOT":
+            continue
+
+        try:
+            data = bytes.fromhex(parts[1])
+            checksum = int(parts[2], 16)
+        except ValueError:
+            damaged += 1
+            continue
+        if len(data) != RECORD.size or sum(data) & 0xFF != checksum:
+            damaged += 1
+            continue
+
+        record = dict(zip(FIELDS, RECORD.unpack(data)))
+        records[record["sequence"]] = record
+
+    return [records[sequence] for sequence in sorted(records)], damaged
+
+
+def read_port(port, baud, timeout):
+    import serial  # pyserial
+
+    lines = []
+    with serial.Serial(port, baud, timeout=timeout) as uart:
+        uart.reset_input_buffer()
+        uart.write(b"shots\n")
+        while True:
+            line = uart.readline().decode("ascii", errors="replace")
+            if not line:
+                sys.exit("No end of the dump from %s" % port)
+            lines.append(line)
+            if line.startswith("SHOTLOG END"):
+                return lines
+
+
+def time_ms(value):
+    return None if value == NONE else value / 1000.0
+
+
+def flag_names(flags):
+    return "|".join(name for bit, name in FLAGS if flags & bit)
+
+
+def write_csv(records, out):
+    writer = csv.writer(out)
+    writer.writerow(["sequence", "shot", "scheduled_s", "camera", "status", "write_ms", "press_ms", "release_ms",
+                     "press_release_ms", "rssi", "flags"])
+
+    for r in records:
+        write, press, release = time_ms(r["write_us"]), time_ms(r["press_us"]), time_ms(r["release_us"])
+        writer.writerow([
+            r["sequence"],
+            r["shot"],
+            "%.6f" % (r["scheduled_us"] / 1e6),
+            "" if r["camera"] == NO_CAMERA else r["camera"],
+            STATUS.get(r["status"], r["status"]),
+            "" if write is None else "%.3f" % write,
+            "" if press is None else "%.3f" % press,
+            "" if release is None else "%.3f" % release,
+            "" if press is None or release is None else "%.3f" % (release - press),
+            "" if r["rssi"] == RSSI_NONE else r["rssi"],
+            flag_names(r["flags"]),
+        ])
+
+
+def percentile(values, p):
+    index = min(len(values) - 1, int(round(p / 100.0 * (len(values) - 1))))
+    return sorted(values)[index]
+
+
+def histogram(name, values, bin_ms, width=50):
+    print("\n%s, %d shots" % (name, len(values)))
+    if not values:
+        return
+
+    print("  min %.3f  p50 %.3f  p95 %.3f  p99 %.3f  max %.3f ms" % (
+        min(values), percentile(values, 50), percentile(values, 95), percentile(values, 99), max(values)))
+
+    bins = {}
+    for value in values:
+        index = int(value // bin_ms)
+        bins[index] = bins.get(index, 0) + 1
+
+    peak = max(bins.values())
+    for index in range(min(bins), max(bins) + 1):
+        count = bins.get(index, 0)
+        bar = "#" * int(round(count * width / peak))
+        print("  %8.1f - %8.1f ms %7d %s" % (index * bin_ms, (index + 1) * bin_ms, count, bar))
+
+
+def summary(records, damaged, bin_ms):
+    print("%d records, %d damaged lines" % (len(records), damaged))
+
+    gaps = sum(1 for a, b in zip(records, records[1:]) if b["sequence"] != a["sequence"] + 1)
+    if gaps:
+        print("%d gaps in the sequence, records were lost or overwritten" % gaps)
+
+    counts = {}
+    for r in records:
+        status = STATUS.get(r["status"], str(r["status"]))
+        counts[status] = counts.get(status, 0) + 1
+    print("  " + "  ".join("%s %d" % (status, counts[status]) for status in sorted(counts)))
+
+    ok = [r for r in records if r["status"] == 0]
+    histogram("Deadline to trig_seq0 write", [time_ms(r["write_us"]) for r in ok], bin_ms)
+    histogram("Deadline to trig_seq0 completion (press)", [time_ms(r["press_us"]) for r in ok], bin_ms)
+    histogram("Deadline to trig_seq1 completion (release)", [time_ms(r["release_us"]) for r in ok], bin_ms)
+
+    # Interval accuracy, consecutive timer shots of the same camera
+    intervals = []
+    by_camera = {}
+    for r in ok:
+        if r["shot"] == 0:
+            continue
+        last = by_camera.get(r["camera"])
+        if last is not None and r["shot"] == last["shot"] + 1 and r["scheduled_us"] > last["scheduled_us"]:
+            nominal = r["scheduled_us"] - last["scheduled_us"]
+            actual = nominal + r["press_us"] - last["press_us"]
+            intervals.append((actual - nominal) / 1000.0)
+        by_camera[r["camera"]] = r
+    histogram("Interval error between consecutive presses", intervals, bin_ms)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="*", help="Serial monitor captures with a dump, stdin if none and no port")
+    parser.add_argument("--port", help="Read the dump from this serial port")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--timeout", type=float, default=10.0, help="Seconds without a line before giving up")
+    parser.add_argument("--csv", help="Write the records to this CSV file, - for stdout")
+    parser.add_argument("--bin", type=float, default=5.0, help="Histogram bin width in ms")
+    args = parser.parse_args()
+
+    lines = []
+    if args.port:
+        lines = read_port(args.port, args.baud, args.timeout)
+    elif args.capture:
+        for path in args.capture:
+            with open(path, errors="replace") as capture:
+                lines.extend(capture)
+    else:
+        lines = sys.stdin.readlines()
+
+    records, damaged = parse(lines)
+
+    if args.csv == "-":
+        write_csv(records, sys.stdout)
+        return
+    if args.csv:
+        with open(args.csv, "w", newline="") as out:
+            write_csv(records, out)
+
+    summary(records, damaged, args.bin)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""Converts the event trace dump of the firmware into a Chrome trace (chrome://tracing, ui.perfetto.dev).
+
+The dump comes from the "trace" console command on the UART, either from a capture of the serial
+monitor or read directly from the port (needs pyserial). The log lines around it are ignored.
+
+    trace_chrome.py capture.txt -o trace.json
+    trace_chrome.py --port /dev/ttyUSB0 -o trace.json
+
+Every core is a process, every event a thread of it. Begin and end records become complete events,
+the instants stay instants. Without -o a summary of the spans is printed.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+RECORD = struct.Struct("<IHHI")  # struct trace_record of trace.h
+PHASE_INSTANT, PHASE_BEGIN, PHASE_END = 0, 1, 2
+ID_MASK = 0x3FFF
+
+# Arguments named per event, the rest are shown as arg0 and arg1
+ARGS = {
+    "gpio_isr": ("levels", None),
+    "menu_input": ("button", "steps"),
+    "dispatch": ("type", None),
+    "timer_shot": (None, "shot"),
+    "canon_set": ("camera", "set"),
+    "canon_step": ("camera", "step"),
+    "trigger_write": ("camera", None),
+    "trigger_press": ("camera", None),
+    "trigger_release": ("camera", None),
+    "gap_cb": ("event", None),
+    "gattc_cb": ("event", None),
+    "gap": ("event", None),
+    "gattc": ("event", None),
+}
+
+# Spans which run on several contexts at once are paired per arg0
+PAIR_BY_ARG0 = {"canon_set"}
+
+
+def parse(lines):
+    """Returns the event names, the records as (core, time, id, phase, arg0, arg1) and the number of damaged lines"""
+    names = {}
+    records = []
+    damaged = 0
+    last = {}
+    wraps = {}
+
+    for line in lines:
+        parts = line.strip().split()
+        if len(parts) < 3 or parts[0] != "TRACE":
+            continue
+        if parts[1] == "NAME" and len(parts) == 4:
+            names[int(parts[2])] = parts[3]
+            continue
+        if len(parts) != 4 or not parts[1].isdigit():
+            continue
+
+        try:
+            core = int(parts[1])
+            data = bytes.fromhex(parts[2])
+            checksum = int(parts[3], 16)
+        except ValueError:
+            damaged += 1
+            continue
+        if len(data) != RECORD.size or sum(data) & 0xFF != checksum:
+            damaged += 1
+            continue
+
+        time_us, event, arg0, arg1 = RECORD.unpack(data)
+
+        # The records of a core are in order, a smaller time is a wrap of the 32 bit microseconds
+        if core in last and time_us < last[core]:
+            wraps[core] = wraps.get(core, 0) + 1
+        last[core] = time_us
+        time_us += wraps.get(core, 0) << 32
+
+        records.append((core, time_us, event & ID_MASK, event >> 14, arg0, arg1))
+
+    records.sort(key=lambda r: r[1])
+    return names, records, damaged
+
+
+def read_port(port, baud, timeout):
+    import serial  # pyserial
+
+    lines = []
+    with serial.Serial(port, baud, timeout=timeout) as uart:
+        uart.reset_input_buffer()
+        uart.write(b"trace\n")
+        while True:
+            line = uart.readline().decode("ascii", errors="replace")
+            if not line:
+                sys.exit("No end of the dump from %s" % port)
+            lines.append(line)
+            if line.startswith("TRACE END"):
+                return lines
+
+
+def event_args(name, arg0, arg1):
+    names = ARGS.get(name, ("arg0", "arg1"))
+    args = {}
+    if names[0]:
+        args[names[0]] = arg0
+    if names[1]:
+        args[names[1]] = arg1
+    return args
+
+
+def convert(names, records):
+    """Returns the Chrome trace events and the durations of the spans by name"""
+    events = []
+    spans = {}
+    open_spans = {}
+    start = records[0][1] if records else 0
+
+    for core in sorted({r[0] for r in records}):
+        events.append({"name": "process_name", "ph": "M", "pid": core, "args": {"name": "core %d" % core}})
+
+    for core, time_us, event, phase, arg0, arg1 in records:
+        name = names.get(event, "event %d" % event)
+        ts = time_us - start
+
+        if phase == PHASE_INSTANT:
+            events.append({"name": name, "ph": "i", "s": "t", "ts": ts, "pid": core, "tid": name,
+                           "args": event_args(name, arg0, arg1)})
+            continue
+
+        key = (core, event, arg0 if name in PAIR_BY_ARG0 else None)
+        if phase == PHASE_BEGIN:
+            open_spans.setdefault(key, []).append((ts, arg0, arg1))
+        elif phase == PHASE_END and open_spans.get(key):
+            begin, begin_arg0, begin_arg1 = open_spans[key].pop()
+            events.append({"name": name, "ph": "X", "ts": begin, "dur": ts - begin, "pid": core, "tid": name,
+                           "args": event_args(name, begin_arg0, begin_arg1)})
+            spans.setdefault(name, []).append(ts - begin)
+
+    return events, spans
+
+
+def summary(records, spans, damaged):
+    print("%d records, %d damaged lines" % (len(records), damaged))
+    if records:
+        print("%.3f s traced" % ((records[-1][1] - records[0][1]) / 1e6))
+
+    print("\n%-16s %7s %10s %10s %10s" % ("span", "count", "mean ms", "max ms", "total ms"))
+    for name in sorted(spans, key=lambda n: -sum(spans[n])):
+        values = spans[name]
+        print("%-16s %7d %10.3f %10.3f %10.3f" % (
+            name, len(values), sum(values) / len(values) / 1e3, max(values) / 1e3, sum(values) / 1e3))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("capture", nargs="*", help="Serial monitor captures with a dump, stdin if none and no port")
+    parser.add_argument("--port", help="Read the dump from this serial port")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--timeout", type=float, default=10.0, help="Seconds without a line before giving up")
+    parser.add_argument("-o", "--output", help="Write the Chrome trace JSON to this file, - for stdout")
+    args = parser.parse_args()
+
+    lines = []
+    if args.port:
+        lines = read_port(args.port, args.baud, args.timeout)
+    elif args.capture:
+        for path in args.capture:
+            with open(path, errors="replace") as capture:
+                lines.extend(capture)
+    else:
+        lines = sys.stdin.readlines()
+
+    names, records, damaged = parse(lines)
+    events, spans = convert(names, records)
+
+    if args.output == "-":
+        json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, sys.stdout)
+        return
+    if args.output:
+        with open(args.output, "w") as out:
+            json.dump({"traceEvents": events, "displayTimeUnit": "ms"}, out)
+
+    summary(records, spans, damaged)
+
+
+if __name__ == "__main__":
+    main()